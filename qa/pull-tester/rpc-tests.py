@@ -128,8 +128,10 @@ testScripts = [
     'signrawtransactions.py',
     'nodehandling.py',
     'reindex.py',
+    'txoutset.py',
     'decodescript.py',
     'blockchain.py',
+    'getblocktemplate_prebuilt.py',
     'disablewallet.py',
     'sendheaders.py',
     'keypool.py',
@@ -166,6 +168,7 @@ testScriptsExt = [
     'smartfees.py',
     'maxblocksinflight.py',
     'p2p-acceptblock.py',
+    'assumevalid.py',
     'mempool_packages.py',
     'maxuploadtarget.py',
     'replace-by-fee.py',
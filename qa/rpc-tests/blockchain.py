@@ -17,7 +17,9 @@ from test_framework.util import (
     assert_raises,
     assert_is_hex_string,
     assert_is_hash_string,
+    start_node,
     start_nodes,
+    stop_node,
     connect_nodes_bi,
 )
 
@@ -52,12 +54,50 @@ class BlockchainTest(BitcoinTestFramework):
         res = node.gettxoutsetinfo()
 
         assert_equal(res['total_amount'], Decimal('8725.00000000'))
-        assert_equal(res['transactions'], 200)
         assert_equal(res['height'], 200)
         assert_equal(res['txouts'], 200)
         assert_equal(res['bytes_serialized'], 13924),
         assert_equal(len(res['bestblock']), 64)
-        assert_equal(len(res['hash_serialized']), 64)
+        assert_equal(len(res['muhash']), 64)
+
+        # Walking the set gives the same statistics as keeping them up to date
+        full = node.gettxoutsetinfo("hash_serialized")
+        assert_equal(full['transactions'], 200)
+        assert_equal(len(full['hash_serialized']), 64)
+        for key in ['height', 'bestblock', 'txouts', 'bytes_serialized', 'total_amount']:
+            assert_equal(full[key], res[key])
+        assert_raises(JSONRPCException, node.gettxoutsetinfo, "sha256")
+
+        # Scanning the whole set from scratch agrees with the rolling statistics
+        assert_equal(node.gettxoutsetinfo("muhash", False), res)
+
+        # Scanning for a script finds its outputs
+        coinbase = node.getblock(res['bestblock'])['tx'][0]
+        script = node.gettxout(coinbase, 0)['scriptPubKey']['hex']
+        scan = node.scantxoutset([script])
+        assert_equal(scan['bestblock'], res['bestblock'])
+        assert_equal(scan['height'], 200)
+        assert_equal(scan['txouts'], 200)
+        assert(coinbase in [u['txid'] for u in scan['unspents']])
+        for u in scan['unspents']:
+            assert_equal(u['scriptPubKey'], script)
+            assert(u['coinbase'])
+        assert_equal(scan['total_amount'], sum(u['amount'] for u in scan['unspents']))
+        assert_equal(node.scantxoutset([])['unspents'], [])
+        assert_raises(JSONRPCException, node.scantxoutset, ["nonsense"])
+
+        # Disconnecting and reconnecting a block restores the rolling hash
+        node.invalidateblock(res['bestblock'])
+        assert_equal(node.gettxoutsetinfo()['txouts'], 199)
+        assert(node.gettxoutsetinfo()['muhash'] != res['muhash'])
+        node.reconsiderblock(res['bestblock'])
+        assert_equal(node.gettxoutsetinfo(), res)
+
+        # The statistics are written with the chainstate
+        stop_node(node, 0)
+        self.nodes[0] = start_node(0, self.options.tmpdir)
+        assert_equal(self.nodes[0].gettxoutsetinfo(), res)
+        connect_nodes_bi(self.nodes, 0, 1)
 
     def _test_getblockheader(self):
         node = self.nodes[0]
@@ -0,0 +1,57 @@
+#!/usr/bin/env python3
+# Copyright (c) 2017 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test that getblocktemplate, which uses the template built in the
+# background when it can, answers before there is one, and still picks up
+# new tips and mempool changes.
+#
+import time
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import (
+    assert_equal,
+    connect_nodes_bi,
+    start_nodes,
+)
+
+class GetBlockTemplatePrebuiltTest(BitcoinTestFramework):
+
+    def __init__(self):
+        super().__init__()
+        self.setup_clean_chain = False
+        self.num_nodes = 2
+
+    def setup_network(self):
+        self.nodes = start_nodes(self.num_nodes, self.options.tmpdir)
+        connect_nodes_bi(self.nodes, 0, 1)
+        self.is_network_split = False
+        self.sync_all()
+
+    def run_test(self):
+        node = self.nodes[0]
+
+        # The first call finds no template built yet, and builds its own
+        txid = node.sendtoaddress(node.getnewaddress(), 1)
+        tmpl = node.getblocktemplate()
+        assert_equal(tmpl['previousblockhash'], node.getbestblockhash())
+        assert(txid in [tx['txid'] for tx in tmpl['transactions']])
+
+        # A transaction paying less than -blocktemplatefeedelta still shows
+        # up once the template is 5 seconds old
+        txid = node.sendtoaddress(node.getnewaddress(), 1)
+        node.setmocktime(int(time.time()) + 10)
+        tmpl = node.getblocktemplate()
+        assert(txid in [tx['txid'] for tx in tmpl['transactions']])
+
+        # A new tip gets a new template
+        node.setmocktime(0)
+        node.generate(1)
+        tmpl = node.getblocktemplate()
+        assert_equal(tmpl['previousblockhash'], node.getbestblockhash())
+        assert_equal(tmpl['transactions'], [])
+
+if __name__ == '__main__':
+    GetBlockTemplatePrebuiltTest().main()
@@ -4,14 +4,16 @@
 # file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #
-# Test -reindex and -reindex-chainstate with CheckBlockIndex
+# Test -reindex, -reindex-chainstate and -loadblock with CheckBlockIndex
 #
 from test_framework.test_framework import BitcoinTestFramework
 from test_framework.util import (
+    start_node,
     start_nodes,
     stop_nodes,
     assert_equal,
 )
+import os
 import time
 
 class ReindexTest(BitcoinTestFramework):
@@ -19,27 +21,41 @@ class ReindexTest(BitcoinTestFramework):
     def __init__(self):
         super().__init__()
         self.setup_clean_chain = True
-        self.num_nodes = 1
+        self.num_nodes = 2
 
     def setup_network(self):
-        self.nodes = start_nodes(self.num_nodes, self.options.tmpdir)
+        self.nodes = start_nodes(1, self.options.tmpdir)
 
     def reindex(self, justchainstate=False):
         self.nodes[0].generate(3)
         blockcount = self.nodes[0].getblockcount()
         stop_nodes(self.nodes)
         extra_args = [["-debug", "-reindex-chainstate" if justchainstate else "-reindex", "-checkblockindex=1"]]
-        self.nodes = start_nodes(self.num_nodes, self.options.tmpdir, extra_args)
+        self.nodes = start_nodes(1, self.options.tmpdir, extra_args)
         while self.nodes[0].getblockcount() < blockcount:
             time.sleep(0.1)
         assert_equal(self.nodes[0].getblockcount(), blockcount)
         print("Success")
 
+    def loadblock(self):
+        # A node without blocks imports the block file of node 0
+        self.nodes[0].generate(150)
+        blockcount = self.nodes[0].getblockcount()
+        besthash = self.nodes[0].getbestblockhash()
+        stop_nodes(self.nodes)
+        blkfile = os.path.join(self.options.tmpdir, "node0", "regtest", "blocks", "blk00000.dat")
+        self.nodes = [start_node(1, self.options.tmpdir, ["-debug", "-loadblock=" + blkfile, "-checkblockindex=1"])]
+        while self.nodes[0].getblockcount() < blockcount:
+            time.sleep(0.1)
+        assert_equal(self.nodes[0].getbestblockhash(), besthash)
+        print("Success")
+
     def run_test(self):
         self.reindex(False)
         self.reindex(True)
         self.reindex(False)
         self.reindex(True)
+        self.loadblock()
 
 if __name__ == '__main__':
     ReindexTest().main()
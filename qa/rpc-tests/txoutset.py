@@ -0,0 +1,70 @@
+#!/usr/bin/env python3
+# Copyright (c) 2019 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test dumptxoutset and starting a fresh node with -loadtxoutset
+#
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.authproxy import JSONRPCException
+from test_framework.util import (
+    assert_equal,
+    assert_raises,
+    connect_nodes_bi,
+    start_node,
+    start_nodes,
+    stop_node,
+    sync_blocks,
+)
+
+class TxOutSetTest(BitcoinTestFramework):
+
+    def __init__(self):
+        super().__init__()
+        self.setup_clean_chain = True
+        self.num_nodes = 2
+
+    def setup_network(self):
+        self.nodes = start_nodes(1, self.options.tmpdir, [["-checkblockindex=1"]])
+
+    def run_test(self):
+        self.nodes[0].generate(150)
+        info = self.nodes[0].gettxoutsetinfo("hash_serialized")
+        res = self.nodes[0].dumptxoutset("utxo.dat")
+        assert_equal(res['coins_written'], info['txouts'])
+        assert_equal(res['base_hash'], info['bestblock'])
+        assert_equal(res['base_height'], 150)
+        assert_equal(res['hash_serialized'], info['hash_serialized'])
+        assert_raises(JSONRPCException, self.nodes[0].dumptxoutset, "utxo.dat")
+
+        # A snapshot that is not pinned with its hash is refused
+        params = "-txoutsetparams=150:%s:%s" % (res['base_hash'], "00" * 32)
+        try:
+            start_node(1, self.options.tmpdir, ["-loadtxoutset=" + res['path'], params])
+            raise AssertionError("node started with a snapshot of the wrong hash")
+        except Exception as e:
+            assert("exited" in str(e))
+
+        params = "-txoutsetparams=150:%s:%s" % (res['base_hash'], res['hash_serialized'])
+        self.nodes.append(start_node(1, self.options.tmpdir, ["-checkblockindex=1", "-loadtxoutset=" + res['path'], params]))
+        assert_equal(self.nodes[1].getblockcount(), 150)
+        assert_equal(self.nodes[1].gettxoutsetinfo("hash_serialized"), info)
+        assert_equal(self.nodes[1].gettxoutsetinfo(), self.nodes[0].gettxoutsetinfo())
+        assert_raises(JSONRPCException, self.nodes[1].getblock, self.nodes[1].getblockhash(10))
+
+        # The node follows the chain on top of the snapshot
+        connect_nodes_bi(self.nodes, 0, 1)
+        self.nodes[0].generate(10)
+        sync_blocks(self.nodes)
+        assert_equal(self.nodes[1].gettxoutsetinfo("hash_serialized"), self.nodes[0].gettxoutsetinfo("hash_serialized"))
+        assert_equal(self.nodes[1].gettxoutsetinfo(), self.nodes[0].gettxoutsetinfo())
+
+        # Restarting with the same snapshot is a no-op
+        stop_node(self.nodes[1], 1)
+        self.nodes[1] = start_node(1, self.options.tmpdir, ["-checkblockindex=1", "-loadtxoutset=" + res['path'], params])
+        assert_equal(self.nodes[1].getblockcount(), 160)
+        self.nodes[1].verifychain(4, 0)
+
+if __name__ == '__main__':
+    TxOutSetTest().main()
@@ -0,0 +1,73 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "checkqueue.h"
+#include "util.h"
+#include "crypto/sha256.h"
+
+#include <algorithm>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+/* Number of checks added per block, in batches the size of a transaction's inputs */
+static const int CHECKS_PER_BLOCK = 2000;
+static const int BATCH_SIZE = 4;
+
+/** A check costing about as much as hashing nRounds times 64 bytes. */
+struct HashCheck
+{
+    int nRounds;
+
+    HashCheck() : nRounds(0) {}
+    explicit HashCheck(int nRoundsIn) : nRounds(nRoundsIn) {}
+
+    bool operator()()
+    {
+        unsigned char hash[CSHA256::OUTPUT_SIZE] = {0};
+        for (int i = 0; i < nRounds; i++)
+            CSHA256().Write(hash, sizeof(hash)).Finalize(hash);
+        return true;
+    }
+
+    void swap(HashCheck& check) { std::swap(nRounds, check.nRounds); }
+};
+
+static void CheckQueue(benchmark::State& state, int nThreads, int nRounds)
+{
+    CCheckQueue<HashCheck> queue(16);
+    boost::thread_group threadGroup;
+    for (int i = 0; i < nThreads - 1; i++)
+        threadGroup.create_thread(boost::bind(&CCheckQueue<HashCheck>::Thread, boost::ref(queue)));
+
+    while (state.KeepRunning()) {
+        CCheckQueueControl<HashCheck> control(&queue);
+        for (int i = 0; i < CHECKS_PER_BLOCK; i += BATCH_SIZE) {
+            std::vector<HashCheck> vChecks(BATCH_SIZE, HashCheck(nRounds));
+            control.Add(vChecks);
+        }
+        control.Wait();
+    }
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+}
+
+/* As many threads as cores, up to the limit on script checking threads */
+static int AllThreads() { return std::max(1, std::min(GetNumCores(), 16)); }
+
+static void CheckQueueEmpty_1Thread(benchmark::State& state) { CheckQueue(state, 1, 0); }
+static void CheckQueueEmpty_AllThreads(benchmark::State& state) { CheckQueue(state, AllThreads(), 0); }
+static void CheckQueueHash_1Thread(benchmark::State& state) { CheckQueue(state, 1, 100); }
+static void CheckQueueHash_2Threads(benchmark::State& state) { CheckQueue(state, 2, 100); }
+static void CheckQueueHash_4Threads(benchmark::State& state) { CheckQueue(state, 4, 100); }
+static void CheckQueueHash_AllThreads(benchmark::State& state) { CheckQueue(state, AllThreads(), 100); }
+
+BENCHMARK(CheckQueueEmpty_1Thread);
+BENCHMARK(CheckQueueEmpty_AllThreads);
+BENCHMARK(CheckQueueHash_1Thread);
+BENCHMARK(CheckQueueHash_2Threads);
+BENCHMARK(CheckQueueHash_4Threads);
+BENCHMARK(CheckQueueHash_AllThreads);
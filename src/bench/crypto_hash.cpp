@@ -10,6 +10,7 @@
 #include "uint256.h"
 #include "utiltime.h"
 #include "crypto/ripemd160.h"
+#include "crypto/scrypt.h"
 #include "crypto/sha1.h"
 #include "crypto/sha256.h"
 #include "crypto/sha512.h"
@@ -69,6 +70,55 @@ static void SipHash_32b(benchmark::State& state)
     }
 }
 
+static void SCRYPT_1024_1_1_256(benchmark::State& state)
+{
+    std::vector<char> in(80, 0);
+    std::vector<char> scratchpad(SCRYPT_SCRATCHPAD_SIZE);
+    char hash[32];
+    while (state.KeepRunning()) {
+        scrypt_1024_1_1_256_sp(&in[0], hash, &scratchpad[0]);
+        in[76]++;
+    }
+}
+
+static void SCRYPT_1024_1_1_256_multi(benchmark::State& state)
+{
+    scrypt_detect_multi();
+    const int lanes = scrypt_multi_lanes();
+    std::vector<std::vector<char> > in(lanes, std::vector<char>(80, 0));
+    std::vector<std::vector<char> > out(lanes, std::vector<char>(32));
+    std::vector<const char*> inputs;
+    std::vector<char*> outputs;
+    for (int i = 0; i < lanes; i++) {
+        in[i][76] = i;
+        inputs.push_back(&in[i][0]);
+        outputs.push_back(&out[i][0]);
+    }
+    std::vector<char> scratchpad(SCRYPT_MULTI_SCRATCHPAD_SIZE);
+    while (state.KeepRunning()) {
+        scrypt_1024_1_1_256_multi_sp(&inputs[0], &outputs[0], lanes, &scratchpad[0]);
+    }
+}
+
+static void SCRYPT_1024_1_1_256_nonces(benchmark::State& state)
+{
+    scrypt_detect_multi();
+    const int lanes = scrypt_multi_lanes();
+    std::vector<char> in(80, 0);
+    std::vector<std::vector<char> > out(lanes, std::vector<char>(32));
+    std::vector<char*> outputs;
+    for (int i = 0; i < lanes; i++)
+        outputs.push_back(&out[i][0]);
+    std::vector<char> scratchpad(SCRYPT_MULTI_SCRATCHPAD_SIZE);
+    scrypt_header_midstate midstate;
+    scrypt_header_midstate_init(&midstate, &in[0]);
+    uint32_t nonce = 0;
+    while (state.KeepRunning()) {
+        scrypt_1024_1_1_256_nonces_sp(&midstate, nonce, &outputs[0], lanes, &scratchpad[0]);
+        nonce += lanes;
+    }
+}
+
 BENCHMARK(RIPEMD160);
 BENCHMARK(SHA1);
 BENCHMARK(SHA256);
@@ -76,3 +126,7 @@ BENCHMARK(SHA512);
 
 BENCHMARK(SHA256_32b);
 BENCHMARK(SipHash_32b);
+
+BENCHMARK(SCRYPT_1024_1_1_256);
+BENCHMARK(SCRYPT_1024_1_1_256_multi);
+BENCHMARK(SCRYPT_1024_1_1_256_nonces);
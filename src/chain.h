@@ -146,6 +146,8 @@ enum BlockStatus: uint32_t {
     BLOCK_FAILED_MASK        =   BLOCK_FAILED_VALID | BLOCK_FAILED_CHILD,
 
     BLOCK_OPT_WITNESS       =   128, //!< block data in blk*.data was received with a witness-enforcing client
+
+    BLOCK_HAVE_POWHASH      =   256, //!< scrypt proof-of-work hash of the header is stored in hashPoW
 };
 
 /** The block chain is a tree shaped structure starting with the
@@ -199,9 +201,18 @@ public:
     unsigned int nBits;
     unsigned int nNonce;
 
+    //! Scrypt proof-of-work hash of the header, only set if nStatus has BLOCK_HAVE_POWHASH
+    uint256 hashPoW;
+
     //! (memory only) Sequential id assigned to distinguish order in which blocks are received.
     uint32_t nSequenceId;
 
+    //! (memory only) Cached GetNextWorkRequired() result for a block building on this one
+    mutable unsigned int nNextWorkRequired;
+
+    //! (memory only) Consensus parameters nNextWorkRequired was computed with, NULL if not cached
+    mutable const Consensus::Params* pNextWorkParams;
+
     void SetNull()
     {
         phashBlock = NULL;
@@ -216,12 +227,15 @@ public:
         nChainTx = 0;
         nStatus = 0;
         nSequenceId = 0;
+        nNextWorkRequired = 0;
+        pNextWorkParams = NULL;
 
         nVersion       = 0;
         hashMerkleRoot = uint256();
         nTime          = 0;
         nBits          = 0;
         nNonce         = 0;
+        hashPoW        = uint256();
     }
 
     CBlockIndex()
@@ -278,6 +292,8 @@ public:
 
     uint256 GetBlockPoWHash() const
     {
+        if (nStatus & BLOCK_HAVE_POWHASH)
+            return hashPoW;
         return GetBlockHeader().GetPoWHash();
     }
 
@@ -383,6 +399,8 @@ public:
         READWRITE(nTime);
         READWRITE(nBits);
         READWRITE(nNonce);
+        if (nStatus & BLOCK_HAVE_POWHASH)
+            READWRITE(hashPoW);
     }
 
     uint256 GetBlockHash() const
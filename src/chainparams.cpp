@@ -96,6 +96,10 @@ public:
         // The best chain should have at least this much work.
         consensus.nMinimumChainWork = uint256S("00000000000000000000000000000000000000000000000000c77bc63bfadbd1"); // <-- Testcoin: OK
 
+        // By default assume that the signatures in ancestors of this block are valid.
+        // Keep it at or below the last checkpoint, and move it forward with each release.
+        consensus.defaultAssumeValid = uint256S("0xf6736ff2a7743014ab1902e442328f5c9928ce7f4edb2b4fd0130010cb4cebc4"); // 1410100
+
         /**
          * The message start string is designed to be unlikely to occur in normal data.
          * The characters are rarely used upper ASCII, not valid as UTF-8, and produce
@@ -154,6 +158,11 @@ public:
                       //   (the tx=... number in the SetBestChain debug.log lines)
             2000     // * estimated number of transactions per day after checkpoint                      // <--Testcoin: OK
             };
+
+        // UTXO set snapshots accepted by -loadtxoutset, keyed by height. Pin
+        // one with the base_hash and hash_serialized dumptxoutset reports
+        // for a block below the last checkpoint.
+        mapSnapshots.clear();
     }
 };
 static CMainParams mainParams;
@@ -196,6 +205,9 @@ public:
         // The best chain should have at least this much work.
         consensus.nMinimumChainWork = uint256S("0x00"); // <-- Testcoin: chaeck after wallet update
 
+        // By default assume that the signatures in ancestors of this block are valid.
+        consensus.defaultAssumeValid = uint256S("0x8618a815ad94f918a7d3d4df7ebc4df5f14da1ea25d0eb156b6a32f9621c2ce4"); // 6
+
         pchMessageStart[0] = 0xaf;  // <--Testcoin: OK
         pchMessageStart[1] = 0x2a;  // <--Testcoin: OK
         pchMessageStart[2] = 0x0f;  // <--Testcoin: OK
@@ -278,6 +290,9 @@ public:
         // The best chain should have at least this much work.
         consensus.nMinimumChainWork = uint256S("0x00");
 
+        // By default assume that the signatures in ancestors of this block are valid.
+        consensus.defaultAssumeValid = uint256S("0x00");
+
         pchMessageStart[0] = 0xaf;
         pchMessageStart[1] = 0xfb;
         pchMessageStart[2] = 0x5b;
@@ -325,6 +340,16 @@ public:
         consensus.vDeployments[d].nStartTime = nStartTime;
         consensus.vDeployments[d].nTimeout = nTimeout;
     }
+
+    void UpdateSnapshot(int nHeight, const uint256& hashBlock, const uint256& hashSerialized)
+    {
+        if (hashBlock.IsNull()) {
+            mapSnapshots.erase(nHeight);
+            return;
+        }
+        mapSnapshots[nHeight].hashBlock = hashBlock;
+        mapSnapshots[nHeight].hashSerialized = hashSerialized;
+    }
 };
 static CRegTestParams regTestParams;
 
@@ -358,3 +383,8 @@ void UpdateRegtestBIP9Parameters(Consensus::DeploymentPos d, int64_t nStartTime,
     regTestParams.UpdateBIP9Parameters(d, nStartTime, nTimeout);
 }
 
+void UpdateRegtestSnapshot(int nHeight, const uint256& hashBlock, const uint256& hashSerialized)
+{
+    regTestParams.UpdateSnapshot(nHeight, hashBlock, hashSerialized);
+}
+
@@ -33,6 +33,15 @@ struct CCheckpointData {
     double fTransactionsPerDay;
 };
 
+/** UTXO set snapshot that -loadtxoutset accepts */
+struct CSnapshotData {
+    uint256 hashBlock;
+    //! hash_serialized of gettxoutsetinfo as of hashBlock
+    uint256 hashSerialized;
+};
+
+typedef std::map<int, CSnapshotData> MapSnapshots;
+
 /**
  * CChainParams defines various tweakable parameters of a given instance of the
  * Bitcoin system. There are three: the main network on which people trade goods
@@ -76,6 +85,8 @@ public:
     const std::vector<unsigned char>& Base58Prefix(Base58Type type) const { return base58Prefixes[type]; }
     const std::vector<SeedSpec6>& FixedSeeds() const { return vFixedSeeds; }
     const CCheckpointData& Checkpoints() const { return checkpointData; }
+    /** Snapshots by height */
+    const MapSnapshots& Snapshots() const { return mapSnapshots; }
 protected:
     CChainParams() {}
 
@@ -94,6 +105,7 @@ protected:
     bool fMineBlocksOnDemand;
     bool fTestnetToBeDeprecatedFieldRPC;
     CCheckpointData checkpointData;
+    MapSnapshots mapSnapshots;
 };
 
 /**
@@ -118,4 +130,9 @@ void SelectParams(const std::string& chain);
  */
 void UpdateRegtestBIP9Parameters(Consensus::DeploymentPos d, int64_t nStartTime, int64_t nTimeout);
 
+/**
+ * Allows pinning a UTXO set snapshot on regtest, or unpinning it with a null hashBlock.
+ */
+void UpdateRegtestSnapshot(int nHeight, const uint256& hashBlock, const uint256& hashSerialized);
+
 #endif // BITCOIN_CHAINPARAMS_H
@@ -5,156 +5,328 @@
 #ifndef BITCOIN_CHECKQUEUE_H
 #define BITCOIN_CHECKQUEUE_H
 
+#include <assert.h>
+#include <stdint.h>
+
 #include <algorithm>
+#include <atomic>
+#include <memory>
 #include <vector>
 
-#include <boost/foreach.hpp>
 #include <boost/thread/condition_variable.hpp>
 #include <boost/thread/locks.hpp>
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
 
 template <typename T>
 class CCheckQueueControl;
 
-/** 
+/**
+ * Fixed-size work-stealing deque of 64-bit items (Chase and Lev, "Dynamic
+ * circular work-stealing deque", with the memory orderings of Le et al.,
+ * "Correct and efficient work-stealing for weak memory models").
+ *
+ * The thread owning the deque pushes and pops at the bottom; any other
+ * thread may steal from the top. None of them take a lock.
+ */
+class CWorkStealingDeque
+{
+private:
+    const int64_t nCapacity;
+    std::unique_ptr<std::atomic<uint64_t>[]> buffer;
+    std::atomic<int64_t> top;
+    std::atomic<int64_t> bottom;
+
+public:
+    //! nCapacityIn must be a power of two
+    explicit CWorkStealingDeque(int64_t nCapacityIn) : nCapacity(nCapacityIn), buffer(new std::atomic<uint64_t>[nCapacityIn]), top(0), bottom(0)
+    {
+        assert(nCapacity > 0 && (nCapacity & (nCapacity - 1)) == 0);
+    }
+
+    //! Owner only: add an item at the bottom; false if the deque is full
+    bool Push(uint64_t x)
+    {
+        const int64_t b = bottom.load(std::memory_order_relaxed);
+        const int64_t t = top.load(std::memory_order_acquire);
+        if (b - t >= nCapacity)
+            return false;
+        buffer[b & (nCapacity - 1)].store(x, std::memory_order_relaxed);
+        // Publishes the item, and the checks it refers to, to thieves
+        bottom.store(b + 1, std::memory_order_release);
+        return true;
+    }
+
+    //! Owner only: take the item at the bottom, the one pushed last
+    bool Pop(uint64_t& x)
+    {
+        const int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top.load(std::memory_order_relaxed);
+        if (t > b) {
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return false;
+        }
+        x = buffer[b & (nCapacity - 1)].load(std::memory_order_relaxed);
+        if (t == b) {
+            // The last item, which a thief may be taking as well
+            const bool fWon = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return fWon;
+        }
+        return true;
+    }
+
+    //! Any thread: take the item at the top, the oldest one; false if empty or another thread got it first
+    bool Steal(uint64_t& x)
+    {
+        int64_t t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const int64_t b = bottom.load(std::memory_order_acquire);
+        if (t >= b)
+            return false;
+        x = buffer[t & (nCapacity - 1)].load(std::memory_order_relaxed);
+        return top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+    }
+
+    bool IsEmpty() const
+    {
+        return top.load(std::memory_order_acquire) >= bottom.load(std::memory_order_acquire);
+    }
+};
+
+/**
  * Queue for verifications that have to be performed.
-  * The verifications are represented by a type T, which must provide an
-  * operator(), returning a bool.
-  *
-  * One thread (the master) is assumed to push batches of verifications
-  * onto the queue, where they are processed by N-1 worker threads. When
-  * the master is done adding work, it temporarily joins the worker pool
-  * as an N'th worker, until all jobs are done.
-  */
+ * The verifications are represented by a type T, which must provide an
+ * operator(), returning a bool, a default constructor and a swap.
+ *
+ * One thread (the master) is assumed to push batches of verifications
+ * onto the queue, where they are processed by N-1 worker threads. When
+ * the master is done adding work, it temporarily joins the worker pool
+ * as an N'th worker, until all jobs are done.
+ *
+ * Every thread has a deque of its own holding ranges of checks. The master
+ * puts each batch it adds in its deque as one range. A thread about to run
+ * a range of more than nBatchSize checks first splits off the upper half
+ * into its own deque, repeatedly, and threads out of work steal the oldest,
+ * so largest, range from another thread's deque. No lock is taken while
+ * there is work; the mutex is only used by threads going to sleep and by
+ * whoever wakes them. Once a check fails, the remaining ones are dropped
+ * without being run.
+ */
 template <typename T>
 class CCheckQueue
 {
 private:
-    //! Mutex to protect the inner state
-    boost::mutex mutex;
+    //! Checks are kept in segments, which are never moved while threads use them
+    static const uint32_t SEGMENT_SIZE = 256;
+    static const uint32_t MAX_SEGMENTS = 4096;
+    //! Deque slot 0 belongs to the master, the rest to worker threads
+    static const int MAX_THREADS = 64;
+    //! Ranges the master can have outstanding; once full, it runs what it adds itself
+    static const int64_t MASTER_DEQUE_SIZE = 4096;
+    //! Ranges split off by a worker, which needs about log2(checks) of them
+    static const int64_t WORKER_DEQUE_SIZE = 64;
+    //! Times a thread out of work looks for more before going to sleep
+    static const int IDLE_SPINS = 64;
 
-    //! Worker threads block on this when out of work
-    boost::condition_variable condWorker;
+    //! The largest range of checks a thread runs without splitting off half of it
+    const uint32_t nBatchSize;
+
+    std::vector<std::unique_ptr<CWorkStealingDeque> > vDeques;
+    //! Number of deque slots handed out, including the master's
+    std::atomic<int> nSlots;
+
+    std::vector<std::unique_ptr<T[]> > vSegments;
+    //! Checks added in this round; only touched by the master
+    uint32_t nAdded;
+
+    //! The temporary evaluation result.
+    std::atomic<bool> fAllOk;
+
+    //! Number of checks added in this round that haven't been run (or dropped) yet
+    std::atomic<uint32_t> nTodo;
 
-    //! Master thread blocks on this when out of work
+    //! Changes whenever there may be new work, or the last check is done
+    std::atomic<uint64_t> nEpoch;
+    //! Number of worker threads asleep, and whether the master is
+    std::atomic<int> nSleeping;
+    std::atomic<bool> fMasterSleeping;
+    //! Only used for going to sleep and waking up
+    boost::mutex mutex;
+    boost::condition_variable condWorker;
     boost::condition_variable condMaster;
 
-    //! The queue of elements to be processed.
-    //! As the order of booleans doesn't matter, it is used as a LIFO (stack)
-    std::vector<T> queue;
+    static uint64_t PackRange(uint32_t nBegin, uint32_t nEnd) { return ((uint64_t)nBegin << 32) | nEnd; }
 
-    //! The number of workers (including the master) that are idle.
-    int nIdle;
+    T& At(uint32_t i) { return vSegments[i / SEGMENT_SIZE][i % SEGMENT_SIZE]; }
 
-    //! The total number of workers (including the master).
-    int nTotal;
+    //! Wake a sleeping thread, if any, to steal a range just pushed
+    void WakeOne()
+    {
+        nEpoch++;
+        if (nSleeping.load() > 0) {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            condWorker.notify_one();
+        } else if (fMasterSleeping.load()) {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            condMaster.notify_one();
+        }
+    }
 
-    //! The temporary evaluation result.
-    bool fAllOk;
+    //! Wake the master, if asleep, as the last check is done
+    void WakeMaster()
+    {
+        nEpoch++;
+        if (fMasterSleeping.load()) {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            condMaster.notify_one();
+        }
+    }
 
     /**
-     * Number of verifications that haven't completed yet.
-     * This includes elements that are no longer queued, but still in the
-     * worker's own batches.
+     * Sleep until woken after nEpoch moved on from nEpochSeen. As nEpoch is
+     * read before looking for work, and whoever makes work available moves
+     * it on before checking for sleepers, no wake-up is missed.
      */
-    unsigned int nTodo;
+    void Sleep(uint64_t nEpochSeen, bool fMaster)
+    {
+        boost::condition_variable& cond = fMaster ? condMaster : condWorker;
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (fMaster)
+            fMasterSleeping = true;
+        else
+            nSleeping++;
+        try {
+            while (nEpoch.load() == nEpochSeen)
+                cond.wait(lock);
+        } catch (...) {
+            if (fMaster)
+                fMasterSleeping = false;
+            else
+                nSleeping--;
+            throw;
+        }
+        if (fMaster)
+            fMasterSleeping = false;
+        else
+            nSleeping--;
+    }
+
+    bool Steal(int nSlot, uint64_t& nRange)
+    {
+        const int nSlotsNow = nSlots.load();
+        for (int i = 1; i < nSlotsNow; i++) {
+            CWorkStealingDeque& victim = *vDeques[(nSlot + i) % nSlotsNow];
+            while (!victim.IsEmpty()) {
+                if (victim.Steal(nRange))
+                    return true;
+            }
+        }
+        return false;
+    }
 
-    //! Whether we're shutting down.
-    bool fQuit;
+    //! Run a range of checks taken from a deque, splitting off what others can help with
+    void Run(int nSlot, uint64_t nRange)
+    {
+        const uint32_t nBegin = nRange >> 32;
+        uint32_t nEnd = (uint32_t)nRange;
+        while (nEnd - nBegin > nBatchSize) {
+            const uint32_t nMid = nBegin + (nEnd - nBegin) / 2;
+            if (!vDeques[nSlot]->Push(PackRange(nMid, nEnd)))
+                break;
+            nEnd = nMid;
+            WakeOne();
+        }
 
-    //! The maximum number of elements to be processed in one batch
-    unsigned int nBatchSize;
+        for (uint32_t i = nBegin; i < nEnd; i++) {
+            T& check = At(i);
+            if (fAllOk.load(std::memory_order_relaxed) && !check())
+                fAllOk.store(false, std::memory_order_relaxed);
+            T().swap(check);
+        }
+        if (nTodo.fetch_sub(nEnd - nBegin) == nEnd - nBegin)
+            WakeMaster();
+    }
 
     /** Internal function that does bulk of the verification work. */
-    bool Loop(bool fMaster = false)
+    void Loop(int nSlot, bool fMaster)
     {
-        boost::condition_variable& cond = fMaster ? condMaster : condWorker;
-        std::vector<T> vChecks;
-        vChecks.reserve(nBatchSize);
-        unsigned int nNow = 0;
-        bool fOk = true;
-        do {
-            {
-                boost::unique_lock<boost::mutex> lock(mutex);
-                // first do the clean-up of the previous loop run (allowing us to do it in the same critsect)
-                if (nNow) {
-                    fAllOk &= fOk;
-                    nTodo -= nNow;
-                    if (nTodo == 0 && !fMaster)
-                        // We processed the last element; inform the master it can exit and return the result
-                        condMaster.notify_one();
-                } else {
-                    // first iteration
-                    nTotal++;
-                }
-                // logically, the do loop starts here
-                while (queue.empty()) {
-                    if ((fMaster || fQuit) && nTodo == 0) {
-                        nTotal--;
-                        bool fRet = fAllOk;
-                        // reset the status for new work later
-                        if (fMaster)
-                            fAllOk = true;
-                        // return the current status
-                        return fRet;
-                    }
-                    nIdle++;
-                    cond.wait(lock); // wait
-                    nIdle--;
-                }
-                // Decide how many work units to process now.
-                // * Do not try to do everything at once, but aim for increasingly smaller batches so
-                //   all workers finish approximately simultaneously.
-                // * Try to account for idle jobs which will instantly start helping.
-                // * Don't do batches smaller than 1 (duh), or larger than nBatchSize.
-                nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.size() / (nTotal + nIdle + 1)));
-                vChecks.resize(nNow);
-                for (unsigned int i = 0; i < nNow; i++) {
-                    // We want the lock on the mutex to be as short as possible, so swap jobs from the global
-                    // queue to the local batch vector instead of copying.
-                    vChecks[i].swap(queue.back());
-                    queue.pop_back();
-                }
-                // Check whether we need to do work at all
-                fOk = fAllOk;
+        int nIdle = 0;
+        while (true) {
+            const uint64_t nEpochSeen = nEpoch.load();
+            uint64_t nRange;
+            if (vDeques[nSlot]->Pop(nRange) || Steal(nSlot, nRange)) {
+                Run(nSlot, nRange);
+                nIdle = 0;
+                continue;
+            }
+            if (fMaster && nTodo.load() == 0)
+                return;
+            if (++nIdle < IDLE_SPINS) {
+                boost::this_thread::yield();
+                continue;
             }
-            // execute work
-            BOOST_FOREACH (T& check, vChecks)
-                if (fOk)
-                    fOk = check();
-            vChecks.clear();
-        } while (true);
+            Sleep(nEpochSeen, fMaster);
+            nIdle = 0;
+        }
     }
 
 public:
     //! Create a new check queue
-    CCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), fQuit(false), nBatchSize(nBatchSizeIn) {}
+    CCheckQueue(unsigned int nBatchSizeIn) : nBatchSize(std::max(nBatchSizeIn, 1U)), nSlots(1), vSegments(MAX_SEGMENTS), nAdded(0), fAllOk(true), nTodo(0), nEpoch(0), nSleeping(0), fMasterSleeping(false)
+    {
+        vDeques.emplace_back(new CWorkStealingDeque(MASTER_DEQUE_SIZE));
+        for (int i = 1; i < MAX_THREADS; i++)
+            vDeques.emplace_back(new CWorkStealingDeque(WORKER_DEQUE_SIZE));
+    }
 
     //! Worker thread
     void Thread()
     {
-        Loop();
+        const int nSlot = nSlots++;
+        assert(nSlot < MAX_THREADS);
+        Loop(nSlot, false);
     }
 
     //! Wait until execution finishes, and return whether all evaluations were successful.
     bool Wait()
     {
-        return Loop(true);
+        Loop(0, true);
+        const bool fRet = fAllOk.load();
+        // reset the status for new work later
+        fAllOk.store(true);
+        nAdded = 0;
+        return fRet;
     }
 
     //! Add a batch of checks to the queue
     void Add(std::vector<T>& vChecks)
     {
-        boost::unique_lock<boost::mutex> lock(mutex);
-        BOOST_FOREACH (T& check, vChecks) {
-            queue.push_back(T());
-            check.swap(queue.back());
+        if (vChecks.empty() || !fAllOk.load(std::memory_order_relaxed))
+            return;
+        if (vChecks.size() > (uint64_t)SEGMENT_SIZE * MAX_SEGMENTS - nAdded) {
+            // No room left in this round; run them here
+            for (size_t i = 0; i < vChecks.size() && fAllOk.load(); i++) {
+                if (!vChecks[i]())
+                    fAllOk.store(false);
+            }
+            return;
         }
-        nTodo += vChecks.size();
-        if (vChecks.size() == 1)
-            condWorker.notify_one();
-        else if (vChecks.size() > 1)
-            condWorker.notify_all();
+
+        const uint32_t nBegin = nAdded;
+        for (size_t i = 0; i < vChecks.size(); i++, nAdded++) {
+            if (!vSegments[nAdded / SEGMENT_SIZE])
+                vSegments[nAdded / SEGMENT_SIZE].reset(new T[SEGMENT_SIZE]);
+            At(nAdded).swap(vChecks[i]);
+        }
+        // Counted before anyone can take them, so nTodo only reaches zero at the end
+        nTodo += nAdded - nBegin;
+        if (vDeques[0]->Push(PackRange(nBegin, nAdded)))
+            WakeOne();
+        else
+            Run(0, PackRange(nBegin, nAdded));
     }
 
     ~CCheckQueue()
@@ -163,13 +335,12 @@ public:
 
     bool IsIdle()
     {
-        boost::unique_lock<boost::mutex> lock(mutex);
-        return (nTotal == nIdle && nTodo == 0 && fAllOk == true);
+        return nTodo.load() == 0 && fAllOk.load();
     }
 
 };
 
-/** 
+/**
  * RAII-style controller object for a CCheckQueue that guarantees the passed
  * queue is finished before continuing.
  */
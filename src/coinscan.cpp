@@ -0,0 +1,66 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coinscan.h"
+
+#include "init.h"
+#include "txdb.h"
+#include "util.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+static void ScanCoinsThread(CCoinsViewCursor* pcursor, CCoinsScanReducer* preducer, std::atomic<bool>* pfFailed)
+{
+    RenameThread("testcoin-coinscan");
+    COutPoint key;
+    Coin coin;
+    while (pcursor->Valid() && !*pfFailed) {
+        if (!pcursor->GetKey(key) || !pcursor->GetValue(coin)) {
+            LogPrintf("%s: unable to read value\n", __func__);
+            *pfFailed = true;
+            break;
+        }
+        if (!preducer->Apply(key, coin, pcursor->GetValueSize()) || ShutdownRequested()) {
+            *pfFailed = true;
+            break;
+        }
+        pcursor->Next();
+    }
+}
+
+bool ScanCoins(const CCoinsViewDB& view, CCoinsScanReducer& reducer, int nThreads, uint256& hashBlock)
+{
+    nThreads = std::max(nThreads, 1);
+    std::vector<std::unique_ptr<CCoinsViewCursor> > vCursors;
+    std::vector<std::unique_ptr<CCoinsScanReducer> > vReducers;
+    std::vector<CCoinsViewCursor*> vShards = view.ShardedCursors(nThreads);
+    for (size_t i = 0; i < vShards.size(); i++) {
+        vCursors.emplace_back(vShards[i]);
+        vReducers.emplace_back(reducer.Fork());
+    }
+    hashBlock = vCursors[0]->GetBestBlock();
+
+    std::atomic<bool> fFailed(false);
+    {
+        // The threads work on the vectors above until they are joined
+        boost::this_thread::disable_interruption di;
+        boost::thread_group threads;
+        for (size_t i = 0; i < vCursors.size(); i++)
+            threads.create_thread(boost::bind(&ScanCoinsThread, vCursors[i].get(), vReducers[i].get(), &fFailed));
+        threads.join_all();
+    }
+    boost::this_thread::interruption_point();
+    if (fFailed)
+        return false;
+
+    for (size_t i = 0; i < vReducers.size(); i++)
+        reducer.Merge(*vReducers[i]);
+    return true;
+}
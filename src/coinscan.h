@@ -0,0 +1,41 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_COINSCAN_H
+#define BITCOIN_COINSCAN_H
+
+#include "coins.h"
+#include "uint256.h"
+
+class CCoinsViewDB;
+
+/**
+ * What a scan of the UTXO set computes. The set is split into shards by
+ * txid, and every shard hands its coins, in key order, to a reducer of its
+ * own made by Fork. Once all shards are done, they are merged into the
+ * reducer the scan was started with, in txid order.
+ */
+class CCoinsScanReducer
+{
+public:
+    virtual ~CCoinsScanReducer() {}
+
+    //! A reducer of the same kind with nothing applied, for one shard
+    virtual CCoinsScanReducer* Fork() const = 0;
+    //! Take a coin, of nValueSize bytes in the database; false stops the whole scan
+    virtual bool Apply(const COutPoint& outpoint, const Coin& coin, unsigned int nValueSize) = 0;
+    //! Take the result of the next shard, a reducer made by Fork
+    virtual void Merge(const CCoinsScanReducer& shard) = 0;
+};
+
+/**
+ * Scan the coins database on nThreads threads, each over its own range of
+ * txids of one database snapshot, so cs_main is not needed while it runs.
+ * hashBlock is set to the best block the coins are as of. Returns false if
+ * a coin could not be read, a reducer stopped the scan or shutdown was
+ * requested.
+ */
+bool ScanCoins(const CCoinsViewDB& view, CCoinsScanReducer& reducer, int nThreads, uint256& hashBlock);
+
+#endif // BITCOIN_COINSCAN_H
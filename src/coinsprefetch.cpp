@@ -0,0 +1,202 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coinsprefetch.h"
+
+#include "memusage.h"
+#include "primitives/block.h"
+#include "util.h"
+
+#include <algorithm>
+#include <set>
+
+#include <boost/thread.hpp>
+
+//! Outpoints a worker reads in one go
+static const size_t PREFETCH_BATCH_SIZE = 64;
+
+static size_t StagedUsage(const Coin& coin)
+{
+    return memusage::MallocUsage(sizeof(std::pair<const COutPoint, Coin>) + sizeof(void*) * 2) + coin.DynamicMemoryUsage();
+}
+
+CCoinsViewPrefetch::CCoinsViewPrefetch(CCoinsView* viewIn, size_t nMaxUsageIn) : CCoinsViewBacked(viewIn), nMaxUsage(nMaxUsageIn), nQueued(0), nStagedUsage(0), nGeneration(0), fWriting(false), nWorkers(0), nBusy(0)
+{
+}
+
+CCoinsViewPrefetch::~CCoinsViewPrefetch()
+{
+    // Interrupted workers may still be finishing their last read
+    boost::unique_lock<boost::mutex> lock(cs);
+    while (nWorkers > 0)
+        cvIdle.wait(lock);
+}
+
+void CCoinsViewPrefetch::Stage(const COutPoint& outpoint, Coin&& coin)
+{
+    const size_t nUsage = StagedUsage(coin);
+    if (nStagedUsage + nUsage > nMaxUsage) {
+        // Mostly coins of blocks that were never connected, or that were
+        // read anyway before their prefetch finished
+        LogPrint("coindb", "Dropping %u prefetched coins\n", (unsigned int)mapStaged.size());
+        mapStaged.clear();
+        nStagedUsage = 0;
+    }
+    if (mapStaged.emplace(outpoint, std::move(coin)).second)
+        nStagedUsage += nUsage;
+}
+
+void CCoinsViewPrefetch::Unstage(CStagedCoins::iterator it)
+{
+    nStagedUsage -= StagedUsage(it->second);
+    mapStaged.erase(it);
+}
+
+bool CCoinsViewPrefetch::GetCoin(const COutPoint &outpoint, Coin &coin) const
+{
+    {
+        boost::lock_guard<boost::mutex> lock(cs);
+        CStagedCoins::iterator it = mapStaged.find(outpoint);
+        if (it != mapStaged.end()) {
+            nStagedUsage -= StagedUsage(it->second);
+            coin = std::move(it->second);
+            mapStaged.erase(it);
+            return true;
+        }
+    }
+    return base->GetCoin(outpoint, coin);
+}
+
+bool CCoinsViewPrefetch::HaveCoin(const COutPoint &outpoint) const
+{
+    {
+        boost::lock_guard<boost::mutex> lock(cs);
+        if (mapStaged.count(outpoint))
+            return true;
+    }
+    return base->HaveCoin(outpoint);
+}
+
+bool CCoinsViewPrefetch::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock)
+{
+    {
+        boost::lock_guard<boost::mutex> lock(cs);
+        fWriting = true;
+        nGeneration++;
+        if (!mapStaged.empty()) {
+            for (CCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); ++it) {
+                CStagedCoins::iterator itStaged = mapStaged.find(it->first);
+                if (itStaged != mapStaged.end())
+                    Unstage(itStaged);
+            }
+        }
+    }
+    bool fOk = base->BatchWrite(mapCoins, hashBlock);
+    {
+        boost::lock_guard<boost::mutex> lock(cs);
+        fWriting = false;
+        nGeneration++;
+    }
+    return fOk;
+}
+
+void CCoinsViewPrefetch::Prefetch(const CBlock& block, const CCoinsViewCache& cache)
+{
+    {
+        boost::lock_guard<boost::mutex> lock(cs);
+        if (nWorkers == 0)
+            return;
+    }
+
+    std::set<uint256> setTxids;
+    for (unsigned int i = 0; i < block.vtx.size(); i++)
+        setTxids.insert(block.vtx[i].GetHash());
+    std::vector<COutPoint> vOutpoints;
+    for (unsigned int i = 1; i < block.vtx.size(); i++) {
+        const CTransaction& tx = block.vtx[i];
+        for (unsigned int j = 0; j < tx.vin.size(); j++) {
+            const COutPoint& prevout = tx.vin[j].prevout;
+            if (!setTxids.count(prevout.hash) && !cache.HaveCoinInCache(prevout))
+                vOutpoints.push_back(prevout);
+        }
+    }
+    if (vOutpoints.empty())
+        return;
+
+    boost::lock_guard<boost::mutex> lock(cs);
+    // Do not queue more than could be staged
+    if ((nQueued + vOutpoints.size()) * StagedUsage(Coin()) > nMaxUsage)
+        return;
+    for (size_t nPos = 0; nPos < vOutpoints.size(); nPos += PREFETCH_BATCH_SIZE) {
+        const size_t nEnd = std::min(nPos + PREFETCH_BATCH_SIZE, vOutpoints.size());
+        queue.push_back(std::vector<COutPoint>(vOutpoints.begin() + nPos, vOutpoints.begin() + nEnd));
+    }
+    nQueued += vOutpoints.size();
+    cvQueue.notify_all();
+}
+
+void CCoinsViewPrefetch::WorkerThread()
+{
+    {
+        boost::lock_guard<boost::mutex> lock(cs);
+        nWorkers++;
+    }
+    try {
+        while (true) {
+            std::vector<COutPoint> vOutpoints;
+            uint64_t nGenerationRead;
+            {
+                boost::unique_lock<boost::mutex> lock(cs);
+                while (queue.empty())
+                    cvQueue.wait(lock);
+                vOutpoints.swap(queue.front());
+                queue.pop_front();
+                nQueued -= vOutpoints.size();
+                nGenerationRead = nGeneration;
+                nBusy++;
+            }
+
+            std::vector<std::pair<COutPoint, Coin> > vCoins;
+            vCoins.reserve(vOutpoints.size());
+            for (std::vector<COutPoint>::const_iterator it = vOutpoints.begin(); it != vOutpoints.end(); ++it) {
+                Coin coin;
+                if (base->GetCoin(*it, coin))
+                    vCoins.push_back(std::make_pair(*it, std::move(coin)));
+            }
+
+            {
+                boost::lock_guard<boost::mutex> lock(cs);
+                nBusy--;
+                if (!fWriting && nGenerationRead == nGeneration) {
+                    for (size_t i = 0; i < vCoins.size(); i++)
+                        Stage(vCoins[i].first, std::move(vCoins[i].second));
+                }
+                if (queue.empty() && nBusy == 0)
+                    cvIdle.notify_all();
+            }
+            boost::this_thread::interruption_point();
+        }
+    } catch (const boost::thread_interrupted&) {
+        boost::lock_guard<boost::mutex> lock(cs);
+        if (--nWorkers == 0) {
+            queue.clear();
+            nQueued = 0;
+        }
+        cvIdle.notify_all();
+        throw;
+    }
+}
+
+void CCoinsViewPrefetch::WaitForPrefetch() const
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    while ((!queue.empty() && nWorkers > 0) || nBusy > 0)
+        cvIdle.wait(lock);
+}
+
+size_t CCoinsViewPrefetch::GetStagedCount() const
+{
+    boost::lock_guard<boost::mutex> lock(cs);
+    return mapStaged.size();
+}
@@ -0,0 +1,82 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_COINSPREFETCH_H
+#define BITCOIN_COINSPREFETCH_H
+
+#include "coins.h"
+
+#include <deque>
+#include <vector>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/unordered_map.hpp>
+
+class CBlock;
+
+//! -prefetchthreads default
+static const int DEFAULT_PREFETCH_THREADS = 4;
+//! Maximum number of -prefetchthreads
+static const int MAX_PREFETCH_THREADS = 16;
+//! Memory for prefetched coins (bytes), on top of -dbcache
+static const size_t DEFAULT_PREFETCH_CACHE = 32 << 20;
+
+/**
+ * Staging layer under pcoinsTip for the coins spent by blocks that are
+ * stored but not connected yet. Prefetch hands the inputs of such a block to
+ * worker threads, which read them from the base view in parallel, so that
+ * ConnectBlock finds them in memory instead of reading them from disk one
+ * at a time.
+ *
+ * A staged coin is handed out once, to the cache above, which keeps it from
+ * then on. BatchWrite drops the staged copies of the coins it writes, and
+ * reads that overlap a write are not staged, so staged coins always match
+ * the base view.
+ */
+class CCoinsViewPrefetch : public CCoinsViewBacked
+{
+private:
+    typedef boost::unordered_map<COutPoint, Coin, SaltedOutpointHasher> CStagedCoins;
+
+    const size_t nMaxUsage;
+
+    mutable boost::mutex cs;
+    //! Wakes the workers
+    boost::condition_variable cvQueue;
+    //! Wakes threads waiting for the workers to run out of work
+    mutable boost::condition_variable cvIdle;
+    //! Outpoints to read, in chunks handed to one worker each
+    std::deque<std::vector<COutPoint> > queue;
+    size_t nQueued;
+    mutable CStagedCoins mapStaged;
+    mutable size_t nStagedUsage;
+    //! Changes with every write, so reads started before it are not staged
+    uint64_t nGeneration;
+    bool fWriting;
+    int nWorkers;
+    int nBusy;
+
+    void Stage(const COutPoint& outpoint, Coin&& coin);
+    void Unstage(CStagedCoins::iterator it);
+
+public:
+    CCoinsViewPrefetch(CCoinsView* viewIn, size_t nMaxUsageIn = DEFAULT_PREFETCH_CACHE);
+    ~CCoinsViewPrefetch();
+
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const;
+    bool HaveCoin(const COutPoint &outpoint) const;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
+
+    /** Queue the inputs of block that are neither in cache nor created by block itself */
+    void Prefetch(const CBlock& block, const CCoinsViewCache& cache);
+    /** Read queued outpoints until interrupted */
+    void WorkerThread();
+    /** Wait until the queue is empty and no reads are in flight */
+    void WaitForPrefetch() const;
+    /** Number of staged coins */
+    size_t GetStagedCount() const;
+};
+
+#endif // BITCOIN_COINSPREFETCH_H
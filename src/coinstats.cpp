@@ -0,0 +1,151 @@
+// Copyright (c) 2010 Satoshi Nakamoto
+// Copyright (c) 2009-2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coinstats.h"
+
+#include "clientversion.h"
+#include "coinscan.h"
+#include "hash.h"
+#include "main.h"
+#include "serialize.h"
+#include "streams.h"
+#include "sync.h"
+#include "txdb.h"
+#include "util.h"
+
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
+
+void ApplyStats(CCoinsStats &stats, CHashWriter& ss, const uint256& hash, const std::map<uint32_t, Coin>& outputs)
+{
+    assert(!outputs.empty());
+    ss << hash;
+    ss << VARINT(outputs.begin()->second.nHeight * 2 + outputs.begin()->second.fCoinBase);
+    stats.nTransactions++;
+    for (std::map<uint32_t, Coin>::const_iterator it = outputs.begin(); it != outputs.end(); ++it) {
+        ss << VARINT(it->first + 1);
+        ss << *(const CScriptBase*)(&it->second.out.scriptPubKey);
+        ss << VARINT(it->second.out.nValue);
+        stats.nTransactionOutputs++;
+        stats.nTotalAmount += it->second.out.nValue;
+    }
+    ss << VARINT(0);
+}
+
+bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
+{
+    boost::scoped_ptr<CCoinsViewCursor> pcursor(view->Cursor());
+
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    stats.hashBlock = pcursor->GetBestBlock();
+    {
+        LOCK(cs_main);
+        stats.nHeight = mapBlockIndex.find(stats.hashBlock)->second->nHeight;
+    }
+    ss << stats.hashBlock;
+    uint256 prevkey;
+    std::map<uint32_t, Coin> outputs;
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        COutPoint key;
+        Coin coin;
+        if (pcursor->GetKey(key) && pcursor->GetValue(coin)) {
+            if (!outputs.empty() && key.hash != prevkey) {
+                ApplyStats(stats, ss, prevkey, outputs);
+                outputs.clear();
+            }
+            prevkey = key.hash;
+            outputs[key.n] = std::move(coin);
+            stats.nSerializedSize += 32 + 4 + pcursor->GetValueSize();
+        } else {
+            return error("%s: unable to read value", __func__);
+        }
+        pcursor->Next();
+    }
+    if (!outputs.empty())
+        ApplyStats(stats, ss, prevkey, outputs);
+    stats.hashSerialized = ss.GetHash();
+    return true;
+}
+
+//! Add a coin to, or remove it from, a multiset hash
+static void ApplyCoinHash(MuHash3072& muhash, const COutPoint& outpoint, const Coin& coin, bool fAdd)
+{
+    CDataStream ss(SER_DISK, PROTOCOL_VERSION);
+    ss << outpoint;
+    ss << (uint32_t)(coin.nHeight * 2 + coin.fCoinBase);
+    ss << coin.out;
+    if (fAdd)
+        muhash.Insert((const unsigned char*)&ss[0], ss.size());
+    else
+        muhash.Remove((const unsigned char*)&ss[0], ss.size());
+}
+
+void CRollingCoinsStats::AddCoin(const COutPoint& outpoint, const Coin& coin)
+{
+    ApplyCoinHash(muhash, outpoint, coin, true);
+    nTransactionOutputs++;
+    nSerializedSize += 32 + 4 + coin.GetSerializeSize(SER_DISK, CLIENT_VERSION);
+    nTotalAmount += coin.out.nValue;
+}
+
+void CRollingCoinsStats::RemoveCoin(const COutPoint& outpoint, const Coin& coin)
+{
+    ApplyCoinHash(muhash, outpoint, coin, false);
+    nTransactionOutputs--;
+    nSerializedSize -= 32 + 4 + coin.GetSerializeSize(SER_DISK, CLIENT_VERSION);
+    nTotalAmount -= coin.out.nValue;
+}
+
+CRollingCoinsStats& CRollingCoinsStats::operator+=(const CRollingCoinsStats& delta)
+{
+    nTransactionOutputs += delta.nTransactionOutputs;
+    nSerializedSize += delta.nSerializedSize;
+    nTotalAmount += delta.nTotalAmount;
+    muhash *= delta.muhash;
+    return *this;
+}
+
+uint256 CRollingCoinsStats::GetHash() const
+{
+    MuHash3072 muhashFinal = muhash;
+    uint256 hash;
+    muhashFinal.Finalize(hash.begin());
+    return hash;
+}
+
+namespace {
+
+class CRollingCoinsStatsReducer : public CCoinsScanReducer
+{
+public:
+    CRollingCoinsStats stats;
+
+    CCoinsScanReducer* Fork() const { return new CRollingCoinsStatsReducer(); }
+
+    bool Apply(const COutPoint& outpoint, const Coin& coin, unsigned int nValueSize)
+    {
+        stats.AddCoin(outpoint, coin);
+        return true;
+    }
+
+    void Merge(const CCoinsScanReducer& shard)
+    {
+        stats += static_cast<const CRollingCoinsStatsReducer&>(shard).stats;
+    }
+};
+
+}
+
+bool GetRollingCoinsStats(CCoinsViewDB *view, CRollingCoinsStats &stats)
+{
+    CRollingCoinsStatsReducer reducer;
+    uint256 hashBlock;
+    if (!ScanCoins(*view, reducer, GetNumCores(), hashBlock))
+        return error("%s: unable to scan the UTXO set", __func__);
+    stats = reducer.stats;
+    stats.hashBlock = hashBlock;
+    return true;
+}
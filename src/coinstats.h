@@ -0,0 +1,93 @@
+// Copyright (c) 2010 Satoshi Nakamoto
+// Copyright (c) 2009-2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_COINSTATS_H
+#define BITCOIN_COINSTATS_H
+
+#include "amount.h"
+#include "coins.h"
+#include "crypto/muhash.h"
+#include "serialize.h"
+#include "uint256.h"
+
+#include <map>
+
+class CCoinsViewDB;
+class CHashWriter;
+
+struct CCoinsStats
+{
+    int nHeight;
+    uint256 hashBlock;
+    uint64_t nTransactions;
+    uint64_t nTransactionOutputs;
+    uint64_t nSerializedSize;
+    uint256 hashSerialized;
+    CAmount nTotalAmount;
+
+    CCoinsStats() : nHeight(0), nTransactions(0), nTransactionOutputs(0), nSerializedSize(0), nTotalAmount(0) {}
+};
+
+/**
+ * Add the unspent outputs of one transaction to the statistics. hash_serialized
+ * is the hash of the best block followed by this for every transaction, in
+ * txid order.
+ */
+void ApplyStats(CCoinsStats &stats, CHashWriter& ss, const uint256& hash, const std::map<uint32_t, Coin>& outputs);
+
+//! Calculate statistics about the unspent transaction output set
+bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats);
+
+/**
+ * Statistics about the unspent transaction output set that are kept up to
+ * date as blocks are connected and disconnected, and written along with the
+ * best block of the coins database, so that gettxoutsetinfo does not have to
+ * walk the database. The changes of a single block are kept in one too, with
+ * a null hashBlock and counts that may be negative.
+ */
+class CRollingCoinsStats
+{
+public:
+    //! The block the statistics are as of
+    uint256 hashBlock;
+    int64_t nTransactionOutputs;
+    //! Size of the coins database records, as GetUTXOStats counts it
+    int64_t nSerializedSize;
+    CAmount nTotalAmount;
+    //! Multiset hash of the coins, each as its outpoint, height and coinbase code, and output
+    MuHash3072 muhash;
+
+    CRollingCoinsStats() : nTransactionOutputs(0), nSerializedSize(0), nTotalAmount(0) {}
+
+    void AddCoin(const COutPoint& outpoint, const Coin& coin);
+    void RemoveCoin(const COutPoint& outpoint, const Coin& coin);
+
+    //! Apply the changes of a block; hashBlock is left to the caller
+    CRollingCoinsStats& operator+=(const CRollingCoinsStats& delta);
+
+    //! The hash of the set; takes the time of a modular inversion
+    uint256 GetHash() const;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        unsigned char bytes[MuHash3072::SERIALIZED_SIZE];
+        if (!ser_action.ForRead())
+            muhash.ToBytes(bytes);
+        READWRITE(hashBlock);
+        READWRITE(nTransactionOutputs);
+        READWRITE(nSerializedSize);
+        READWRITE(nTotalAmount);
+        READWRITE(FLATDATA(bytes));
+        if (ser_action.ForRead())
+            muhash.FromBytes(bytes);
+    }
+};
+
+//! Calculate the rolling statistics of the coins database from scratch, on as many threads as there are cores
+bool GetRollingCoinsStats(CCoinsViewDB *view, CRollingCoinsStats &stats);
+
+#endif // BITCOIN_COINSTATS_H
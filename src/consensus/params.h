@@ -63,6 +63,8 @@ struct Params {
     int64_t nPowTargetTimespan;
     int64_t DifficultyAdjustmentInterval() const { return nPowTargetTimespan / nPowTargetSpacing; }
     uint256 nMinimumChainWork;
+    /** Block whose ancestors are assumed to have valid scripts, unless overridden with -assumevalid */
+    uint256 defaultAssumeValid;
 };
 } // namespace Consensus
 
@@ -0,0 +1,176 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "crypto/muhash.h"
+
+#include "crypto/sha256.h"
+#include "crypto/sha512.h"
+
+#include <string.h>
+
+namespace {
+
+typedef Num3072::limb_t limb_t;
+typedef Num3072::double_limb_t double_limb_t;
+static const int LIMB_SIZE = Num3072::LIMB_SIZE;
+static const int LIMBS = Num3072::LIMBS;
+//! 2^3072 - 1103717 is prime, so 2^3072 is 1103717 modulo it
+static const limb_t MAX_PRIME_DIFF = 1103717;
+
+}
+
+Num3072::Num3072(const unsigned char (&data)[BYTE_SIZE])
+{
+    for (int i = 0; i < LIMBS; ++i) {
+        limbs[i] = 0;
+        for (int j = 0; j < LIMB_SIZE / 8; ++j)
+            limbs[i] |= (limb_t)data[i * (LIMB_SIZE / 8) + j] << (8 * j);
+    }
+}
+
+void Num3072::SetToOne()
+{
+    limbs[0] = 1;
+    for (int i = 1; i < LIMBS; ++i)
+        limbs[i] = 0;
+}
+
+bool Num3072::IsOverflow() const
+{
+    if (limbs[0] <= (limb_t)(0 - MAX_PRIME_DIFF) - 1)
+        return false;
+    for (int i = 1; i < LIMBS; ++i) {
+        if (limbs[i] != (limb_t)(0 - 1))
+            return false;
+    }
+    return true;
+}
+
+void Num3072::FullReduce()
+{
+    // x - (2^3072 - MAX_PRIME_DIFF), with the carry out of the top dropped
+    double_limb_t c = MAX_PRIME_DIFF;
+    for (int i = 0; i < LIMBS; ++i) {
+        c += limbs[i];
+        limbs[i] = (limb_t)c;
+        c >>= LIMB_SIZE;
+    }
+}
+
+void Num3072::Multiply(const Num3072& a)
+{
+    // Schoolbook product; a may be *this, as limbs is only written once
+    // the product is complete
+    limb_t tmp[2 * LIMBS];
+    memset(tmp, 0, sizeof(tmp));
+    for (int i = 0; i < LIMBS; ++i) {
+        double_limb_t c = 0;
+        for (int j = 0; j < LIMBS; ++j) {
+            c += (double_limb_t)limbs[i] * a.limbs[j] + tmp[i + j];
+            tmp[i + j] = (limb_t)c;
+            c >>= LIMB_SIZE;
+        }
+        tmp[i + LIMBS] = (limb_t)c;
+    }
+
+    // Fold the high half into the low one, as high * 2^3072 = high * MAX_PRIME_DIFF
+    double_limb_t c = 0;
+    for (int i = 0; i < LIMBS; ++i) {
+        c += (double_limb_t)tmp[LIMBS + i] * MAX_PRIME_DIFF + tmp[i];
+        limbs[i] = (limb_t)c;
+        c >>= LIMB_SIZE;
+    }
+    // Then what carried out of it, which at most once carries out again
+    while (c != 0) {
+        c *= MAX_PRIME_DIFF;
+        for (int i = 0; i < LIMBS && c != 0; ++i) {
+            c += limbs[i];
+            limbs[i] = (limb_t)c;
+            c >>= LIMB_SIZE;
+        }
+    }
+}
+
+Num3072 Num3072::GetInverse() const
+{
+    // Fermat: x^(p - 2), where p - 2 = 2^3072 - MAX_PRIME_DIFF - 2 has all
+    // bits set above the lowest limb
+    Num3072 r;
+    for (int i = LIMBS - 1; i >= 0; --i) {
+        const limb_t e = i == 0 ? (limb_t)(0 - MAX_PRIME_DIFF - 2) : (limb_t)(0 - 1);
+        for (int b = LIMB_SIZE - 1; b >= 0; --b) {
+            r.Multiply(r);
+            if ((e >> b) & 1)
+                r.Multiply(*this);
+        }
+    }
+    return r;
+}
+
+void Num3072::Divide(const Num3072& a)
+{
+    Multiply(a.GetInverse());
+}
+
+void Num3072::ToBytes(unsigned char (&out)[BYTE_SIZE])
+{
+    // Below 2^3072, so at most one modulus above the fully reduced number
+    if (IsOverflow())
+        FullReduce();
+    for (int i = 0; i < LIMBS; ++i) {
+        for (int j = 0; j < LIMB_SIZE / 8; ++j)
+            out[i * (LIMB_SIZE / 8) + j] = (unsigned char)(limbs[i] >> (8 * j));
+    }
+}
+
+Num3072 MuHash3072::ToNum3072(const unsigned char* data, size_t len)
+{
+    unsigned char hash[CSHA256::OUTPUT_SIZE];
+    CSHA256().Write(data, len).Finalize(hash);
+    unsigned char expanded[Num3072::BYTE_SIZE];
+    for (unsigned char i = 0; i < Num3072::BYTE_SIZE / CSHA512::OUTPUT_SIZE; ++i)
+        CSHA512().Write(hash, sizeof(hash)).Write(&i, 1).Finalize(expanded + i * CSHA512::OUTPUT_SIZE);
+    return Num3072(expanded);
+}
+
+MuHash3072& MuHash3072::Insert(const unsigned char* data, size_t len)
+{
+    numerator.Multiply(ToNum3072(data, len));
+    return *this;
+}
+
+MuHash3072& MuHash3072::Remove(const unsigned char* data, size_t len)
+{
+    denominator.Multiply(ToNum3072(data, len));
+    return *this;
+}
+
+MuHash3072& MuHash3072::operator*=(const MuHash3072& mul)
+{
+    numerator.Multiply(mul.numerator);
+    denominator.Multiply(mul.denominator);
+    return *this;
+}
+
+void MuHash3072::Finalize(unsigned char out[32])
+{
+    numerator.Divide(denominator);
+    denominator.SetToOne();
+    unsigned char data[Num3072::BYTE_SIZE];
+    numerator.ToBytes(data);
+    CSHA256().Write(data, sizeof(data)).Finalize(out);
+}
+
+void MuHash3072::ToBytes(unsigned char (&out)[SERIALIZED_SIZE]) const
+{
+    Num3072 num = numerator, den = denominator;
+    num.ToBytes(*(unsigned char (*)[Num3072::BYTE_SIZE])out);
+    den.ToBytes(*(unsigned char (*)[Num3072::BYTE_SIZE])(out + Num3072::BYTE_SIZE));
+}
+
+void MuHash3072::FromBytes(const unsigned char (&in)[SERIALIZED_SIZE])
+{
+    numerator = Num3072(*(const unsigned char (*)[Num3072::BYTE_SIZE])in);
+    denominator = Num3072(*(const unsigned char (*)[Num3072::BYTE_SIZE])(in + Num3072::BYTE_SIZE));
+}
@@ -0,0 +1,87 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_MUHASH_H
+#define BITCOIN_CRYPTO_MUHASH_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/** A number modulo 2^3072 - 1103717, the largest 3072-bit safe prime. */
+class Num3072
+{
+public:
+    static const size_t BYTE_SIZE = 384;
+
+#ifdef __SIZEOF_INT128__
+    typedef unsigned __int128 double_limb_t;
+    typedef uint64_t limb_t;
+    static const int LIMBS = 48;
+    static const int LIMB_SIZE = 64;
+#else
+    typedef uint64_t double_limb_t;
+    typedef uint32_t limb_t;
+    static const int LIMBS = 96;
+    static const int LIMB_SIZE = 32;
+#endif
+    limb_t limbs[LIMBS];
+
+    //! 1
+    Num3072() { SetToOne(); }
+    //! The little-endian number in data, which may be up to 2^3072 - 1
+    explicit Num3072(const unsigned char (&data)[BYTE_SIZE]);
+
+    void SetToOne();
+    void Multiply(const Num3072& a);
+    void Divide(const Num3072& a);
+    Num3072 GetInverse() const;
+    //! Write the fully reduced number, little-endian
+    void ToBytes(unsigned char (&out)[BYTE_SIZE]);
+
+private:
+    //! Whether the number is at least the modulus
+    bool IsOverflow() const;
+    //! Subtract the modulus once, for a number that IsOverflow
+    void FullReduce();
+};
+
+/**
+ * A hash of a set of byte strings, which elements can be added to and
+ * removed from in any order (MuHash3072, https://cseweb.ucsd.edu/~mihir/papers/inchash.pdf).
+ *
+ * Each element is hashed to a number modulo a 3072-bit prime: its SHA256 is
+ * expanded to 384 bytes with SHA512(hash || counter). Adding multiplies the
+ * numerator by it, removing multiplies the denominator, and Finalize hashes
+ * their quotient with SHA256. Sets that are equal give equal hashes, however
+ * they were built; the order of adds and removes does not matter, and
+ * neither does removing an element before it was added.
+ */
+class MuHash3072
+{
+private:
+    Num3072 numerator;
+    Num3072 denominator;
+
+    static Num3072 ToNum3072(const unsigned char* data, size_t len);
+
+public:
+    static const size_t SERIALIZED_SIZE = 2 * Num3072::BYTE_SIZE;
+
+    //! The hash of the empty set
+    MuHash3072() {}
+
+    MuHash3072& Insert(const unsigned char* data, size_t len);
+    MuHash3072& Remove(const unsigned char* data, size_t len);
+
+    //! Add, or remove, everything another MuHash3072 adds, or removes
+    MuHash3072& operator*=(const MuHash3072& mul);
+
+    //! Reduce to one number, as a SHA256 of it; the state is kept
+    void Finalize(unsigned char out[32]);
+
+    void ToBytes(unsigned char (&out)[SERIALIZED_SIZE]) const;
+    void FromBytes(const unsigned char (&in)[SERIALIZED_SIZE]);
+};
+
+#endif // BITCOIN_CRYPTO_MUHASH_H
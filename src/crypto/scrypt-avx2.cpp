@@ -0,0 +1,29 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifdef ENABLE_AVX2
+
+#include <stdint.h>
+#include <immintrin.h>
+
+#include "crypto/scrypt-lanes.h"
+
+namespace {
+
+typedef uint32_t v8u __attribute__((vector_size(32), may_alias));
+
+inline v8u Gather8(const uint32_t *base, v8u idx)
+{
+    return (v8u)_mm256_i32gather_epi32((const int *)base, (__m256i)idx, 4);
+}
+
+} // namespace
+
+/** Eight scrypt(1024,1,1) ROMix evaluations, one per 32-bit lane of a ymm register. */
+void scrypt_core_8way_avx2(uint32_t *X, uint32_t *V)
+{
+    scrypt_core_lanes<v8u, 8>(X, V, Gather8);
+}
+
+#endif
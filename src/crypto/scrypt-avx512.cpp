@@ -0,0 +1,29 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifdef ENABLE_AVX512
+
+#include <stdint.h>
+#include <immintrin.h>
+
+#include "crypto/scrypt-lanes.h"
+
+namespace {
+
+typedef uint32_t v16u __attribute__((vector_size(64), may_alias));
+
+inline v16u Gather16(const uint32_t *base, v16u idx)
+{
+    return (v16u)_mm512_i32gather_epi32((__m512i)idx, (const int *)base, 4);
+}
+
+} // namespace
+
+/** Sixteen scrypt(1024,1,1) ROMix evaluations, one per 32-bit lane of a zmm register. */
+void scrypt_core_16way_avx512(uint32_t *X, uint32_t *V)
+{
+    scrypt_core_lanes<v16u, 16>(X, V, Gather16);
+}
+
+#endif
@@ -0,0 +1,98 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_SCRYPT_LANES_H
+#define BITCOIN_CRYPTO_SCRYPT_LANES_H
+
+#include <stdint.h>
+
+/**
+ * Lane-interleaved scrypt(1024,1,1) ROMix core shared by the wide SIMD
+ * kernels. Only include this from translation units that are built with the
+ * matching instruction set flags.
+ *
+ * X holds the 32-word state of LANES independent hashes stored word-major:
+ * word k of lane l lives at X[k * LANES + l]. V is the combined scratchpad of
+ * LANES * 128 KiB in the same layout. Both must be 64-byte aligned.
+ */
+namespace {
+
+#define ROTL_LANES(a, b) (((a) << (b)) | ((a) >> (32 - (b))))
+
+template<typename Vec>
+inline void xor_salsa8_lanes(Vec B[16], const Vec Bx[16])
+{
+    Vec x[16];
+    for (int k = 0; k < 16; k++)
+        x[k] = (B[k] ^= Bx[k]);
+
+    for (int i = 0; i < 8; i += 2) {
+        /* Operate on columns. */
+        x[ 4] ^= ROTL_LANES(x[ 0] + x[12],  7);  x[ 9] ^= ROTL_LANES(x[ 5] + x[ 1],  7);
+        x[14] ^= ROTL_LANES(x[10] + x[ 6],  7);  x[ 3] ^= ROTL_LANES(x[15] + x[11],  7);
+
+        x[ 8] ^= ROTL_LANES(x[ 4] + x[ 0],  9);  x[13] ^= ROTL_LANES(x[ 9] + x[ 5],  9);
+        x[ 2] ^= ROTL_LANES(x[14] + x[10],  9);  x[ 7] ^= ROTL_LANES(x[ 3] + x[15],  9);
+
+        x[12] ^= ROTL_LANES(x[ 8] + x[ 4], 13);  x[ 1] ^= ROTL_LANES(x[13] + x[ 9], 13);
+        x[ 6] ^= ROTL_LANES(x[ 2] + x[14], 13);  x[11] ^= ROTL_LANES(x[ 7] + x[ 3], 13);
+
+        x[ 0] ^= ROTL_LANES(x[12] + x[ 8], 18);  x[ 5] ^= ROTL_LANES(x[ 1] + x[13], 18);
+        x[10] ^= ROTL_LANES(x[ 6] + x[ 2], 18);  x[15] ^= ROTL_LANES(x[11] + x[ 7], 18);
+
+        /* Operate on rows. */
+        x[ 1] ^= ROTL_LANES(x[ 0] + x[ 3],  7);  x[ 6] ^= ROTL_LANES(x[ 5] + x[ 4],  7);
+        x[11] ^= ROTL_LANES(x[10] + x[ 9],  7);  x[12] ^= ROTL_LANES(x[15] + x[14],  7);
+
+        x[ 2] ^= ROTL_LANES(x[ 1] + x[ 0],  9);  x[ 7] ^= ROTL_LANES(x[ 6] + x[ 5],  9);
+        x[ 8] ^= ROTL_LANES(x[11] + x[10],  9);  x[13] ^= ROTL_LANES(x[12] + x[15],  9);
+
+        x[ 3] ^= ROTL_LANES(x[ 2] + x[ 1], 13);  x[ 4] ^= ROTL_LANES(x[ 7] + x[ 6], 13);
+        x[ 9] ^= ROTL_LANES(x[ 8] + x[11], 13);  x[14] ^= ROTL_LANES(x[13] + x[12], 13);
+
+        x[ 0] ^= ROTL_LANES(x[ 3] + x[ 2], 18);  x[ 5] ^= ROTL_LANES(x[ 4] + x[ 7], 18);
+        x[10] ^= ROTL_LANES(x[ 9] + x[ 8], 18);  x[15] ^= ROTL_LANES(x[14] + x[13], 18);
+    }
+
+    for (int k = 0; k < 16; k++)
+        B[k] += x[k];
+}
+
+#undef ROTL_LANES
+
+/**
+ * Run ROMix over LANES interleaved hashes. Gather(base, idx) must return the
+ * vector whose lane l is base[idx[l]].
+ */
+template<typename Vec, int LANES, typename Gather>
+inline void scrypt_core_lanes(uint32_t *X_, uint32_t *V_, Gather gather)
+{
+    Vec *X = (Vec *)X_;
+    Vec *V = (Vec *)V_;
+    Vec iota;
+    uint32_t i;
+    int k;
+
+    for (k = 0; k < LANES; k++)
+        iota[k] = k;
+
+    for (i = 0; i < 1024; i++) {
+        for (k = 0; k < 32; k++)
+            V[i * 32 + k] = X[k];
+        xor_salsa8_lanes(&X[0], &X[16]);
+        xor_salsa8_lanes(&X[16], &X[0]);
+    }
+    for (i = 0; i < 1024; i++) {
+        /* Every lane picks its own row, so the reads have to be gathered. */
+        Vec j = (X[16] & 1023) * (32 * LANES) + iota;
+        for (k = 0; k < 32; k++)
+            X[k] ^= gather(V_, j + k * LANES);
+        xor_salsa8_lanes(&X[0], &X[16]);
+        xor_salsa8_lanes(&X[16], &X[0]);
+    }
+}
+
+} // namespace
+
+#endif // BITCOIN_CRYPTO_SCRYPT_LANES_H
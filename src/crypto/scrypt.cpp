@@ -27,6 +27,10 @@
  * online backup system.
  */
 
+#if defined(HAVE_CONFIG_H)
+#include "bitcoin-config.h"
+#endif
+
 #include "crypto/scrypt.h"
 //#include "util.h"
 #include <stdlib.h>
@@ -34,6 +38,11 @@
 #include <string.h>
 #include <openssl/sha.h>
 
+#if (defined(ENABLE_AVX2) || defined(ENABLE_AVX512)) && !defined(BUILD_BITCOIN_INTERNAL) && (defined(__x86_64__) || defined(__amd64__) || defined(__i386__))
+#define USE_SCRYPT_LANES 1
+#include <cpuid.h>
+#endif
+
 #if defined(USE_SSE2) && !defined(USE_SSE2_ALWAYS)
 #ifdef _MSC_VER
 // MSVC 64bit is unable to use inline asm
@@ -253,17 +262,71 @@ static inline void xor_salsa8(uint32_t B[16], const uint32_t Bx[16])
 	B[15] += x15;
 }
 
-void scrypt_1024_1_1_256_sp_generic(const char *input, char *output, char *scratchpad)
+/*
+ * Both PBKDF2 passes of scrypt(1024,1,1) over an 80-byte block header are
+ * keyed with the header itself. That key is longer than a SHA256 block, so
+ * HMAC uses SHA256(header) instead; the passes below derive it once and
+ * share it, and callers that only vary the nonce can hash the first 64
+ * bytes of the header once up front.
+ */
+
+/* Start the HMAC key hash with the first 64 bytes of header, which do not contain the nonce. */
+static void
+scrypt_header_key_prefix(CSHA256 *ctx, const uint8_t *header)
+{
+	ctx->Reset().Write(header, 64);
+}
+
+/*
+ * B = PBKDF2-SHA256(header, header, 1, 128). key_prefix must come from
+ * scrypt_header_key_prefix() on the same first 64 bytes. The HMAC key state
+ * is left in key for scrypt_header_kdf_out().
+ */
+static void
+scrypt_header_kdf_in(const CSHA256 *key_prefix, const uint8_t *header,
+    HMAC_SHA256_CTX *key, uint8_t B[128])
+{
+	CSHA256 ctx(*key_prefix);
+	HMAC_SHA256_CTX PShctx, hctx;
+	uint8_t khash[32];
+	uint8_t ivec[4];
+	int i;
+
+	ctx.Write(header + 64, 16).Finalize(khash);
+	HMAC_SHA256_Init(key, khash, 32);
+
+	memcpy(&PShctx, key, sizeof(HMAC_SHA256_CTX));
+	HMAC_SHA256_Update(&PShctx, header, 80);
+	for (i = 0; i < 4; i++) {
+		be32enc(ivec, (uint32_t)(i + 1));
+		memcpy(&hctx, &PShctx, sizeof(HMAC_SHA256_CTX));
+		HMAC_SHA256_Update(&hctx, ivec, 4);
+		HMAC_SHA256_Final(&B[i * 32], &hctx);
+	}
+}
+
+/* output = PBKDF2-SHA256(header, B, 1, 32), with the key state from scrypt_header_kdf_in(). */
+static void
+scrypt_header_kdf_out(const HMAC_SHA256_CTX *key, const uint8_t B[128], uint8_t *output)
+{
+	HMAC_SHA256_CTX hctx;
+	uint8_t ivec[4];
+
+	memcpy(&hctx, key, sizeof(HMAC_SHA256_CTX));
+	HMAC_SHA256_Update(&hctx, B, 128);
+	be32enc(ivec, 1);
+	HMAC_SHA256_Update(&hctx, ivec, 4);
+	HMAC_SHA256_Final(output, &hctx);
+}
+
+static void scrypt_romix_generic(uint8_t B[128], char *scratchpad)
 {
-	uint8_t B[128];
 	uint32_t X[32];
 	uint32_t *V;
 	uint32_t i, j, k;
 
 	V = (uint32_t *)(((uintptr_t)(scratchpad) + 63) & ~ (uintptr_t)(63));
 
-	PBKDF2_SHA256((const uint8_t *)input, 80, (const uint8_t *)input, 80, 1, B, 128);
-
 	for (k = 0; k < 32; k++)
 		X[k] = le32dec(&B[4 * k]);
 
@@ -282,13 +345,38 @@ void scrypt_1024_1_1_256_sp_generic(const char *input, char *output, char *scrat
 
 	for (k = 0; k < 32; k++)
 		le32enc(&B[4 * k], X[k]);
+}
+
+void scrypt_1024_1_1_256_sp_generic(const char *input, char *output, char *scratchpad)
+{
+	CSHA256 key_prefix;
+	HMAC_SHA256_CTX key;
+	uint8_t B[128];
 
-	PBKDF2_SHA256((const uint8_t *)input, 80, B, 128, 1, (uint8_t *)output, 32);
+	scrypt_header_key_prefix(&key_prefix, (const uint8_t *)input);
+	scrypt_header_kdf_in(&key_prefix, (const uint8_t *)input, &key, B);
+	scrypt_romix_generic(B, scratchpad);
+	scrypt_header_kdf_out(&key, B, (uint8_t *)output);
 }
 
 #if defined(USE_SSE2)
+void scrypt_1024_1_1_256_sp_sse2(const char *input, char *output, char *scratchpad)
+{
+	CSHA256 key_prefix;
+	HMAC_SHA256_CTX key;
+	uint8_t B[128];
+
+	scrypt_header_key_prefix(&key_prefix, (const uint8_t *)input);
+	scrypt_header_kdf_in(&key_prefix, (const uint8_t *)input, &key, B);
+	scrypt_romix_sse2(B, scratchpad);
+	scrypt_header_kdf_out(&key, B, (uint8_t *)output);
+}
+
 // By default, set to generic scrypt function. This will prevent crash in case when scrypt_detect_sse2() wasn't called
 void (*scrypt_1024_1_1_256_sp_detected)(const char *input, char *output, char *scratchpad) = &scrypt_1024_1_1_256_sp_generic;
+#if !defined(USE_SSE2_ALWAYS)
+static void (*scrypt_romix_detected)(uint8_t B[128], char *scratchpad) = &scrypt_romix_generic;
+#endif
 
 void scrypt_detect_sse2()
 {
@@ -311,19 +399,201 @@ void scrypt_detect_sse2()
     if (cpuid_edx & 1<<26)
     {
         scrypt_1024_1_1_256_sp_detected = &scrypt_1024_1_1_256_sp_sse2;
+        scrypt_romix_detected = &scrypt_romix_sse2;
         printf("scrypt: using scrypt-sse2 as detected.\n");
     }
     else
     {
         scrypt_1024_1_1_256_sp_detected = &scrypt_1024_1_1_256_sp_generic;
+        scrypt_romix_detected = &scrypt_romix_generic;
         printf("scrypt: using scrypt-generic, SSE2 unavailable.\n");
     }
 #endif // USE_SSE2_ALWAYS
 }
 #endif
 
+/* ROMix of one hash with the same implementation scrypt_1024_1_1_256_sp() uses. */
+static inline void scrypt_romix(uint8_t B[128], char *scratchpad)
+{
+#if defined(USE_SSE2_ALWAYS)
+	scrypt_romix_sse2(B, scratchpad);
+#elif defined(USE_SSE2)
+	scrypt_romix_detected(B, scratchpad);
+#else
+	scrypt_romix_generic(B, scratchpad);
+#endif
+}
+
 void scrypt_1024_1_1_256(const char *input, char *output)
 {
 	char scratchpad[SCRYPT_SCRATCHPAD_SIZE];
     scrypt_1024_1_1_256_sp(input, output, scratchpad);
 }
+
+#if defined(ENABLE_AVX2) && defined(USE_SCRYPT_LANES)
+void scrypt_core_8way_avx2(uint32_t *X, uint32_t *V);
+#endif
+#if defined(ENABLE_AVX512) && defined(USE_SCRYPT_LANES)
+void scrypt_core_16way_avx512(uint32_t *X, uint32_t *V);
+#endif
+
+#if defined(USE_SCRYPT_LANES)
+// Interleaved ROMix core chosen by scrypt_detect_multi(), NULL until a usable one is found
+static void (*scrypt_core_lanes_detected)(uint32_t *X, uint32_t *V) = NULL;
+#endif
+static int scrypt_lanes_detected = 1;
+
+int scrypt_multi_lanes()
+{
+	return scrypt_lanes_detected;
+}
+
+const char *scrypt_detect_multi()
+{
+#if defined(USE_SCRYPT_LANES)
+	unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+	uint64_t xcr0 = 0;
+
+	scrypt_core_lanes_detected = NULL;
+	scrypt_lanes_detected = 1;
+
+	// The OS has to save the wide registers too (OSXSAVE + XGETBV), not just the CPU support them.
+	if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) && ((ecx >> 27) & 1) && ((ecx >> 28) & 1)) {
+		uint32_t xcr0_lo, xcr0_hi;
+		__asm__ ("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+		xcr0 = xcr0_lo | ((uint64_t)xcr0_hi << 32);
+	}
+	ebx = 0;
+	if (__get_cpuid_max(0, NULL) >= 7)
+		__cpuid_count(7, 0, eax, ebx, ecx, edx);
+
+#if defined(ENABLE_AVX512)
+	if (((ebx >> 16) & 1) && (xcr0 & 0xe6) == 0xe6) {
+		scrypt_core_lanes_detected = &scrypt_core_16way_avx512;
+		scrypt_lanes_detected = 16;
+		return "avx512 (16-way)";
+	}
+#endif
+#if defined(ENABLE_AVX2)
+	if (((ebx >> 5) & 1) && (xcr0 & 0x6) == 0x6) {
+		scrypt_core_lanes_detected = &scrypt_core_8way_avx2;
+		scrypt_lanes_detected = 8;
+		return "avx2 (8-way)";
+	}
+#endif
+#endif
+	return "single-hash";
+}
+
+#if defined(USE_SCRYPT_LANES)
+/* ROMix of the PBKDF2 outputs of m <= scrypt_lanes_detected hashes, in place, in one pass of the wide core. */
+static void scrypt_romix_lanes(uint8_t B[][128], size_t m, char *scratchpad)
+{
+	const size_t lanes = scrypt_lanes_detected;
+	uint32_t *V = (uint32_t *)(((uintptr_t)(scratchpad) + 63) & ~ (uintptr_t)(63));
+	alignas(64) uint32_t X[32 * SCRYPT_MAX_LANES];
+	size_t l, k;
+
+	for (l = 0; l < m; l++) {
+		for (k = 0; k < 32; k++)
+			X[k * lanes + l] = le32dec(&B[l][4 * k]);
+	}
+	// Idle lanes repeat the last hash; their results are dropped.
+	for (; l < lanes; l++) {
+		for (k = 0; k < 32; k++)
+			X[k * lanes + l] = X[k * lanes + m - 1];
+	}
+
+	scrypt_core_lanes_detected(X, V);
+
+	for (l = 0; l < m; l++) {
+		for (k = 0; k < 32; k++)
+			le32enc(&B[l][4 * k], X[k * lanes + l]);
+	}
+}
+
+/* Whether the next pass over n remaining hashes should use the wide core. A short tail is cheaper one hash at a time than as a mostly idle wide pass. */
+static inline bool scrypt_use_lanes(size_t n)
+{
+	return scrypt_core_lanes_detected != NULL && n > 1 && n >= (size_t)scrypt_lanes_detected / 2;
+}
+#endif
+
+void scrypt_1024_1_1_256_multi_sp(const char *const *input, char *const *output, size_t n, char *scratchpad)
+{
+#if defined(USE_SCRYPT_LANES)
+	CSHA256 key_prefix;
+	HMAC_SHA256_CTX key[SCRYPT_MAX_LANES];
+	uint8_t B[SCRYPT_MAX_LANES][128];
+	size_t l;
+
+	while (scrypt_use_lanes(n)) {
+		const size_t m = n < (size_t)scrypt_lanes_detected ? n : scrypt_lanes_detected;
+
+		for (l = 0; l < m; l++) {
+			scrypt_header_key_prefix(&key_prefix, (const uint8_t *)input[l]);
+			scrypt_header_kdf_in(&key_prefix, (const uint8_t *)input[l], &key[l], B[l]);
+		}
+		scrypt_romix_lanes(B, m, scratchpad);
+		for (l = 0; l < m; l++)
+			scrypt_header_kdf_out(&key[l], B[l], (uint8_t *)output[l]);
+
+		input += m;
+		output += m;
+		n -= m;
+	}
+#endif
+	for (size_t i = 0; i < n; i++)
+		scrypt_1024_1_1_256_sp(input[i], output[i], scratchpad);
+}
+
+void scrypt_header_midstate_init(scrypt_header_midstate *ms, const char *header)
+{
+	memcpy(ms->header, header, 76);
+	scrypt_header_key_prefix(&ms->key_prefix, ms->header);
+}
+
+void scrypt_1024_1_1_256_nonces_sp(const scrypt_header_midstate *ms, uint32_t nonce, char *const *output, size_t n, char *scratchpad)
+{
+	uint8_t header[80];
+	HMAC_SHA256_CTX key[SCRYPT_MAX_LANES];
+	uint8_t B[SCRYPT_MAX_LANES][128];
+	size_t l;
+
+	memcpy(header, ms->header, 76);
+#if defined(USE_SCRYPT_LANES)
+	while (scrypt_use_lanes(n)) {
+		const size_t m = n < (size_t)scrypt_lanes_detected ? n : scrypt_lanes_detected;
+
+		for (l = 0; l < m; l++) {
+			le32enc(&header[76], nonce + (uint32_t)l);
+			scrypt_header_kdf_in(&ms->key_prefix, header, &key[l], B[l]);
+		}
+		scrypt_romix_lanes(B, m, scratchpad);
+		for (l = 0; l < m; l++)
+			scrypt_header_kdf_out(&key[l], B[l], (uint8_t *)output[l]);
+
+		nonce += (uint32_t)m;
+		output += m;
+		n -= m;
+	}
+#endif
+	for (l = 0; l < n; l++) {
+		le32enc(&header[76], nonce + (uint32_t)l);
+		scrypt_header_kdf_in(&ms->key_prefix, header, &key[0], B[0]);
+		scrypt_romix(B[0], scratchpad);
+		scrypt_header_kdf_out(&key[0], B[0], (uint8_t *)output[l]);
+	}
+}
+
+void scrypt_1024_1_1_256_multi(const char *const *input, char *const *output, size_t n)
+{
+	char *scratchpad = (char *)malloc(SCRYPT_MULTI_SCRATCHPAD_SIZE);
+	if (scratchpad == NULL) {
+		for (size_t i = 0; i < n; i++)
+			scrypt_1024_1_1_256(input[i], output[i]);
+		return;
+	}
+	scrypt_1024_1_1_256_multi_sp(input, output, n, scratchpad);
+	free(scratchpad);
+}
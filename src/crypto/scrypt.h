@@ -3,11 +3,50 @@
 #include <stdlib.h>
 #include <stdint.h>
 
+#include "crypto/sha256.h"
+
 static const int SCRYPT_SCRATCHPAD_SIZE = 131072 + 63;
 
+/** Widest lane count of any multi-hash kernel (AVX-512). */
+static const int SCRYPT_MAX_LANES = 16;
+static const int SCRYPT_MULTI_SCRATCHPAD_SIZE = SCRYPT_MAX_LANES * 131072 + 63;
+
 void scrypt_1024_1_1_256(const char *input, char *output);
 void scrypt_1024_1_1_256_sp_generic(const char *input, char *output, char *scratchpad);
 
+/**
+ * Hash n independent 80-byte inputs, writing 32 bytes to each output[i].
+ * Uses the interleaved AVX2/AVX-512 kernel picked by scrypt_detect_multi()
+ * and falls back to one hash at a time otherwise. The _sp variant takes a
+ * caller-owned scratchpad of SCRYPT_MULTI_SCRATCHPAD_SIZE bytes.
+ */
+void scrypt_1024_1_1_256_multi(const char *const *input, char *const *output, size_t n);
+void scrypt_1024_1_1_256_multi_sp(const char *const *input, char *const *output, size_t n, char *scratchpad);
+
+/**
+ * Hashing state for an 80-byte block header whose first 76 bytes stay fixed
+ * while the nonce in the last 4 bytes changes. The nonce-independent part of
+ * the PBKDF2 key setup is done once by scrypt_header_midstate_init().
+ */
+struct scrypt_header_midstate {
+    uint8_t header[76];
+    CSHA256 key_prefix;
+};
+
+void scrypt_header_midstate_init(scrypt_header_midstate *ms, const char *header);
+/**
+ * Hash the header of ms with the n consecutive nonces starting at nonce,
+ * writing 32 bytes to each output[i]. Gives the same results as
+ * scrypt_1024_1_1_256() on the full headers. scratchpad must hold
+ * SCRYPT_MULTI_SCRATCHPAD_SIZE bytes.
+ */
+void scrypt_1024_1_1_256_nonces_sp(const scrypt_header_midstate *ms, uint32_t nonce, char *const *output, size_t n, char *scratchpad);
+
+/** Select the widest multi-hash kernel this CPU supports; returns its name. */
+const char *scrypt_detect_multi();
+/** Number of hashes the selected multi-hash kernel computes per pass (1 if none). */
+int scrypt_multi_lanes();
+
 #if defined(USE_SSE2)
 #if defined(_M_X64) || defined(__x86_64__) || defined(_M_AMD64) || (defined(MAC_OSX) && defined(__i386__))
 #define USE_SSE2_ALWAYS 1
@@ -18,6 +57,8 @@ void scrypt_1024_1_1_256_sp_generic(const char *input, char *output, char *scrat
 
 void scrypt_detect_sse2();
 void scrypt_1024_1_1_256_sp_sse2(const char *input, char *output, char *scratchpad);
+/** ROMix over the 128-byte output of the first PBKDF2 pass, in place. */
+void scrypt_romix_sse2(uint8_t *B, char *scratchpad);
 extern void (*scrypt_1024_1_1_256_sp_detected)(const char *input, char *output, char *scratchpad);
 #else
 #define scrypt_1024_1_1_256_sp(input, output, scratchpad) scrypt_1024_1_1_256_sp_generic((input), (output), (scratchpad))
@@ -14,20 +14,25 @@
 #include "chain.h"
 #include "chainparams.h"
 #include "checkpoints.h"
+#include "coinsprefetch.h"
 #include "compat/sanity.h"
 #include "consensus/validation.h"
+#include "crypto/scrypt.h"
 #include "httpserver.h"
 #include "httprpc.h"
 #include "key.h"
 #include "main.h"
 #include "miner.h"
+#include "momcache.h"
 #include "net.h"
+#include "notarizationdb.h"
 #include "policy/policy.h"
 #include "rpc/server.h"
 #include "rpc/register.h"
 #include "script/standard.h"
 #include "script/sigcache.h"
 #include "scheduler.h"
+#include "stratum.h"
 #include "timedata.h"
 #include "txdb.h"
 #include "txmempool.h"
@@ -143,9 +148,9 @@ class CCoinsViewErrorCatcher : public CCoinsViewBacked
 {
 public:
     CCoinsViewErrorCatcher(CCoinsView* view) : CCoinsViewBacked(view) {}
-    bool GetCoins(const uint256 &txid, CCoins &coins) const {
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const {
         try {
-            return CCoinsViewBacked::GetCoins(txid, coins);
+            return CCoinsViewBacked::GetCoin(outpoint, coin);
         } catch(const std::runtime_error& e) {
             uiInterface.ThreadSafeMessageBox(_("Error reading from database, shutting down."), "", CClientUIInterface::MSG_ERROR);
             LogPrintf("Error reading from database: %s\n", e.what());
@@ -159,7 +164,6 @@ public:
     // Writes do not need similar protection, as failure to write is handled by the caller.
 };
 
-static CCoinsViewDB *pcoinsdbview = NULL;
 static CCoinsViewErrorCatcher *pcoinscatcher = NULL;
 static boost::scoped_ptr<ECCVerifyHandle> globalVerifyHandle;
 
@@ -170,6 +174,7 @@ void Interrupt(boost::thread_group& threadGroup)
     InterruptRPC();
     InterruptREST();
     InterruptTorControl();
+    InterruptStratumServer();
     threadGroup.interrupt_all();
 }
 
@@ -196,6 +201,7 @@ void Shutdown()
     if (pwalletMain)
         pwalletMain->Flush(false);
 #endif
+    StopStratumServer();
     StopNode();
     StopTorControl();
     UnregisterNodeSignals(GetNodeSignals());
@@ -218,12 +224,15 @@ void Shutdown()
         }
         delete pcoinsTip;
         pcoinsTip = NULL;
+        delete pcoinsprefetch;
+        pcoinsprefetch = NULL;
         delete pcoinscatcher;
         pcoinscatcher = NULL;
         delete pcoinsdbview;
         pcoinsdbview = NULL;
         delete pblocktree;
         pblocktree = NULL;
+        notarizationindex.Close();
     }
 #ifdef ENABLE_WALLET
     if (pwalletMain)
@@ -305,6 +314,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-?", _("Print this help message and exit"));
     strUsage += HelpMessageOpt("-version", _("Print version and exit"));
     strUsage += HelpMessageOpt("-alertnotify=<cmd>", _("Execute command when a relevant alert is received or we see a really long fork (%s in cmd is replaced by message)"));
+    strUsage += HelpMessageOpt("-assumevalid=<hex>", strprintf(_("If this block is in the chain assume that it and its ancestors are valid and potentially skip their script verification (0 to verify all, default: %s, testnet: %s)"), Params(CBaseChainParams::MAIN).GetConsensus().defaultAssumeValid.GetHex(), Params(CBaseChainParams::TESTNET).GetConsensus().defaultAssumeValid.GetHex()));
     strUsage += HelpMessageOpt("-blocknotify=<cmd>", _("Execute command when the best block changes (%s in cmd is replaced by block hash)"));
     if (showDebug)
         strUsage += HelpMessageOpt("-blocksonly", strprintf(_("Whether to operate in a blocks only mode (default: %u)"), DEFAULT_BLOCKSONLY));
@@ -318,15 +328,20 @@ std::string HelpMessage(HelpMessageMode mode)
 #endif
     }
     strUsage += HelpMessageOpt("-datadir=<dir>", _("Specify data directory"));
+    if (showDebug)
+        strUsage += HelpMessageOpt("-dbbatchsize", strprintf("Maximum database write batch size in bytes (default: %u)", nDefaultDbBatchSize));
     strUsage += HelpMessageOpt("-dbcache=<n>", strprintf(_("Set database cache size in megabytes (%d to %d, default: %d)"), nMinDbCache, nMaxDbCache, nDefaultDbCache));
     if (showDebug)
         strUsage += HelpMessageOpt("-feefilter", strprintf("Tell other nodes to filter invs to us by our mempool min fee (default: %u)", DEFAULT_FEEFILTER));
     strUsage += HelpMessageOpt("-loadblock=<file>", _("Imports blocks from external blk000??.dat file on startup"));
+    strUsage += HelpMessageOpt("-loadtxoutset=<file>", _("Start a fresh chainstate from a UTXO set snapshot written by dumptxoutset; the blocks below it are not downloaded"));
     strUsage += HelpMessageOpt("-maxorphantx=<n>", strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS));
     strUsage += HelpMessageOpt("-maxmempool=<n>", strprintf(_("Keep the transaction memory pool below <n> megabytes (default: %u)"), DEFAULT_MAX_MEMPOOL_SIZE));
     strUsage += HelpMessageOpt("-mempoolexpiry=<n>", strprintf(_("Do not keep transactions in the mempool longer than <n> hours (default: %u)"), DEFAULT_MEMPOOL_EXPIRY));
     strUsage += HelpMessageOpt("-par=<n>", strprintf(_("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
         -GetNumCores(), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS));
+    strUsage += HelpMessageOpt("-prefetchthreads=<n>", strprintf(_("Set the number of threads reading the coins spent by blocks waiting to be connected (0 to %d, default: %d)"),
+        MAX_PREFETCH_THREADS, DEFAULT_PREFETCH_THREADS));
 #ifndef WIN32
     strUsage += HelpMessageOpt("-pid=<file>", strprintf(_("Specify pid file (default: %s)"), BITCOIN_PID_FILENAME));
 #endif
@@ -400,8 +415,9 @@ std::string HelpMessage(HelpMessageMode mode)
     if (showDebug)
     {
         strUsage += HelpMessageOpt("-checkblockindex", strprintf("Do a full consistency check for mapBlockIndex, setBlockIndexCandidates, chainActive and mapBlocksUnlinked occasionally. Also sets -checkmempool (default: %u)", Params(CBaseChainParams::MAIN).DefaultConsistencyChecks()));
+        strUsage += HelpMessageOpt("-checkblockindexpow", strprintf("Recompute the proof-of-work hash of every block index entry in the background after startup and store it (default: %u)", DEFAULT_CHECKBLOCKINDEXPOW));
         strUsage += HelpMessageOpt("-checkmempool=<n>", strprintf("Run checks every <n> transactions (default: %u)", Params(CBaseChainParams::MAIN).DefaultConsistencyChecks()));
-        strUsage += HelpMessageOpt("-checkpoints", strprintf("Disable expensive verification for known chain history (default: %u)", DEFAULT_CHECKPOINTS_ENABLED));
+        strUsage += HelpMessageOpt("-checkpoints", strprintf("Only accept block chain matching built-in checkpoints (default: %u)", DEFAULT_CHECKPOINTS_ENABLED));
         strUsage += HelpMessageOpt("-disablesafemode", strprintf("Disable safemode, override a real safe mode event (default: %u)", DEFAULT_DISABLE_SAFEMODE));
         strUsage += HelpMessageOpt("-testsafemode", strprintf("Force safe mode (default: %u)", DEFAULT_TESTSAFEMODE));
         strUsage += HelpMessageOpt("-dropmessagestest=<n>", "Randomly drop 1 of every <n> network messages");
@@ -412,8 +428,9 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-limitdescendantcount=<n>", strprintf("Do not accept transactions if any ancestor would have <n> or more in-mempool descendants (default: %u)", DEFAULT_DESCENDANT_LIMIT));
         strUsage += HelpMessageOpt("-limitdescendantsize=<n>", strprintf("Do not accept transactions if any ancestor would have more than <n> kilobytes of in-mempool descendants (default: %u).", DEFAULT_DESCENDANT_SIZE_LIMIT));
         strUsage += HelpMessageOpt("-bip9params=deployment:start:end", "Use given start/end times for specified bip9 deployment (regtest-only)");
+        strUsage += HelpMessageOpt("-txoutsetparams=height:blockhash:hash", "Accept the UTXO set snapshot of the given block with the given hash_serialized (regtest-only)");
     }
-    string debugCategories = "addrman, alert, bench, cmpctblock, coindb, db, http, libevent, lock, mempool, mempoolrej, net, proxy, prune, rand, reindex, rpc, selectcoins, tor, zmq"; // Don't translate these and qt below
+    string debugCategories = "addrman, alert, bench, cmpctblock, coindb, db, http, libevent, lock, mempool, mempoolrej, net, proxy, prune, rand, reindex, rpc, selectcoins, stratum, tor, zmq"; // Don't translate these and qt below
     if (mode == HMM_BITCOIN_QT)
         debugCategories += ", qt";
     strUsage += HelpMessageOpt("-debug=<category>", strprintf(_("Output debugging information (default: %u, supplying <category> is optional)"), 0) + ". " +
@@ -459,6 +476,11 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-blockprioritysize=<n>", strprintf(_("Set maximum size of high-priority/low-fee transactions in bytes (default: %d)"), DEFAULT_BLOCK_PRIORITY_SIZE));
     if (showDebug)
         strUsage += HelpMessageOpt("-blockversion=<n>", "Override block version to test forking scenarios");
+    strUsage += HelpMessageOpt("-blocktemplatefeedelta=<amt>", strprintf(_("Rebuild the prebuilt block template for getblocktemplate and stratum once mempool fees grew by <amt> %s (default: %s)"), CURRENCY_UNIT, FormatMoney(DEFAULT_BLOCK_TEMPLATE_FEE_DELTA)));
+    strUsage += HelpMessageOpt("-genthreads=<n>", strprintf(_("Set the number of threads generate and generatetoaddress search nonces with (0 = number of cores, default: %d)"), DEFAULT_GENERATE_THREADS));
+    strUsage += HelpMessageOpt("-stratumport=<port>", _("Serve stratum v1 mining jobs on <port> (default: disabled)"));
+    strUsage += HelpMessageOpt("-stratumbind=<addr>", _("Bind the stratum server to given address. Use [host]:port notation for IPv6. This option can be specified multiple times (default: bind to loopback)"));
+    strUsage += HelpMessageOpt("-stratumdifficulty=<n>", strprintf(_("Share difficulty asked from stratum miners (default: %g)"), DEFAULT_STRATUM_DIFFICULTY));
 
     strUsage += HelpMessageGroup(_("RPC server options:"));
     strUsage += HelpMessageOpt("-server", _("Accept command line and JSON-RPC commands"));
@@ -778,6 +800,7 @@ void InitLogging()
 }
 
 int32_t komodo_init();
+void komodo_initnotarizations();
 
 /** Initialize testcoin.
  *  @pre Parameters should be parsed and config file should be read.
@@ -910,6 +933,12 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     fCheckBlockIndex = GetBoolArg("-checkblockindex", chainparams.DefaultConsistencyChecks());
     fCheckpointsEnabled = GetBoolArg("-checkpoints", DEFAULT_CHECKPOINTS_ENABLED);
 
+    hashAssumeValid = uint256S(GetArg("-assumevalid", chainparams.GetConsensus().defaultAssumeValid.GetHex()));
+    if (!hashAssumeValid.IsNull())
+        LogPrintf("Assuming ancestors of block %s have valid signatures.\n", hashAssumeValid.GetHex());
+    else
+        LogPrintf("Validating signatures for all blocks.\n");
+
     // mempool limits
     int64_t nMempoolSizeMax = GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
     int64_t nMempoolSizeMin = GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT) * 1000 * 40;
@@ -1039,6 +1068,24 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         }
     }
 
+    if (mapArgs.count("-txoutsetparams")) {
+        // Allow pinning a UTXO set snapshot for testing
+        if (!Params().MineBlocksOnDemand()) {
+            return InitError("UTXO set snapshots may only be pinned on regtest.");
+        }
+        std::vector<std::string> vSnapshotParams;
+        boost::split(vSnapshotParams, mapArgs["-txoutsetparams"], boost::is_any_of(":"));
+        int nHeight;
+        if (vSnapshotParams.size() != 3 || !ParseInt32(vSnapshotParams[0], &nHeight) || nHeight <= 0 || !IsHex(vSnapshotParams[1]) || !IsHex(vSnapshotParams[2])) {
+            return InitError("UTXO set snapshot parameters malformed, expecting height:blockhash:hash");
+        }
+        UpdateRegtestSnapshot(nHeight, uint256S(vSnapshotParams[1]), uint256S(vSnapshotParams[2]));
+        LogPrintf("Accepting the UTXO set snapshot of block %s at height %d\n", vSnapshotParams[1], nHeight);
+    }
+
+    if (mapArgs.count("-loadtxoutset") && (GetBoolArg("-reindex", false) || GetBoolArg("-reindex-chainstate", false)))
+        return InitError(_("-loadtxoutset is incompatible with -reindex and -reindex-chainstate."));
+
     // ********************************************************* Step 4: application initialization: dir lock, daemonize, pidfile, debug log
 
     // Initialize elliptic curve code
@@ -1081,10 +1128,13 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     LogPrintf("Using at most %i connections (%i file descriptors available)\n", nMaxConnections, nFD);
     std::ostringstream strErrors;
 
-    LogPrintf("Using %u threads for script verification\n", nScriptCheckThreads);
+    LogPrintf("Using %u threads for script and proof-of-work verification\n", nScriptCheckThreads);
     if (nScriptCheckThreads) {
-        for (int i=0; i<nScriptCheckThreads-1; i++)
+        for (int i=0; i<nScriptCheckThreads-1; i++) {
             threadGroup.create_thread(&ThreadScriptCheck);
+            threadGroup.create_thread(&ThreadPowCheck);
+            threadGroup.create_thread(&ThreadTxDataPrecompute);
+        }
     }
 
     // Start the lightweight task scheduler thread
@@ -1108,6 +1158,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 #if defined(USE_SSE2)
     scrypt_detect_sse2();
 #endif
+    LogPrintf("scrypt: using %s multi-hash kernel\n", scrypt_detect_multi());
 
     // ********************************************************* Step 5: verify wallet database integrity
 #ifdef ENABLE_WALLET
@@ -1309,6 +1360,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
             try {
                 UnloadBlockIndex();
                 delete pcoinsTip;
+                delete pcoinsprefetch;
                 delete pcoinsdbview;
                 delete pcoinscatcher;
                 delete pblocktree;
@@ -1316,7 +1368,16 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                 pblocktree = new CBlockTreeDB(nBlockTreeDBCache, false, fReindex);
                 pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, fReindex || fReindexChainState);
                 pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsdbview);
-                pcoinsTip = new CCoinsViewCache(pcoinscatcher);
+                pcoinsprefetch = new CCoinsViewPrefetch(pcoinscatcher);
+                pcoinsTip = new CCoinsViewCache(pcoinsprefetch);
+
+                if (!notarizationindex.Open(GetDataDir() / "notarizationindex", nNotarizationDBCache << 20, fReindex || fReindexChainState)) {
+                    strLoadError = _("Error loading notarization database");
+                    break;
+                }
+                // The notarizations flat file only describes the chain being replaced
+                if (fReindex || fReindexChainState)
+                    notarizationindex.WriteFlag("flatfileimported");
 
                 if (fReindex) {
                     pblocktree->WriteReindexing(true);
@@ -1335,6 +1396,14 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                 if (!mapBlockIndex.empty() && mapBlockIndex.count(chainparams.GetConsensus().hashGenesisBlock) == 0)
                     return InitError(_("Incorrect or no genesis block found. Wrong datadir for network?"));
 
+                // Finish a chainstate write that was cut short before taking
+                // its best block as the tip
+                if (!ReplayBlocks(chainparams, pcoinsdbview)) {
+                    strLoadError = _("Unable to replay blocks. You will need to rebuild the database using -reindex-chainstate.");
+                    break;
+                }
+                LoadChainTip(chainparams);
+
                 // Initialize the block index (no-op if non-empty database was already loaded)
                 if (!InitBlockIndex(chainparams)) {
                     strLoadError = _("Error initializing block database");
@@ -1354,6 +1423,20 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                     break;
                 }
 
+                // If necessary, upgrade from older database format.
+                // This is a no-op if we cleared the coinsviewdb with -reindex or -reindex-chainstate
+                if (!pcoinsdbview->Upgrade()) {
+                    strLoadError = _("Error upgrading chainstate database");
+                    break;
+                }
+
+                // The tip's UTXO set statistics are kept up to date from here on
+                uiInterface.InitMessage(_("Loading UTXO set statistics..."));
+                if (!LoadCoinsStats()) {
+                    strLoadError = _("Error computing UTXO set statistics");
+                    break;
+                }
+
                 if (!fReindex && chainActive.Tip() != NULL) {
                     uiInterface.InitMessage(_("Rewinding blocks..."));
                     if (!RewindBlockIndex(chainparams)) {
@@ -1393,7 +1476,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
             fLoaded = true;
         } while(false);
 
-        if (!fLoaded) {
+        if (!fLoaded && !fRequestShutdown) {
             // first suggest a reindex
             if (!fReset) {
                 bool fRet = uiInterface.ThreadSafeQuestion(
@@ -1423,6 +1506,14 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     }
     LogPrintf(" block index %15dms\n", GetTimeMillis() - nStart);
 
+    if (mapArgs.count("-loadtxoutset")) {
+        uiInterface.InitMessage(_("Loading UTXO set snapshot..."));
+        nStart = GetTimeMillis();
+        if (!LoadTxOutSet(chainparams, boost::filesystem::absolute(mapArgs["-loadtxoutset"], GetDataDir())))
+            return fRequestShutdown ? false : InitError(_("Unable to load the UTXO set snapshot. See debug.log for details."));
+        LogPrintf(" txoutset load %15dms\n", GetTimeMillis() - nStart);
+    }
+
     boost::filesystem::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
     CAutoFile est_filein(fopen(est_path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
     // Allowed to fail as this file IS missing on first startup.
@@ -1448,6 +1539,10 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     // if pruning, unset the service bit and perform the initial blockstore prune
     // after any wallet rescanning has taken place.
+    if (fSnapshotChainstate && !fPruneMode) {
+        LogPrintf("Unsetting NODE_NETWORK on a chainstate loaded from a snapshot\n");
+        nLocalServices = ServiceFlags(nLocalServices & ~NODE_NETWORK);
+    }
     if (fPruneMode) {
         LogPrintf("Unsetting NODE_NETWORK on prune mode\n");
         nLocalServices = ServiceFlags(nLocalServices & ~NODE_NETWORK);
@@ -1492,7 +1587,29 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
             vImportFiles.push_back(strFile);
     }
 
+    // Keep the MoM subtrees of the recent active chain for the MoM RPCs, and
+    // handle the notarizations of blocks connected from now on off cs_main
+    {
+        LOCK(cs_main);
+        if (chainActive.Tip() != NULL)
+            momcache.SetTip(chainActive.Tip());
+        komodo_initnotarizations();
+    }
+    RegisterValidationInterface(&momcache);
+    RegisterValidationInterface(&notarizationprocessor);
+    threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, "notarize", boost::function<void()>(boost::bind(&CNotarizationProcessor::Thread, &notarizationprocessor))));
+
+    // Write the chainstate off cs_main from now on
+    threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, "coindb", boost::function<void()>(boost::bind(&CCoinsViewDB::WriterThread, pcoinsdbview))));
+
+    // Read the coins of blocks waiting to be connected ahead of ConnectBlock
+    int nPrefetchThreads = std::max(0, std::min((int)GetArg("-prefetchthreads", DEFAULT_PREFETCH_THREADS), MAX_PREFETCH_THREADS));
+    for (int i = 0; i < nPrefetchThreads; i++)
+        threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, "prefetch", boost::function<void()>(boost::bind(&CCoinsViewPrefetch::WorkerThread, pcoinsprefetch))));
+
     threadGroup.create_thread(boost::bind(&ThreadImport, vImportFiles));
+    if (GetBoolArg("-checkblockindexpow", DEFAULT_CHECKBLOCKINDEXPOW))
+        threadGroup.create_thread(&ThreadCheckBlockIndexPoW);
 
     // Wait for genesis block to be processed
     {
@@ -1522,6 +1639,16 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     StartNode(threadGroup, scheduler);
 
+    if (GetBoolArg("-server", false) || mapArgs.count("-stratumport")) {
+        CAmount nFeeDelta = DEFAULT_BLOCK_TEMPLATE_FEE_DELTA;
+        if (mapArgs.count("-blocktemplatefeedelta") && !ParseMoney(mapArgs["-blocktemplatefeedelta"], nFeeDelta))
+            return InitError(AmountErrMsg("blocktemplatefeedelta", mapArgs["-blocktemplatefeedelta"]));
+        threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, "template", boost::function<void()>(boost::bind(&ThreadBlockTemplateBuilder, nFeeDelta))));
+    }
+
+    if (!StartStratumServer())
+        return InitError(_("Unable to start stratum server. See debug log for details."));
+
     // ********************************************************* Step 12: finished
 
     SetRPCWarmupFinished();
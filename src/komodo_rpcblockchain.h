@@ -17,6 +17,7 @@
 #define komodo_rpcblockchain_h
 
 #include "main.h"
+#include "momcache.h"
 
 int32_t komodo_MoMdata(int32_t *notarized_htp,uint256 *MoMp,uint256 *kmdtxidp,int32_t height,uint256 *MoMoMp,int32_t *MoMoMoffsetp,int32_t *MoMoMdepthp,int32_t *kmdstartip,int32_t *kmdendip);
 uint256 komodo_calcMoM(int32_t height,int32_t MoMdepth);
@@ -79,6 +80,45 @@ UniValue calc_MoM(const UniValue& params, bool fHelp)
     return ret;
 }
 
+UniValue calc_MoMproof(const UniValue& params, bool fHelp)
+{
+    int32_t i,height,MoMdepth,blockheight; uint256 MoM; CBlockIndex *pindex; std::vector<uint256> branch; UniValue ret(UniValue::VOBJ); UniValue a(UniValue::VARR);
+    if ( fHelp || params.size() != 3 )
+        throw std::runtime_error("calc_MoMproof height MoMdepth blockheight\n");
+    LOCK(cs_main);
+    height = atoi(params[0].get_str().c_str());
+    MoMdepth = atoi(params[1].get_str().c_str());
+    blockheight = atoi(params[2].get_str().c_str());
+    if ( height <= 0 || height > chainActive.Height() )
+        throw std::runtime_error("calc_MoMproof illegal height, must be positive and in the active chain\n");
+    if ( MoMdepth <= 0 || MoMdepth >= height )
+        throw std::runtime_error("calc_MoMproof illegal MoMdepth, must be positive and less than height\n");
+    if ( blockheight > height || blockheight <= height - MoMdepth )
+        throw std::runtime_error("calc_MoMproof illegal blockheight, must be within the MoMdepth blocks up to height\n");
+
+    pindex = chainActive[height];
+    if ( momcache.GetMoM(pindex,MoMdepth,MoM) == 0 || momcache.GetMoMBranch(pindex,MoMdepth,blockheight,branch) == 0 )
+    {
+        // Below the cached heights, build the tree from scratch
+        std::vector<uint256> leaves;
+        for (i=0; i<MoMdepth; i++)
+            leaves.push_back(chainActive[height - i]->hashMerkleRoot);
+        MoM = ComputeMoM(leaves);
+        branch = ComputeMoMBranch(leaves,height - blockheight);
+    }
+    for (i=0; i<(int32_t)branch.size(); i++)
+        a.push_back(branch[i].GetHex());
+    ret.push_back(Pair("coin",(char *)(ASSETCHAINS_SYMBOL[0] == 0 ? "KMD" : ASSETCHAINS_SYMBOL)));
+    ret.push_back(Pair("height",height));
+    ret.push_back(Pair("MoMdepth",MoMdepth));
+    ret.push_back(Pair("MoM",MoM.GetHex()));
+    ret.push_back(Pair("blockheight",blockheight));
+    ret.push_back(Pair("merkleroot",chainActive[blockheight]->hashMerkleRoot.GetHex()));
+    ret.push_back(Pair("index",height - blockheight));
+    ret.push_back(Pair("branch",a));
+    return ret;
+}
+
 UniValue height_MoM(const UniValue& params, bool fHelp)
 {
     int32_t height,depth,notarized_height,MoMoMdepth,MoMoMoffset,kmdstarti,kmdendi; uint256 MoM,MoMoM,kmdtxid; uint32_t timestamp = 0; UniValue ret(UniValue::VOBJ); UniValue a(UniValue::VARR);
@@ -24,8 +24,9 @@
 // { "blockchain",         "height_MoM",             &height_MoM,             {"height"}  },
 
 // in validation.cpp
-// at end of ConnectBlock: komodo_connectblock(pindex,*(CBlock *)&block);
-// at beginning DisconnectBlock: komodo_disconnect((CBlockIndex *)pindex,(CBlock *)&block);
+// at end of ConnectBlock: GetMainSignals().BlockConnected(block,pindex,blockundo);
+// in DisconnectTip after DisconnectBlock: GetMainSignals().BlockDisconnected(block,pindexDelete);
+// in init.cpp after loading the chain: komodo_initnotarizations(), then run notarizationprocessor
 /* add to ContextualCheckBlockHeader
     uint256 hash = block.GetHash();
     int32_t notarized_height;
@@ -57,6 +58,12 @@
 #include <key_io.h>
 #include <base58.h>
 #include <komodo_notaries.h>
+#include <notarizationdb.h>
+#include <momcache.h>
+#include <crypto/common.h>
+
+#include <array>
+#include <unordered_map>
 
 #define SATOSHIDEN ((uint64_t)100000000L)
 #define dstr(x) ((double)(x) / SATOSHIDEN)
@@ -75,83 +82,6 @@ typedef union _bits256 bits256;
 
 struct sha256_vstate { uint64_t length; uint32_t state[8],curlen; uint8_t buf[64]; };
 struct rmd160_vstate { uint64_t length; uint8_t buf[64]; uint32_t curlen, state[5]; };
-int32_t KOMODO_TXINDEX = 1;
-
-int32_t gettxout_scriptPubKey(int32_t height,uint8_t *scriptPubKey,int32_t maxsize,uint256 txid,int32_t n)
-{
-    static uint256 zero; int32_t i,m; uint8_t *ptr; CTransaction tx; uint256 hashBlock;
-
-    LOCK(cs_main);
-
-    if ( KOMODO_TXINDEX != 0 )
-    {
-        if ( GetTransaction(txid,tx,Params().GetConsensus(),hashBlock,false) == 0 )
-        {
-            //fprintf(stderr,"ht.%d couldnt get txid.%s\n",height,txid.GetHex().c_str());
-            return(-1);
-        }
-    }
-    else
-    {
-        CWallet * const pwallet = pwalletMain;
-        if ( pwallet != 0 )
-        {
-            //fprintf(stderr,"Size of tx in wallet: %d\n", pwallet->mapWallet.size());
-            auto it = pwallet->mapWallet.find(txid);
-            if ( it != pwallet->mapWallet.end() )
-            {
-                //fprintf(stderr,"try to found tx in wallet\n");
-                const CWalletTx& wtx = it->second;
-                tx = wtx;
-                //fprintf(stderr,"found tx in wallet\n");
-            }
-        }
-    }
-    
-    if ( !tx.IsNull() && n >= 0 && n <= (int32_t)tx.vout.size() ) // vout.size() seems off by 1
-    {
-        ptr = (uint8_t *)&tx.vout[n].scriptPubKey[0];
-        m = tx.vout[n].scriptPubKey.size();
-        for (i=0; i<maxsize&&i<m; i++)
-            scriptPubKey[i] = ptr[i];
-        //fprintf(stderr,"got scriptPubKey[%d] via rawtransaction ht.%d %s\n",m,height,txid.GetHex().c_str());
-        return(i);
-    }
-    else if ( !tx.IsNull() )
-        fprintf(stderr,"gettxout_scriptPubKey ht.%d n.%d > voutsize.%d\n",height,n,(int32_t)tx.vout.size());
-    return(-1);
-}
-
-void ImportAddress(const CBitcoinAddress& address, const std::string& strLabel);
-
-int32_t komodo_importaddress(std::string addr)
-{
-    CBitcoinAddress address(addr);
-    CWallet * const pwallet = pwalletMain;
-    if ( pwallet != 0 )
-    {
-        LOCK2(cs_main, pwallet->cs_wallet);
-        if ( address.IsValid() != 0 )
-        {
-            isminetype mine = IsMine(*pwallet, address.Get());
-            if ( (mine & ISMINE_SPENDABLE) != 0 || (mine & ISMINE_WATCH_ONLY) != 0 )
-            {
-                //printf("komodo_importaddress %s already there\n",EncodeDestination(address).c_str());
-                return(0);
-            }
-            else
-            {
-                //printf("komodo_importaddress %s\n",addr.c_str());
-                ImportAddress(address, addr);
-                return(1);
-            }
-        }
-        LogPrint("dpow","%s -> komodo_importaddress failed valid.%d\n",addr.c_str(),address.IsValid());
-    }
-    return(-1);
-}
-
-
 // following is ported from libtom
 /* LibTomCrypt, modular cryptographic library -- Tom St Denis
  *
@@ -592,15 +522,16 @@ uint32_t komodo_heightstamp(int32_t height)
     return(0);
 }
 
+// record layout of the notarizations flat file that preceded notarizationindex
 struct notarized_checkpoint
 {
     uint256 notarized_hash,notarized_desttxid,MoM,MoMoM;
     int32_t nHeight,notarized_height,MoMdepth,MoMoMdepth,MoMoMoffset,kmdstarti,kmdendi;
-} *NPOINTS;
+};
 std::string NOTARY_PUBKEY;
 uint8_t NOTARY_PUBKEY33[33];
 uint256 NOTARIZED_HASH,NOTARIZED_DESTTXID,NOTARIZED_MOM;
-int32_t NUM_NPOINTS,last_NPOINTSi,NOTARIZED_HEIGHT,NOTARIZED_MOMDEPTH,KOMODO_NEEDPUBKEYS;
+int32_t NOTARIZED_HEIGHT,NOTARIZED_MOMDEPTH;
 portable_mutex_t komodo_mutex;
 
 bool Getscriptaddress(char *destaddr,const CScript &scriptPubKey)
@@ -624,28 +555,6 @@ bool pubkey2addr(char *destaddr,uint8_t *pubkey33)
     return(Getscriptaddress(destaddr,CScript() << pk << OP_CHECKSIG));
 }
 
-void komodo_importpubkeys()
-{
-    int32_t i,n,val,dispflag = 0; std::string addr;
-    for (n = 0; n < NUM_KMD_SEASONS; n++)
-    {
-        for (i=0; i<NUM_KMD_NOTARIES; i++)
-        {
-            uint8_t pubkey[33]; char address[64];
-            decode_hex(pubkey,33,(char *)notaries_elected[n][i][1]);
-            pubkey2addr((char *)address,(uint8_t *)pubkey);
-            addr.clear();
-            addr.append(address);
-            if ( (val= komodo_importaddress(addr)) < 0 )
-                fprintf(stderr,"error importing (%s)\n",addr.c_str());
-            else if ( val != 0 )
-                dispflag++;
-        }
-    }
-    if ( dispflag != 0 )
-        fprintf(stderr,"%d Notary pubkeys imported\n",dispflag);
-}
-
 int32_t getkmdseason(int32_t height)
 {
     if ( height <= KMD_SEASON_HEIGHTS[0] )
@@ -662,12 +571,6 @@ int32_t komodo_init()
 {
     NOTARY_PUBKEY = GetArg("-pubkey", "");
     decode_hex(NOTARY_PUBKEY33,33,(char *)NOTARY_PUBKEY.c_str());
-    if ( GetBoolArg("-txindex", DEFAULT_TXINDEX) == 0 )
-    {
-        fprintf(stderr,"txindex is off, import notary pubkeys\n");
-        KOMODO_NEEDPUBKEYS = 1;
-        KOMODO_TXINDEX = 0;
-    }
     return(0);
 }
 
@@ -699,6 +602,8 @@ uint256 komodo_calcMoM(int32_t height,int32_t MoMdepth)
     static uint256 zero; bits256 MoM,*tree; CBlockIndex *pindex; int32_t i;
     if ( MoMdepth >= height )
         return(zero);
+    if ( (pindex= komodo_chainactive(height)) != 0 && momcache.GetMoM(pindex,MoMdepth,*(uint256 *)&MoM) != 0 )
+        return(*(uint256 *)&MoM);
     tree = (bits256 *)calloc(MoMdepth * 3,sizeof(*tree));
     for (i=0; i<MoMdepth; i++)
     {
@@ -715,68 +620,80 @@ uint256 komodo_calcMoM(int32_t height,int32_t MoMdepth)
     return(*(uint256 *)&MoM);
 }
 
-int32_t komodo_notaries(uint8_t pubkeys[64][33],int32_t height,uint32_t timestamp)
+struct komodo_notarykeyhasher
 {
-    int32_t i, kmd_season;
-    static uint8_t kmd_pubkeys[NUM_KMD_SEASONS][64][33],didinit[NUM_KMD_SEASONS];
-    if ( (kmd_season= getkmdseason(height)) != 0 )
-    {
-        if ( didinit[kmd_season-1] == 0 )
+    // pubkeys are random past their first byte
+    size_t operator()(const std::array<uint8_t,33> &pubkey) const { return(ReadLE64(&pubkey[1])); }
+};
+typedef std::unordered_map<std::array<uint8_t,33>,int32_t,komodo_notarykeyhasher> komodo_notarykeys_t;
+
+std::vector<komodo_notarykeys_t> komodo_decodenotarykeys()
+{
+    std::vector<komodo_notarykeys_t> seasons(NUM_KMD_SEASONS); std::array<uint8_t,33> pubkey; int32_t i,kmd_season;
+    for (kmd_season=0; kmd_season<NUM_KMD_SEASONS; kmd_season++)
+        for (i=0; i<NUM_KMD_NOTARIES; i++)
         {
-            for (i=0; i<NUM_KMD_NOTARIES; i++) 
-                decode_hex(kmd_pubkeys[kmd_season-1][i],33,(char *)notaries_elected[kmd_season-1][i][1]);
-            didinit[kmd_season-1] = 1;
+            decode_hex(pubkey.data(),33,(char *)notaries_elected[kmd_season][i][1]);
+            seasons[kmd_season][pubkey] = i;
         }
-        memcpy(pubkeys,kmd_pubkeys[kmd_season-1],NUM_KMD_NOTARIES * 33);
-        return(NUM_KMD_NOTARIES);
-    }
-    return(-1);
+    return(seasons);
 }
 
-void komodo_clearstate()
+// notary pubkey -> notary index for the season of height, decoded once
+const komodo_notarykeys_t *komodo_notarykeys(int32_t height)
 {
-    portable_mutex_lock(&komodo_mutex);
-    memset(&NOTARIZED_HEIGHT,0,sizeof(NOTARIZED_HEIGHT));
-    memset(&NOTARIZED_HASH,0,sizeof(NOTARIZED_HASH));
-    memset(&NOTARIZED_DESTTXID,0,sizeof(NOTARIZED_DESTTXID));
-    memset(&NOTARIZED_MOM,0,sizeof(NOTARIZED_MOM));
-    memset(&NOTARIZED_MOMDEPTH,0,sizeof(NOTARIZED_MOMDEPTH));
-    memset(&last_NPOINTSi,0,sizeof(last_NPOINTSi));
-    portable_mutex_unlock(&komodo_mutex);
+    static const std::vector<komodo_notarykeys_t> seasons = komodo_decodenotarykeys();
+    int32_t kmd_season;
+    if ( (kmd_season= getkmdseason(height)) != 0 )
+        return(&seasons[kmd_season-1]);
+    return(0);
 }
 
-void komodo_disconnect(CBlockIndex *pindex,CBlock *block)
+// derive the active notarization from notarizationindex, which holds the
+// notarizations carried by the active chain and nothing above it
+void komodo_setstate()
 {
-    if ( (int32_t)pindex->nHeight <= NOTARIZED_HEIGHT )
+    CNotarizedCheckpoint last,lastMoM;
+    portable_mutex_lock(&komodo_mutex);
+    if ( notarizationindex.GetLast(last) )
     {
-        fprintf(stderr,"komodo_disconnect unexpected reorg pindex->nHeight.%d vs %d\n",(int32_t)pindex->nHeight,NOTARIZED_HEIGHT);
-        komodo_clearstate(); // bruteforce shortcut. on any reorg, no active notarization until next one is seen
+        NOTARIZED_HEIGHT = last.nNotarizedHeight;
+        NOTARIZED_HASH = last.hashNotarized;
+        NOTARIZED_DESTTXID = last.hashDestTx;
     }
+    else
+    {
+        NOTARIZED_HEIGHT = 0;
+        memset(&NOTARIZED_HASH,0,sizeof(NOTARIZED_HASH));
+        memset(&NOTARIZED_DESTTXID,0,sizeof(NOTARIZED_DESTTXID));
+    }
+    // a notarization without MoM keeps the one before it
+    if ( notarizationindex.GetLastMoM(lastMoM) )
+    {
+        NOTARIZED_MOM = lastMoM.MoM;
+        NOTARIZED_MOMDEPTH = lastMoM.nMoMDepth;
+    }
+    else
+    {
+        memset(&NOTARIZED_MOM,0,sizeof(NOTARIZED_MOM));
+        NOTARIZED_MOMDEPTH = 0;
+    }
+    portable_mutex_unlock(&komodo_mutex);
 }
 
-struct notarized_checkpoint *komodo_npptr(int32_t height)
+// roll back the notarizations carried by the block leaving the active chain
+void komodo_disconnect(const CBlockIndex *pindex)
 {
-    int32_t i; struct notarized_checkpoint *np = 0;
-    for (i=NUM_NPOINTS-1; i>=0; i--)
-    {
-        np = &NPOINTS[i];
-        if ( np->MoMdepth > 0 && height > np->notarized_height-np->MoMdepth && height <= np->notarized_height )
-            return(np);
-    }
-    return(0);
+    if ( (int32_t)pindex->nHeight <= NOTARIZED_HEIGHT )
+        fprintf(stderr,"komodo_disconnect unexpected reorg pindex->nHeight.%d vs %d\n",(int32_t)pindex->nHeight,NOTARIZED_HEIGHT);
+    if ( !notarizationindex.EraseFrom(pindex->nHeight) )
+        fprintf(stderr,"komodo_disconnect error erasing notarizations ht.%d\n",(int32_t)pindex->nHeight);
+    komodo_setstate();
 }
 
 int32_t komodo_prevMoMheight()
 {
-    static uint256 zero;
-    int32_t i; struct notarized_checkpoint *np = 0;
-    for (i=NUM_NPOINTS-1; i>=0; i--)
-    {
-        np = &NPOINTS[i];
-        if ( np->MoM != zero )
-            return(np->notarized_height);
-    }
-    return(0);
+    return(notarizationindex.PrevMoMHeight());
 }
 
 //struct komodo_state *komodo_stateptr(char *symbol,char *dest);
@@ -790,18 +707,18 @@ int32_t komodo_notarized_height(int32_t *prevMoMheightp,uint256 *hashp,uint256 *
 
 int32_t komodo_MoMdata(int32_t *notarized_htp,uint256 *MoMp,uint256 *kmdtxidp,int32_t height,uint256 *MoMoMp,int32_t *MoMoMoffsetp,int32_t *MoMoMdepthp,int32_t *kmdstartip,int32_t *kmdendip)
 {
-    struct notarized_checkpoint *np = 0;
-    if ( (np= komodo_npptr(height)) != 0 )
+    CNotarizedCheckpoint np;
+    if ( notarizationindex.FindMoM(height,np) )
     {
-        *notarized_htp = np->notarized_height;
-        *MoMp = np->MoM;
-        *kmdtxidp = np->notarized_desttxid;
-        *MoMoMp = np->MoMoM;
-        *MoMoMoffsetp = np->MoMoMoffset;
-        *MoMoMdepthp = np->MoMoMdepth;
-        *kmdstartip = np->kmdstarti;
-        *kmdendip = np->kmdendi;
-        return(np->MoMdepth);
+        *notarized_htp = np.nNotarizedHeight;
+        *MoMp = np.MoM;
+        *kmdtxidp = np.hashDestTx;
+        *MoMoMp = np.MoMoM;
+        *MoMoMoffsetp = np.nMoMoMOffset;
+        *MoMoMdepthp = np.nMoMoMDepth;
+        *kmdstartip = np.nKmdStartI;
+        *kmdendip = np.nKmdEndI;
+        return(np.nMoMDepth);
     }
     *notarized_htp = *MoMoMoffsetp = *MoMoMdepthp = *kmdstartip = *kmdendip = 0;
     memset(MoMp,0,sizeof(*MoMp));
@@ -812,147 +729,118 @@ int32_t komodo_MoMdata(int32_t *notarized_htp,uint256 *MoMp,uint256 *kmdtxidp,in
 
 int32_t komodo_notarizeddata(int32_t nHeight,uint256 *notarized_hashp,uint256 *notarized_desttxidp)
 {
-    struct notarized_checkpoint *np = 0; int32_t i=0,flag = 0;
-    if ( NUM_NPOINTS > 0 )
+    CNotarizedCheckpoint np;
+    if ( notarizationindex.FindBefore(nHeight,np) )
     {
-        flag = 0;
-        if ( last_NPOINTSi < NUM_NPOINTS && last_NPOINTSi > 0 )
-        {
-            np = &NPOINTS[last_NPOINTSi-1];
-            if ( np->nHeight < nHeight )
-            {
-                for (i=last_NPOINTSi; i<NUM_NPOINTS; i++)
-                {
-                    if ( NPOINTS[i].nHeight >= nHeight )
-                    {
-                        //printf("flag.1 i.%d np->ht %d [%d].ht %d >= nHeight.%d, last.%d num.%d\n",i,np->nHeight,i,NPOINTS[i].nHeight,nHeight,last_NPOINTSi,NUM_NPOINTS);
-                        flag = 1;
-                        break;
-                    }
-                    np = &NPOINTS[i];
-                    last_NPOINTSi = i;
-                }
-            }
-        }
-        if ( flag == 0 )
-        {
-            np = 0;
-            for (i=0; i<NUM_NPOINTS; i++)
-            {
-                if ( NPOINTS[i].nHeight >= nHeight )
-                {
-                    //printf("i.%d np->ht %d [%d].ht %d >= nHeight.%d\n",i,np->nHeight,i,NPOINTS[i].nHeight,nHeight);
-                    break;
-                }
-                np = &NPOINTS[i];
-                last_NPOINTSi = i;
-            }
-        }
-    }
-    if ( np != 0 )
-    {
-        if ( np->nHeight >= nHeight || (i < NUM_NPOINTS && np[1].nHeight < nHeight) )
-            fprintf(stderr,"warning: flag.%d i.%d np->ht %d [1].ht %d >= nHeight.%d\n",flag,i,np->nHeight,np[1].nHeight,nHeight);
-        *notarized_hashp = np->notarized_hash;
-        *notarized_desttxidp = np->notarized_desttxid;
-        return(np->notarized_height);
+        *notarized_hashp = np.hashNotarized;
+        *notarized_desttxidp = np.hashDestTx;
+        return(np.nNotarizedHeight);
     }
     memset(notarized_hashp,0,sizeof(*notarized_hashp));
     memset(notarized_desttxidp,0,sizeof(*notarized_desttxidp));
     return(0);
 }
 
-void komodo_notarized_update(int32_t nHeight,int32_t notarized_height,uint256 notarized_hash,uint256 notarized_desttxid,uint256 MoM,int32_t MoMdepth)
+// import the notarizations flat file once into notarizationindex
+void komodo_importnotarizations()
 {
-    static int didinit; static uint256 zero; static FILE *fp; CBlockIndex *pindex; struct notarized_checkpoint *np,N; long fpos;
-    if ( didinit == 0 )
-    {
-        char fname[512];int32_t latestht = 0;
-        //decode_hex(NOTARY_PUBKEY33,33,(char *)NOTARY_PUBKEY.c_str());
-        pthread_mutex_init(&komodo_mutex,NULL);
+    char fname[512]; FILE *fp; struct notarized_checkpoint N; CNotarizedCheckpoint np; int32_t latestht = 0,n = 0;
+    if ( notarizationindex.ReadFlag("flatfileimported") )
+        return;
 #ifdef _WIN32
-        sprintf(fname,"%s\\notarizations",GetDataDir().string().c_str());
+    sprintf(fname,"%s\\notarizations",GetDataDir().string().c_str());
 #else
-        sprintf(fname,"%s/notarizations",GetDataDir().string().c_str());
+    sprintf(fname,"%s/notarizations",GetDataDir().string().c_str());
 #endif
-        printf("fname.(%s)\n",fname);
-        if ( (fp= fopen(fname,"rb+")) == 0 )
-            fp = fopen(fname,"wb+");
-        else
+    if ( (fp= fopen(fname,"rb")) != 0 )
+    {
+        while ( fread(&N,1,sizeof(N),fp) == sizeof(N) )
         {
-            fpos = 0;
-            while ( fread(&N,1,sizeof(N),fp) == sizeof(N) )
+            if ( N.notarized_height > latestht )
             {
-                //pindex = komodo_chainactive(N.notarized_height);
-                //if ( pindex != 0 && pindex->GetBlockHash() == N.notarized_hash && N.notarized_height > latestht )
-                if ( N.notarized_height > latestht )
-                {
-                    NPOINTS = (struct notarized_checkpoint *)realloc(NPOINTS,(NUM_NPOINTS+1) * sizeof(*NPOINTS));
-                    np = &NPOINTS[NUM_NPOINTS++];
-                    *np = N;
-                    latestht = np->notarized_height;
-                    NOTARIZED_HEIGHT = np->notarized_height;
-                    NOTARIZED_HASH = np->notarized_hash;
-                    NOTARIZED_DESTTXID = np->notarized_desttxid;
-                    NOTARIZED_MOM = np->MoM;
-                    NOTARIZED_MOMDEPTH = np->MoMdepth;
-                    fprintf(stderr,"%d ",np->notarized_height);
-                    fpos = ftell(fp);
-                } //else fprintf(stderr,"%s error with notarization ht.%d %s\n",ASSETCHAINS_SYMBOL,N.notarized_height,pindex->GetBlockHash().ToString().c_str());
+                np.nHeight = N.nHeight;
+                np.nNotarizedHeight = N.notarized_height;
+                np.hashNotarized = N.notarized_hash;
+                np.hashDestTx = N.notarized_desttxid;
+                np.MoM = N.MoM;
+                np.nMoMDepth = N.MoMdepth;
+                np.MoMoM = N.MoMoM;
+                np.nMoMoMDepth = N.MoMoMdepth;
+                np.nMoMoMOffset = N.MoMoMoffset;
+                np.nKmdStartI = N.kmdstarti;
+                np.nKmdEndI = N.kmdendi;
+                notarizationindex.Add(np);
+                latestht = N.notarized_height;
+                n++;
             }
-            if ( ftell(fp) !=  fpos )
-                fseek(fp,fpos,SEEK_SET);
         }
-        fprintf(stderr,"finished loading %s [%s]\n",fname,NOTARY_PUBKEY.c_str());
-        didinit = 1;
+        fclose(fp);
+        LogPrintf("imported %d notarizations from %s\n",n,fname);
     }
-    if ( notarized_height == 0 )
-        return;
+    notarizationindex.WriteFlag("flatfileimported");
+}
+
+// pindex is the block carrying the notarization, being connected to the active chain
+void komodo_notarized_update(const CBlockIndex *pindex,int32_t notarized_height,uint256 notarized_hash,uint256 notarized_desttxid,uint256 MoM,int32_t MoMdepth)
+{
+    static uint256 zero; const CBlockIndex *notarized; CNotarizedCheckpoint np; int32_t nHeight = pindex->nHeight;
     if ( notarized_height >= nHeight )
     {
         fprintf(stderr,"komodo_notarized_update REJECT notarized_height %d > %d nHeight\n",notarized_height,nHeight);
         return;
     }
-    pindex = komodo_chainactive(notarized_height);
-    if ( pindex == 0 || pindex->GetBlockHash() != notarized_hash || notarized_height != pindex->nHeight )
+    // the processor runs without cs_main, so check against the ancestors of pindex rather than chainActive
+    notarized = pindex->GetAncestor(notarized_height);
+    if ( notarized == 0 || notarized->GetBlockHash() != notarized_hash )
     {
-        fprintf(stderr,"komodo_notarized_update reject nHeight.%d notarized_height.%d:%d\n",nHeight,notarized_height,(int32_t)pindex->nHeight);
+        fprintf(stderr,"komodo_notarized_update reject nHeight.%d notarized_height.%d:%d\n",nHeight,notarized_height,notarized != 0 ? (int32_t)notarized->nHeight : -1);
         return;
     }
-    //fprintf(stderr,"komodo_notarized_update nHeight.%d notarized_height.%d prev.%d\n",nHeight,notarized_height,NPOINTS!=0?NPOINTS[NUM_NPOINTS-1].notarized_height:-1);
     portable_mutex_lock(&komodo_mutex);
-    NPOINTS = (struct notarized_checkpoint *)realloc(NPOINTS,(NUM_NPOINTS+1) * sizeof(*NPOINTS));
-    np = &NPOINTS[NUM_NPOINTS++];
-    memset(np,0,sizeof(*np));
-    np->nHeight = nHeight;
-    NOTARIZED_HEIGHT = np->notarized_height = notarized_height;
-    NOTARIZED_HASH = np->notarized_hash = notarized_hash;
-    NOTARIZED_DESTTXID = np->notarized_desttxid = notarized_desttxid;
+    np.nHeight = nHeight;
+    NOTARIZED_HEIGHT = np.nNotarizedHeight = notarized_height;
+    NOTARIZED_HASH = np.hashNotarized = notarized_hash;
+    NOTARIZED_DESTTXID = np.hashDestTx = notarized_desttxid;
     if ( MoM != zero && MoMdepth > 0 )
     {
-        NOTARIZED_MOM = np->MoM = MoM;
-        NOTARIZED_MOMDEPTH = np->MoMdepth = MoMdepth;
+        NOTARIZED_MOM = np.MoM = MoM;
+        NOTARIZED_MOMDEPTH = np.nMoMDepth = MoMdepth;
     }
-    if ( fp != 0 )
+    if ( !notarizationindex.Add(np) )
+        fprintf(stderr,"error storing notarization ht.%d\n",nHeight);
+    portable_mutex_unlock(&komodo_mutex);
+}
+
+// the last notarization carried below nHeight by a block of the active chain,
+// as published by notarizationprocessor, which may trail the tip
+int32_t komodo_snapshotnotarized(int32_t nHeight,uint256 *notarized_hashp)
+{
+    std::shared_ptr<const CNotarizationSnapshot> snapshot; const CBlockIndex *pfork; int32_t i;
+    memset(notarized_hashp,0,sizeof(*notarized_hashp));
+    snapshot = notarizationprocessor.GetSnapshot();
+    if ( snapshot == 0 || snapshot->pindex == 0 || (pfork= chainActive.FindFork(snapshot->pindex)) == 0 )
+        return(0);
+    // notarizations from blocks whose disconnection is still queued do not count
+    for (i=(int32_t)snapshot->vCheckpoints.size()-1; i>=0; i--)
     {
-        if ( fwrite(np,1,sizeof(*np),fp) == sizeof(*np) )
-            fflush(fp);
-        else printf("error writing notarization to %d\n",(int32_t)ftell(fp));
+        const CNotarizedCheckpoint &np = snapshot->vCheckpoints[i];
+        if ( np.nHeight < nHeight && np.nHeight <= pfork->nHeight )
+        {
+            *notarized_hashp = np.hashNotarized;
+            return(np.nNotarizedHeight);
+        }
     }
-    // add to stored notarizations
-    portable_mutex_unlock(&komodo_mutex);
+    return(0);
 }
 
 int32_t komodo_checkpoint(int32_t *notarized_heightp,int32_t nHeight,uint256 hash)
 {
-    int32_t notarized_height; uint256 zero,notarized_hash,notarized_desttxid; CBlockIndex *notary; CBlockIndex *pindex;
-    memset(&zero,0,sizeof(zero));
-    //komodo_notarized_update(0,0,zero,zero,zero,0);
+    int32_t notarized_height; uint256 notarized_hash; CBlockIndex *notary; CBlockIndex *pindex; BlockMap::iterator mi;
     if ( (pindex= chainActive.Tip()) == 0 )
         return(-1);
-    notarized_height = komodo_notarizeddata(pindex->nHeight,&notarized_hash,&notarized_desttxid);
+    notarized_height = komodo_snapshotnotarized(pindex->nHeight,&notarized_hash);
     *notarized_heightp = notarized_height;
-    if ( notarized_height >= 0 && notarized_height <= pindex->nHeight && (notary= mapBlockIndex[notarized_hash]) != 0 )
+    if ( notarized_height >= 0 && notarized_height <= pindex->nHeight && (mi= mapBlockIndex.find(notarized_hash)) != mapBlockIndex.end() && (notary= mi->second) != 0 )
     {
         //printf("nHeight.%d -> (%d %s)\n",pindex->nHeight,notarized_height,notarized_hash.ToString().c_str());
         if ( notary->nHeight == notarized_height ) // if notarized_hash not in chain, reorg
@@ -973,17 +861,12 @@ int32_t komodo_checkpoint(int32_t *notarized_heightp,int32_t nHeight,uint256 has
     return(0);
 }
 
-void komodo_voutupdate(int32_t txi,int32_t vout,uint8_t *scriptbuf,int32_t scriptlen,int32_t height,int32_t *specialtxp,int32_t *notarizedheightp,uint64_t value,int32_t notarized,uint64_t signedmask)
+// scriptbuf is the OP_RETURN second output of a transaction in the block pindex
+void komodo_voutupdate(const CBlockIndex *pindex,uint8_t *scriptbuf,int32_t scriptlen,int32_t *notarizedheightp,int32_t notarized)
 {
-    static uint256 zero; static uint8_t crypto777[33];
-    int32_t MoMdepth,opretlen,len = 0; uint256 hash,desttxid,MoM;
-    if ( scriptlen == 35 && scriptbuf[0] == 33 && scriptbuf[34] == 0xac )
-    {
-        if ( crypto777[0] != 0x02 )// && crypto777[0] != 0x03 )
-            decode_hex(crypto777,33,(char *)CRYPTO777_PUBSECPSTR);
-        if ( memcmp(crypto777,scriptbuf+1,33) == 0 )
-            *specialtxp = 1;
-    }
+    static uint256 zero;
+    int32_t MoMdepth,opretlen,height,len = 0; uint256 hash,desttxid,MoM;
+    height = pindex->nHeight;
     if ( scriptbuf[len++] == 0x6a )
     {
         if ( (opretlen= scriptbuf[len++]) == 0x4c )
@@ -993,8 +876,8 @@ void komodo_voutupdate(int32_t txi,int32_t vout,uint8_t *scriptbuf,int32_t scrip
             opretlen = scriptbuf[len++];
             opretlen += (scriptbuf[len++] << 8);
         }
-        //printf("opretlen.%d vout.%d [%s].(%s)\n",opretlen,vout,(char *)&scriptbuf[len+32*2+4],ASSETCHAINS_SYMBOL);
-        if ( vout == 1 && opretlen-3 >= 32*2+4 && strcmp(ASSETCHAINS_SYMBOL,(char *)&scriptbuf[len+32*2+4]) == 0 )
+        //printf("opretlen.%d [%s].(%s)\n",opretlen,(char *)&scriptbuf[len+32*2+4],ASSETCHAINS_SYMBOL);
+        if ( opretlen-3 >= 32*2+4 && strcmp(ASSETCHAINS_SYMBOL,(char *)&scriptbuf[len+32*2+4]) == 0 )
         {
             len += iguana_rwbignum(0,&scriptbuf[len],32,(uint8_t *)&hash);
             len += iguana_rwnum(0,&scriptbuf[len],sizeof(*notarizedheightp),(uint8_t *)notarizedheightp);
@@ -1002,9 +885,6 @@ void komodo_voutupdate(int32_t txi,int32_t vout,uint8_t *scriptbuf,int32_t scrip
             if ( notarized != 0 && *notarizedheightp > NOTARIZED_HEIGHT && *notarizedheightp < height )
             {
                 int32_t nameoffset = (int32_t)strlen(ASSETCHAINS_SYMBOL) + 1;
-                //NOTARIZED_HEIGHT = *notarizedheightp;
-                //NOTARIZED_HASH = hash;
-                //NOTARIZED_DESTTXID = desttxid;
                 memset(&MoM,0,sizeof(MoM));
                 MoMdepth = 0;
                 len += nameoffset;
@@ -1017,30 +897,21 @@ void komodo_voutupdate(int32_t txi,int32_t vout,uint8_t *scriptbuf,int32_t scrip
                         memset(&MoM,0,sizeof(MoM));
                         MoMdepth = 0;
                     }
-                    else
-                    {
-                        //fprintf(stderr,"VALID %s MoM.%s [%d]\n",ASSETCHAINS_SYMBOL,MoM.ToString().c_str(),MoMdepth);
-                    }
                 }
-                komodo_notarized_update(height,*notarizedheightp,hash,desttxid,MoM,MoMdepth);
+                komodo_notarized_update(pindex,*notarizedheightp,hash,desttxid,MoM,MoMdepth);
                 fprintf(stderr,"%s ht.%d NOTARIZED.%d %s %sTXID.%s lens.(%d %d)\n",ASSETCHAINS_SYMBOL,height,*notarizedheightp,hash.ToString().c_str(),"KMD",desttxid.ToString().c_str(),opretlen,len);
             } //else fprintf(stderr,"notarized.%d ht %d vs prev %d vs height.%d\n",notarized,*notarizedheightp,NOTARIZED_HEIGHT,height);
         }
     }
 }
 
-void komodo_connectblock(CBlockIndex *pindex,CBlock& block)
+// candidates are the transactions of the block pindex that may carry a notarization,
+// see GetNotarizationCandidates; runs on the notarizationprocessor thread
+void komodo_connectcandidates(const CBlockIndex *pindex,const std::vector<CNotarizationCandidate>& candidates)
 {
     static int32_t hwmheight;
-    uint64_t signedmask; uint8_t scriptbuf[4096],pubkeys[64][33],scriptPubKey[35]; uint256 zero; int32_t i,j,k,numnotaries,notarized,scriptlen,numvalid,specialtx,notarizedheight,len,numvouts,numvins,height,txn_count;
-    if ( KOMODO_NEEDPUBKEYS != 0 )
-    {
-        komodo_importpubkeys();
-        KOMODO_NEEDPUBKEYS = 0;
-    }
-    memset(&zero,0,sizeof(zero));
-    komodo_notarized_update(0,0,zero,zero,zero,0);
-    numnotaries = komodo_notaries(pubkeys,pindex->nHeight,pindex->GetBlockTime());
+    const komodo_notarykeys_t *notarykeys; komodo_notarykeys_t::const_iterator it; std::array<uint8_t,33> pubkey;
+    uint64_t signedmask; uint8_t scriptbuf[4096]; int32_t i,j,notarizedheight,len;
     if ( pindex->nHeight > hwmheight )
         hwmheight = pindex->nHeight;
     else
@@ -1048,54 +919,61 @@ void komodo_connectblock(CBlockIndex *pindex,CBlock& block)
         if ( pindex->nHeight != hwmheight )
             printf("%s hwmheight.%d vs pindex->nHeight.%d t.%u reorg.%d\n",ASSETCHAINS_SYMBOL,hwmheight,pindex->nHeight,(uint32_t)pindex->nTime,hwmheight-pindex->nHeight);
     }
-    if ( pindex != 0 )
+    if ( (notarykeys= komodo_notarykeys(pindex->nHeight)) == 0 )
+        return;
+    for (i=0; i<(int32_t)candidates.size(); i++)
     {
-        height = pindex->nHeight;
-        txn_count = block.vtx.size();
-        for (i=0; i<txn_count; i++)
+        const CNotarizationCandidate &candidate = candidates[i];
+        signedmask = 0;
+        for (j=0; j<(int32_t)candidate.vSpent.size(); j++)
         {
-            //txhash = block.vtx[i].GetHash();
-            numvouts = block.vtx[i].vout.size();
-            specialtx = notarizedheight = notarized = 0;
-            signedmask = 0;
-            numvins = block.vtx[i].vin.size();
-            for (j=0; j<numvins; j++)
+            const CScript &scriptPubKey = candidate.vSpent[j];
+            if ( scriptPubKey.size() >= 35 )
             {
-                if ( i == 0 && j == 0 )
-                    continue;
-                if ( block.vtx[i].vin[j].prevout.hash != zero && (scriptlen= gettxout_scriptPubKey(height,scriptPubKey,sizeof(scriptPubKey),block.vtx[i].vin[j].prevout.hash,block.vtx[i].vin[j].prevout.n)) == 35 )
-                {
-                    for (k=0; k<numnotaries; k++)
-                        if ( memcmp(&scriptPubKey[1],pubkeys[k],33) == 0 )
-                        {
-                            signedmask |= (1LL << k);
-                            break;
-                        }
-                }  /*else if ( block.vtx[i].vin[j].prevout.hash != zero ) {
-                    printf("%s cant get scriptPubKey for ht.%d txi.%d vin.%d\n",ASSETCHAINS_SYMBOL,height,i,j);
-                }*/
+                memcpy(pubkey.data(),&scriptPubKey[1],33);
+                if ( (it= notarykeys->find(pubkey)) != notarykeys->end() )
+                    signedmask |= (1LL << it->second);
             }
-            numvalid = bitweight(signedmask);
-            if ( numvalid >= KOMODO_MINRATIFY )
-                notarized = 1;
-            //if ( NOTARY_PUBKEY33[0] != 0 )
-            //    printf("(tx.%d: ",i);
-            for (j=0; j<numvouts; j++)
-            {
-                //if ( NOTARY_PUBKEY33[0] != 0 )
-                //    printf("%.8f ",dstr(block.vtx[i]->vout[j].nValue));
-                len = block.vtx[i].vout[j].scriptPubKey.size();
-                if ( len >= (int32_t)sizeof(uint32_t) && len <= (int32_t)sizeof(scriptbuf) )
-                {
-                    memcpy(scriptbuf,&block.vtx[i].vout[j].scriptPubKey[0],len);
-                    komodo_voutupdate(i,j,scriptbuf,len,height,&specialtx,&notarizedheight,(uint64_t)block.vtx[i].vout[j].nValue,notarized,signedmask);
-                }
-            }
-            //if ( NOTARY_PUBKEY33[0] != 0 )
-            //    printf(") ");
-            //if ( NOTARY_PUBKEY33[0] != 0 )
-            //    printf("%s ht.%d\n",ASSETCHAINS_SYMBOL,height);
-            //printf("[%s] ht.%d txi.%d signedmask.%llx numvins.%d numvouts.%d notarized.%d special.%d\n",ASSETCHAINS_SYMBOL,height,i,(long long)signedmask,numvins,numvouts,notarized,specialtx);
         }
-    } else fprintf(stderr,"komodo_connectblock: unexpected null pindex\n");
+        if ( bitweight(signedmask) < KOMODO_MINRATIFY )
+            continue;
+        len = candidate.scriptOpReturn.size();
+        if ( len >= (int32_t)sizeof(uint32_t) && len <= (int32_t)sizeof(scriptbuf) )
+        {
+            memcpy(scriptbuf,&candidate.scriptOpReturn[0],len);
+            notarizedheight = 0;
+            komodo_voutupdate(pindex,scriptbuf,len,&notarizedheight,1);
+        }
+    }
+}
+
+namespace {
+bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock);
+}
+
+// called with cs_main held once the block index is loaded and before notarizationprocessor runs:
+// catch notarizationindex up with the active chain, which it may trail or lead after a restart
+void komodo_initnotarizations()
+{
+    const CBlockIndex *pfork = 0; CBlockIndex *pindex; BlockMap::iterator mi; CBlock block; CBlockUndo blockundo; int32_t n = 0;
+    pthread_mutex_init(&komodo_mutex,NULL);
+    komodo_importnotarizations();
+    if ( (mi= mapBlockIndex.find(notarizationindex.GetBestBlock())) != mapBlockIndex.end() )
+        pfork = chainActive.FindFork(mi->second);
+    else pfork = chainActive.Tip(); // written before it recorded its best block
+    notarizationindex.EraseFrom(pfork != 0 ? pfork->nHeight + 1 : 0);
+    for (pindex= (pfork != 0 ? chainActive.Next(pfork) : 0); pindex != 0; pindex= chainActive.Next(pindex))
+    {
+        if ( !ReadBlockFromDisk(block,pindex,Params().GetConsensus()) || !UndoReadFromDisk(blockundo,pindex->GetUndoPos(),pindex->pprev->GetBlockHash()) )
+        {
+            fprintf(stderr,"komodo_initnotarizations cant read block ht.%d\n",(int32_t)pindex->nHeight);
+            break;
+        }
+        komodo_connectcandidates(pindex,GetNotarizationCandidates(block,blockundo));
+        n++;
+    }
+    if ( n > 0 )
+        LogPrintf("processed notarizations of %d blocks\n",n);
+    komodo_setstate();
+    notarizationprocessor.Publish(chainActive.Tip());
 }
@@ -11,9 +11,12 @@
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
+#include "coinsprefetch.h"
+#include "coinstats.h"
 #include "consensus/consensus.h"
 #include "consensus/merkle.h"
 #include "consensus/validation.h"
+#include "crypto/scrypt.h"
 #include "hash.h"
 #include "init.h"
 #include "merkleblock.h"
@@ -27,6 +30,7 @@
 #include "script/script.h"
 #include "script/sigcache.h"
 #include "script/standard.h"
+#include "snapshot.h"
 #include "tinyformat.h"
 #include "txdb.h"
 #include "txmempool.h"
@@ -39,6 +43,8 @@
 #include "versionbits.h"
 
 #include <atomic>
+#include <limits>
+#include <memory>
 #include <sstream>
 
 #include <boost/algorithm/string/replace.hpp>
@@ -74,11 +80,13 @@ bool fImporting = false;
 bool fReindex = false;
 bool fTxIndex = false;
 bool fHavePruned = false;
+bool fSnapshotChainstate = false;
 bool fPruneMode = false;
 bool fIsBareMultisigStd = DEFAULT_PERMIT_BAREMULTISIG;
 bool fRequireStandard = true;
 bool fCheckBlockIndex = false;
 bool fCheckpointsEnabled = DEFAULT_CHECKPOINTS_ENABLED;
+uint256 hashAssumeValid;
 size_t nCoinCacheUsage = 5000 * 300;
 uint64_t nPruneTarget = 0;
 int64_t nMaxTipAge = DEFAULT_MAX_TIP_AGE;
@@ -702,7 +710,11 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
     return chain.Genesis();
 }
 
+CCoinsViewDB *pcoinsdbview = NULL;
+CCoinsViewPrefetch *pcoinsprefetch = NULL;
 CCoinsViewCache *pcoinsTip = NULL;
+/** Statistics of the UTXO set as of the best block of pcoinsTip, guarded by cs_main */
+static CRollingCoinsStats coinsStatsTip;
 CBlockTreeDB *pblocktree = NULL;
 
 //////////////////////////////////////////////////////////////////////////////
@@ -986,15 +998,15 @@ bool CheckSequenceLocks(const CTransaction &tx, int flags, LockPoints* lp, bool
         prevheights.resize(tx.vin.size());
         for (size_t txinIndex = 0; txinIndex < tx.vin.size(); txinIndex++) {
             const CTxIn& txin = tx.vin[txinIndex];
-            CCoins coins;
-            if (!viewMemPool.GetCoins(txin.prevout.hash, coins)) {
+            Coin coin;
+            if (!viewMemPool.GetCoin(txin.prevout, coin)) {
                 return error("%s: Missing input", __func__);
             }
-            if (coins.nHeight == MEMPOOL_HEIGHT) {
+            if (coin.nHeight == MEMPOOL_HEIGHT) {
                 // Assume all mempool transaction confirm in the next block
                 prevheights[txinIndex] = tip->nHeight + 1;
             } else {
-                prevheights[txinIndex] = coins.nHeight;
+                prevheights[txinIndex] = coin.nHeight;
             }
         }
         lockPair = CalculateSequenceLocks(tx, flags, &prevheights, index);
@@ -1050,7 +1062,9 @@ unsigned int GetP2SHSigOpCount(const CTransaction& tx, const CCoinsViewCache& in
     unsigned int nSigOps = 0;
     for (unsigned int i = 0; i < tx.vin.size(); i++)
     {
-        const CTxOut &prevout = inputs.GetOutputFor(tx.vin[i]);
+        const Coin& coin = inputs.AccessCoin(tx.vin[i].prevout);
+        assert(!coin.IsSpent());
+        const CTxOut &prevout = coin.out;
         if (prevout.scriptPubKey.IsPayToScriptHash())
             nSigOps += prevout.scriptPubKey.GetSigOpCount(tx.vin[i].scriptSig);
     }
@@ -1070,7 +1084,9 @@ int64_t GetTransactionSigOpCost(const CTransaction& tx, const CCoinsViewCache& i
 
     for (unsigned int i = 0; i < tx.vin.size(); i++)
     {
-        const CTxOut &prevout = inputs.GetOutputFor(tx.vin[i]);
+        const Coin& coin = inputs.AccessCoin(tx.vin[i].prevout);
+        assert(!coin.IsSpent());
+        const CTxOut &prevout = coin.out;
         nSigOps += CountWitnessSigOps(tx.vin[i].scriptSig, prevout.scriptPubKey, i < tx.wit.vtxinwit.size() ? &tx.wit.vtxinwit[i].scriptWitness : NULL, flags);
     }
     return nSigOps;
@@ -1133,9 +1149,9 @@ void LimitMempoolSize(CTxMemPool& pool, size_t limit, unsigned long age) {
     if (expired != 0)
         LogPrint("mempool", "Expired %i transactions from the memory pool\n", expired);
 
-    std::vector<uint256> vNoSpendsRemaining;
+    std::vector<COutPoint> vNoSpendsRemaining;
     pool.TrimToSize(limit, &vNoSpendsRemaining);
-    BOOST_FOREACH(const uint256& removed, vNoSpendsRemaining)
+    BOOST_FOREACH(const COutPoint& removed, vNoSpendsRemaining)
         pcoinsTip->Uncache(removed);
 }
 
@@ -1150,7 +1166,7 @@ std::string FormatStateMessage(const CValidationState &state)
 
 bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree,
                               bool* pfMissingInputs, bool fOverrideMempoolLimit, const CAmount& nAbsurdFee,
-                              std::vector<uint256>& vHashTxnToUncache)
+                              std::vector<COutPoint>& coins_to_uncache)
 {
     const uint256 hash = tx.GetHash();
     AssertLockHeld(cs_main);
@@ -1250,30 +1266,37 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
         view.SetBackend(viewMemPool);
 
         // do we already have it?
-        bool fHadTxInCache = pcoinsTip->HaveCoinsInCache(hash);
-        if (view.HaveCoins(hash)) {
-            if (!fHadTxInCache)
-                vHashTxnToUncache.push_back(hash);
-            return state.Invalid(false, REJECT_ALREADY_KNOWN, "txn-already-known");
+        for (size_t out = 0; out < tx.vout.size(); out++) {
+            COutPoint outpoint(hash, out);
+            bool had_coin_in_cache = pcoinsTip->HaveCoinInCache(outpoint);
+            if (view.HaveCoin(outpoint)) {
+                if (!had_coin_in_cache) {
+                    coins_to_uncache.push_back(outpoint);
+                }
+                return state.Invalid(false, REJECT_ALREADY_KNOWN, "txn-already-known");
+            }
         }
 
         // do all inputs exist?
-        // Note that this does not check for the presence of actual outputs (see the next check for that),
-        // and only helps with filling in pfMissingInputs (to determine missing vs spent).
         BOOST_FOREACH(const CTxIn txin, tx.vin) {
-            if (!pcoinsTip->HaveCoinsInCache(txin.prevout.hash))
-                vHashTxnToUncache.push_back(txin.prevout.hash);
-            if (!view.HaveCoins(txin.prevout.hash)) {
+            if (!pcoinsTip->HaveCoinInCache(txin.prevout)) {
+                coins_to_uncache.push_back(txin.prevout);
+            }
+            if (!view.HaveCoin(txin.prevout)) {
+                // Are inputs missing because we already have the tx?
+                for (size_t out = 0; out < tx.vout.size(); out++) {
+                    // Optimistically just do efficient check of cache for outputs
+                    if (pcoinsTip->HaveCoinInCache(COutPoint(hash, out))) {
+                        return state.Invalid(false, REJECT_ALREADY_KNOWN, "txn-already-known");
+                    }
+                }
+                // Otherwise assume this might be an orphan tx for which we just haven't seen parents yet
                 if (pfMissingInputs)
                     *pfMissingInputs = true;
                 return false; // fMissingInputs and !state.IsInvalid() is used to detect this condition, don't set state.Invalid()
             }
         }
 
-        // are the actual inputs available?
-        if (!view.HaveInputs(tx))
-            return state.Invalid(false, REJECT_DUPLICATE, "bad-txns-inputs-spent");
-
         // Bring the best block into scope
         view.GetBestBlock();
 
@@ -1315,8 +1338,8 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
         // during reorgs to ensure COINBASE_MATURITY is still met.
         bool fSpendsCoinbase = false;
         BOOST_FOREACH(const CTxIn &txin, tx.vin) {
-            const CCoins *coins = view.AccessCoins(txin.prevout.hash);
-            if (coins->IsCoinBase()) {
+            const Coin &coin = view.AccessCoin(txin.prevout);
+            if (coin.IsCoinBase()) {
                 fSpendsCoinbase = true;
                 break;
             }
@@ -1589,10 +1612,10 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
                         bool* pfMissingInputs, bool fOverrideMempoolLimit, const CAmount nAbsurdFee)
 {
-    std::vector<uint256> vHashTxToUncache;
-    bool res = AcceptToMemoryPoolWorker(pool, state, tx, fLimitFree, pfMissingInputs, fOverrideMempoolLimit, nAbsurdFee, vHashTxToUncache);
+    std::vector<COutPoint> coins_to_uncache;
+    bool res = AcceptToMemoryPoolWorker(pool, state, tx, fLimitFree, pfMissingInputs, fOverrideMempoolLimit, nAbsurdFee, coins_to_uncache);
     if (!res) {
-        BOOST_FOREACH(const uint256& hashTx, vHashTxToUncache)
+        BOOST_FOREACH(const COutPoint& hashTx, coins_to_uncache)
             pcoinsTip->Uncache(hashTx);
     }
     return res;
@@ -1634,15 +1657,9 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, const Consensus::P
     }
 
     if (fAllowSlow) { // use coin database to locate block that contains transaction, and scan it
-        int nHeight = -1;
-        {
-            const CCoinsViewCache& view = *pcoinsTip;
-            const CCoins* coins = view.AccessCoins(hash);
-            if (coins)
-                nHeight = coins->nHeight;
-        }
-        if (nHeight > 0)
-            pindexSlow = chainActive[nHeight];
+        const Coin& coin = AccessByTxid(*pcoinsTip, hash);
+        if (!coin.IsSpent())
+            pindexSlow = chainActive[coin.nHeight];
     }
 
     if (pindexSlow) {
@@ -1733,24 +1750,11 @@ int static generateMTRandom(unsigned int s, int range)
     return dist(gen);
 }
 
-CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams)
+/** Mainnet block subsidy straight from its definition; reseeds the wormhole generator on every call. */
+static CAmount ComputeWormholeSubsidy(int nHeight)
 {
     CAmount nSubsidy = 0;
-    if (consensusParams.fPowAllowMinDifficultyBlocks)
-    {
-        int halvings = nHeight / consensusParams.nSubsidyHalvingInterval;
-        // Force block reward to zero when right shift is undefined.
-        if (halvings >= 64)
-            return 0;
-
-        nSubsidy = 50 * COIN;
-        // Subsidy is cut in half every 210,000 blocks which will occur approximately every 4 years.
-        nSubsidy >>= halvings;
-            return nSubsidy;
-    }
-    else
     {
-        nSubsidy = 0;
 
         int StartOffset;
         int WormholeStartBlock;
@@ -1787,6 +1791,111 @@ CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams)
         return nSubsidy;
 }
 
+namespace {
+
+/**
+ * The mainnet subsidy is piecewise constant: a base reward that steps down
+ * at fixed heights, replaced by the 2973 coin wormhole for 180 blocks at a
+ * pseudo-random offset in each of epochs 2 to 47. This splits the heights
+ * into segments of constant subsidy, each with the supply created by the
+ * blocks before it, so both lookups are a binary search.
+ */
+class CEmissionSchedule
+{
+private:
+    //! First height of each segment, ascending
+    std::vector<int> vStart;
+    //! Subsidy of every block in the segment
+    std::vector<CAmount> vSubsidy;
+    //! Sum of the subsidies of heights 1 up to the start of the segment
+    std::vector<CAmount> vSupplyBefore;
+
+    size_t FindSegment(int nHeight) const
+    {
+        return std::upper_bound(vStart.begin(), vStart.end(), nHeight) - vStart.begin() - 1;
+    }
+
+public:
+    CEmissionSchedule()
+    {
+        std::set<int> setStart;
+        setStart.insert(std::numeric_limits<int>::min());
+        setStart.insert(1);
+        setStart.insert(2);
+        const int nBaseSteps[] = {72000, 144000, 288000, 432000, 576000, 864000, 1080000, 1584000, 2304000, 5256000, 26280000};
+        BOOST_FOREACH(int nLast, nBaseSteps)
+            setStart.insert(nLast + 1);
+        for (int epoch = 2; epoch < 48; epoch++) {
+            int nWormholeStart = generateMTRandom(5299860 * epoch, 35820) + (epoch - 1) * 36000;
+            setStart.insert(nWormholeStart);
+            setStart.insert(nWormholeStart + 180);
+        }
+
+        CAmount nSupply = 0;
+        BOOST_FOREACH(int nStart, setStart) {
+            if (!vStart.empty() && nStart > 1)
+                nSupply += vSubsidy.back() * (nStart - std::max(vStart.back(), 1));
+            vStart.push_back(nStart);
+            vSubsidy.push_back(ComputeWormholeSubsidy(std::max(nStart, 0)));
+            vSupplyBefore.push_back(nSupply);
+        }
+    }
+
+    CAmount GetSubsidy(int nHeight) const
+    {
+        return vSubsidy[FindSegment(nHeight)];
+    }
+
+    CAmount GetSupply(int nHeight) const
+    {
+        if (nHeight < 1)
+            return 0;
+        size_t i = FindSegment(nHeight);
+        return vSupplyBefore[i] + vSubsidy[i] * (nHeight - vStart[i] + 1);
+    }
+};
+
+const CEmissionSchedule& WormholeSchedule()
+{
+    static const CEmissionSchedule schedule;
+    return schedule;
+}
+
+} // anon namespace
+
+CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams)
+{
+    if (consensusParams.fPowAllowMinDifficultyBlocks)
+    {
+        int halvings = nHeight / consensusParams.nSubsidyHalvingInterval;
+        // Force block reward to zero when right shift is undefined.
+        if (halvings >= 64)
+            return 0;
+
+        CAmount nSubsidy = 50 * COIN;
+        // Subsidy is cut in half every 210,000 blocks which will occur approximately every 4 years.
+        nSubsidy >>= halvings;
+        return nSubsidy;
+    }
+    return WormholeSchedule().GetSubsidy(nHeight);
+}
+
+CAmount GetTotalSupply(int nHeight, const Consensus::Params& consensusParams)
+{
+    if (nHeight < 1)
+        return 0;
+    if (consensusParams.fPowAllowMinDifficultyBlocks)
+    {
+        // Whole halving intervals, then the part of the last one up to nHeight
+        const int nInterval = consensusParams.nSubsidyHalvingInterval;
+        CAmount nSupply = 0;
+        for (int nStart = 0; nStart <= nHeight && nStart / nInterval < 64; nStart += nInterval)
+            nSupply += GetBlockSubsidy(nStart, consensusParams) * (std::min(nHeight, nStart + nInterval - 1) - std::max(nStart, 1) + 1);
+        return nSupply;
+    }
+    return WormholeSchedule().GetSupply(nHeight);
+}
+
 bool IsInitialBlockDownload()
 {
     const CChainParams& chainParams = Params();
@@ -1970,24 +2079,13 @@ void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, CTxUndo &txund
     if (!tx.IsCoinBase()) {
         txundo.vprevout.reserve(tx.vin.size());
         BOOST_FOREACH(const CTxIn &txin, tx.vin) {
-            CCoinsModifier coins = inputs.ModifyCoins(txin.prevout.hash);
-            unsigned nPos = txin.prevout.n;
-
-            if (nPos >= coins->vout.size() || coins->vout[nPos].IsNull())
-                assert(false);
-            // mark an outpoint spent, and construct undo information
-            txundo.vprevout.push_back(CTxInUndo(coins->vout[nPos]));
-            coins->Spend(nPos);
-            if (coins->vout.size() == 0) {
-                CTxInUndo& undo = txundo.vprevout.back();
-                undo.nHeight = coins->nHeight;
-                undo.fCoinBase = coins->fCoinBase;
-                undo.nVersion = coins->nVersion;
-            }
+            txundo.vprevout.push_back(Coin());
+            bool is_spent = inputs.SpendCoin(txin.prevout, &txundo.vprevout.back());
+            assert(is_spent);
         }
     }
     // add outputs
-    inputs.ModifyNewCoins(tx.GetHash(), tx.IsCoinBase())->FromTx(tx, nHeight);
+    AddCoins(inputs, tx, nHeight);
 }
 
 void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, int nHeight)
@@ -2025,20 +2123,20 @@ bool CheckTxInputs(const CTransaction& tx, CValidationState& state, const CCoins
         for (unsigned int i = 0; i < tx.vin.size(); i++)
         {
             const COutPoint &prevout = tx.vin[i].prevout;
-            const CCoins *coins = inputs.AccessCoins(prevout.hash);
-            assert(coins);
+            const Coin& coin = inputs.AccessCoin(prevout);
+            assert(!coin.IsSpent());
 
             // If prev is coinbase, check that it's matured
-            if (coins->IsCoinBase()) {
-                if (nSpendHeight - coins->nHeight < COINBASE_MATURITY)
+            if (coin.IsCoinBase()) {
+                if (nSpendHeight - coin.nHeight < COINBASE_MATURITY)
                     return state.Invalid(false,
                         REJECT_INVALID, "bad-txns-premature-spend-of-coinbase",
-                        strprintf("tried to spend coinbase at depth %d", nSpendHeight - coins->nHeight));
+                        strprintf("tried to spend coinbase at depth %d", nSpendHeight - coin.nHeight));
             }
 
             // Check for negative or overflow input values
-            nValueIn += coins->vout[prevout.n].nValue;
-            if (!MoneyRange(coins->vout[prevout.n].nValue) || !MoneyRange(nValueIn))
+            nValueIn += coin.out.nValue;
+            if (!MoneyRange(coin.out.nValue) || !MoneyRange(nValueIn))
                 return state.DoS(100, false, REJECT_INVALID, "bad-txns-inputvalues-outofrange");
 
         }
@@ -2081,11 +2179,11 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
         if (fScriptChecks) {
             for (unsigned int i = 0; i < tx.vin.size(); i++) {
                 const COutPoint &prevout = tx.vin[i].prevout;
-                const CCoins* coins = inputs.AccessCoins(prevout.hash);
-                assert(coins);
+                const Coin& coin = inputs.AccessCoin(prevout);
+                assert(!coin.IsSpent());
 
                 // Verify signature
-                CScriptCheck check(*coins, tx, i, flags, cacheStore, &txdata);
+                CScriptCheck check(coin.out, tx, i, flags, cacheStore, &txdata);
                 if (pvChecks) {
                     pvChecks->push_back(CScriptCheck());
                     check.swap(pvChecks->back());
@@ -2097,7 +2195,7 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
                         // arguments; if so, don't trigger DoS protection to
                         // avoid splitting the network between upgraded and
                         // non-upgraded nodes.
-                        CScriptCheck check2(*coins, tx, i,
+                        CScriptCheck check2(coin.out, tx, i,
                                 flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheStore, &txdata);
                         if (check2())
                             return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
@@ -2195,39 +2293,44 @@ bool AbortNode(CValidationState& state, const std::string& strMessage, const std
 } // anon namespace
 
 /**
- * Apply the undo operation of a CTxInUndo to the given chain state.
- * @param undo The undo object.
+ * Restore the UTXO in a Coin at a given COutPoint
+ * @param undo The Coin to be restored.
  * @param view The coins view to which to apply the changes.
  * @param out The out point that corresponds to the tx input.
  * @return True on success.
  */
-static bool ApplyTxInUndo(const CTxInUndo& undo, CCoinsViewCache& view, const COutPoint& out)
+static bool ApplyTxInUndo(Coin&& undo, CCoinsViewCache& view, const COutPoint& out, CRollingCoinsStats* pstatsDelta)
 {
     bool fClean = true;
 
-    CCoinsModifier coins = view.ModifyCoins(out.hash);
-    if (undo.nHeight != 0) {
-        // undo data contains height: this is the last output of the prevout tx being spent
-        if (!coins->IsPruned())
-            fClean = fClean && error("%s: undo data overwriting existing transaction", __func__);
-        coins->Clear();
-        coins->fCoinBase = undo.fCoinBase;
-        coins->nHeight = undo.nHeight;
-        coins->nVersion = undo.nVersion;
-    } else {
-        if (coins->IsPruned())
-            fClean = fClean && error("%s: undo data adding output to missing transaction", __func__);
-    }
-    if (coins->IsAvailable(out.n))
+    if (view.HaveCoin(out)) {
         fClean = fClean && error("%s: undo data overwriting existing output", __func__);
-    if (coins->vout.size() < out.n+1)
-        coins->vout.resize(out.n+1);
-    coins->vout[out.n] = undo.txout;
+        if (pstatsDelta)
+            pstatsDelta->RemoveCoin(out, view.AccessCoin(out));
+    }
+
+    if (undo.nHeight == 0) {
+        // Missing undo metadata (height and coinbase). Older versions included this
+        // information only in undo records for the last spend of a transactions'
+        // outputs. This implies that it must be present for some other output of the same tx.
+        const Coin& alternate = AccessByTxid(view, out.hash);
+        if (alternate.IsSpent())
+            return error("%s: undo data adding output to missing transaction", __func__);
+        undo.nHeight = alternate.nHeight;
+        undo.fCoinBase = alternate.fCoinBase;
+    }
+    // The potential_overwrite parameter to AddCoin is only allowed to be false if we know for
+    // sure that the coin did not already exist in the cache. As we have queried for that above
+    // using HaveCoin, we don't need to guess. When fClean is false, a coin already existed and
+    // it is an overwrite.
+    if (pstatsDelta && !undo.out.scriptPubKey.IsUnspendable())
+        pstatsDelta->AddCoin(out, undo);
+    view.AddCoin(out, std::move(undo), !fClean);
 
     return fClean;
 }
 
-bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& view, bool* pfClean)
+bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& view, bool* pfClean, CRollingCoinsStats* pstatsDelta)
 {
     assert(pindex->GetBlockHash() == view.GetBestBlock());
 
@@ -2246,8 +2349,6 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
     if (blockUndo.vtxundo.size() + 1 != block.vtx.size())
         return error("DisconnectBlock(): block and undo data inconsistent");
 
-    komodo_disconnect((CBlockIndex *)pindex,(CBlock *)&block);
-
     // undo transactions in reverse order
     for (int i = block.vtx.size() - 1; i >= 0; i--) {
         const CTransaction &tx = block.vtx[i];
@@ -2255,32 +2356,26 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
 
         // Check that all outputs are available and match the outputs in the block itself
         // exactly.
-        {
-        CCoinsModifier outs = view.ModifyCoins(hash);
-        outs->ClearUnspendable();
-
-        CCoins outsBlock(tx, pindex->nHeight);
-        // The CCoins serialization does not serialize negative numbers.
-        // No network rules currently depend on the version here, so an inconsistency is harmless
-        // but it must be corrected before txout nversion ever influences a network rule.
-        if (outsBlock.nVersion < 0)
-            outs->nVersion = outsBlock.nVersion;
-        if (*outs != outsBlock)
-            fClean = fClean && error("DisconnectBlock(): added transaction mismatch? database corrupted");
-
-        // remove outputs
-        outs->Clear();
+        for (size_t o = 0; o < tx.vout.size(); o++) {
+            if (!tx.vout[o].scriptPubKey.IsUnspendable()) {
+                COutPoint out(hash, o);
+                Coin coin;
+                bool is_spent = view.SpendCoin(out, &coin);
+                if (!is_spent || tx.vout[o] != coin.out || pindex->nHeight != (int)coin.nHeight || tx.IsCoinBase() != coin.IsCoinBase())
+                    fClean = fClean && error("DisconnectBlock(): added transaction mismatch? database corrupted");
+                if (is_spent && pstatsDelta)
+                    pstatsDelta->RemoveCoin(out, coin);
+            }
         }
 
         // restore inputs
         if (i > 0) { // not coinbases
-            const CTxUndo &txundo = blockUndo.vtxundo[i-1];
+            CTxUndo &txundo = blockUndo.vtxundo[i-1];
             if (txundo.vprevout.size() != tx.vin.size())
                 return error("DisconnectBlock(): transaction and undo data inconsistent");
             for (unsigned int j = tx.vin.size(); j-- > 0;) {
                 const COutPoint &out = tx.vin[j].prevout;
-                const CTxInUndo &undo = txundo.vprevout[j];
-                if (!ApplyTxInUndo(undo, view, out))
+                if (!ApplyTxInUndo(std::move(txundo.vprevout[j]), view, out, pstatsDelta))
                     fClean = false;
             }
         }
@@ -2322,13 +2417,182 @@ void static FlushBlockFile(bool fFinalize = false)
 
 bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigned int nAddSize);
 
-static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
+// Ranges of script checks are split down to this size, so idle threads can steal the rest.
+static CCheckQueue<CScriptCheck> scriptcheckqueue(16);
 
 void ThreadScriptCheck() {
     RenameThread("testcoin-scriptch");
     scriptcheckqueue.Thread();
 }
 
+// Every CPowCheck already carries a full kernel pass, so workers take them one at a time.
+static CCheckQueue<CPowCheck> powcheckqueue(1);
+
+// Scrypt scratchpad of each PoW checking thread, allocated once on first use.
+static boost::thread_specific_ptr<std::vector<char> > powcheckScratchpad;
+
+void ThreadPowCheck() {
+    RenameThread("testcoin-powch");
+    powcheckqueue.Thread();
+}
+
+// Each precomputation hashes one transaction, so split ranges as finely as script checks.
+static CCheckQueue<CTxDataPrecompute> txdataqueue(16);
+
+void ThreadTxDataPrecompute() {
+    RenameThread("testcoin-txdata");
+    txdataqueue.Thread();
+}
+
+bool CTxDataPrecompute::operator()() {
+    *ptxdata = PrecomputedTransactionData(*ptx);
+    return true;
+}
+
+bool CPowCheck::operator()() {
+    std::vector<char>* pscratchpad = powcheckScratchpad.get();
+    if (pscratchpad == NULL) {
+        pscratchpad = new std::vector<char>(SCRYPT_MULTI_SCRATCHPAD_SIZE);
+        powcheckScratchpad.reset(pscratchpad);
+    }
+
+    const char* vInput[SCRYPT_MAX_LANES];
+    char* vOutput[SCRYPT_MAX_LANES];
+    assert(nCount <= (size_t)SCRYPT_MAX_LANES);
+    for (size_t i = 0; i < nCount; i++) {
+        vInput[i] = BEGIN(ppHeader[i]->nVersion);
+        vOutput[i] = BEGIN(phashPoW[i]);
+    }
+    scrypt_1024_1_1_256_multi_sp(vInput, vOutput, nCount, &(*pscratchpad)[0]);
+
+    bool fOk = true;
+    for (size_t i = 0; i < nCount; i++) {
+        if (CheckProofOfWork(phashPoW[i], ppHeader[i]->nBits, *pparams))
+            pfValid[i] = 1;
+        else
+            fOk = false;
+    }
+    return fOk;
+}
+
+void CheckProofOfWorkBatch(const std::vector<const CBlockHeader*>& vpHeaders, std::vector<char>& vValid, std::vector<uint256>& vHashPoW, const Consensus::Params& consensusParams)
+{
+    vValid.assign(vpHeaders.size(), 0);
+    vHashPoW.assign(vpHeaders.size(), uint256());
+    if (vpHeaders.empty())
+        return;
+
+    const size_t nLanes = scrypt_multi_lanes();
+    std::vector<CPowCheck> vChecks;
+    vChecks.reserve((vpHeaders.size() + nLanes - 1) / nLanes);
+    for (size_t i = 0; i < vpHeaders.size(); i += nLanes)
+        vChecks.push_back(CPowCheck(&vpHeaders[i], std::min(nLanes, vpHeaders.size() - i), &vHashPoW[i], &vValid[i], consensusParams));
+
+    if (nScriptCheckThreads) {
+        CCheckQueueControl<CPowCheck> control(&powcheckqueue);
+        control.Add(vChecks);
+        control.Wait();
+    } else {
+        BOOST_FOREACH(CPowCheck& check, vChecks)
+            check();
+    }
+}
+
+/** Number of headers each -checkblockindexpow worker hashes per cs_main round trip. */
+static const size_t BLOCKINDEXPOW_CHUNK_SIZE = 2000;
+
+static void CheckBlockIndexPoWWorker(const std::vector<CBlockIndex*>* pvIndex, size_t nWorker, size_t nWorkers, int64_t* pnChecked)
+{
+    RenameThread("testcoin-idxpow");
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+    std::vector<char> vScratchpad(SCRYPT_MULTI_SCRATCHPAD_SIZE);
+    std::vector<CBlockHeader> vHeaders;
+    std::vector<uint256> vHash;
+    std::vector<const char*> vInput;
+    std::vector<char*> vOutput;
+
+    for (size_t nBegin = nWorker * BLOCKINDEXPOW_CHUNK_SIZE; nBegin < pvIndex->size(); nBegin += nWorkers * BLOCKINDEXPOW_CHUNK_SIZE) {
+        boost::this_thread::interruption_point();
+        const size_t nEnd = std::min(nBegin + BLOCKINDEXPOW_CHUNK_SIZE, pvIndex->size());
+
+        vHeaders.clear();
+        {
+            LOCK(cs_main);
+            for (size_t i = nBegin; i < nEnd; i++)
+                vHeaders.push_back((*pvIndex)[i]->GetBlockHeader());
+        }
+
+        vHash.resize(vHeaders.size());
+        vInput.resize(vHeaders.size());
+        vOutput.resize(vHeaders.size());
+        for (size_t i = 0; i < vHeaders.size(); i++) {
+            vInput[i] = BEGIN(vHeaders[i].nVersion);
+            vOutput[i] = BEGIN(vHash[i]);
+        }
+        for (size_t i = 0; i < vHeaders.size(); i += SCRYPT_MAX_LANES) {
+            boost::this_thread::interruption_point();
+            scrypt_1024_1_1_256_multi_sp(&vInput[i], &vOutput[i], std::min((size_t)SCRYPT_MAX_LANES, vHeaders.size() - i), &vScratchpad[0]);
+        }
+
+        LOCK(cs_main);
+        for (size_t i = nBegin; i < nEnd; i++) {
+            CBlockIndex* pindex = (*pvIndex)[i];
+            const uint256& hashPoW = vHash[i - nBegin];
+            if ((pindex->nStatus & BLOCK_HAVE_POWHASH) && pindex->hashPoW != hashPoW) {
+                AbortNode(strprintf("Stored proof-of-work hash of block %s does not match its header", pindex->GetBlockHash().ToString()),
+                          _("Corrupted block database detected"));
+                return;
+            }
+            if (!CheckProofOfWork(hashPoW, pindex->nBits, consensusParams)) {
+                AbortNode(strprintf("Proof of work of block %s in the block index is invalid", pindex->GetBlockHash().ToString()),
+                          _("Corrupted block database detected"));
+                return;
+            }
+            if (!(pindex->nStatus & BLOCK_HAVE_POWHASH)) {
+                pindex->hashPoW = hashPoW;
+                pindex->nStatus |= BLOCK_HAVE_POWHASH;
+                setDirtyBlockIndex.insert(pindex);
+            }
+        }
+        *pnChecked += nEnd - nBegin;
+    }
+}
+
+void ThreadCheckBlockIndexPoW()
+{
+    RenameThread("testcoin-idxpow");
+    int64_t nStart = GetTimeMillis();
+
+    std::vector<CBlockIndex*> vIndex;
+    {
+        LOCK(cs_main);
+        vIndex.reserve(mapBlockIndex.size());
+        BOOST_FOREACH(const BlockMap::value_type& item, mapBlockIndex) {
+            if (item.second->pprev != NULL)
+                vIndex.push_back(item.second);
+        }
+    }
+    LogPrintf("Checking proof of work of %u block index entries...\n", vIndex.size());
+
+    const size_t nWorkers = std::max(nScriptCheckThreads, 1);
+    std::vector<int64_t> vChecked(nWorkers, 0);
+    boost::thread_group workers;
+    for (size_t i = 0; i < nWorkers; i++)
+        workers.create_thread(boost::bind(&CheckBlockIndexPoWWorker, &vIndex, i, nWorkers, &vChecked[i]));
+    try {
+        workers.join_all();
+    } catch (const boost::thread_interrupted&) {
+        workers.interrupt_all();
+        workers.join_all();
+        throw;
+    }
+
+    int64_t nChecked = 0;
+    BOOST_FOREACH(int64_t n, vChecked)
+        nChecked += n;
+    LogPrintf("Checked proof of work of %d block index entries in %dms\n", nChecked, GetTimeMillis() - nStart);
+}
+
 // Protected by cs_main
 VersionBitsCache versionbitscache;
 
@@ -2383,7 +2647,7 @@ static int64_t nTimeCallbacks = 0;
 static int64_t nTimeTotal = 0;
 
 bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex,
-                  CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck)
+                  CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck, CRollingCoinsStats* pstatsDelta)
 {
     AssertLockHeld(cs_main);
 
@@ -2406,11 +2670,25 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     }
 
     bool fScriptChecks = true;
-    if (fCheckpointsEnabled) {
-        CBlockIndex *pindexLastCheckpoint = Checkpoints::GetLastCheckpoint(chainparams.Checkpoints());
-        if (pindexLastCheckpoint && pindexLastCheckpoint->GetAncestor(pindex->nHeight) == pindex) {
-            // This block is an ancestor of a checkpoint: disable script checks
-            fScriptChecks = false;
+    if (!hashAssumeValid.IsNull()) {
+        // We've been configured with the hash of a block which has been externally verified to have a valid history.
+        // A suitable default value is included with the software and updated from time to time. Because validity
+        // relative to a piece of software is an objective fact these defaults can be easily reviewed.
+        // This setting doesn't force the selection of any particular chain but makes validating some faster by
+        // effectively caching the result of part of the verification.
+        BlockMap::const_iterator it = mapBlockIndex.find(hashAssumeValid);
+        if (it != mapBlockIndex.end()) {
+            if (it->second->GetAncestor(pindex->nHeight) == pindex &&
+                pindexBestHeader->GetAncestor(pindex->nHeight) == pindex &&
+                pindexBestHeader->nChainWork >= UintToArith256(chainparams.GetConsensus().nMinimumChainWork)) {
+                // This block is a member of the assumed verified chain and an ancestor of the best header.
+                // Only skip the scripts once the best header is two weeks' worth of work past the block, so
+                // that a release whose default is near the tip still verifies the blocks around it, and an
+                // invalid block cannot be slipped in by asking users to set -assumevalid to a fresh block.
+                // The test against nMinimumChainWork keeps the checks on while the node knows of no chain
+                // at least as good as the expected one.
+                fScriptChecks = (GetBlockProofEquivalentTime(*pindexBestHeader, *pindex, *pindexBestHeader, chainparams.GetConsensus()) <= 60 * 60 * 24 * 7 * 2);
+            }
         }
     }
 
@@ -2446,10 +2724,11 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     if (fEnforceBIP30) {
         BOOST_FOREACH(const CTransaction& tx, block.vtx) {
-            const CCoins* coins = view.AccessCoins(tx.GetHash());
-            if (coins && !coins->IsPruned())
-                return state.DoS(100, error("ConnectBlock(): tried to overwrite transaction"),
-                                 REJECT_INVALID, "bad-txns-BIP30");
+            for (size_t o = 0; o < tx.vout.size(); o++) {
+                if (view.HaveCoin(COutPoint(tx.GetHash(), o)))
+                    return state.DoS(100, error("ConnectBlock(): tried to overwrite transaction"),
+                                     REJECT_INVALID, "bad-txns-BIP30");
+            }
         }
     }
 
@@ -2500,8 +2779,21 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     std::vector<std::pair<uint256, CDiskTxPos> > vPos;
     vPos.reserve(block.vtx.size());
     blockundo.vtxundo.reserve(block.vtx.size() - 1);
-    std::vector<PrecomputedTransactionData> txdata;
-    txdata.reserve(block.vtx.size()); // Required so that pointers to individual PrecomputedTransactionData don't get invalidated
+    // Sized up front, as the script checks keep pointers into it. The
+    // coinbase has no inputs to check, so its entry is left empty.
+    std::vector<PrecomputedTransactionData> txdata(block.vtx.size());
+    if (fScriptChecks && nScriptCheckThreads) {
+        std::vector<CTxDataPrecompute> vPrecompute;
+        vPrecompute.reserve(block.vtx.size());
+        for (unsigned int i = 1; i < block.vtx.size(); i++)
+            vPrecompute.push_back(CTxDataPrecompute(block.vtx[i], &txdata[i]));
+        CCheckQueueControl<CTxDataPrecompute> controlTxData(&txdataqueue);
+        controlTxData.Add(vPrecompute);
+        controlTxData.Wait();
+    } else {
+        for (unsigned int i = 1; i < block.vtx.size(); i++)
+            txdata[i] = PrecomputedTransactionData(block.vtx[i]);
+    }
     for (unsigned int i = 0; i < block.vtx.size(); i++)
     {
         const CTransaction &tx = block.vtx[i];
@@ -2519,7 +2811,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             // be in ConnectBlock because they require the UTXO set
             prevheights.resize(tx.vin.size());
             for (size_t j = 0; j < tx.vin.size(); j++) {
-                prevheights[j] = view.AccessCoins(tx.vin[j].prevout.hash)->nHeight;
+                prevheights[j] = view.AccessCoin(tx.vin[j].prevout).nHeight;
             }
 
             // Which orphan pool entries must we evict?
@@ -2548,7 +2840,6 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             return state.DoS(100, error("ConnectBlock(): too many sigops"),
                              REJECT_INVALID, "bad-blk-sigops");
 
-        txdata.emplace_back(tx);
         if (!tx.IsCoinBase())
         {
             nFees += view.GetValueIn(tx)-tx.GetValueOut();
@@ -2620,6 +2911,23 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         if (!pblocktree->WriteTxIndex(vPos))
             return AbortNode(state, "Failed to write transaction index");
 
+    // Tally the coins the block spends and creates. Outputs spent within
+    // the block are both added and removed, which cancels out.
+    if (pstatsDelta) {
+        for (unsigned int i = 0; i < block.vtx.size(); i++) {
+            const CTransaction &tx = block.vtx[i];
+            if (i > 0) {
+                const CTxUndo &txundo = blockundo.vtxundo[i-1];
+                for (unsigned int j = 0; j < tx.vin.size(); j++)
+                    pstatsDelta->RemoveCoin(tx.vin[j].prevout, txundo.vprevout[j]);
+            }
+            for (unsigned int o = 0; o < tx.vout.size(); o++) {
+                if (!tx.vout[o].scriptPubKey.IsUnspendable())
+                    pstatsDelta->AddCoin(COutPoint(tx.GetHash(), o), Coin(tx.vout[o], pindex->nHeight, tx.IsCoinBase()));
+            }
+        }
+    }
+
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
 
@@ -2643,7 +2951,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     int64_t nTime6 = GetTimeMicros(); nTimeCallbacks += nTime6 - nTime5;
     LogPrint("bench", "    - Callbacks: %.2fms [%.2fs]\n", 0.001 * (nTime6 - nTime5), nTimeCallbacks * 0.000001);
 
-    komodo_connectblock(pindex,*(CBlock *)&block);
+    GetMainSignals().BlockConnected(block, pindex, blockundo);
 
     return true;
 }
@@ -2728,25 +3036,33 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
                 return AbortNode(state, "Files to write to block index database");
             }
         }
-        // Finally remove any pruned files
-        if (fFlushForPrune)
-            UnlinkPrunedFiles(setFilesToPrune);
         nLastWrite = nNow;
     }
     // Flush best chain related state. This can only be done if the blocks / block index write was also done.
     if (fDoFullFlush) {
-        // Typical CCoins structures on disk are around 128 bytes in size.
+        // Typical Coin structures on disk are around 48 bytes in size.
         // Pushing a new one to the database can cause it to be written
         // twice (once in the log, and once in the tables). This is already
         // an overestimation, as most will delete an existing entry or
         // overwrite one. Still, use a conservative safety factor of 2.
-        if (!CheckDiskSpace(128 * 2 * 2 * pcoinsTip->GetCacheSize()))
+        if (!CheckDiskSpace(48 * 2 * 2 * pcoinsTip->GetCacheSize()))
             return state.Error("out of disk space");
         // Flush the chainstate (which may refer to block index entries).
-        if (!pcoinsTip->Flush())
+        // Unless the cache has grown too large, its coins are kept for the
+        // blocks that will spend them.
+        bool fEmptyCache = fCacheLarge || fCacheCritical;
+        pcoinsdbview->SetStats(coinsStatsTip);
+        if (!(fEmptyCache ? pcoinsTip->Flush() : pcoinsTip->Sync()))
             return AbortNode(state, "Failed to write to coin database");
         nLastFlush = nNow;
     }
+    // Finally remove any pruned files, once no chainstate write that might
+    // still have to be replayed from them is in flight
+    if (fFlushForPrune) {
+        if (!pcoinsdbview->WaitForWrites())
+            return AbortNode(state, "Failed to write to coin database");
+        UnlinkPrunedFiles(setFilesToPrune);
+    }
     if (fDoFullFlush || ((mode == FLUSH_STATE_ALWAYS || mode == FLUSH_STATE_PERIODIC) && nNow > nLastSetChain + (int64_t)DATABASE_WRITE_INTERVAL * 1000000)) {
         // Update best block in wallet (so we can detect restored wallets).
         GetMainSignals().SetBestChain(chainActive.GetLocator());
@@ -2841,8 +3157,8 @@ bool static DisconnectTip(CValidationState& state, const CChainParams& chainpara
     if (!ReadBlockFromDisk(block, pindexDelete, chainparams.GetConsensus()))
         return AbortNode(state, "Failed to read block");
 
-    int32_t prevMoMheight; uint256 notarizedhash,txid;
-    komodo_notarized_height(&prevMoMheight,&notarizedhash,&txid);
+    uint256 notarizedhash;
+    komodo_snapshotnotarized(chainActive.Height() + 1,&notarizedhash);
     if ( block.GetHash() == notarizedhash )
     {
         LogPrintf("DisconnectTip trying to disconnect notarized block at ht.%d\n",(int32_t)pindexDelete->nHeight);
@@ -2853,10 +3169,15 @@ bool static DisconnectTip(CValidationState& state, const CChainParams& chainpara
     int64_t nStart = GetTimeMicros();
     {
         CCoinsViewCache view(pcoinsTip);
-        if (!DisconnectBlock(block, state, pindexDelete, view))
+        CRollingCoinsStats statsDelta;
+        if (!DisconnectBlock(block, state, pindexDelete, view, NULL, &statsDelta))
             return error("DisconnectTip(): DisconnectBlock %s failed", pindexDelete->GetBlockHash().ToString());
         assert(view.Flush());
+        coinsStatsTip += statsDelta;
+        coinsStatsTip.hashBlock = pindexDelete->pprev->GetBlockHash();
     }
+    // Not in DisconnectBlock, which VerifyDB also runs on blocks it keeps
+    GetMainSignals().BlockDisconnected(block, pindexDelete);
     LogPrint("bench", "- Disconnect block: %.2fms\n", (GetTimeMicros() - nStart) * 0.001);
     // Write the chain state to disk, if necessary.
     if (!FlushStateToDisk(state, FLUSH_STATE_IF_NEEDED))
@@ -2920,7 +3241,8 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
     LogPrint("bench", "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * 0.001, nTimeReadFromDisk * 0.000001);
     {
         CCoinsViewCache view(pcoinsTip);
-        bool rv = ConnectBlock(*pblock, state, pindexNew, view, chainparams);
+        CRollingCoinsStats statsDelta;
+        bool rv = ConnectBlock(*pblock, state, pindexNew, view, chainparams, false, &statsDelta);
         GetMainSignals().BlockChecked(*pblock, state);
         if (!rv) {
             if (state.IsInvalid())
@@ -2931,6 +3253,8 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
         nTime3 = GetTimeMicros(); nTimeConnectTotal += nTime3 - nTime2;
         LogPrint("bench", "  - Connect total: %.2fms [%.2fs]\n", (nTime3 - nTime2) * 0.001, nTimeConnectTotal * 0.000001);
         assert(view.Flush());
+        coinsStatsTip += statsDelta;
+        coinsStatsTip.hashBlock = pindexNew->GetBlockHash();
     }
     int64_t nTime4 = GetTimeMicros(); nTimeFlush += nTime4 - nTime3;
     LogPrint("bench", "  - Flush: %.2fms [%.2fs]\n", (nTime4 - nTime3) * 0.001, nTimeFlush * 0.000001);
@@ -3289,7 +3613,7 @@ bool ResetBlockFailureFlags(CBlockIndex *pindex) {
     return true;
 }
 
-CBlockIndex* AddToBlockIndex(const CBlockHeader& block)
+CBlockIndex* AddToBlockIndex(const CBlockHeader& block, const uint256* phashPoW = NULL)
 {
     // Check for duplicate
     uint256 hash = block.GetHash();
@@ -3300,6 +3624,10 @@ CBlockIndex* AddToBlockIndex(const CBlockHeader& block)
     // Construct new block index object
     CBlockIndex* pindexNew = new CBlockIndex(block);
     assert(pindexNew);
+    if (phashPoW) {
+        pindexNew->hashPoW = *phashPoW;
+        pindexNew->nStatus |= BLOCK_HAVE_POWHASH;
+    }
     // We assign the sequence id to blocks only when the full data is available,
     // to avoid miners withholding blocks but broadcasting headers, to get a
     // competitive advantage.
@@ -3460,16 +3788,21 @@ bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigne
     return true;
 }
 
-bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW)
+bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW, uint256* phashPoW)
 {
     // Check proof of work matches claimed amount
-    if (fCheckPOW && !CheckProofOfWork(block.GetPoWHash(), block.nBits, consensusParams))
-        return state.DoS(50, false, REJECT_INVALID, "high-hash", false, "proof of work failed");
+    if (fCheckPOW) {
+        uint256 hashPoW = block.GetPoWHash();
+        if (!CheckProofOfWork(hashPoW, block.nBits, consensusParams))
+            return state.DoS(50, false, REJECT_INVALID, "high-hash", false, "proof of work failed");
+        if (phashPoW)
+            *phashPoW = hashPoW;
+    }
 
     return true;
 }
 
-bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW, bool fCheckMerkleRoot)
+bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW, bool fCheckMerkleRoot, uint256* phashPoW)
 {
     // These are checks that are independent of context.
 
@@ -3478,7 +3811,7 @@ bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::P
 
     // Check that the header is valid (particularly PoW).  This is mostly
     // redundant with the call in AcceptBlockHeader.
-    if (!CheckBlockHeader(block, state, consensusParams, fCheckPOW))
+    if (!CheckBlockHeader(block, state, consensusParams, fCheckPOW, phashPoW))
         return false;
 
     // Check the merkle root.
@@ -3768,13 +4101,16 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
     return true;
 }
 
-static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex=NULL)
+/** phashPoW, if given, is the already verified proof-of-work hash of the header. */
+static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex=NULL, const uint256* phashPoW=NULL)
 {
     AssertLockHeld(cs_main);
     // Check for duplicate
     uint256 hash = block.GetHash();
     BlockMap::iterator miSelf = mapBlockIndex.find(hash);
     CBlockIndex *pindex = NULL;
+    uint256 hashPoW;
+    bool fHavePoWHash = false;
     if (hash != chainparams.GetConsensus().hashGenesisBlock) {
 
         if (miSelf != mapBlockIndex.end()) {
@@ -3787,8 +4123,11 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
             return true;
         }
 
-        if (!CheckBlockHeader(block, state, chainparams.GetConsensus()))
+        if (phashPoW)
+            hashPoW = *phashPoW;
+        if (!CheckBlockHeader(block, state, chainparams.GetConsensus(), phashPoW == NULL, &hashPoW))
             return error("%s: Consensus::CheckBlockHeader: %s, %s", __func__, hash.ToString(), FormatStateMessage(state));
+        fHavePoWHash = true;
 
         // Get prev block index
         CBlockIndex* pindexPrev = NULL;
@@ -3807,7 +4146,7 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
             return error("%s: Consensus::ContextualCheckBlockHeader: %s, %s", __func__, hash.ToString(), FormatStateMessage(state));
     }
     if (pindex == NULL)
-        pindex = AddToBlockIndex(block);
+        pindex = AddToBlockIndex(block, fHavePoWHash ? &hashPoW : NULL);
 
     if (ppindex)
         *ppindex = pindex;
@@ -3815,8 +4154,9 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
     return true;
 }
 
-/** Store block on disk. If dbp is non-NULL, the file is known to already reside on disk */
-static bool AcceptBlock(const CBlock& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fRequested, const CDiskBlockPos* dbp, bool* fNewBlock)
+/** Store block on disk. If dbp is non-NULL, the file is known to already reside on disk.
+ *  phashPoW, if given, is the already verified proof-of-work hash of the block. */
+static bool AcceptBlock(const CBlock& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fRequested, const CDiskBlockPos* dbp, bool* fNewBlock, const uint256* phashPoW=NULL)
 {
     if (fNewBlock) *fNewBlock = false;
     AssertLockHeld(cs_main);
@@ -3824,7 +4164,7 @@ static bool AcceptBlock(const CBlock& block, CValidationState& state, const CCha
     CBlockIndex *pindexDummy = NULL;
     CBlockIndex *&pindex = ppindex ? *ppindex : pindexDummy;
 
-    if (!AcceptBlockHeader(block, state, chainparams, &pindex))
+    if (!AcceptBlockHeader(block, state, chainparams, &pindex, phashPoW))
         return false;
 
     // Try to process all requested blocks that we don't have, but only
@@ -3876,6 +4216,10 @@ static bool AcceptBlock(const CBlock& block, CValidationState& state, const CCha
         return AbortNode(state, std::string("System error: ") + e.what());
     }
 
+    // Start reading the coins it spends while it waits to be connected
+    if (fHasMoreWork && pcoinsprefetch != NULL)
+        pcoinsprefetch->Prefetch(block, *pcoinsTip);
+
     if (fCheckForPruning)
         FlushStateToDisk(state, FLUSH_STATE_NONE); // we just allocated more disk space for block files
 
@@ -4123,7 +4467,6 @@ CBlockIndex * InsertBlockIndex(uint256 hash)
 
 bool static LoadBlockIndexDB()
 {
-    const CChainParams& chainparams = Params();
     if (!pblocktree->LoadBlockIndexGuts(InsertBlockIndex))
         return false;
 
@@ -4206,6 +4549,11 @@ bool static LoadBlockIndexDB()
     if (fHavePruned)
         LogPrintf("LoadBlockIndexDB(): Block files have previously been pruned\n");
 
+    // Check whether the chainstate was loaded from a snapshot
+    pblocktree->ReadFlag("snapshotchainstate", fSnapshotChainstate);
+    if (fSnapshotChainstate)
+        LogPrintf("LoadBlockIndexDB(): Chainstate was loaded from a UTXO set snapshot\n");
+
     // Check whether we need to continue reindexing
     bool fReindexing = false;
     pblocktree->ReadReindexing(fReindexing);
@@ -4215,6 +4563,13 @@ bool static LoadBlockIndexDB()
     pblocktree->ReadFlag("txindex", fTxIndex);
     LogPrintf("%s: transaction index %s\n", __func__, fTxIndex ? "enabled" : "disabled");
 
+    return true;
+}
+
+bool LoadChainTip(const CChainParams& chainparams)
+{
+    LOCK(cs_main);
+
     // Load pointer to end of best chain
     BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
     if (it == mapBlockIndex.end())
@@ -4231,6 +4586,292 @@ bool static LoadBlockIndexDB()
     return true;
 }
 
+bool LoadCoinsStats()
+{
+    LOCK(cs_main);
+    if (pcoinsdbview->ReadStats(coinsStatsTip) && coinsStatsTip.hashBlock == pcoinsTip->GetBestBlock())
+        return true;
+
+    // Not written by this version, or not along with the last chainstate write
+    LogPrintf("Computing UTXO set statistics...\n");
+    int64_t nStart = GetTimeMillis();
+    if (!GetRollingCoinsStats(pcoinsdbview, coinsStatsTip))
+        return false;
+    LogPrintf("%s: %d coins as of %s in %dms\n", __func__, coinsStatsTip.nTransactionOutputs, coinsStatsTip.hashBlock.ToString(), GetTimeMillis() - nStart);
+    return true;
+}
+
+CRollingCoinsStats GetTipCoinsStats()
+{
+    LOCK(cs_main);
+    return coinsStatsTip;
+}
+
+/** Apply the effects of a block on the utxo cache, ignoring that it may already have been applied. */
+static bool RollforwardBlock(const CBlockIndex* pindex, CCoinsViewCache& inputs, const CChainParams& params)
+{
+    CBlock block;
+    if (!ReadBlockFromDisk(block, pindex, params.GetConsensus()))
+        return error("ReplayBlock(): ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+
+    BOOST_FOREACH(const CTransaction& tx, block.vtx) {
+        if (!tx.IsCoinBase()) {
+            BOOST_FOREACH(const CTxIn& txin, tx.vin)
+                inputs.SpendCoin(txin.prevout);
+        }
+        // Pass check = true as every addition may be an overwrite.
+        AddCoins(inputs, tx, pindex->nHeight, true);
+    }
+    return true;
+}
+
+bool ReplayBlocks(const CChainParams& params, CCoinsViewDB* view)
+{
+    LOCK(cs_main);
+
+    CCoinsViewCache cache(view);
+
+    std::vector<uint256> hashHeads = view->GetHeadBlocks();
+    if (hashHeads.empty()) return true; // We're already in a consistent state.
+    if (hashHeads.size() != 2) return error("ReplayBlocks(): unknown inconsistent state");
+
+    // A UTXO set snapshot load into a fresh chainstate that was cut short.
+    // Its headers only go into the block index once the coins are in, so
+    // there is nothing to roll forward with; drop the coins instead, and let
+    // -loadtxoutset start over.
+    if (hashHeads[1] == params.GetConsensus().hashGenesisBlock) {
+        bool fSnapshot = false;
+        for (MapSnapshots::const_iterator it = params.Snapshots().begin(); it != params.Snapshots().end(); ++it)
+            fSnapshot |= it->second.hashBlock == hashHeads[0];
+        BlockMap::iterator mi = mapBlockIndex.find(hashHeads[0]);
+        if (fSnapshot && (mi == mapBlockIndex.end() || !(mi->second->nStatus & BLOCK_HAVE_DATA))) {
+            if (!view->AbortLoadCoins(hashHeads[0]))
+                return error("ReplayBlocks(): failed to roll back the load of snapshot %s", hashHeads[0].ToString());
+            return true;
+        }
+    }
+
+    uiInterface.ShowProgress(_("Replaying blocks..."), 0);
+    LogPrintf("Replaying blocks\n");
+
+    CBlockIndex* pindexOld = NULL;  // Old tip during the interrupted flush.
+    CBlockIndex* pindexNew;         // New tip during the interrupted flush.
+    CBlockIndex* pindexFork = NULL; // Latest block common to both the old and the new tip.
+
+    if (mapBlockIndex.count(hashHeads[0]) == 0)
+        return error("ReplayBlocks(): reorganization to unknown block requested");
+    pindexNew = mapBlockIndex[hashHeads[0]];
+
+    if (!hashHeads[1].IsNull()) { // The old tip is allowed to be 0, indicating it's the first flush.
+        if (mapBlockIndex.count(hashHeads[1]) == 0)
+            return error("ReplayBlocks(): reorganization from unknown block requested");
+        pindexOld = mapBlockIndex[hashHeads[1]];
+        pindexFork = LastCommonAncestor(pindexOld, pindexNew);
+        assert(pindexFork != NULL);
+    }
+
+    // Rollback along the old branch.
+    while (pindexOld != pindexFork) {
+        if (pindexOld->nHeight > 0) { // Never disconnect the genesis block.
+            CBlock block;
+            if (!ReadBlockFromDisk(block, pindexOld, params.GetConsensus()))
+                return error("RollbackBlock(): ReadBlockFromDisk() failed at %d, hash=%s", pindexOld->nHeight, pindexOld->GetBlockHash().ToString());
+            LogPrintf("Rolling back %s (%i)\n", pindexOld->GetBlockHash().ToString(), pindexOld->nHeight);
+            // Undoing coins that were never written is harmless, as both
+            // writing and deleting a coin are idempotent: the result is the
+            // UTXO set without the block either way
+            CValidationState state;
+            bool fClean;
+            cache.SetBestBlock(pindexOld->GetBlockHash());
+            if (!DisconnectBlock(block, state, pindexOld, cache, &fClean))
+                return error("RollbackBlock(): DisconnectBlock failed at %d, hash=%s", pindexOld->nHeight, pindexOld->GetBlockHash().ToString());
+        }
+        pindexOld = pindexOld->pprev;
+    }
+
+    // Roll forward from the forking point to the new tip.
+    int nForkHeight = pindexFork ? pindexFork->nHeight : 0;
+    for (int nHeight = nForkHeight + 1; nHeight <= pindexNew->nHeight; ++nHeight) {
+        const CBlockIndex* pindex = pindexNew->GetAncestor(nHeight);
+        LogPrintf("Rolling forward %s (%i)\n", pindex->GetBlockHash().ToString(), nHeight);
+        if (!RollforwardBlock(pindex, cache, params)) return false;
+    }
+
+    cache.SetBestBlock(pindexNew->GetBlockHash());
+    cache.Flush();
+    uiInterface.ShowProgress("", 100);
+    return true;
+}
+
+//! Coins read from a snapshot per write to the coins database
+static const size_t SNAPSHOT_LOAD_BATCH = 1 << 16;
+
+/**
+ * Read the coins of a snapshot, and the hash_serialized they add up to. With
+ * fWrite they are also loaded into pcoinsdbview, and added to pstats if given.
+ */
+static bool ReadSnapshotCoins(CAutoFile& file, const CSnapshotMetadata& metadata, bool fWrite, uint256& hashSerialized, CRollingCoinsStats* pstats = NULL)
+{
+    CCoinsStats stats;
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    ss << metadata.hashBlock;
+    std::vector<std::pair<COutPoint, Coin> > vBatch;
+    uint256 hashPrev;
+    uint64_t nCoins = 0;
+    while (nCoins < metadata.nCoins) {
+        if (ShutdownRequested())
+            return false;
+        uint256 txid;
+        file >> txid;
+        uint64_t nOutputs = ReadCompactSize(file);
+        if ((nCoins > 0 && !(hashPrev < txid)) || nOutputs == 0 || nOutputs > metadata.nCoins - nCoins)
+            return error("%s: malformed snapshot at transaction %s", __func__, txid.ToString());
+        std::map<uint32_t, Coin> outputs;
+        for (uint64_t i = 0; i < nOutputs; i++) {
+            uint64_t n = ReadCompactSize(file);
+            Coin coin;
+            file >> coin;
+            if (n > std::numeric_limits<uint32_t>::max() || (!outputs.empty() && n <= outputs.rbegin()->first) || coin.IsSpent() || coin.nHeight > (uint32_t)metadata.nHeight)
+                return error("%s: malformed snapshot at output %s:%u", __func__, txid.ToString(), n);
+            outputs[n] = std::move(coin);
+        }
+        ApplyStats(stats, ss, txid, outputs);
+        hashPrev = txid;
+        nCoins += nOutputs;
+
+        if (fWrite) {
+            for (std::map<uint32_t, Coin>::iterator it = outputs.begin(); it != outputs.end(); ++it) {
+                if (pstats)
+                    pstats->AddCoin(COutPoint(txid, it->first), it->second);
+                vBatch.push_back(std::make_pair(COutPoint(txid, it->first), std::move(it->second)));
+            }
+            if (vBatch.size() >= SNAPSHOT_LOAD_BATCH) {
+                if (!pcoinsdbview->LoadCoins(vBatch, metadata.hashBlock, false))
+                    return error("%s: failed to write to coin database", __func__);
+                vBatch.clear();
+            }
+        }
+    }
+    if (fWrite && !pcoinsdbview->LoadCoins(vBatch, metadata.hashBlock, true))
+        return error("%s: failed to write to coin database", __func__);
+    hashSerialized = ss.GetHash();
+    return true;
+}
+
+bool LoadTxOutSet(const CChainParams& chainparams, const boost::filesystem::path& path)
+{
+    // Connect the genesis block, as the import thread would, so that the
+    // headers are checked against an active chain
+    CValidationState stateGenesis;
+    if (!ActivateBestChain(stateGenesis, chainparams))
+        return error("%s: failed to connect the genesis block: %s", __func__, FormatStateMessage(stateGenesis));
+
+    LOCK(cs_main);
+
+    CAutoFile file(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull())
+        return error("%s: unable to open %s", __func__, path.string());
+
+    CBlockIndex* pindexSnapshot;
+    try {
+        CSnapshotMetadata metadata;
+        file >> metadata;
+
+        BlockMap::iterator mi = mapBlockIndex.find(metadata.hashBlock);
+        if (mi != mapBlockIndex.end() && chainActive.Contains(mi->second)) {
+            LogPrintf("%s: the active chain already contains block %s\n", __func__, metadata.hashBlock.ToString());
+            return true;
+        }
+        if (chainActive.Tip() == NULL || chainActive.Height() != 0 || pcoinsTip->GetBestBlock() != chainActive.Tip()->GetBlockHash())
+            return error("%s: a snapshot can only be loaded into a fresh chainstate", __func__);
+        MapSnapshots::const_iterator itSnapshot = chainparams.Snapshots().find(metadata.nHeight);
+        if (itSnapshot == chainparams.Snapshots().end() || itSnapshot->second.hashBlock != metadata.hashBlock)
+            return error("%s: no snapshot of block %s is pinned for this chain", __func__, metadata.hashBlock.ToString());
+        LogPrintf("Loading UTXO set snapshot of block %s (height %d, %u coins)\n", metadata.hashBlock.ToString(), metadata.nHeight, metadata.nCoins);
+
+        // The headers get the same checks as headers from peers
+        std::vector<CBlockIndex*> vIndex;
+        std::vector<unsigned int> vTx;
+        pindexSnapshot = chainActive.Tip();
+        for (int nHeight = 1; nHeight <= metadata.nHeight; nHeight++) {
+            if (ShutdownRequested())
+                return false;
+            CBlockHeader header;
+            unsigned int nTx;
+            file >> header >> VARINT(nTx);
+            CValidationState state;
+            if (header.hashPrevBlock != pindexSnapshot->GetBlockHash() || nTx == 0 || !AcceptBlockHeader(header, state, chainparams, &pindexSnapshot))
+                return error("%s: invalid header at height %d", __func__, nHeight);
+            vIndex.push_back(pindexSnapshot);
+            vTx.push_back(nTx);
+        }
+        if (pindexSnapshot->GetBlockHash() != metadata.hashBlock)
+            return error("%s: the headers do not lead to block %s", __func__, metadata.hashBlock.ToString());
+
+        // Nothing is written before the coins are known to be the pinned ones
+        const long nCoinsPos = ftell(file.Get());
+        uint256 hashSerialized;
+        if (!ReadSnapshotCoins(file, metadata, false, hashSerialized))
+            return false;
+        if (hashSerialized != itSnapshot->second.hashSerialized)
+            return error("%s: the coins hash to %s, not to the pinned %s", __func__, hashSerialized.ToString(), itSnapshot->second.hashSerialized.ToString());
+        if (nCoinsPos < 0 || fseek(file.Get(), nCoinsPos, SEEK_SET) != 0)
+            return error("%s: unable to seek in %s", __func__, path.string());
+
+        // The coins go straight to the database, under an empty cache
+        if (!pcoinsTip->Flush())
+            return error("%s: failed to write to coin database", __func__);
+        const CRollingCoinsStats statsGenesis = coinsStatsTip;
+        coinsStatsTip = CRollingCoinsStats();
+        bool fLoaded = false;
+        try {
+            fLoaded = ReadSnapshotCoins(file, metadata, true, hashSerialized, &coinsStatsTip);
+        } catch (const std::exception& e) {
+            LogPrintf("%s: %s: %s\n", __func__, path.string(), e.what());
+        }
+        if (!fLoaded) {
+            // Go back to the genesis block rather than leave the database
+            // halfway into the snapshot, which neither the flush at shutdown
+            // nor the next start could continue from
+            coinsStatsTip = statsGenesis;
+            pcoinsTip->SetBestBlock(chainActive.Tip()->GetBlockHash());
+            if (!pcoinsdbview->AbortLoadCoins(metadata.hashBlock))
+                return AbortNode("Failed to roll back the partially loaded UTXO set snapshot");
+            return false;
+        }
+        coinsStatsTip.hashBlock = metadata.hashBlock;
+        pcoinsTip->SetBestBlock(metadata.hashBlock);
+
+        // The blocks below the snapshot count as validated and pruned
+        for (size_t i = 0; i < vIndex.size(); i++) {
+            CBlockIndex* pindex = vIndex[i];
+            pindex->nTx = vTx[i];
+            pindex->nChainTx = pindex->pprev->nChainTx + pindex->nTx;
+            pindex->RaiseValidity(BLOCK_VALID_SCRIPTS);
+            if (IsWitnessEnabled(pindex->pprev, chainparams.GetConsensus()))
+                pindex->nStatus |= BLOCK_OPT_WITNESS;
+            setDirtyBlockIndex.insert(pindex);
+        }
+    } catch (const std::exception& e) {
+        return error("%s: %s: %s", __func__, path.string(), e.what());
+    }
+
+    fSnapshotChainstate = true;
+    pblocktree->WriteFlag("snapshotchainstate", true);
+    chainActive.SetTip(pindexSnapshot);
+    setBlockIndexCandidates.insert(pindexSnapshot);
+    PruneBlockIndexCandidates();
+    CValidationState state;
+    if (!FlushStateToDisk(state, FLUSH_STATE_ALWAYS))
+        return false;
+    CheckBlockIndex(chainparams.GetConsensus());
+
+    LogPrintf("%s: hashBestChain=%s height=%d date=%s\n", __func__,
+        chainActive.Tip()->GetBlockHash().ToString(), chainActive.Height(),
+        DateTimeStrFormat("%Y-%m-%d %H:%M:%S", chainActive.Tip()->GetBlockTime()));
+    return true;
+}
+
 CVerifyDB::CVerifyDB()
 {
     uiInterface.ShowProgress(_("Verifying blocks..."), 0);
@@ -4274,8 +4915,8 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
         uiInterface.ShowProgress(_("Verifying blocks..."), percentageDone);
         if (pindex->nHeight < chainActive.Height()-nCheckDepth)
             break;
-        if (fPruneMode && !(pindex->nStatus & BLOCK_HAVE_DATA)) {
-            // If pruning, only go back as far as we have data.
+        if ((fPruneMode || fSnapshotChainstate) && !(pindex->nStatus & BLOCK_HAVE_DATA)) {
+            // If pruning, or below a snapshot, only go back as far as we have data.
             LogPrintf("VerifyDB(): block verification stopping at height %d (pruning, no data)\n", pindex->nHeight);
             break;
         }
@@ -4351,8 +4992,8 @@ bool RewindBlockIndex(const CChainParams& params)
     CValidationState state;
     CBlockIndex* pindex = chainActive.Tip();
     while (chainActive.Height() >= nHeight) {
-        if (fPruneMode && !(chainActive.Tip()->nStatus & BLOCK_HAVE_DATA)) {
-            // If pruning, don't try rewinding past the HAVE_DATA point;
+        if ((fPruneMode || fSnapshotChainstate) && !(chainActive.Tip()->nStatus & BLOCK_HAVE_DATA)) {
+            // If pruning, or below a snapshot, don't try rewinding past the HAVE_DATA point;
             // since older blocks can't be served anyway, there's
             // no need to walk further, and trying to DisconnectTip()
             // will fail (and require a needless reindex/redownload
@@ -4451,6 +5092,8 @@ void UnloadBlockIndex()
     }
     mapBlockIndex.clear();
     fHavePruned = false;
+    fSnapshotChainstate = false;
+    coinsStatsTip = CRollingCoinsStats();
 }
 
 bool LoadBlockIndex()
@@ -4506,13 +5149,73 @@ bool InitBlockIndex(const CChainParams& chainparams)
     return true;
 }
 
-bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp)
+namespace {
+
+/** A block found in a file being imported, on its way through CBlockImportQueue */
+struct CImportRecord
 {
-    // Map of disk positions for blocks with unknown parent (only used for reindex)
-    static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
-    int64_t nStart = GetTimeMillis();
+    //! Position and size of the block in the file
+    unsigned int nPos;
+    unsigned int nSize;
+    //! The serialized block; kept only if it cannot be deserialized
+    std::vector<char> vData;
+    //! Set once a worker is done with the record
+    bool fParsed;
+    bool fDeserialized;
+    std::string strError;
+    CBlock block;
+    uint256 hash;
+    //! Whether the block passed CheckBlock, and so its proof of work
+    bool fChecked;
+    uint256 hashPoW;
 
-    int nLoaded = 0;
+    CImportRecord(unsigned int nPosIn, unsigned int nSizeIn) : nPos(nPosIn), nSize(nSizeIn), fParsed(false), fDeserialized(false), fChecked(false) {}
+};
+
+/**
+ * Pipeline feeding LoadExternalBlockFile. A reader thread finds the blocks
+ * in the file and queues them in file order, worker threads deserialize them
+ * and run the context-free checks (block hash, merkle root, proof of work),
+ * and the thread importing the file takes them off the front of the queue
+ * to add them to the block index one at a time. The queue holds at most
+ * MAX_IMPORT_QUEUE_SIZE bytes of blocks, so the reader can only get that far
+ * ahead.
+ */
+class CBlockImportQueue
+{
+private:
+    boost::mutex cs;
+    //! Wakes the reader when there is room in the queue
+    boost::condition_variable cvReader;
+    //! Wakes the workers when there is a record to parse
+    boost::condition_variable cvWorker;
+    //! Wakes the importing thread when a record is parsed
+    boost::condition_variable cvParsed;
+    //! Records in file order
+    std::deque<std::unique_ptr<CImportRecord> > queue;
+    //! Records no worker has taken yet
+    std::deque<CImportRecord*> queueToParse;
+    size_t nQueuedSize;
+    bool fReaderDone;
+    bool fStop;
+
+public:
+    //! Set if reading the file failed in a way that needs the node to stop
+    std::string strReadError;
+
+    CBlockImportQueue() : nQueuedSize(0), fReaderDone(false), fStop(false) {}
+
+    void ReaderThread(FILE* fileIn, const CChainParams& chainparams);
+    void WorkerThread(const Consensus::Params& consensusParams);
+    /** Take the next record in file order once parsed; false when there are no more */
+    bool Pop(std::unique_ptr<CImportRecord>& record);
+    /** Make the reader and workers return */
+    void Stop();
+};
+
+void CBlockImportQueue::ReaderThread(FILE* fileIn, const CChainParams& chainparams)
+{
+    RenameThread("testcoin-loadblkrd");
     try {
         // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
         CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SERIALIZED_SIZE, MAX_BLOCK_SERIALIZED_SIZE+8, SER_DISK, CLIENT_VERSION);
@@ -4540,82 +5243,254 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
                 // no valid block header found; don't complain
                 break;
             }
+            std::unique_ptr<CImportRecord> record(new CImportRecord(blkdat.GetPos(), nSize));
             try {
                 // read block
-                uint64_t nBlockPos = blkdat.GetPos();
-                if (dbp)
-                    dbp->nPos = nBlockPos;
-                blkdat.SetLimit(nBlockPos + nSize);
-                blkdat.SetPos(nBlockPos);
-                CBlock block;
-                blkdat >> block;
+                blkdat.SetLimit(record->nPos + nSize);
+                record->vData.resize(nSize);
+                blkdat.read(&record->vData[0], nSize);
                 nRewind = blkdat.GetPos();
+            } catch (const std::exception& e) {
+                LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+                continue;
+            }
 
-                // detect out of order blocks, and store them for later
-                uint256 hash = block.GetHash();
-                if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
-                    LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
-                            block.hashPrevBlock.ToString());
-                    if (dbp)
-                        mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
-                    continue;
-                }
+            boost::unique_lock<boost::mutex> lock(cs);
+            while (nQueuedSize > 0 && nQueuedSize + nSize > MAX_IMPORT_QUEUE_SIZE && !fStop)
+                cvReader.wait(lock);
+            if (fStop)
+                break;
+            nQueuedSize += nSize;
+            queueToParse.push_back(record.get());
+            queue.push_back(std::move(record));
+            cvWorker.notify_one();
+        }
+    } catch (const std::runtime_error& e) {
+        boost::unique_lock<boost::mutex> lock(cs);
+        strReadError = e.what();
+    }
 
-                // process in case the block isn't known yet
-                if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
-                    LOCK(cs_main);
-                    CValidationState state;
-                    if (AcceptBlock(block, state, chainparams, NULL, true, dbp, NULL))
-                        nLoaded++;
-                    if (state.IsError())
-                        break;
-                } else if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex[hash]->nHeight % 1000 == 0) {
-                    LogPrint("reindex", "Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
-                }
+    boost::unique_lock<boost::mutex> lock(cs);
+    fReaderDone = true;
+    cvWorker.notify_all();
+    cvParsed.notify_all();
+}
 
-                // Activate the genesis block so normal node progress can continue
-                if (hash == chainparams.GetConsensus().hashGenesisBlock) {
-                    CValidationState state;
-                    if (!ActivateBestChain(state, chainparams)) {
-                        break;
-                    }
+void CBlockImportQueue::WorkerThread(const Consensus::Params& consensusParams)
+{
+    RenameThread("testcoin-loadblkchk");
+    while (true) {
+        CImportRecord* record;
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            while (queueToParse.empty() && !fReaderDone && !fStop)
+                cvWorker.wait(lock);
+            if (queueToParse.empty() || fStop)
+                return;
+            record = queueToParse.front();
+            queueToParse.pop_front();
+        }
+
+        try {
+            CDataStream ss(record->vData, SER_DISK, CLIENT_VERSION);
+            ss >> record->block;
+            record->fDeserialized = true;
+            std::vector<char>().swap(record->vData);
+        } catch (const std::exception& e) {
+            record->strError = e.what();
+        }
+        if (record->fDeserialized) {
+            record->hash = record->block.GetHash();
+            // A block failing here is checked again, and dealt with, when it is accepted
+            CValidationState state;
+            record->fChecked = CheckBlock(record->block, state, consensusParams, true, true, &record->hashPoW);
+        }
+
+        boost::unique_lock<boost::mutex> lock(cs);
+        record->fParsed = true;
+        cvParsed.notify_all();
+    }
+}
+
+bool CBlockImportQueue::Pop(std::unique_ptr<CImportRecord>& record)
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    while (!fStop && (queue.empty() ? !fReaderDone : !queue.front()->fParsed))
+        cvParsed.wait(lock);
+    if (fStop || queue.empty())
+        return false;
+    record = std::move(queue.front());
+    queue.pop_front();
+    nQueuedSize -= record->nSize;
+    cvReader.notify_one();
+    return true;
+}
+
+void CBlockImportQueue::Stop()
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    fStop = true;
+    cvReader.notify_all();
+    cvWorker.notify_all();
+    cvParsed.notify_all();
+}
+
+}
+
+/**
+ * Look for blocks inside a record that could not be deserialized, as the
+ * size it was stored with may be wrong. Blocks running past the end of the
+ * record are not found here; the reader has moved on beyond it.
+ */
+static void FindBlocksInRecord(const CChainParams& chainparams, const CImportRecord& record, std::vector<std::pair<unsigned int, CBlock> >& vBlocks)
+{
+    const std::vector<char>& vData = record.vData;
+    size_t nOffset = 0;
+    while (nOffset + MESSAGE_START_SIZE + 4 <= vData.size()) {
+        if (memcmp(&vData[nOffset], chainparams.MessageStart(), MESSAGE_START_SIZE)) {
+            nOffset++;
+            continue;
+        }
+        unsigned int nSize = ReadLE32((const unsigned char*)&vData[nOffset + MESSAGE_START_SIZE]);
+        const size_t nBlockPos = nOffset + MESSAGE_START_SIZE + 4;
+        if (nSize >= 80 && nSize <= vData.size() - nBlockPos) {
+            try {
+                CDataStream ss(&vData[nBlockPos], &vData[nBlockPos] + nSize, SER_DISK, CLIENT_VERSION);
+                CBlock block;
+                ss >> block;
+                vBlocks.push_back(std::make_pair(record.nPos + (unsigned int)nBlockPos, block));
+                nOffset = nBlockPos + nSize;
+                continue;
+            } catch (const std::exception&) {
+            }
+        }
+        nOffset++;
+    }
+}
+
+/**
+ * Add a block read from an external file to the block index, along with the
+ * blocks found earlier whose parent it is. phashPoW, if given, is the already
+ * verified proof-of-work hash of the block. Returns false if the import
+ * cannot go on.
+ */
+static bool ImportBlock(const CChainParams& chainparams, const CBlock& block, const uint256& hash, const uint256* phashPoW, CDiskBlockPos* dbp,
+                        std::multimap<uint256, CDiskBlockPos>& mapBlocksUnknownParent, int& nLoaded)
+{
+    // detect out of order blocks, and store them for later
+    if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
+        LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
+                block.hashPrevBlock.ToString());
+        if (dbp)
+            mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
+        return true;
+    }
+
+    // process in case the block isn't known yet
+    if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
+        LOCK(cs_main);
+        CValidationState state;
+        if (AcceptBlock(block, state, chainparams, NULL, true, dbp, NULL, phashPoW))
+            nLoaded++;
+        if (state.IsError())
+            return false;
+    } else if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex[hash]->nHeight % 1000 == 0) {
+        LogPrint("reindex", "Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
+    }
+
+    // Activate the genesis block so normal node progress can continue
+    if (hash == chainparams.GetConsensus().hashGenesisBlock) {
+        CValidationState state;
+        if (!ActivateBestChain(state, chainparams)) {
+            return false;
+        }
+    }
+
+    NotifyHeaderTip();
+
+    // Recursively process earlier encountered successors of this block
+    deque<uint256> queue;
+    queue.push_back(hash);
+    while (!queue.empty()) {
+        uint256 head = queue.front();
+        queue.pop_front();
+        std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
+        while (range.first != range.second) {
+            std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
+            CBlock child;
+            if (ReadBlockFromDisk(child, it->second, chainparams.GetConsensus()))
+            {
+                LogPrint("reindex", "%s: Processing out of order child %s of %s\n", __func__, child.GetHash().ToString(),
+                        head.ToString());
+                LOCK(cs_main);
+                CValidationState dummy;
+                if (AcceptBlock(child, dummy, chainparams, NULL, true, &it->second, NULL))
+                {
+                    nLoaded++;
+                    queue.push_back(child.GetHash());
                 }
+            }
+            range.first++;
+            mapBlocksUnknownParent.erase(it);
+            NotifyHeaderTip();
+        }
+    }
+    return true;
+}
 
-                NotifyHeaderTip();
-
-                // Recursively process earlier encountered successors of this block
-                deque<uint256> queue;
-                queue.push_back(hash);
-                while (!queue.empty()) {
-                    uint256 head = queue.front();
-                    queue.pop_front();
-                    std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
-                    while (range.first != range.second) {
-                        std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
-                        if (ReadBlockFromDisk(block, it->second, chainparams.GetConsensus()))
-                        {
-                            LogPrint("reindex", "%s: Processing out of order child %s of %s\n", __func__, block.GetHash().ToString(),
-                                    head.ToString());
-                            LOCK(cs_main);
-                            CValidationState dummy;
-                            if (AcceptBlock(block, dummy, chainparams, NULL, true, &it->second, NULL))
-                            {
-                                nLoaded++;
-                                queue.push_back(block.GetHash());
-                            }
-                        }
-                        range.first++;
-                        mapBlocksUnknownParent.erase(it);
-                        NotifyHeaderTip();
+bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp)
+{
+    // Map of disk positions for blocks with unknown parent (only used for reindex)
+    static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
+    int64_t nStart = GetTimeMillis();
+
+    int nLoaded = 0;
+    CBlockImportQueue importQueue;
+    boost::thread_group threads;
+    threads.create_thread(boost::bind(&CBlockImportQueue::ReaderThread, &importQueue, fileIn, boost::cref(chainparams)));
+    const int nWorkers = std::max(nScriptCheckThreads, 1);
+    for (int i = 0; i < nWorkers; i++)
+        threads.create_thread(boost::bind(&CBlockImportQueue::WorkerThread, &importQueue, boost::cref(chainparams.GetConsensus())));
+
+    try {
+        std::unique_ptr<CImportRecord> record;
+        while (importQueue.Pop(record)) {
+            boost::this_thread::interruption_point();
+
+            try {
+                if (!record->fDeserialized) {
+                    LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, record->strError);
+                    std::vector<std::pair<unsigned int, CBlock> > vBlocks;
+                    FindBlocksInRecord(chainparams, *record, vBlocks);
+                    bool fContinue = true;
+                    for (size_t i = 0; i < vBlocks.size() && fContinue; i++) {
+                        if (dbp)
+                            dbp->nPos = vBlocks[i].first;
+                        fContinue = ImportBlock(chainparams, vBlocks[i].second, vBlocks[i].second.GetHash(), NULL, dbp, mapBlocksUnknownParent, nLoaded);
                     }
+                    if (!fContinue)
+                        break;
+                    continue;
                 }
+                if (dbp)
+                    dbp->nPos = record->nPos;
+                if (!ImportBlock(chainparams, record->block, record->hash, record->fChecked ? &record->hashPoW : NULL, dbp, mapBlocksUnknownParent, nLoaded))
+                    break;
             } catch (const std::exception& e) {
                 LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
             }
         }
-    } catch (const std::runtime_error& e) {
-        AbortNode(std::string("System error: ") + e.what());
+    } catch (const boost::thread_interrupted&) {
+        importQueue.Stop();
+        threads.interrupt_all();
+        threads.join_all();
+        throw;
     }
+    importQueue.Stop();
+    threads.join_all();
+
+    if (!importQueue.strReadError.empty())
+        AbortNode(std::string("System error: ") + importQueue.strReadError);
     if (nLoaded > 0)
         LogPrintf("Loaded %i blocks from external file in %dms\n", nLoaded, GetTimeMillis() - nStart);
     return nLoaded > 0;
@@ -4681,12 +5556,13 @@ void static CheckBlockIndex(const Consensus::Params& consensusParams)
         if (pindex->nChainTx == 0) assert(pindex->nSequenceId == 0);  // nSequenceId can't be set for blocks that aren't linked
         // VALID_TRANSACTIONS is equivalent to nTx > 0 for all nodes (whether or not pruning has occurred).
         // HAVE_DATA is only equivalent to nTx > 0 (or VALID_TRANSACTIONS) if no pruning has occurred.
-        if (!fHavePruned) {
+        if (!fHavePruned && !fSnapshotChainstate) {
             // If we've never pruned, then HAVE_DATA should be equivalent to nTx > 0
             assert(!(pindex->nStatus & BLOCK_HAVE_DATA) == (pindex->nTx == 0));
             assert(pindexFirstMissing == pindexFirstNeverProcessed);
         } else {
-            // If we have pruned, then we can only say that HAVE_DATA implies nTx > 0
+            // If we have pruned, or skipped the blocks below a snapshot, then
+            // we can only say that HAVE_DATA implies nTx > 0
             if (pindex->nStatus & BLOCK_HAVE_DATA) assert(pindex->nTx > 0);
         }
         if (pindex->nStatus & BLOCK_HAVE_UNDO) assert(pindex->nStatus & BLOCK_HAVE_DATA);
@@ -4740,7 +5616,7 @@ void static CheckBlockIndex(const Consensus::Params& consensusParams)
         if (pindexFirstMissing == NULL) assert(!foundInUnlinked); // We aren't missing data for any parent -- cannot be in mapBlocksUnlinked.
         if (pindex->pprev && (pindex->nStatus & BLOCK_HAVE_DATA) && pindexFirstNeverProcessed == NULL && pindexFirstMissing != NULL) {
             // We HAVE_DATA for this block, have received data for all parents at some point, but we're currently missing data for some parent.
-            assert(fHavePruned); // We must have pruned.
+            assert(fHavePruned || fSnapshotChainstate); // We must have pruned, or started from a snapshot.
             // This block may have entered mapBlocksUnlinked if:
             //  - it has a descendant that at some point had more work than the
             //    tip, and
@@ -4878,12 +5754,13 @@ bool static AlreadyHave(const CInv& inv) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
                 recentRejects->reset();
             }
 
-            // Use pcoinsTip->HaveCoinsInCache as a quick approximation to exclude
+            // Use pcoinsTip->HaveCoinInCache as a quick approximation to exclude
             // requesting or processing some txs which have already been included in a block
             return recentRejects->contains(inv.hash) ||
                    mempool.exists(inv.hash) ||
                    mapOrphanTransactions.count(inv.hash) ||
-                   pcoinsTip->HaveCoinsInCache(inv.hash);
+                   pcoinsTip->HaveCoinInCache(COutPoint(inv.hash, 0)) || // Best effort: only try output 0 and 1
+                   pcoinsTip->HaveCoinInCache(COutPoint(inv.hash, 1));
         }
     case MSG_BLOCK:
     case MSG_WITNESS_BLOCK:
@@ -6048,6 +6925,36 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             ReadCompactSize(vRecv); // ignore tx count; assume it is 0.
         }
 
+        // Check the proof of work of all headers we don't know yet in parallel
+        // and without cs_main; AcceptBlockHeader then skips the ones that passed.
+        // Only a run that connects to our index is hashed up front, so that an
+        // unconnecting or broken sequence costs no more than it would serially.
+        std::vector<char> vPowChecked(nCount, 0);
+        std::vector<uint256> vHashPoW(nCount);
+        if (nCount > 0) {
+            std::vector<const CBlockHeader*> vpHeaders;
+            {
+                LOCK(cs_main);
+                if (mapBlockIndex.count(headers[0].hashPrevBlock)) {
+                    uint256 hashPrev = headers[0].hashPrevBlock;
+                    BOOST_FOREACH(const CBlockHeader& header, headers) {
+                        if (header.hashPrevBlock != hashPrev)
+                            break;
+                        hashPrev = header.GetHash();
+                        if (!mapBlockIndex.count(hashPrev))
+                            vpHeaders.push_back(&header);
+                    }
+                }
+            }
+            std::vector<char> vValid;
+            std::vector<uint256> vHash;
+            CheckProofOfWorkBatch(vpHeaders, vValid, vHash, chainparams.GetConsensus());
+            for (size_t i = 0; i < vpHeaders.size(); i++) {
+                vPowChecked[vpHeaders[i] - &headers[0]] = vValid[i];
+                vHashPoW[vpHeaders[i] - &headers[0]] = vHash[i];
+            }
+        }
+
         {
         LOCK(cs_main);
 
@@ -6086,13 +6993,14 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         }
 
         CBlockIndex *pindexLast = NULL;
-        BOOST_FOREACH(const CBlockHeader& header, headers) {
+        for (unsigned int n = 0; n < nCount; n++) {
+            const CBlockHeader& header = headers[n];
             CValidationState state;
             if (pindexLast != NULL && header.hashPrevBlock != pindexLast->GetBlockHash()) {
                 Misbehaving(pfrom->GetId(), 20);
                 return error("non-continuous headers sequence");
             }
-            if (!AcceptBlockHeader(header, state, chainparams, &pindexLast)) {
+            if (!AcceptBlockHeader(header, state, chainparams, &pindexLast, vPowChecked[n] ? &vHashPoW[n] : NULL)) {
                 int nDoS;
                 if (state.IsInvalid(nDoS)) {
                     if (nDoS > 0)
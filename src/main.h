@@ -33,7 +33,10 @@
 class CBlockIndex;
 class CBlockTreeDB;
 class CBloomFilter;
+class CCoinsViewDB;
+class CCoinsViewPrefetch;
 class CChainParams;
+class CRollingCoinsStats;
 class CInv;
 class CScriptCheck;
 class CTxMemPool;
@@ -78,6 +81,8 @@ static const unsigned int MAX_BLOCKFILE_SIZE = 0x8000000; // 128 MiB
 static const unsigned int BLOCKFILE_CHUNK_SIZE = 0x1000000; // 16 MiB
 /** The pre-allocation chunk size for rev?????.dat files (since 0.8) */
 static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
+/** Maximum size of the blocks LoadExternalBlockFile reads ahead of the one being added to the block index */
+static const size_t MAX_IMPORT_QUEUE_SIZE = 64 << 20;
 
 /** Maximum number of script-checking threads allowed */
 static const int MAX_SCRIPTCHECK_THREADS = 16;
@@ -133,6 +138,7 @@ static const int64_t DEFAULT_MAX_TIP_AGE = 24 * 60 * 60;
 static const bool DEFAULT_PERMIT_BAREMULTISIG = true;
 static const bool DEFAULT_CHECKPOINTS_ENABLED = true;
 static const bool DEFAULT_TXINDEX = false;
+static const bool DEFAULT_CHECKBLOCKINDEXPOW = false;
 static const unsigned int DEFAULT_BANSCORE_THRESHOLD = 100;
 
 static const bool DEFAULT_TESTSAFEMODE = false;
@@ -173,6 +179,8 @@ extern bool fIsBareMultisigStd;
 extern bool fRequireStandard;
 extern bool fCheckBlockIndex;
 extern bool fCheckpointsEnabled;
+/** Block hash whose ancestors we will assume to have valid scripts without checking them. */
+extern uint256 hashAssumeValid;
 extern size_t nCoinCacheUsage;
 /** A fee rate smaller than this is considered zero fee (for relaying, mining and transaction creation) */
 extern CFeeRate minRelayTxFee;
@@ -191,6 +199,8 @@ static const uint64_t nMinDiskSpace = 52428800;
 /** Pruning-related variables and constants */
 /** True if any block files have ever been pruned. */
 extern bool fHavePruned;
+/** True if the chainstate was loaded from a UTXO set snapshot, so the blocks below it were never downloaded. */
+extern bool fSnapshotChainstate;
 /** True if we're running in -prune mode. */
 extern bool fPruneMode;
 /** Number of MiB of block files that we're trying to stay below. */
@@ -245,6 +255,16 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
 bool InitBlockIndex(const CChainParams& chainparams);
 /** Load the block tree and coins database from disk */
 bool LoadBlockIndex();
+/** Finish applying the blocks a coins database write was interrupted in */
+bool ReplayBlocks(const CChainParams& params, CCoinsViewDB* view);
+/** Set the active chain to the best block of the coins database */
+bool LoadChainTip(const CChainParams& chainparams);
+/** Load the statistics of the UTXO set, or compute them if the coins database has none for its best block */
+bool LoadCoinsStats();
+/** Statistics of the UTXO set as of the active chain tip */
+CRollingCoinsStats GetTipCoinsStats();
+/** Load a UTXO set snapshot written by dumptxoutset into a fresh chainstate; true if loaded or the active chain is past it already */
+bool LoadTxOutSet(const CChainParams& chainparams, const boost::filesystem::path& path);
 /** Unload database information */
 void UnloadBlockIndex();
 /** Process protocol messages received from a given node */
@@ -257,6 +277,12 @@ bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the proof-of-work checking thread */
+void ThreadPowCheck();
+/** Run an instance of the signature hash precomputation thread */
+void ThreadTxDataPrecompute();
+/** Recompute the PoW hash of every block index entry in the background (-checkblockindexpow) */
+void ThreadCheckBlockIndexPoW();
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload();
 /** Format a string that describes several potential problems detected by the core.
@@ -272,6 +298,8 @@ bool GetTransaction(const uint256 &hash, CTransaction &tx, const Consensus::Para
 /** Find the best known block, and make it the tip of the block chain */
 bool ActivateBestChain(CValidationState& state, const CChainParams& chainparams, const CBlock* pblock = NULL);
 CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams);
+/** Sum of GetBlockSubsidy() over heights 1 to nHeight: the most coin blocks up to nHeight can have created, not counting the unspendable genesis output */
+CAmount GetTotalSupply(int nHeight, const Consensus::Params& consensusParams);
 
 /**
  * Prune block and undo files (blk???.dat and undo???.dat) so that the disk space used is less than a user-defined target.
@@ -421,8 +449,8 @@ private:
 
 public:
     CScriptCheck(): amount(0), ptxTo(0), nIn(0), nFlags(0), cacheStore(false), error(SCRIPT_ERR_UNKNOWN_ERROR) {}
-    CScriptCheck(const CCoins& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn, PrecomputedTransactionData* txdataIn) :
-        scriptPubKey(txFromIn.vout[txToIn.vin[nInIn].prevout.n].scriptPubKey), amount(txFromIn.vout[txToIn.vin[nInIn].prevout.n].nValue),
+    CScriptCheck(const CTxOut& outIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn, PrecomputedTransactionData* txdataIn) :
+        scriptPubKey(outIn.scriptPubKey), amount(outIn.nValue),
         ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), error(SCRIPT_ERR_UNKNOWN_ERROR), txdata(txdataIn) { }
 
     bool operator()();
@@ -441,6 +469,68 @@ public:
     ScriptError GetScriptError() const { return error; }
 };
 
+/**
+ * Closure computing the signature hash data CScriptChecks of one transaction
+ * share. Never fails.
+ */
+class CTxDataPrecompute
+{
+private:
+    const CTransaction *ptx;
+    PrecomputedTransactionData *ptxdata;
+
+public:
+    CTxDataPrecompute(): ptx(NULL), ptxdata(NULL) {}
+    CTxDataPrecompute(const CTransaction& txIn, PrecomputedTransactionData* ptxdataIn) : ptx(&txIn), ptxdata(ptxdataIn) { }
+
+    bool operator()();
+
+    void swap(CTxDataPrecompute &check) {
+        std::swap(ptx, check.ptx);
+        std::swap(ptxdata, check.ptxdata);
+    }
+};
+
+/**
+ * Closure representing the proof-of-work check of a run of block headers,
+ * sized to fill one pass of the multi-hash scrypt kernel.
+ * phashPoW[i] receives the PoW hash of each header, and pfValid[i] is set for
+ * every header whose PoW hash meets its nBits target.
+ */
+class CPowCheck
+{
+private:
+    const CBlockHeader * const *ppHeader;
+    size_t nCount;
+    uint256 *phashPoW;
+    char *pfValid;
+    const Consensus::Params *pparams;
+
+public:
+    CPowCheck(): ppHeader(NULL), nCount(0), phashPoW(NULL), pfValid(NULL), pparams(NULL) {}
+    CPowCheck(const CBlockHeader * const *ppHeaderIn, size_t nCountIn, uint256 *phashPoWIn, char *pfValidIn, const Consensus::Params& paramsIn) :
+        ppHeader(ppHeaderIn), nCount(nCountIn), phashPoW(phashPoWIn), pfValid(pfValidIn), pparams(&paramsIn) { }
+
+    bool operator()();
+
+    void swap(CPowCheck &check) {
+        std::swap(ppHeader, check.ppHeader);
+        std::swap(nCount, check.nCount);
+        std::swap(phashPoW, check.phashPoW);
+        std::swap(pfValid, check.pfValid);
+        std::swap(pparams, check.pparams);
+    }
+};
+
+/**
+ * Check the proof of work of many headers at once, spread over the PoW
+ * checking threads. Does not require cs_main. On return vValid[i] is 1 for
+ * every header confirmed to pass, and vHashPoW[i] holds its PoW hash; headers
+ * left at 0 either failed or were skipped after another failure and must be
+ * checked again individually.
+ */
+void CheckProofOfWorkBatch(const std::vector<const CBlockHeader*>& vpHeaders, std::vector<char>& vValid, std::vector<uint256>& vHashPoW, const Consensus::Params& consensusParams);
+
 
 /** Functions for disk access for blocks */
 bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
@@ -450,8 +540,8 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus
 /** Functions for validating blocks and updating the block tree */
 
 /** Context-independent validity checks */
-bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW = true);
-bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW = true, bool fCheckMerkleRoot = true);
+bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW = true, uint256* phashPoW = NULL);
+bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW = true, bool fCheckMerkleRoot = true, uint256* phashPoW = NULL);
 
 /** Context-dependent validity checks.
  *  By "context", we mean only the previous block headers, but not the UTXO
@@ -461,15 +551,17 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
 
 /** Apply the effects of this block (with given index) on the UTXO set represented by coins.
  *  Validity checks that depend on the UTXO set are also done; ConnectBlock()
- *  can fail if those validity checks fail (among other reasons). */
+ *  can fail if those validity checks fail (among other reasons). The changes
+ *  to the UTXO set statistics are added to pstatsDelta, if given. */
 bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins,
-                  const CChainParams& chainparams, bool fJustCheck = false);
+                  const CChainParams& chainparams, bool fJustCheck = false, CRollingCoinsStats* pstatsDelta = NULL);
 
 /** Undo the effects of this block (with given index) on the UTXO set represented by coins.
  *  In case pfClean is provided, operation will try to be tolerant about errors, and *pfClean
  *  will be true if no problems were found. Otherwise, the return value will be false in case
- *  of problems. Note that in any case, coins may be modified. */
-bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& coins, bool* pfClean = NULL);
+ *  of problems. Note that in any case, coins may be modified. The changes to the UTXO set
+ *  statistics are added to pstatsDelta, if given. */
+bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& coins, bool* pfClean = NULL, CRollingCoinsStats* pstatsDelta = NULL);
 
 /** Check a block is completely valid from start to finish (only works on top of our current best block, with cs_main held) */
 bool TestBlockValidity(CValidationState& state, const CChainParams& chainparams, const CBlock& block, CBlockIndex* pindexPrev, bool fCheckPOW = true, bool fCheckMerkleRoot = true);
@@ -506,6 +598,12 @@ bool ResetBlockFailureFlags(CBlockIndex *pindex);
 /** The currently-connected chain of blocks (protected by cs_main). */
 extern CChain chainActive;
 
+/** Global variable that points to the coins database (protected by cs_main) */
+extern CCoinsViewDB *pcoinsdbview;
+
+/** Global variable that points to the prefetched coins under pcoinsTip, if any */
+extern CCoinsViewPrefetch *pcoinsprefetch;
+
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern CCoinsViewCache *pcoinsTip;
 
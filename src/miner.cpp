@@ -25,9 +25,11 @@
 #include "txmempool.h"
 #include "util.h"
 #include "utilmoneystr.h"
+#include "utilstrencodings.h"
 #include "validationinterface.h"
 
 #include <algorithm>
+#include <atomic>
 #include <boost/thread.hpp>
 #include <boost/tuple/tuple.hpp>
 #include <queue>
@@ -197,6 +199,7 @@ CBlockTemplate* BlockAssembler::CreateNewBlock(const CScript& scriptPubKeyIn)
     pblock->nBits          = GetNextWorkRequired(pindexPrev, pblock, chainparams.GetConsensus());
     pblock->nNonce         = 0;
     pblocktemplate->vTxSigOpsCost[0] = WITNESS_SCALE_FACTOR * GetLegacySigOpCount(pblock->vtx[0]);
+    pblocktemplate->vCoinbaseMerkleBranch = BlockMerkleBranch(*pblock, 0);
 
     CValidationState state;
     if (!TestBlockValidity(state, chainparams, *pblock, pindexPrev, false, false)) {
@@ -596,7 +599,7 @@ void BlockAssembler::addPriorityTxs()
     fNeedSizeAccounting = fSizeAccounting;
 }
 
-void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce)
+void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce, const std::vector<uint256>* pvCoinbaseMerkleBranch)
 {
     // Update nExtraNonce
     static uint256 hashPrevBlock;
@@ -612,5 +615,191 @@ void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned
     assert(txCoinbase.vin[0].scriptSig.size() <= 100);
 
     pblock->vtx[0] = txCoinbase;
-    pblock->hashMerkleRoot = BlockMerkleRoot(*pblock);
+    if (pvCoinbaseMerkleBranch)
+        pblock->hashMerkleRoot = ComputeMerkleRootFromBranch(pblock->vtx[0].GetHash(), *pvCoinbaseMerkleBranch, 0);
+    else
+        pblock->hashMerkleRoot = BlockMerkleRoot(*pblock);
+}
+
+static void ScanNoncesThread(CBlockHeader* pheader, uint32_t nNonceEnd, std::atomic<uint64_t>* pnTries, std::atomic<bool>* pfFound, char* scratchpad, const Consensus::Params* pparams, char* pfSolved)
+{
+    const uint32_t nLanes = scrypt_multi_lanes();
+    uint256 vHash[SCRYPT_MAX_LANES];
+    char* vOutput[SCRYPT_MAX_LANES];
+    for (uint32_t i = 0; i < nLanes; i++)
+        vOutput[i] = BEGIN(vHash[i]);
+    // Only the nonce changes, so set up the part of the hash before it once
+    scrypt_header_midstate midstate;
+    scrypt_header_midstate_init(&midstate, BEGIN(pheader->nVersion));
+
+    uint32_t nNonce = pheader->nNonce;
+    while (nNonce < nNonceEnd && !pfFound->load()) {
+        // Claim up to one kernel pass worth of tries from the shared budget
+        uint64_t nWant = std::min(nLanes, nNonceEnd - nNonce);
+        uint64_t nTries = pnTries->load();
+        uint64_t nCount;
+        do {
+            if (nTries == 0) {
+                pheader->nNonce = nNonce;
+                return;
+            }
+            nCount = std::min(nWant, nTries);
+        } while (!pnTries->compare_exchange_weak(nTries, nTries - nCount));
+
+        scrypt_1024_1_1_256_nonces_sp(&midstate, nNonce, vOutput, nCount, scratchpad);
+        for (uint32_t i = 0; i < nCount; i++) {
+            if (CheckProofOfWork(vHash[i], pheader->nBits, *pparams)) {
+                // Only the hashes before the solution count as spent
+                *pnTries += nCount - i;
+                pheader->nNonce = nNonce + i;
+                *pfSolved = 1;
+                *pfFound = true;
+                return;
+            }
+        }
+        nNonce += nCount;
+    }
+    pheader->nNonce = nNonce;
+}
+
+int ScanNonces(std::vector<CBlock>& vBlocks, uint32_t nNonceEnd, uint64_t& nMaxTries, std::vector<std::vector<char> >& vScratchpad, const Consensus::Params& consensusParams)
+{
+    assert(vScratchpad.size() >= vBlocks.size());
+    std::atomic<uint64_t> nTries(nMaxTries);
+    std::atomic<bool> fFound(false);
+    std::vector<char> vSolved(vBlocks.size(), 0);
+
+    if (vBlocks.size() == 1) {
+        ScanNoncesThread(&vBlocks[0], nNonceEnd, &nTries, &fFound, &vScratchpad[0][0], &consensusParams, &vSolved[0]);
+    } else {
+        boost::thread_group threads;
+        for (size_t i = 0; i < vBlocks.size(); i++)
+            threads.create_thread(boost::bind(&ScanNoncesThread, &vBlocks[i], nNonceEnd, &nTries, &fFound, &vScratchpad[i][0], &consensusParams, &vSolved[i]));
+        threads.join_all();
+    }
+
+    nMaxTries = nTries;
+    for (size_t i = 0; i < vBlocks.size(); i++) {
+        if (vSolved[i])
+            return i;
+    }
+    return -1;
+}
+
+namespace {
+
+/** Protects the state of the background template builder below */
+boost::mutex csTemplateBuilder;
+/** Wakes the builder */
+boost::condition_variable cvTemplateBuilder;
+/** Wakes threads waiting for a template */
+boost::condition_variable cvTemplateBuilt;
+/** Set while ThreadBlockTemplateBuilder runs */
+bool fTemplateBuilderRunning = false;
+/** Set once a template was asked for */
+bool fTemplateBuilderActive = false;
+bool fTemplateTipChanged = false;
+std::shared_ptr<const CBlockTemplate> pPrebuiltTemplate;
+/** Mempool fees, transactions updated count and time when pPrebuiltTemplate was built */
+CAmount nPrebuiltMempoolFee = 0;
+unsigned int nPrebuiltTransactionsUpdated = 0;
+int64_t nPrebuiltTime = 0;
+
+class CTemplateBuilderNotifier : public CValidationInterface
+{
+protected:
+    void UpdatedBlockTip(const CBlockIndex *pindex)
+    {
+        boost::lock_guard<boost::mutex> lock(csTemplateBuilder);
+        fTemplateTipChanged = true;
+        cvTemplateBuilder.notify_one();
+    }
+};
+
+} // anon namespace
+
+std::shared_ptr<const CBlockTemplate> GetPrebuiltBlockTemplate(const CBlockIndex* pindexPrev, unsigned int nTransactionsUpdated, int64_t nWaitMillis)
+{
+    boost::unique_lock<boost::mutex> lock(csTemplateBuilder);
+    if (!fTemplateBuilderActive) {
+        fTemplateBuilderActive = true;
+        cvTemplateBuilder.notify_one();
+    }
+    if (!fTemplateBuilderRunning)
+        return std::shared_ptr<const CBlockTemplate>();
+    const uint256 hashPrev = pindexPrev->GetBlockHash();
+    boost::system_time deadline = boost::get_system_time() + boost::posix_time::milliseconds(nWaitMillis);
+    while (!pPrebuiltTemplate || pPrebuiltTemplate->block.hashPrevBlock != hashPrev || nPrebuiltTransactionsUpdated != nTransactionsUpdated) {
+        if (!cvTemplateBuilt.timed_wait(lock, deadline))
+            return std::shared_ptr<const CBlockTemplate>();
+    }
+    return pPrebuiltTemplate;
+}
+
+void ThreadBlockTemplateBuilder(CAmount nFeeDelta)
+{
+    CTemplateBuilderNotifier notifier;
+    RegisterValidationInterface(&notifier);
+    {
+        boost::lock_guard<boost::mutex> lock(csTemplateBuilder);
+        fTemplateBuilderRunning = true;
+    }
+    try {
+        while (true) {
+            {
+                boost::unique_lock<boost::mutex> lock(csTemplateBuilder);
+                // Poll the mempool every second; a new tip wakes us at once
+                if (!fTemplateTipChanged)
+                    cvTemplateBuilder.timed_wait(lock, boost::posix_time::seconds(1));
+                fTemplateTipChanged = false;
+                if (!fTemplateBuilderActive)
+                    continue;
+            }
+            if (IsInitialBlockDownload())
+                continue;
+
+            uint256 hashTip;
+            {
+                LOCK(cs_main);
+                hashTip = chainActive.Tip()->GetBlockHash();
+            }
+            // Read before building, so a change while building is seen later
+            const unsigned int nTransactionsUpdated = mempool.GetTransactionsUpdated();
+            CAmount nMempoolFee = mempool.GetTotalFee();
+            {
+                boost::lock_guard<boost::mutex> lock(csTemplateBuilder);
+                CAmount nFeeGrowth = nMempoolFee - nPrebuiltMempoolFee;
+                bool fMempoolChanged = nTransactionsUpdated != nPrebuiltTransactionsUpdated && GetTime() - nPrebuiltTime >= BLOCK_TEMPLATE_MIN_AGE;
+                if (pPrebuiltTemplate && pPrebuiltTemplate->block.hashPrevBlock == hashTip && (nFeeGrowth <= 0 || nFeeGrowth < nFeeDelta) && !fMempoolChanged)
+                    continue;
+            }
+
+            int64_t nTimeStart = GetTimeMicros();
+            std::shared_ptr<const CBlockTemplate> ptemplate;
+            try {
+                ptemplate.reset(BlockAssembler(Params()).CreateNewBlock(CScript() << OP_TRUE));
+            } catch (const std::runtime_error& e) {
+                LogPrintf("%s: %s\n", __func__, e.what());
+                continue;
+            }
+            if (!ptemplate)
+                continue;
+            LogPrint("bench", "Prebuilt block template on %s with %u transactions: %.2fms\n",
+                ptemplate->block.hashPrevBlock.ToString(), ptemplate->block.vtx.size(), (GetTimeMicros() - nTimeStart) * 0.001);
+
+            boost::lock_guard<boost::mutex> lock(csTemplateBuilder);
+            pPrebuiltTemplate = ptemplate;
+            nPrebuiltMempoolFee = nMempoolFee;
+            nPrebuiltTransactionsUpdated = nTransactionsUpdated;
+            nPrebuiltTime = GetTime();
+            cvTemplateBuilt.notify_all();
+        }
+    } catch (...) {
+        // Interrupted, or anything else: the notifier must not outlive us
+        UnregisterValidationInterface(&notifier);
+        boost::lock_guard<boost::mutex> lock(csTemplateBuilder);
+        fTemplateBuilderRunning = false;
+        pPrebuiltTemplate.reset();
+        throw;
+    }
 }
@@ -23,6 +23,12 @@ class CWallet;
 namespace Consensus { struct Params; };
 
 static const bool DEFAULT_PRINTPRIORITY = false;
+/** Default for -genthreads, the number of nonce search threads used by generate */
+static const int DEFAULT_GENERATE_THREADS = 1;
+/** Default for -blocktemplatefeedelta, the mempool fee growth that makes the background builder rebuild the template */
+static const CAmount DEFAULT_BLOCK_TEMPLATE_FEE_DELTA = COIN / 1000;
+/** Seconds the background builder keeps a template after any other mempool change */
+static const int64_t BLOCK_TEMPLATE_MIN_AGE = 2;
 
 struct CBlockTemplate
 {
@@ -30,6 +36,8 @@ struct CBlockTemplate
     std::vector<CAmount> vTxFees;
     std::vector<int64_t> vTxSigOpsCost;
     std::vector<unsigned char> vchCoinbaseCommitment;
+    /** Merkle branch of the coinbase; it stays valid whatever the coinbase contains */
+    std::vector<uint256> vCoinbaseMerkleBranch;
 };
 
 // Container for tracking updates to ancestor feerate as we include (parent)
@@ -205,8 +213,38 @@ private:
     void UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded, indexed_modified_transaction_set &mapModifiedTx);
 };
 
-/** Modify the extranonce in a block */
-void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
+/**
+ * Modify the extranonce in a block. With the coinbase merkle branch of the
+ * block's template only the coinbase is rehashed to get the merkle root.
+ */
+void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce, const std::vector<uint256>* pvCoinbaseMerkleBranch = NULL);
 int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev);
+/**
+ * Search nonces up to nNonceEnd of every block in vBlocks, one thread per
+ * block, starting from each block's current nNonce. vScratchpad must hold
+ * a scratchpad of SCRYPT_MULTI_SCRATCHPAD_SIZE bytes per block; it is reused
+ * across calls. Stops at the first header that meets its target or once
+ * nMaxTries hashes have been spent; the hashes tried are subtracted from
+ * nMaxTries.
+ * @return the index of the solved block, whose nNonce is set, or -1.
+ */
+int ScanNonces(std::vector<CBlock>& vBlocks, uint32_t nNonceEnd, uint64_t& nMaxTries, std::vector<std::vector<char> >& vScratchpad, const Consensus::Params& consensusParams);
+
+/**
+ * Build block templates in the background, paying to OP_TRUE like the
+ * templates of getblocktemplate. Nothing is built until the first call to
+ * GetPrebuiltBlockTemplate(); after that a template is rebuilt as soon as the
+ * tip changes, and when the fees in the mempool have grown by nFeeDelta. Any
+ * other mempool change rebuilds it once it is BLOCK_TEMPLATE_MIN_AGE old.
+ */
+void ThreadBlockTemplateBuilder(CAmount nFeeDelta);
+/**
+ * The latest background template if it builds on pindexPrev and was built
+ * from the mempool as of nTransactionsUpdated (see
+ * CTxMemPool::GetTransactionsUpdated()), else NULL. Waits up to nWaitMillis
+ * for such a template; do not wait while holding cs_main, which the builder
+ * needs.
+ */
+std::shared_ptr<const CBlockTemplate> GetPrebuiltBlockTemplate(const CBlockIndex* pindexPrev, unsigned int nTransactionsUpdated, int64_t nWaitMillis = 0);
 
 #endif // BITCOIN_MINER_H
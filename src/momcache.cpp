@@ -0,0 +1,173 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "momcache.h"
+
+#include "chain.h"
+#include "hash.h"
+
+#include <algorithm>
+
+CMoMCache momcache;
+
+uint256 MoMHash(const uint256& left, const uint256& right)
+{
+    uint256 hash = Hash(left.begin(), left.end(), right.begin(), right.end());
+    std::reverse(hash.begin(), hash.end());
+    return hash;
+}
+
+uint256 ComputeMoM(std::vector<uint256> vLeaves)
+{
+    if (vLeaves.empty())
+        return uint256();
+    while (vLeaves.size() > 1) {
+        if (vLeaves.size() & 1)
+            vLeaves.push_back(vLeaves.back());
+        for (size_t i = 0; i < vLeaves.size() / 2; i++)
+            vLeaves[i] = MoMHash(vLeaves[2 * i], vLeaves[2 * i + 1]);
+        vLeaves.resize(vLeaves.size() / 2);
+    }
+    return vLeaves[0];
+}
+
+std::vector<uint256> ComputeMoMBranch(std::vector<uint256> vLeaves, int nPos)
+{
+    std::vector<uint256> vBranch;
+    while (vLeaves.size() > 1) {
+        if (vLeaves.size() & 1)
+            vLeaves.push_back(vLeaves.back());
+        vBranch.push_back(vLeaves[nPos ^ 1]);
+        for (size_t i = 0; i < vLeaves.size() / 2; i++)
+            vLeaves[i] = MoMHash(vLeaves[2 * i], vLeaves[2 * i + 1]);
+        vLeaves.resize(vLeaves.size() / 2);
+        nPos >>= 1;
+    }
+    return vBranch;
+}
+
+uint256 ComputeMoMFromBranch(uint256 leaf, const std::vector<uint256>& vBranch, int nPos)
+{
+    for (std::vector<uint256>::const_iterator it = vBranch.begin(); it != vBranch.end(); ++it) {
+        if (nPos & 1)
+            leaf = MoMHash(*it, leaf);
+        else
+            leaf = MoMHash(leaf, *it);
+        nPos >>= 1;
+    }
+    return leaf;
+}
+
+static int MoMLevels(int nDepth)
+{
+    int nLevel = 0;
+    while ((1 << nLevel) < nDepth)
+        nLevel++;
+    return nLevel;
+}
+
+CMoMCache::CMoMCache(int nLevelsIn) : nLevels(nLevelsIn), nHeights(1 << nLevelsIn), pindexTip(NULL), nLowest(0)
+{
+}
+
+void CMoMCache::Append(const CBlockIndex* pindex)
+{
+    const int nHeight = pindex->nHeight;
+    const int nSlot = nHeight & (nHeights - 1);
+    if (pindexTip == NULL)
+        nLowest = nHeight;
+    vIndex[nSlot] = pindex;
+    vSubtrees[0][nSlot] = pindex->hashMerkleRoot;
+    for (int nLevel = 1; nLevel <= nLevels && nHeight - (1 << nLevel) + 1 >= nLowest; nLevel++) {
+        int nRight = (nHeight - (1 << (nLevel - 1))) & (nHeights - 1);
+        vSubtrees[nLevel][nSlot] = MoMHash(vSubtrees[nLevel - 1][nSlot], vSubtrees[nLevel - 1][nRight]);
+    }
+    nLowest = std::max(nLowest, nHeight - nHeights + 1);
+    pindexTip = pindex;
+}
+
+void CMoMCache::SetTip(const CBlockIndex* pindex)
+{
+    LOCK(cs);
+    if (vIndex.empty()) {
+        vIndex.resize(nHeights);
+        vSubtrees.assign(nLevels + 1, std::vector<uint256>(nHeights));
+    }
+
+    const CBlockIndex* pindexFork = pindexTip;
+    if (pindexFork && pindexFork->nHeight > pindex->nHeight)
+        pindexFork = pindexFork->GetAncestor(pindex->nHeight);
+    while (pindexFork && pindexFork->nHeight >= nLowest && pindex->GetAncestor(pindexFork->nHeight) != pindexFork)
+        pindexFork = pindexFork->pprev;
+    int nStart = std::max(pindex->nHeight - nHeights + 1, 0);
+    if (pindexFork && pindexFork->nHeight >= nLowest && pindexFork->nHeight >= nStart - 1) {
+        nStart = pindexFork->nHeight + 1;
+        pindexTip = pindexFork;
+    } else {
+        // Nothing cached is on the new chain, or the gap is too wide to bridge
+        pindexTip = NULL;
+    }
+
+    std::vector<const CBlockIndex*> vConnect;
+    for (const CBlockIndex* pindexWalk = pindex; pindexWalk && pindexWalk->nHeight >= nStart; pindexWalk = pindexWalk->pprev)
+        vConnect.push_back(pindexWalk);
+    for (std::vector<const CBlockIndex*>::reverse_iterator it = vConnect.rbegin(); it != vConnect.rend(); ++it)
+        Append(*it);
+}
+
+void CMoMCache::UpdatedBlockTip(const CBlockIndex* pindex)
+{
+    SetTip(pindex);
+}
+
+uint256 CMoMCache::Subtree(int nHeight, int nLevel) const
+{
+    return vSubtrees[nLevel][nHeight & (nHeights - 1)];
+}
+
+/** Node at nLevel over nLeaves leaves from nHeight down, on the right edge of its tree when not full */
+uint256 CMoMCache::Node(int nHeight, int nLeaves, int nLevel) const
+{
+    if (nLeaves == (1 << nLevel))
+        return Subtree(nHeight, nLevel);
+    const int nHalf = 1 << (nLevel - 1);
+    if (nLeaves <= nHalf) {
+        uint256 left = Node(nHeight, nLeaves, nLevel - 1);
+        return MoMHash(left, left);
+    }
+    return MoMHash(Subtree(nHeight, nLevel - 1), Node(nHeight - nHalf, nLeaves - nHalf, nLevel - 1));
+}
+
+bool CMoMCache::Covers(const CBlockIndex* pindex, int nDepth) const
+{
+    return pindexTip != NULL && nDepth > 0 && pindex->nHeight <= pindexTip->nHeight &&
+           pindex->nHeight - nDepth + 1 >= nLowest && vIndex[pindex->nHeight & (nHeights - 1)] == pindex;
+}
+
+bool CMoMCache::GetMoM(const CBlockIndex* pindex, int nDepth, uint256& MoM) const
+{
+    LOCK(cs);
+    if (!Covers(pindex, nDepth))
+        return false;
+    MoM = Node(pindex->nHeight, nDepth, MoMLevels(nDepth));
+    return true;
+}
+
+bool CMoMCache::GetMoMBranch(const CBlockIndex* pindex, int nDepth, int nHeight, std::vector<uint256>& vBranch) const
+{
+    LOCK(cs);
+    const int nPos = pindex->nHeight - nHeight;
+    if (!Covers(pindex, nDepth) || nPos < 0 || nPos >= nDepth)
+        return false;
+    vBranch.clear();
+    for (int nLevel = 0; nLevel < MoMLevels(nDepth); nLevel++) {
+        // The sibling past the last node of a level is that node itself
+        int nSibling = (nPos >> nLevel) ^ 1;
+        if ((nSibling << nLevel) >= nDepth)
+            nSibling ^= 1;
+        int nFirst = nSibling << nLevel;
+        vBranch.push_back(Node(pindex->nHeight - nFirst, std::min(1 << nLevel, nDepth - nFirst), nLevel));
+    }
+    return true;
+}
@@ -0,0 +1,79 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_MOMCACHE_H
+#define BITCOIN_MOMCACHE_H
+
+#include "sync.h"
+#include "uint256.h"
+#include "validationinterface.h"
+
+#include <vector>
+
+class CBlockIndex;
+
+//! Heights below the tip whose MoM subtrees are kept, as a power of two
+static const int DEFAULT_MOM_CACHE_LEVELS = 14;
+
+/**
+ * Merkle-of-Merkles (MoM) trees are built the way iguana_merkle does: the
+ * leaves are the merkle roots of the blocks at height, height-1, ... down to
+ * height-depth+1, an odd last node is paired with itself, and a node is the
+ * byte-reversed double SHA256 of its two children.
+ */
+uint256 MoMHash(const uint256& left, const uint256& right);
+/** MoM of the leaves in tree order */
+uint256 ComputeMoM(std::vector<uint256> vLeaves);
+/** Merkle branch of the leaf at nPos, from the leaves in tree order */
+std::vector<uint256> ComputeMoMBranch(std::vector<uint256> vLeaves, int nPos);
+/** MoM of a tree with the given leaf at nPos and branch, as returned by CMoMCache::GetMoMBranch */
+uint256 ComputeMoMFromBranch(uint256 leaf, const std::vector<uint256>& vBranch, int nPos);
+
+/**
+ * MoM subtrees of the recent active chain, kept up to date from
+ * UpdatedBlockTip. For each height e it keeps the roots of the perfect
+ * subtrees whose leaves are e, e-1, ... e-2^l+1, each made from two
+ * subtrees of the level below when the block connects. Every node of a MoM
+ * tree is one of those roots except on its right edge, where the last node
+ * of a level may be paired with itself, so a MoM and its inclusion proofs
+ * take O(log depth) hashes. MoMs reaching below the cached heights are not
+ * answered.
+ */
+class CMoMCache : public CValidationInterface
+{
+private:
+    mutable CCriticalSection cs;
+    const int nLevels;
+    const int nHeights;
+    //! Tip the cache was built up to, NULL until the first update
+    const CBlockIndex* pindexTip;
+    //! Lowest height with a cached merkle root
+    int nLowest;
+    //! Block indexes and subtree roots by level, in rings indexed by height
+    std::vector<const CBlockIndex*> vIndex;
+    std::vector<std::vector<uint256> > vSubtrees;
+
+    void Append(const CBlockIndex* pindex);
+    uint256 Subtree(int nHeight, int nLevel) const;
+    uint256 Node(int nHeight, int nLeaves, int nLevel) const;
+    bool Covers(const CBlockIndex* pindex, int nDepth) const;
+
+protected:
+    void UpdatedBlockTip(const CBlockIndex* pindex);
+
+public:
+    CMoMCache(int nLevelsIn = DEFAULT_MOM_CACHE_LEVELS);
+
+    /** Bring the cache to pindex, rolling back to the fork point first */
+    void SetTip(const CBlockIndex* pindex);
+    /** MoM of the nDepth blocks up to pindex; false if they are not all cached */
+    bool GetMoM(const CBlockIndex* pindex, int nDepth, uint256& MoM) const;
+    /** Merkle branch proving the block at nHeight is in that MoM */
+    bool GetMoMBranch(const CBlockIndex* pindex, int nDepth, int nHeight, std::vector<uint256>& vBranch) const;
+};
+
+/** MoM cache of the active chain */
+extern CMoMCache momcache;
+
+#endif // BITCOIN_MOMCACHE_H
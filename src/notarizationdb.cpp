@@ -0,0 +1,383 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "notarizationdb.h"
+
+#include "chain.h"
+#include "primitives/block.h"
+#include "undo.h"
+#include "util.h"
+
+#include <algorithm>
+#include <limits>
+
+#include <boost/scoped_ptr.hpp>
+
+static const char DB_NOTARIZATION = 'n';
+static const char DB_FLAG = 'F';
+static const char DB_BEST_BLOCK = 'B';
+
+CNotarizationIndex notarizationindex;
+CNotarizationProcessor notarizationprocessor;
+
+// Defined with the rest of the notarization parsing in komodo_validation013.h
+void komodo_connectcandidates(const CBlockIndex *pindex,const std::vector<CNotarizationCandidate>& candidates);
+void komodo_disconnect(const CBlockIndex *pindex);
+
+CNotarizationDB::CNotarizationDB(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(path, nCacheSize, fMemory, fWipe) {
+}
+
+bool CNotarizationDB::WriteCheckpoints(const std::vector<CNotarizedCheckpoint>& vErase, const CNotarizedCheckpoint& checkpoint) {
+    CDBBatch batch(*this);
+    for (std::vector<CNotarizedCheckpoint>::const_iterator it = vErase.begin(); it != vErase.end(); it++)
+        batch.Erase(std::make_pair(DB_NOTARIZATION, it->nNotarizedHeight));
+    batch.Write(std::make_pair(DB_NOTARIZATION, checkpoint.nNotarizedHeight), checkpoint);
+    return WriteBatch(batch);
+}
+
+bool CNotarizationDB::EraseCheckpoints(const std::vector<CNotarizedCheckpoint>& vErase) {
+    CDBBatch batch(*this);
+    for (std::vector<CNotarizedCheckpoint>::const_iterator it = vErase.begin(); it != vErase.end(); it++)
+        batch.Erase(std::make_pair(DB_NOTARIZATION, it->nNotarizedHeight));
+    return WriteBatch(batch);
+}
+
+static bool CompareCheckpointHeight(const CNotarizedCheckpoint& a, const CNotarizedCheckpoint& b)
+{
+    return a.nHeight < b.nHeight;
+}
+
+bool CNotarizationDB::LoadCheckpoints(std::vector<CNotarizedCheckpoint>& vCheckpoints) {
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+    pcursor->Seek(DB_NOTARIZATION);
+
+    vCheckpoints.clear();
+    while (pcursor->Valid()) {
+        std::pair<char, int> key;
+        if (!pcursor->GetKey(key) || key.first != DB_NOTARIZATION)
+            break;
+        CNotarizedCheckpoint checkpoint;
+        if (!pcursor->GetValue(checkpoint))
+            return error("%s: failed to read notarization at height %d", __func__, key.second);
+        vCheckpoints.push_back(checkpoint);
+        pcursor->Next();
+    }
+    // Keys are little endian, so they do not come out in height order
+    std::sort(vCheckpoints.begin(), vCheckpoints.end(), CompareCheckpointHeight);
+    return true;
+}
+
+bool CNotarizationDB::WriteFlag(const std::string& name, bool fValue) {
+    return Write(std::make_pair(DB_FLAG, name), fValue ? '1' : '0');
+}
+
+bool CNotarizationDB::ReadFlag(const std::string& name, bool& fValue) {
+    char ch;
+    if (!Read(std::make_pair(DB_FLAG, name), ch))
+        return false;
+    fValue = ch == '1';
+    return true;
+}
+
+bool CNotarizationDB::WriteBestBlock(const uint256& hashBlock) {
+    return Write(DB_BEST_BLOCK, hashBlock);
+}
+
+bool CNotarizationDB::ReadBestBlock(uint256& hashBlock) {
+    return Read(DB_BEST_BLOCK, hashBlock);
+}
+
+static int MoMStart(const CNotarizedCheckpoint& checkpoint)
+{
+    if (checkpoint.nMoMDepth <= 0)
+        return std::numeric_limits<int>::max();
+    return checkpoint.nNotarizedHeight - checkpoint.nMoMDepth;
+}
+
+bool CNotarizationIndex::Open(const boost::filesystem::path& path, size_t nCacheSize, bool fWipe)
+{
+    LOCK(cs);
+    vCheckpoints.clear();
+    vMoMStartMin.clear();
+    pdb.reset();
+    pdb.reset(new CNotarizationDB(path, nCacheSize, false, fWipe));
+    if (!pdb->LoadCheckpoints(vCheckpoints))
+        return false;
+    vMoMStartMin.resize(vCheckpoints.size());
+    for (size_t i = vCheckpoints.size(); i-- > 0; ) {
+        vMoMStartMin[i] = MoMStart(vCheckpoints[i]);
+        if (i + 1 < vCheckpoints.size())
+            vMoMStartMin[i] = std::min(vMoMStartMin[i], vMoMStartMin[i + 1]);
+    }
+    LogPrintf("Loaded %u notarizations\n", vCheckpoints.size());
+    return true;
+}
+
+void CNotarizationIndex::Close()
+{
+    LOCK(cs);
+    vCheckpoints.clear();
+    vMoMStartMin.clear();
+    pdb.reset();
+}
+
+bool CNotarizationIndex::ReadFlag(const std::string& name)
+{
+    LOCK(cs);
+    bool fValue = false;
+    return pdb && pdb->ReadFlag(name, fValue) && fValue;
+}
+
+bool CNotarizationIndex::WriteFlag(const std::string& name)
+{
+    LOCK(cs);
+    return !pdb || pdb->WriteFlag(name, true);
+}
+
+uint256 CNotarizationIndex::GetBestBlock()
+{
+    LOCK(cs);
+    uint256 hashBlock;
+    if (!pdb || !pdb->ReadBestBlock(hashBlock))
+        return uint256();
+    return hashBlock;
+}
+
+bool CNotarizationIndex::WriteBestBlock(const uint256& hashBlock)
+{
+    LOCK(cs);
+    return !pdb || pdb->WriteBestBlock(hashBlock);
+}
+
+void CNotarizationIndex::EraseFromPos(size_t nPos)
+{
+    vCheckpoints.resize(nPos);
+    vMoMStartMin.resize(nPos);
+    // Only the minima that came from the erased checkpoints change
+    for (size_t i = nPos; i-- > 0; ) {
+        int nMin = MoMStart(vCheckpoints[i]);
+        if (i + 1 < nPos)
+            nMin = std::min(nMin, vMoMStartMin[i + 1]);
+        if (nMin == vMoMStartMin[i])
+            break;
+        vMoMStartMin[i] = nMin;
+    }
+}
+
+bool CNotarizationIndex::Add(const CNotarizedCheckpoint& checkpoint)
+{
+    LOCK(cs);
+    size_t nPos = vCheckpoints.size();
+    while (nPos > 0 && (vCheckpoints[nPos - 1].nHeight >= checkpoint.nHeight || vCheckpoints[nPos - 1].nNotarizedHeight >= checkpoint.nNotarizedHeight))
+        nPos--;
+    std::vector<CNotarizedCheckpoint> vErase(vCheckpoints.begin() + nPos, vCheckpoints.end());
+    EraseFromPos(nPos);
+
+    vCheckpoints.push_back(checkpoint);
+    int nStart = MoMStart(checkpoint);
+    vMoMStartMin.push_back(nStart);
+    for (size_t i = nPos; i-- > 0 && vMoMStartMin[i] > nStart; )
+        vMoMStartMin[i] = nStart;
+
+    if (pdb && !pdb->WriteCheckpoints(vErase, checkpoint))
+        return error("%s: failed to write notarization at height %d", __func__, checkpoint.nHeight);
+    return true;
+}
+
+bool CNotarizationIndex::EraseFrom(int nHeight)
+{
+    LOCK(cs);
+    CNotarizedCheckpoint key;
+    key.nHeight = nHeight;
+    size_t nPos = std::lower_bound(vCheckpoints.begin(), vCheckpoints.end(), key, CompareCheckpointHeight) - vCheckpoints.begin();
+    if (nPos == vCheckpoints.size())
+        return true;
+    std::vector<CNotarizedCheckpoint> vErase(vCheckpoints.begin() + nPos, vCheckpoints.end());
+    EraseFromPos(nPos);
+    if (pdb && !pdb->EraseCheckpoints(vErase))
+        return error("%s: failed to erase notarizations from height %d", __func__, nHeight);
+    return true;
+}
+
+size_t CNotarizationIndex::Size() const
+{
+    LOCK(cs);
+    return vCheckpoints.size();
+}
+
+bool CNotarizationIndex::GetLast(CNotarizedCheckpoint& checkpoint) const
+{
+    LOCK(cs);
+    if (vCheckpoints.empty())
+        return false;
+    checkpoint = vCheckpoints.back();
+    return true;
+}
+
+bool CNotarizationIndex::FindBefore(int nHeight, CNotarizedCheckpoint& checkpoint) const
+{
+    LOCK(cs);
+    CNotarizedCheckpoint key;
+    key.nHeight = nHeight;
+    std::vector<CNotarizedCheckpoint>::const_iterator it = std::lower_bound(vCheckpoints.begin(), vCheckpoints.end(), key, CompareCheckpointHeight);
+    if (it == vCheckpoints.begin())
+        return false;
+    checkpoint = *--it;
+    return true;
+}
+
+bool CNotarizationIndex::FindMoM(int nHeight, CNotarizedCheckpoint& checkpoint) const
+{
+    LOCK(cs);
+    // The last checkpoint whose window starts below nHeight is the only
+    // candidate: any earlier one ends no higher than it does
+    size_t nPos = std::lower_bound(vMoMStartMin.begin(), vMoMStartMin.end(), nHeight) - vMoMStartMin.begin();
+    if (nPos == 0)
+        return false;
+    const CNotarizedCheckpoint& candidate = vCheckpoints[nPos - 1];
+    if (candidate.nNotarizedHeight < nHeight)
+        return false;
+    checkpoint = candidate;
+    return true;
+}
+
+bool CNotarizationIndex::GetLastMoM(CNotarizedCheckpoint& checkpoint) const
+{
+    LOCK(cs);
+    size_t nPos = std::lower_bound(vMoMStartMin.begin(), vMoMStartMin.end(), std::numeric_limits<int>::max()) - vMoMStartMin.begin();
+    if (nPos == 0)
+        return false;
+    checkpoint = vCheckpoints[nPos - 1];
+    return true;
+}
+
+int CNotarizationIndex::PrevMoMHeight() const
+{
+    CNotarizedCheckpoint checkpoint;
+    if (!GetLastMoM(checkpoint))
+        return 0;
+    return checkpoint.nNotarizedHeight;
+}
+
+std::vector<CNotarizationCandidate> GetNotarizationCandidates(const CBlock& block, const CBlockUndo& blockundo)
+{
+    std::vector<CNotarizationCandidate> vCandidates;
+    // The coinbase spends nothing a notary could have signed
+    for (size_t i = 1; i < block.vtx.size(); i++) {
+        const CTransaction& tx = block.vtx[i];
+        if (tx.vout.size() < 2 || tx.vout[1].scriptPubKey.empty() || tx.vout[1].scriptPubKey[0] != OP_RETURN)
+            continue;
+        vCandidates.push_back(CNotarizationCandidate());
+        CNotarizationCandidate& candidate = vCandidates.back();
+        candidate.scriptOpReturn = tx.vout[1].scriptPubKey;
+        const std::vector<Coin>& vprevout = blockundo.vtxundo[i - 1].vprevout;
+        for (std::vector<Coin>::const_iterator it = vprevout.begin(); it != vprevout.end(); ++it)
+            candidate.vSpent.push_back(it->out.scriptPubKey);
+    }
+    return vCandidates;
+}
+
+void CNotarizationProcessor::Push(CEvent& event)
+{
+    {
+        boost::lock_guard<boost::mutex> lock(cs);
+        if (fRunning) {
+            queue.push_back(CEvent());
+            std::swap(queue.back(), event);
+            cvQueue.notify_one();
+            return;
+        }
+    }
+    Process(event);
+}
+
+void CNotarizationProcessor::Process(const CEvent& event)
+{
+    const CBlockIndex* pindex = event.pindex;
+    if (event.fConnect) {
+        komodo_connectcandidates(pindex, event.vCandidates);
+    } else {
+        komodo_disconnect(pindex);
+        pindex = pindex->pprev;
+    }
+    Publish(pindex);
+}
+
+void CNotarizationProcessor::BlockConnected(const CBlock& block, const CBlockIndex* pindex, const CBlockUndo& blockundo)
+{
+    CEvent event;
+    event.pindex = pindex;
+    event.fConnect = true;
+    event.vCandidates = GetNotarizationCandidates(block, blockundo);
+    Push(event);
+}
+
+void CNotarizationProcessor::BlockDisconnected(const CBlock& block, const CBlockIndex* pindex)
+{
+    CEvent event;
+    event.pindex = pindex;
+    event.fConnect = false;
+    Push(event);
+}
+
+void CNotarizationProcessor::Thread()
+{
+    {
+        boost::lock_guard<boost::mutex> lock(cs);
+        fRunning = true;
+    }
+    try {
+        while (true) {
+            boost::unique_lock<boost::mutex> lock(cs);
+            while (queue.empty())
+                cvQueue.wait(lock);
+            lock.unlock();
+            Process(queue.front());
+            lock.lock();
+            queue.pop_front();
+            if (queue.empty())
+                cvDone.notify_all();
+        }
+    } catch (const boost::thread_interrupted&) {
+        // Finish what was queued; blocks that still connect while the node
+        // shuts down are handled by the thread connecting them
+        boost::unique_lock<boost::mutex> lock(cs);
+        while (!queue.empty()) {
+            lock.unlock();
+            Process(queue.front());
+            lock.lock();
+            queue.pop_front();
+        }
+        fRunning = false;
+        cvDone.notify_all();
+        throw;
+    }
+}
+
+void CNotarizationProcessor::Sync()
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    while (fRunning && !queue.empty())
+        cvDone.wait(lock);
+}
+
+void CNotarizationProcessor::Publish(const CBlockIndex* pindex)
+{
+    std::shared_ptr<CNotarizationSnapshot> pnew(new CNotarizationSnapshot());
+    pnew->pindex = pindex;
+    CNotarizedCheckpoint last, prev;
+    if (notarizationindex.GetLast(last)) {
+        if (notarizationindex.FindBefore(last.nHeight, prev))
+            pnew->vCheckpoints.push_back(prev);
+        pnew->vCheckpoints.push_back(last);
+    }
+    std::atomic_store(&snapshot, std::shared_ptr<const CNotarizationSnapshot>(pnew));
+    if (pindex && !notarizationindex.WriteBestBlock(pindex->GetBlockHash()))
+        LogPrintf("%s: failed to write best block %s\n", __func__, pindex->GetBlockHash().ToString());
+}
+
+std::shared_ptr<const CNotarizationSnapshot> CNotarizationProcessor::GetSnapshot() const
+{
+    return std::atomic_load(&snapshot);
+}
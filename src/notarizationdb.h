@@ -0,0 +1,214 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_NOTARIZATIONDB_H
+#define BITCOIN_NOTARIZATIONDB_H
+
+#include "dbwrapper.h"
+#include "script/script.h"
+#include "serialize.h"
+#include "sync.h"
+#include "uint256.h"
+#include "validationinterface.h"
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem/path.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+class CBlockUndo;
+
+//! Memory allocated to the notarization database cache (MiB)
+static const int64_t nNotarizationDBCache = 2;
+
+/** A notarization found in the chain */
+struct CNotarizedCheckpoint
+{
+    //! Height of the block carrying the notarization
+    int nHeight;
+    //! Height and hash of the block it notarizes
+    int nNotarizedHeight;
+    uint256 hashNotarized;
+    //! Notarization transaction on the destination chain
+    uint256 hashDestTx;
+    //! Merkle root of the merkle roots of the nMoMDepth blocks up to nNotarizedHeight
+    uint256 MoM;
+    int nMoMDepth;
+    uint256 MoMoM;
+    int nMoMoMDepth;
+    int nMoMoMOffset;
+    int nKmdStartI;
+    int nKmdEndI;
+
+    CNotarizedCheckpoint() : nHeight(0), nNotarizedHeight(0), nMoMDepth(0), nMoMoMDepth(0), nMoMoMOffset(0), nKmdStartI(0), nKmdEndI(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(VARINT(nHeight));
+        READWRITE(VARINT(nNotarizedHeight));
+        READWRITE(hashNotarized);
+        READWRITE(hashDestTx);
+        READWRITE(MoM);
+        READWRITE(VARINT(nMoMDepth));
+        READWRITE(MoMoM);
+        READWRITE(VARINT(nMoMoMDepth));
+        READWRITE(VARINT(nMoMoMOffset));
+        READWRITE(VARINT(nKmdStartI));
+        READWRITE(VARINT(nKmdEndI));
+    }
+};
+
+/** Access to the notarization database (notarizationindex/), keyed by notarized height */
+class CNotarizationDB : public CDBWrapper
+{
+public:
+    CNotarizationDB(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+private:
+    CNotarizationDB(const CNotarizationDB&);
+    void operator=(const CNotarizationDB&);
+public:
+    bool WriteCheckpoints(const std::vector<CNotarizedCheckpoint>& vErase, const CNotarizedCheckpoint& checkpoint);
+    bool EraseCheckpoints(const std::vector<CNotarizedCheckpoint>& vErase);
+    bool LoadCheckpoints(std::vector<CNotarizedCheckpoint>& vCheckpoints);
+    bool WriteFlag(const std::string& name, bool fValue);
+    bool ReadFlag(const std::string& name, bool& fValue);
+    bool WriteBestBlock(const uint256& hashBlock);
+    bool ReadBestBlock(uint256& hashBlock);
+};
+
+/**
+ * The notarizations on the active chain, in chain order. A notarization is
+ * only accepted when it notarizes a higher block than the one before, so both
+ * the carrying height and the notarized height increase along the index and
+ * all lookups are binary searches. Persisted in a CNotarizationDB when open,
+ * memory only otherwise.
+ */
+class CNotarizationIndex
+{
+private:
+    mutable CCriticalSection cs;
+    std::unique_ptr<CNotarizationDB> pdb;
+    std::vector<CNotarizedCheckpoint> vCheckpoints;
+    /**
+     * vMoMStartMin[i] is the lowest height below the MoM window of
+     * checkpoints i and later; it does not decrease with i. A checkpoint
+     * without MoM has an empty window that starts at INT_MAX.
+     */
+    std::vector<int> vMoMStartMin;
+
+    void EraseFromPos(size_t nPos);
+
+public:
+    /** Open (or wipe) the database at path and load the checkpoints in it */
+    bool Open(const boost::filesystem::path& path, size_t nCacheSize, bool fWipe = false);
+    /** Close the database and forget all checkpoints */
+    void Close();
+    /** Whether the database has the flag set, false when none is open */
+    bool ReadFlag(const std::string& name);
+    bool WriteFlag(const std::string& name);
+    /** Last block whose notarizations were processed, null if unknown */
+    uint256 GetBestBlock();
+    bool WriteBestBlock(const uint256& hashBlock);
+
+    /**
+     * Append a checkpoint, dropping the ones from a stale branch it
+     * conflicts with: those carried at or above its height, or notarizing
+     * its notarized height or above.
+     */
+    bool Add(const CNotarizedCheckpoint& checkpoint);
+    /** Remove the checkpoints carried by blocks at nHeight and above */
+    bool EraseFrom(int nHeight);
+
+    size_t Size() const;
+    bool GetLast(CNotarizedCheckpoint& checkpoint) const;
+    /** The last checkpoint carried by a block below nHeight */
+    bool FindBefore(int nHeight, CNotarizedCheckpoint& checkpoint) const;
+    /** The last checkpoint whose MoM covers nHeight */
+    bool FindMoM(int nHeight, CNotarizedCheckpoint& checkpoint) const;
+    /** The last checkpoint with a MoM */
+    bool GetLastMoM(CNotarizedCheckpoint& checkpoint) const;
+    /** Notarized height of the last checkpoint with a MoM, or 0 */
+    int PrevMoMHeight() const;
+};
+
+/** Notarizations of the active chain */
+extern CNotarizationIndex notarizationindex;
+
+/** A transaction of a connected block that may carry a notarization */
+struct CNotarizationCandidate
+{
+    //! Its second output, an OP_RETURN
+    CScript scriptOpReturn;
+    //! Scripts of the outputs its inputs spent
+    std::vector<CScript> vSpent;
+};
+
+/** The transactions of a block that may carry a notarization */
+std::vector<CNotarizationCandidate> GetNotarizationCandidates(const CBlock& block, const CBlockUndo& blockundo);
+
+/** The latest notarizations as of a block, for checks that cannot wait for the processor */
+struct CNotarizationSnapshot
+{
+    //! Last block the processor handled
+    const CBlockIndex* pindex;
+    //! The last notarizations carried up to pindex, oldest first
+    std::vector<CNotarizedCheckpoint> vCheckpoints;
+};
+
+/**
+ * Applies the notarizations of connected and disconnected blocks to
+ * notarizationindex on its own thread, in the order the blocks were
+ * (dis)connected. Only the candidate transactions are copied out of
+ * ConnectBlock, which holds cs_main. After every block a new snapshot is
+ * published atomically. Blocks are handled in the calling thread while
+ * Thread() does not run.
+ */
+class CNotarizationProcessor : public CValidationInterface
+{
+private:
+    struct CEvent
+    {
+        const CBlockIndex* pindex;
+        bool fConnect;
+        std::vector<CNotarizationCandidate> vCandidates;
+    };
+
+    boost::mutex cs;
+    //! Wakes the processor
+    boost::condition_variable cvQueue;
+    //! Wakes threads waiting for the queue to drain
+    boost::condition_variable cvDone;
+    //! Events not handled yet; the front one is in progress
+    std::deque<CEvent> queue;
+    bool fRunning;
+    std::shared_ptr<const CNotarizationSnapshot> snapshot;
+
+    void Push(CEvent& event);
+    void Process(const CEvent& event);
+
+protected:
+    void BlockConnected(const CBlock& block, const CBlockIndex* pindex, const CBlockUndo& blockundo);
+    void BlockDisconnected(const CBlock& block, const CBlockIndex* pindex);
+
+public:
+    CNotarizationProcessor() : fRunning(false) {}
+
+    /** Handle blocks until interrupted */
+    void Thread();
+    /** Wait until every block (dis)connected so far was handled */
+    void Sync();
+    /** Publish the notarizations in notarizationindex as of pindex */
+    void Publish(const CBlockIndex* pindex);
+    std::shared_ptr<const CNotarizationSnapshot> GetSnapshot() const;
+};
+
+extern CNotarizationProcessor notarizationprocessor;
+
+#endif // BITCOIN_NOTARIZATIONDB_H
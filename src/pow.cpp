@@ -15,7 +15,7 @@
 
 static const int64_t nDiffChangeTarget = 56000; // Patch effective @ block 56000
 
-unsigned int GetNextWorkRequired(const CBlockIndex* pindexLast, const CBlockHeader *pblock, const Consensus::Params& params)
+static unsigned int ComputeNextWorkRequired(const CBlockIndex* pindexLast, const CBlockHeader *pblock, const Consensus::Params& params)
 {
     int nHeight = pindexLast->nHeight + 1;
     bool fNewDifficultyProtocol = (nHeight >= nDiffChangeTarget);
@@ -35,6 +35,23 @@ unsigned int GetNextWorkRequired(const CBlockIndex* pindexLast, const CBlockHead
     }
 }
 
+unsigned int GetNextWorkRequired(const CBlockIndex* pindexLast, const CBlockHeader *pblock, const Consensus::Params& params)
+{
+    // The target only depends on the ancestors of the new block, which never
+    // change for a given index, so remember it there. The exception is the
+    // testnet minimum difficulty rule, which looks at the new block's time.
+    const bool fCache = pindexLast != NULL && !params.fPowAllowMinDifficultyBlocks;
+    if (fCache && pindexLast->pNextWorkParams == &params)
+        return pindexLast->nNextWorkRequired;
+
+    unsigned int nBits = ComputeNextWorkRequired(pindexLast, pblock, params);
+    if (fCache) {
+        pindexLast->nNextWorkRequired = nBits;
+        pindexLast->pNextWorkParams = &params;
+    }
+    return nBits;
+}
+
 unsigned int DigiShield(const CBlockIndex* pindexLast, const CBlockHeader *pblock, const Consensus::Params& params)
 {
     unsigned int nProofOfWorkLimit = UintToArith256(params.powLimit).GetCompact();
@@ -72,9 +89,7 @@ unsigned int DigiShield(const CBlockIndex* pindexLast, const CBlockHeader *pbloc
         blockstogoback = params.DifficultyAdjustmentInterval();
 
     // Go back by what we want to be 14 days worth of blocks
-    const CBlockIndex* pindexFirst = pindexLast;
-    for (int i = 0; pindexFirst && i < blockstogoback; i++)
-        pindexFirst = pindexFirst->pprev;
+    const CBlockIndex* pindexFirst = pindexLast->GetAncestor(pindexLast->nHeight - blockstogoback);
     assert(pindexFirst);
 
 	return CalculateNextWorkRequired(pindexLast, pindexFirst->GetBlockTime(), params);
@@ -152,12 +167,14 @@ unsigned int KimotoGravityWell(const CBlockIndex* pindexLast, const CBlockHeader
                 if (PastBlocksMax > 0 && i > PastBlocksMax) { break; }
                 PastBlocksMass++;
 
-                if (i == 1)        { PastDifficultyAverage.SetCompact(BlockReading->nBits); }
+                // Decode each target once; i always fits in a single limb, so the divisions below take the short path
+                const arith_uint256 BlockReadingDifficulty = arith_uint256().SetCompact(BlockReading->nBits);
+                if (i == 1)        { PastDifficultyAverage = BlockReadingDifficulty; }
                 else             //Testcoin: workaround were to overcome the overflow issue when changing from CBigNum to arith_uint256
-                                    if (arith_uint256().SetCompact(BlockReading->nBits) >= PastDifficultyAveragePrev)
-                                    PastDifficultyAverage = ((arith_uint256().SetCompact(BlockReading->nBits) - PastDifficultyAveragePrev) / i) + PastDifficultyAveragePrev;
+                                    if (BlockReadingDifficulty >= PastDifficultyAveragePrev)
+                                    PastDifficultyAverage = ((BlockReadingDifficulty - PastDifficultyAveragePrev) / i) + PastDifficultyAveragePrev;
                                     else
-                                    PastDifficultyAverage = PastDifficultyAveragePrev - ((PastDifficultyAveragePrev - arith_uint256().SetCompact(BlockReading->nBits)) / i);
+                                    PastDifficultyAverage = PastDifficultyAveragePrev - ((PastDifficultyAveragePrev - BlockReadingDifficulty) / i);
 
                 PastDifficultyAveragePrev = PastDifficultyAverage;
 
@@ -168,11 +185,11 @@ unsigned int KimotoGravityWell(const CBlockIndex* pindexLast, const CBlockHeader
                 if (PastRateActualSeconds != 0 && PastRateTargetSeconds != 0) {
                 PastRateAdjustmentRatio                        = double(PastRateTargetSeconds) / double(PastRateActualSeconds);
                 }
-                EventHorizonDeviation                        = 1 + (0.7084 * pow((double(PastBlocksMass)/double(144)), -1.228));
-                EventHorizonDeviationFast                = EventHorizonDeviation;
-                EventHorizonDeviationSlow                = 1 / EventHorizonDeviation;
-
                 if (PastBlocksMass >= PastBlocksMin) {
+                        // Only consulted once the minimum window is reached
+                        EventHorizonDeviation                        = 1 + (0.7084 * pow((double(PastBlocksMass)/double(144)), -1.228));
+                        EventHorizonDeviationFast                = EventHorizonDeviation;
+                        EventHorizonDeviationSlow                = 1 / EventHorizonDeviation;
                         if ((PastRateAdjustmentRatio <= EventHorizonDeviationSlow) || (PastRateAdjustmentRatio >= EventHorizonDeviationFast)) { assert(BlockReading); break; }
                 }
                 if (BlockReading->pprev == NULL) { assert(BlockReading); break; }
@@ -15,6 +15,11 @@ class CBlockHeader;
 class CBlockIndex;
 class uint256;
 
+/**
+ * Return the nBits a block building on pindexLast must have. The result is
+ * remembered in pindexLast, so callers must hold cs_main for indexes that are
+ * in mapBlockIndex.
+ */
 unsigned int GetNextWorkRequired(const CBlockIndex* pindexLast, const CBlockHeader *pblock, const Consensus::Params&);
 unsigned int DigiShield(const CBlockIndex* pindexLast, const CBlockHeader *pblock, const Consensus::Params&);
 unsigned int CalculateNextWorkRequired(const CBlockIndex* pindexLast, int64_t nFirstBlockTime, const Consensus::Params&);
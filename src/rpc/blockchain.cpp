@@ -4,17 +4,23 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "amount.h"
+#include "base58.h"
 #include "chain.h"
 #include "chainparams.h"
 #include "checkpoints.h"
+#include "clientversion.h"
 #include "coins.h"
+#include "coinscan.h"
+#include "coinstats.h"
 #include "consensus/validation.h"
 #include "main.h"
 #include "policy/policy.h"
 #include "primitives/transaction.h"
 #include "rpc/server.h"
+#include "snapshot.h"
 #include "streams.h"
 #include "sync.h"
+#include "txdb.h"
 #include "txmempool.h"
 #include "util.h"
 #include "utilstrencodings.h"
@@ -24,6 +30,8 @@
 
 #include <univalue.h>
 
+#include <boost/filesystem.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/thread/thread.hpp> // boost::thread::interrupt
 
 #include "komodo_rpcblockchain.h"
@@ -489,6 +497,42 @@ UniValue getblockhash(const UniValue& params, bool fHelp)
     return pblockindex->GetBlockHash().GetHex();
 }
 
+UniValue gettotalsupply(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() > 1)
+        throw runtime_error(
+            "gettotalsupply ( height )\n"
+            "\nReturns the total block subsidy issued by the blocks up to the given height.\n"
+            "The unspendable genesis coinbase is not counted, and neither are fees or coins burned by the chain.\n"
+            "\nArguments:\n"
+            "1. height        (numeric, optional, default=current tip) The last block height to include\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"height\": n,   (numeric) The height the supply is given for\n"
+            "  \"supply\": x.xxx (numeric) The total subsidy of blocks 1 to height\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("gettotalsupply", "")
+            + HelpExampleCli("gettotalsupply", "1000000")
+            + HelpExampleRpc("gettotalsupply", "1000000")
+        );
+
+    int nHeight;
+    if (params.size() > 0) {
+        nHeight = params[0].get_int();
+        if (nHeight < 0)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range");
+    } else {
+        LOCK(cs_main);
+        nHeight = chainActive.Height();
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("height", nHeight));
+    ret.push_back(Pair("supply", ValueFromAmount(GetTotalSupply(nHeight, Params().GetConsensus()))));
+    return ret;
+}
+
 UniValue getblockheader(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() < 1 || params.size() > 2)
@@ -606,7 +650,7 @@ UniValue getblock(const UniValue& params, bool fHelp)
     CBlock block;
     CBlockIndex* pblockindex = mapBlockIndex[hash];
 
-    if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
+    if ((fHavePruned || fSnapshotChainstate) && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
         throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
 
     if(!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
@@ -623,84 +667,68 @@ UniValue getblock(const UniValue& params, bool fHelp)
     return blockToJSON(block, pblockindex);
 }
 
-struct CCoinsStats
-{
-    int nHeight;
-    uint256 hashBlock;
-    uint64_t nTransactions;
-    uint64_t nTransactionOutputs;
-    uint64_t nSerializedSize;
-    uint256 hashSerialized;
-    CAmount nTotalAmount;
-
-    CCoinsStats() : nHeight(0), nTransactions(0), nTransactionOutputs(0), nSerializedSize(0), nTotalAmount(0) {}
-};
-
-//! Calculate statistics about the unspent transaction output set
-static bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
-{
-    boost::scoped_ptr<CCoinsViewCursor> pcursor(view->Cursor());
-
-    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
-    stats.hashBlock = pcursor->GetBestBlock();
-    {
-        LOCK(cs_main);
-        stats.nHeight = mapBlockIndex.find(stats.hashBlock)->second->nHeight;
-    }
-    ss << stats.hashBlock;
-    CAmount nTotalAmount = 0;
-    while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
-        uint256 key;
-        CCoins coins;
-        if (pcursor->GetKey(key) && pcursor->GetValue(coins)) {
-            stats.nTransactions++;
-            ss << key;
-            for (unsigned int i=0; i<coins.vout.size(); i++) {
-                const CTxOut &out = coins.vout[i];
-                if (!out.IsNull()) {
-                    stats.nTransactionOutputs++;
-                    ss << VARINT(i+1);
-                    ss << out;
-                    nTotalAmount += out.nValue;
-                }
-            }
-            stats.nSerializedSize += 32 + pcursor->GetValueSize();
-            ss << VARINT(0);
-        } else {
-            return error("%s: unable to read value", __func__);
-        }
-        pcursor->Next();
-    }
-    stats.hashSerialized = ss.GetHash();
-    stats.nTotalAmount = nTotalAmount;
-    return true;
-}
-
 UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
 {
-    if (fHelp || params.size() != 0)
+    if (fHelp || params.size() > 2)
         throw runtime_error(
-            "gettxoutsetinfo\n"
+            "gettxoutsetinfo ( \"hash_type\" use_index )\n"
             "\nReturns statistics about the unspent transaction output set.\n"
-            "Note this call may take some time.\n"
+            "\nArguments:\n"
+            "1. \"hash_type\"  (string, optional, default=\"muhash\") Which UTXO set hash to return:\n"
+            "                 \"muhash\" returns the statistics kept up to date with the chain tip at once;\n"
+            "                 \"hash_serialized\" walks the whole set, so this call may take some time.\n"
+            "2. use_index    (boolean, optional, default=true) With \"muhash\", false computes the statistics\n"
+            "                 afresh from the whole set, on all cores, to check the ones kept up to date.\n"
             "\nResult:\n"
             "{\n"
             "  \"height\":n,     (numeric) The current block height (index)\n"
             "  \"bestblock\": \"hex\",   (string) the best block hash hex\n"
-            "  \"transactions\": n,      (numeric) The number of transactions\n"
+            "  \"transactions\": n,      (numeric) The number of transactions (hash_serialized only)\n"
             "  \"txouts\": n,            (numeric) The number of output transactions\n"
             "  \"bytes_serialized\": n,  (numeric) The serialized size\n"
-            "  \"hash_serialized\": \"hash\",   (string) The serialized hash\n"
+            "  \"hash_serialized\": \"hash\",   (string) The serialized hash (hash_serialized only)\n"
+            "  \"muhash\": \"hash\",            (string) The rolling multiset hash (muhash only)\n"
             "  \"total_amount\": x.xxx          (numeric) The total amount\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("gettxoutsetinfo", "")
+            + HelpExampleCli("gettxoutsetinfo", "\"hash_serialized\"")
+            + HelpExampleCli("gettxoutsetinfo", "\"muhash\" false")
             + HelpExampleRpc("gettxoutsetinfo", "")
         );
 
+    const std::string strHashType = params.size() > 0 ? params[0].get_str() : "muhash";
+    const bool fUseIndex = params.size() > 1 ? params[1].get_bool() : true;
     UniValue ret(UniValue::VOBJ);
 
+    if (strHashType == "muhash") {
+        int nHeight;
+        CRollingCoinsStats stats;
+        if (fUseIndex) {
+            stats = GetTipCoinsStats();
+        } else {
+            FlushStateToDisk();
+            if (!GetRollingCoinsStats(pcoinsdbview, stats))
+                throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read UTXO set");
+        }
+        {
+            LOCK(cs_main);
+            BlockMap::const_iterator it = mapBlockIndex.find(stats.hashBlock);
+            if (it == mapBlockIndex.end())
+                throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read UTXO set");
+            nHeight = it->second->nHeight;
+        }
+        ret.push_back(Pair("height", (int64_t)nHeight));
+        ret.push_back(Pair("bestblock", stats.hashBlock.GetHex()));
+        ret.push_back(Pair("txouts", stats.nTransactionOutputs));
+        ret.push_back(Pair("bytes_serialized", stats.nSerializedSize));
+        ret.push_back(Pair("muhash", stats.GetHash().GetHex()));
+        ret.push_back(Pair("total_amount", ValueFromAmount(stats.nTotalAmount)));
+        return ret;
+    }
+    if (strHashType != "hash_serialized")
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Unknown hash_type " + strHashType);
+
     CCoinsStats stats;
     FlushStateToDisk();
     if (GetUTXOStats(pcoinsTip, stats)) {
@@ -717,6 +745,234 @@ UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
     return ret;
 }
 
+UniValue dumptxoutset(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "dumptxoutset \"path\"\n"
+            "\nWrites the unspent transaction output set, and the headers of the blocks it\n"
+            "was built from, to a snapshot file that -loadtxoutset can start a node from.\n"
+            "Note this call may take some time.\n"
+            "\nArguments:\n"
+            "1. \"path\"    (string, required) The file to write, relative to the data directory\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"coins_written\": n,          (numeric) The number of coins written\n"
+            "  \"base_hash\": \"hash\",         (string) The hash of the block the coins are as of\n"
+            "  \"base_height\": n,            (numeric) The height of that block\n"
+            "  \"path\": \"path\",              (string) The absolute path of the snapshot\n"
+            "  \"hash_serialized\": \"hash\"    (string) The serialized hash, as gettxoutsetinfo \"hash_serialized\" reports it\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("dumptxoutset", "\"utxo.dat\"")
+            + HelpExampleRpc("dumptxoutset", "\"utxo.dat\"")
+        );
+
+    const boost::filesystem::path path = boost::filesystem::absolute(params[0].get_str(), GetDataDir());
+    const boost::filesystem::path pathTemp = path.string() + ".incomplete";
+    if (boost::filesystem::exists(path))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, path.string() + " already exists");
+
+    CAutoFile file(fopen(pathTemp.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull())
+        throw JSONRPCError(RPC_MISC_ERROR, "Unable to open " + pathTemp.string());
+
+    // Whatever goes wrong, don't leave the incomplete file behind
+    CSnapshotMetadata metadata;
+    CCoinsStats stats;
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    try {
+        boost::scoped_ptr<CCoinsViewCursor> pcursor;
+        {
+            // The cursor sees the coins as of the tip, whatever is connected
+            // while they are written out
+            LOCK(cs_main);
+            FlushStateToDisk();
+            pcursor.reset(pcoinsTip->Cursor());
+            metadata.hashBlock = pcursor->GetBestBlock();
+            const CBlockIndex* pindexBase = mapBlockIndex.find(metadata.hashBlock)->second;
+            metadata.nHeight = pindexBase->nHeight;
+            file << metadata;
+            for (int nHeight = 1; nHeight <= pindexBase->nHeight; nHeight++) {
+                const CBlockIndex* pindex = pindexBase->GetAncestor(nHeight);
+                file << pindex->GetBlockHeader() << VARINT(pindex->nTx);
+            }
+        }
+
+        ss << metadata.hashBlock;
+        uint256 prevkey;
+        std::map<uint32_t, Coin> outputs;
+        while (true) {
+            boost::this_thread::interruption_point();
+            COutPoint key;
+            Coin coin;
+            const bool fValid = pcursor->Valid();
+            if (fValid && !(pcursor->GetKey(key) && pcursor->GetValue(coin)))
+                throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read UTXO set");
+            if (!outputs.empty() && (!fValid || key.hash != prevkey)) {
+                file << prevkey;
+                WriteCompactSize(file, outputs.size());
+                for (std::map<uint32_t, Coin>::const_iterator it = outputs.begin(); it != outputs.end(); ++it) {
+                    WriteCompactSize(file, it->first);
+                    file << it->second;
+                }
+                ApplyStats(stats, ss, prevkey, outputs);
+                outputs.clear();
+            }
+            if (!fValid)
+                break;
+            prevkey = key.hash;
+            outputs[key.n] = std::move(coin);
+            pcursor->Next();
+        }
+
+        metadata.nCoins = stats.nTransactionOutputs;
+        if (fseek(file.Get(), 0, SEEK_SET) != 0)
+            throw JSONRPCError(RPC_MISC_ERROR, "Unable to seek in " + pathTemp.string());
+        file << metadata;
+        if (fflush(file.Get()) != 0)
+            throw JSONRPCError(RPC_MISC_ERROR, "Unable to write " + pathTemp.string());
+        FileCommit(file.Get());
+        file.fclose();
+        if (!RenameOver(pathTemp, path))
+            throw JSONRPCError(RPC_MISC_ERROR, "Unable to rename " + pathTemp.string());
+    } catch (...) {
+        file.fclose();
+        boost::system::error_code ec;
+        boost::filesystem::remove(pathTemp, ec);
+        throw;
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("coins_written", (int64_t)metadata.nCoins));
+    ret.push_back(Pair("base_hash", metadata.hashBlock.GetHex()));
+    ret.push_back(Pair("base_height", (int64_t)metadata.nHeight));
+    ret.push_back(Pair("path", path.string()));
+    ret.push_back(Pair("hash_serialized", ss.GetHash().GetHex()));
+    return ret;
+}
+
+namespace {
+
+//! Collects the coins paying to any of a set of scripts
+class CScanScriptsReducer : public CCoinsScanReducer
+{
+public:
+    const std::set<CScript>& setScripts;
+    std::vector<std::pair<COutPoint, Coin> > vFound;
+    uint64_t nScanned;
+
+    CScanScriptsReducer(const std::set<CScript>& setScriptsIn) : setScripts(setScriptsIn), nScanned(0) {}
+
+    CCoinsScanReducer* Fork() const { return new CScanScriptsReducer(setScripts); }
+
+    bool Apply(const COutPoint& outpoint, const Coin& coin, unsigned int nValueSize)
+    {
+        nScanned++;
+        if (setScripts.count(coin.out.scriptPubKey))
+            vFound.push_back(std::make_pair(outpoint, coin));
+        return true;
+    }
+
+    void Merge(const CCoinsScanReducer& shard)
+    {
+        const CScanScriptsReducer& other = static_cast<const CScanScriptsReducer&>(shard);
+        vFound.insert(vFound.end(), other.vFound.begin(), other.vFound.end());
+        nScanned += other.nScanned;
+    }
+};
+
+}
+
+UniValue scantxoutset(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "scantxoutset [\"address\"|\"script\",...]\n"
+            "\nScans the unspent transaction output set for outputs paying to any of the given\n"
+            "addresses or hex-encoded scripts. The scan runs on all cores and does not hold up\n"
+            "block processing, but may take some time.\n"
+            "\nArguments:\n"
+            "1. \"scanobjects\"   (array, required) The addresses or scriptPubKeys to look for\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"bestblock\": \"hash\",   (string) The block the unspent outputs are as of\n"
+            "  \"height\": n,             (numeric) The height of that block\n"
+            "  \"txouts\": n,             (numeric) The number of unspent outputs scanned\n"
+            "  \"unspents\": [           (array) The unspent outputs found, in txid order\n"
+            "    {\n"
+            "      \"txid\": \"hash\",        (string) The transaction id\n"
+            "      \"vout\": n,             (numeric) The output number\n"
+            "      \"scriptPubKey\": \"hex\", (string) The script\n"
+            "      \"amount\": x.xxx,       (numeric) The amount in " + CURRENCY_UNIT + "\n"
+            "      \"height\": n,           (numeric) The height of the block the output was created in\n"
+            "      \"coinbase\": true|false (boolean) Whether the output is from a coinbase\n"
+            "    }\n"
+            "    ,...\n"
+            "  ],\n"
+            "  \"total_amount\": x.xxx    (numeric) The total amount of the unspent outputs found\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("scantxoutset", "\"[\\\"myaddress\\\"]\"")
+            + HelpExampleRpc("scantxoutset", "[\"myaddress\"]")
+        );
+
+    std::set<CScript> setScripts;
+    const UniValue& scanobjects = params[0].get_array();
+    for (size_t i = 0; i < scanobjects.size(); i++) {
+        const std::string& str = scanobjects[i].get_str();
+        CBitcoinAddress address(str);
+        if (address.IsValid()) {
+            setScripts.insert(GetScriptForDestination(address.Get()));
+        } else if (IsHex(str)) {
+            std::vector<unsigned char> data(ParseHex(str));
+            setScripts.insert(CScript(data.begin(), data.end()));
+        } else {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address or script: " + str);
+        }
+    }
+
+    // Only the flush needs cs_main; the scan is over a database snapshot
+    FlushStateToDisk();
+    CScanScriptsReducer reducer(setScripts);
+    uint256 hashBlock;
+    if (!ScanCoins(*pcoinsdbview, reducer, GetNumCores(), hashBlock))
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read UTXO set");
+
+    int nHeight;
+    {
+        LOCK(cs_main);
+        BlockMap::const_iterator it = mapBlockIndex.find(hashBlock);
+        if (it == mapBlockIndex.end())
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read UTXO set");
+        nHeight = it->second->nHeight;
+    }
+
+    UniValue unspents(UniValue::VARR);
+    CAmount nTotal = 0;
+    for (size_t i = 0; i < reducer.vFound.size(); i++) {
+        const COutPoint& outpoint = reducer.vFound[i].first;
+        const Coin& coin = reducer.vFound[i].second;
+        UniValue unspent(UniValue::VOBJ);
+        unspent.push_back(Pair("txid", outpoint.hash.GetHex()));
+        unspent.push_back(Pair("vout", (int64_t)outpoint.n));
+        unspent.push_back(Pair("scriptPubKey", HexStr(coin.out.scriptPubKey.begin(), coin.out.scriptPubKey.end())));
+        unspent.push_back(Pair("amount", ValueFromAmount(coin.out.nValue)));
+        unspent.push_back(Pair("height", (int64_t)coin.nHeight));
+        unspent.push_back(Pair("coinbase", coin.IsCoinBase()));
+        unspents.push_back(unspent);
+        nTotal += coin.out.nValue;
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("bestblock", hashBlock.GetHex()));
+    ret.push_back(Pair("height", (int64_t)nHeight));
+    ret.push_back(Pair("txouts", (int64_t)reducer.nScanned));
+    ret.push_back(Pair("unspents", unspents));
+    ret.push_back(Pair("total_amount", ValueFromAmount(nTotal)));
+    return ret;
+}
+
 UniValue gettxout(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() < 2 || params.size() > 3)
@@ -743,7 +999,6 @@ UniValue gettxout(const UniValue& params, bool fHelp)
             "        ,...\n"
             "     ]\n"
             "  },\n"
-            "  \"version\" : n,            (numeric) The version\n"
             "  \"coinbase\" : true|false   (boolean) Coinbase or not\n"
             "}\n"
 
@@ -763,41 +1018,40 @@ UniValue gettxout(const UniValue& params, bool fHelp)
     std::string strHash = params[0].get_str();
     uint256 hash(uint256S(strHash));
     int n = params[1].get_int();
+    if (n < 0)
+        return NullUniValue;
+    COutPoint out(hash, n);
     bool fMempool = true;
     if (params.size() > 2)
         fMempool = params[2].get_bool();
 
-    CCoins coins;
+    Coin coin;
     if (fMempool) {
         LOCK(mempool.cs);
         CCoinsViewMemPool view(pcoinsTip, mempool);
-        if (!view.GetCoins(hash, coins))
+        if (!view.GetCoin(out, coin) || mempool.isSpent(out)) // TODO: filtering spent coins should be done by the CCoinsViewMemPool
             return NullUniValue;
-        mempool.pruneSpent(hash, coins); // TODO: this should be done by the CCoinsViewMemPool
     } else {
-        if (!pcoinsTip->GetCoins(hash, coins))
+        if (!pcoinsTip->GetCoin(out, coin))
             return NullUniValue;
     }
-    if (n<0 || (unsigned int)n>=coins.vout.size() || coins.vout[n].IsNull())
-        return NullUniValue;
 
     BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
     CBlockIndex *pindex = it->second;
     ret.push_back(Pair("bestblock", pindex->GetBlockHash().GetHex()));
-    if ((unsigned int)coins.nHeight == MEMPOOL_HEIGHT) {
+    if (coin.nHeight == MEMPOOL_HEIGHT) {
         ret.push_back(Pair("confirmations", 0));
         ret.push_back(Pair("rawconfirmations", 0));
     } else {
-        ret.push_back(Pair("confirmations", komodo_dpowconfs(coins.nHeight,pindex->nHeight - coins.nHeight + 1)));
-        ret.push_back(Pair("rawconfirmations", pindex->nHeight - coins.nHeight + 1));
+        ret.push_back(Pair("confirmations", komodo_dpowconfs(coin.nHeight,pindex->nHeight - coin.nHeight + 1)));
+        ret.push_back(Pair("rawconfirmations", (int64_t)(pindex->nHeight - coin.nHeight + 1)));
     }
 
-    ret.push_back(Pair("value", ValueFromAmount(coins.vout[n].nValue)));
+    ret.push_back(Pair("value", ValueFromAmount(coin.out.nValue)));
     UniValue o(UniValue::VOBJ);
-    ScriptPubKeyToJSON(coins.vout[n].scriptPubKey, o, true);
+    ScriptPubKeyToJSON(coin.out.scriptPubKey, o, true);
     ret.push_back(Pair("scriptPubKey", o));
-    ret.push_back(Pair("version", coins.nVersion));
-    ret.push_back(Pair("coinbase", coins.fCoinBase));
+    ret.push_back(Pair("coinbase", (bool)coin.fCoinBase));
 
     return ret;
 }
@@ -1201,6 +1455,7 @@ UniValue reconsiderblock(const UniValue& params, bool fHelp)
 static const CRPCCommand commands[] =
 { //  category              name                      actor (function)         okSafeMode
   //  --------------------- ------------------------  -----------------------  ----------
+    { "blockchain",         "dumptxoutset",           &dumptxoutset,           true  },
     { "blockchain",         "getblockchaininfo",      &getblockchaininfo,      true  },
     { "blockchain",         "getbestblockhash",       &getbestblockhash,       true  },
     { "blockchain",         "getblockcount",          &getblockcount,          true  },
@@ -1209,6 +1464,7 @@ static const CRPCCommand commands[] =
     { "blockchain",         "getblockheader",         &getblockheader,         true  },
     { "blockchain",         "getchaintips",           &getchaintips,           true  },
     { "blockchain",         "getdifficulty",          &getdifficulty,          true  },
+    { "blockchain",         "gettotalsupply",         &gettotalsupply,         true  },
     { "blockchain",         "getmempoolancestors",    &getmempoolancestors,    true  },
     { "blockchain",         "getmempooldescendants",  &getmempooldescendants,  true  },
     { "blockchain",         "getmempoolentry",        &getmempoolentry,        true  },
@@ -1216,8 +1472,10 @@ static const CRPCCommand commands[] =
     { "blockchain",         "getrawmempool",          &getrawmempool,          true  },
     { "blockchain",         "gettxout",               &gettxout,               true  },
     { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true  },
+    { "blockchain",         "scantxoutset",           &scantxoutset,           true  },
     { "blockchain",         "verifychain",            &verifychain,            true  },
     { "blockchain",         "calc_MoM",               &calc_MoM,               true  },
+    { "blockchain",         "calc_MoMproof",          &calc_MoMproof,          true  },
     { "blockchain",         "height_MoM",             &height_MoM,             true  },
 
     /* Not shown in help */
@@ -47,6 +47,7 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "getbalance", 1 },
     { "getbalance", 2 },
     { "getblockhash", 0 },
+    { "gettotalsupply", 0 },
     { "move", 2 },
     { "move", 3 },
     { "sendfrom", 2 },
@@ -81,6 +82,8 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "signrawtransaction", 2 },
     { "sendrawtransaction", 1 },
     { "fundrawtransaction", 1 },
+    { "gettxoutsetinfo", 1 },
+    { "scantxoutset", 0 },
     { "gettxout", 1 },
     { "gettxout", 2 },
     { "gettxoutproof", 0 },
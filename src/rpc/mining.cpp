@@ -12,6 +12,7 @@
 #include "consensus/params.h"
 #include "consensus/validation.h"
 #include "core_io.h"
+#include "crypto/scrypt.h"
 #include "init.h"
 #include "main.h"
 #include "miner.h"
@@ -110,27 +111,32 @@ UniValue generateBlocks(boost::shared_ptr<CReserveScript> coinbaseScript, int nG
         nHeightEnd = nHeightStart+nGenerate;
     }
     unsigned int nExtraNonce = 0;
+    int nThreads = GetArg("-genthreads", DEFAULT_GENERATE_THREADS);
+    if (nThreads <= 0)
+        nThreads = GetNumCores();
+    nThreads = std::max(nThreads, 1);
+    // Scratchpads live for the whole call instead of being set up for every hash
+    std::vector<std::vector<char> > vScratchpad(nThreads, std::vector<char>(SCRYPT_MULTI_SCRATCHPAD_SIZE));
     UniValue blockHashes(UniValue::VARR);
     while (nHeight < nHeightEnd)
     {
         std::unique_ptr<CBlockTemplate> pblocktemplate(BlockAssembler(Params()).CreateNewBlock(coinbaseScript->reserveScript));
         if (!pblocktemplate.get())
             throw JSONRPCError(RPC_INTERNAL_ERROR, "Couldn't create new block");
-        CBlock *pblock = &pblocktemplate->block;
+        // Every thread searches its own extranonce, so the headers never overlap
+        std::vector<CBlock> vBlocks(nThreads, pblocktemplate->block);
         {
             LOCK(cs_main);
-            IncrementExtraNonce(pblock, chainActive.Tip(), nExtraNonce);
+            BOOST_FOREACH(CBlock& block, vBlocks)
+                IncrementExtraNonce(&block, chainActive.Tip(), nExtraNonce, &pblocktemplate->vCoinbaseMerkleBranch);
         }
-        while (nMaxTries > 0 && pblock->nNonce < nInnerLoopCount && !CheckProofOfWork(pblock->GetPoWHash(), pblock->nBits, Params().GetConsensus())) {
-            ++pblock->nNonce;
-            --nMaxTries;
-        }
-        if (nMaxTries == 0) {
-            break;
-        }
-        if (pblock->nNonce == nInnerLoopCount) {
+        int nSolved = ScanNonces(vBlocks, nInnerLoopCount, nMaxTries, vScratchpad, Params().GetConsensus());
+        if (nSolved < 0) {
+            if (nMaxTries == 0)
+                break;
             continue;
         }
+        CBlock *pblock = &vBlocks[nSolved];
         CValidationState state;
         if (!ProcessNewBlock(state, Params(), NULL, pblock, true, NULL, false))
             throw JSONRPCError(RPC_INTERNAL_ERROR, "ProcessNewBlock, block not accepted");
@@ -376,6 +382,10 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
             "  },\n"
             "  \"coinbasevalue\" : n,              (numeric) maximum allowable input to coinbase transaction, including the generation award and transaction fees (in Satoshis)\n"
             "  \"coinbasetxn\" : { ... },          (json object) information for coinbase transaction\n"
+            "  \"coinbasemerklebranch\" : [        (array of string) merkle branch of the coinbase, from the leaves up\n"
+            "     \"xxxx\"                           (string) hash, in the same byte order as \"txid\"\n"
+            "     ,...\n"
+            "  ],\n"
             "  \"target\" : \"xxxx\",                (string) The hash target\n"
             "  \"mintime\" : xxx,                  (numeric) The minimum timestamp appropriate for next block time in seconds since epoch (Jan 1 1970 GMT)\n"
             "  \"mutable\" : [                     (array of string) list of ways the block template may be changed \n"
@@ -539,8 +549,15 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
             delete pblocktemplate;
             pblocktemplate = NULL;
         }
-        CScript scriptDummy = CScript() << OP_TRUE;
-        pblocktemplate = BlockAssembler(Params()).CreateNewBlock(scriptDummy);
+        // Use the template built in the background if it is on the tip and
+        // has the mempool as it is now
+        std::shared_ptr<const CBlockTemplate> pprebuilt = GetPrebuiltBlockTemplate(pindexPrevNew, nTransactionsUpdatedLast);
+        if (pprebuilt) {
+            pblocktemplate = new CBlockTemplate(*pprebuilt);
+        } else {
+            CScript scriptDummy = CScript() << OP_TRUE;
+            pblocktemplate = BlockAssembler(Params()).CreateNewBlock(scriptDummy);
+        }
         if (!pblocktemplate)
             throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
 
@@ -669,6 +686,10 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
     result.push_back(Pair("coinbaseaux", aux));
     result.push_back(Pair("coinbasevalue", (int64_t)pblock->vtx[0].vout[0].nValue + (int64_t)pblock->vtx[0].vout[1].nValue)); //<--Testcoin: Specifications
     result.push_back(Pair("charityvalue", (int64_t)pblock->vtx[0].vout[0].nValue)); //<--Testcoin: Specifications
+    UniValue merkleBranch(UniValue::VARR);
+    BOOST_FOREACH(const uint256& hash, pblocktemplate->vCoinbaseMerkleBranch)
+        merkleBranch.push_back(hash.GetHex());
+    result.push_back(Pair("coinbasemerklebranch", merkleBranch));
     result.push_back(Pair("longpollid", chainActive.Tip()->GetBlockHash().GetHex() + i64tostr(nTransactionsUpdatedLast)));
     result.push_back(Pair("target", hashTarget.GetHex()));
     result.push_back(Pair("mintime", (int64_t)pindexPrev->GetMedianTimePast()+1));
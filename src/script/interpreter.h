@@ -114,6 +114,7 @@ struct PrecomputedTransactionData
 {
     uint256 hashPrevouts, hashSequence, hashOutputs;
 
+    PrecomputedTransactionData() {}
     PrecomputedTransactionData(const CTransaction& tx);
 };
 
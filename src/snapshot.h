@@ -0,0 +1,57 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SNAPSHOT_H
+#define BITCOIN_SNAPSHOT_H
+
+#include "serialize.h"
+#include "uint256.h"
+
+#include <string.h>
+
+#include <ios>
+
+//! Start of every UTXO set snapshot file
+static const unsigned char SNAPSHOT_MAGIC[5] = {'u', 't', 'x', 'o', 0xff};
+static const uint16_t SNAPSHOT_VERSION = 1;
+
+/**
+ * Metadata at the start of a UTXO set snapshot, as dumptxoutset writes it
+ * and -loadtxoutset reads it. It is followed by
+ * - the headers of blocks 1 to nHeight, each with VARINT(nTx) of its block,
+ * - the nCoins coins as of hashBlock, grouped by transaction in txid order:
+ *   the txid, the compact size number of its coins, then for each of them
+ *   the compact size output index and the Coin.
+ */
+class CSnapshotMetadata
+{
+public:
+    uint256 hashBlock;
+    int nHeight;
+    uint64_t nCoins;
+
+    CSnapshotMetadata() : nHeight(0), nCoins(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        unsigned char magic[sizeof(SNAPSHOT_MAGIC)];
+        uint16_t nSnapshotVersion = SNAPSHOT_VERSION;
+        memcpy(magic, SNAPSHOT_MAGIC, sizeof(magic));
+        READWRITE(FLATDATA(magic));
+        READWRITE(nSnapshotVersion);
+        if (ser_action.ForRead()) {
+            if (memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) != 0)
+                throw std::ios_base::failure("not a UTXO set snapshot");
+            if (nSnapshotVersion != SNAPSHOT_VERSION)
+                throw std::ios_base::failure("unsupported UTXO set snapshot version");
+        }
+        READWRITE(hashBlock);
+        READWRITE(nHeight);
+        READWRITE(nCoins);
+    }
+};
+
+#endif // BITCOIN_SNAPSHOT_H
@@ -0,0 +1,579 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "stratum.h"
+
+#include "base58.h"
+#include "chainparams.h"
+#include "consensus/merkle.h"
+#include "consensus/validation.h"
+#include "crypto/common.h"
+#include "crypto/scrypt.h"
+#include "main.h"
+#include "miner.h"
+#include "netbase.h"
+#include "random.h"
+#include "streams.h"
+#include "timedata.h"
+#include "txmempool.h"
+#include "util.h"
+#include "utilstrencodings.h"
+#include "validationinterface.h"
+
+#include <univalue.h>
+
+#include <atomic>
+#include <limits>
+#include <memory>
+
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+#include <boost/thread.hpp>
+
+#include <event2/buffer.h>
+#include <event2/bufferevent.h>
+#include <event2/event.h>
+#include <event2/listener.h>
+#include <event2/thread.h>
+#include <event2/util.h>
+
+/** Maximum length of a line received from a miner */
+static const size_t MAX_STRATUM_LINE_LENGTH = 16384;
+/** How often the server checks whether the job needs rebuilding, in seconds */
+static const int STRATUM_UPDATE_CHECK_INTERVAL = 5;
+
+/** Error codes of the stratum protocol */
+enum StratumErrorCode
+{
+    STRATUM_ERROR_OTHER = 20,
+    STRATUM_ERROR_JOB_NOT_FOUND = 21,
+    STRATUM_ERROR_DUPLICATE_SHARE = 22,
+    STRATUM_ERROR_LOW_DIFFICULTY = 23,
+    STRATUM_ERROR_UNAUTHORIZED = 24,
+    STRATUM_ERROR_NOT_SUBSCRIBED = 25,
+};
+
+static std::string StratumReply(const UniValue& id, const UniValue& result)
+{
+    UniValue reply(UniValue::VOBJ);
+    reply.push_back(Pair("id", id));
+    reply.push_back(Pair("result", result));
+    reply.push_back(Pair("error", NullUniValue));
+    return reply.write() + "\n";
+}
+
+static std::string StratumError(const UniValue& id, int code, const std::string& message)
+{
+    UniValue error(UniValue::VARR);
+    error.push_back(code);
+    error.push_back(message);
+    error.push_back(NullUniValue);
+    UniValue reply(UniValue::VOBJ);
+    reply.push_back(Pair("id", id));
+    reply.push_back(Pair("result", NullUniValue));
+    reply.push_back(Pair("error", error));
+    return reply.write() + "\n";
+}
+
+static std::string StratumNotification(const std::string& method, const UniValue& params)
+{
+    UniValue notification(UniValue::VOBJ);
+    notification.push_back(Pair("id", NullUniValue));
+    notification.push_back(Pair("method", method));
+    notification.push_back(Pair("params", params));
+    return notification.write() + "\n";
+}
+
+/** Parse a hex string of exactly nBytes bytes */
+static bool ParseStratumHex(const UniValue& value, size_t nBytes, std::vector<unsigned char>& vch)
+{
+    if (!value.isStr() || value.get_str().size() != nBytes * 2 || !IsHex(value.get_str()))
+        return false;
+    vch = ParseHex(value.get_str());
+    return true;
+}
+
+/** Miners get the previous block hash with the bytes of every 32-bit word swapped */
+static std::string StratumPrevHash(const uint256& hash)
+{
+    std::vector<unsigned char> vch(hash.begin(), hash.end());
+    for (size_t i = 0; i < vch.size(); i += 4)
+        std::reverse(vch.begin() + i, vch.begin() + i + 4);
+    return HexStr(vch);
+}
+
+/** Placeholder for the miner's payout while the template is built */
+static CScript StratumPayoutPlaceholder()
+{
+    return CScript() << OP_TRUE;
+}
+
+CMutableTransaction StratumCoinbase(const CStratumJob& job, const CScript& scriptPayout, const std::vector<unsigned char>& vchExtraNonce)
+{
+    CMutableTransaction txCoinbase(job.block.vtx[0]);
+    txCoinbase.vin[0].scriptSig = (CScript() << job.nHeight << vchExtraNonce) + COINBASE_FLAGS;
+    assert(txCoinbase.vin[0].scriptSig.size() <= 100);
+    txCoinbase.vout[job.nPayoutOutput].scriptPubKey = scriptPayout;
+    return txCoinbase;
+}
+
+arith_uint256 StratumDifficultyTarget(double dDifficulty)
+{
+    // Divide in 20-bit fixed point so fractional difficulties keep their
+    // precision; the low 224 bits of difficulty 1 are zero, so powers of two
+    // come out exact. Clamping keeps the divisor within 1..2^63, and maps NaN
+    // to the lowest difficulty
+    const int nScaleBits = 20;
+    if (!(dDifficulty >= MIN_STRATUM_DIFFICULTY))
+        dDifficulty = MIN_STRATUM_DIFFICULTY;
+    if (dDifficulty > MAX_STRATUM_DIFFICULTY)
+        dDifficulty = MAX_STRATUM_DIFFICULTY;
+    arith_uint256 bnTarget;
+    bnTarget.SetCompact(0x1f00ffff);
+    bnTarget /= arith_uint256((uint64_t)(dDifficulty * (1 << nScaleBits)));
+    bnTarget <<= nScaleBits;
+    return bnTarget;
+}
+
+CStratumServer::CStratumServer(const CChainParams& chainparamsIn, double dDifficultyIn) :
+    chainparams(chainparamsIn), dDifficulty(dDifficultyIn), nExtraNonce1Counter(GetRand(std::numeric_limits<uint32_t>::max())),
+    nJobCounter(0), nTransactionsUpdatedLast(0), nJobTime(0), vchScratchpad(SCRYPT_SCRATCHPAD_SIZE)
+{
+}
+
+void CStratumServer::InitClient(CStratumClient& client)
+{
+    uint32_t nExtraNonce1 = nExtraNonce1Counter++;
+    client.vchExtraNonce1.resize(STRATUM_EXTRANONCE1_SIZE);
+    WriteBE32(&client.vchExtraNonce1[0], nExtraNonce1);
+    client.dDifficulty = dDifficulty;
+}
+
+bool CStratumServer::UpdateJob(bool& fClean)
+{
+    fClean = false;
+    const CBlockIndex* pindexTip;
+    {
+        LOCK(cs_main);
+        pindexTip = chainActive.Tip();
+    }
+    const uint256 hashTip = pindexTip->GetBlockHash();
+    unsigned int nTransactionsUpdated = mempool.GetTransactionsUpdated();
+    if (hashTip == hashJobTip && (nTransactionsUpdated == nTransactionsUpdatedLast || GetTime() - nJobTime < STRATUM_JOB_REFRESH_INTERVAL))
+        return false;
+
+    // The background builder pays to the same placeholder. Its template is
+    // only used if it is already up to date: waiting for it here would hold
+    // up every miner connection, right after a new tip when it matters most
+    std::shared_ptr<const CBlockTemplate> pblocktemplate = GetPrebuiltBlockTemplate(pindexTip, nTransactionsUpdated);
+    if (!pblocktemplate) {
+        try {
+            pblocktemplate.reset(BlockAssembler(chainparams).CreateNewBlock(StratumPayoutPlaceholder()));
+        } catch (const std::exception& e) {
+            LogPrintf("stratum: unable to create block template: %s\n", e.what());
+            return false;
+        }
+        if (!pblocktemplate)
+            return false;
+    }
+
+    CStratumJob job;
+    job.block = pblocktemplate->block;
+    {
+        LOCK(cs_main);
+        BlockMap::iterator mi = mapBlockIndex.find(job.block.hashPrevBlock);
+        if (mi == mapBlockIndex.end())
+            return false;
+        job.nHeight = mi->second->nHeight + 1;
+        job.nMinTime = mi->second->GetMedianTimePast() + 1;
+    }
+    const std::vector<CTxOut>& vout = job.block.vtx[0].vout;
+    for (job.nPayoutOutput = 0; job.nPayoutOutput < vout.size(); job.nPayoutOutput++)
+        if (vout[job.nPayoutOutput].scriptPubKey == StratumPayoutPlaceholder())
+            break;
+    assert(job.nPayoutOutput < vout.size());
+    job.vMerkleBranch = pblocktemplate->vCoinbaseMerkleBranch;
+
+    if (job.block.hashPrevBlock != hashJobTip) {
+        // Shares for the old tip can no longer become blocks
+        mapJobs.clear();
+        hashJobTip = job.block.hashPrevBlock;
+        fClean = true;
+    }
+    mapJobs[++nJobCounter] = job;
+    while (mapJobs.size() > MAX_STRATUM_JOBS)
+        mapJobs.erase(mapJobs.begin());
+    nTransactionsUpdatedLast = nTransactionsUpdated;
+    nJobTime = GetTime();
+    LogPrint("stratum", "stratum: new job %d at height %d with %u transactions\n", nJobCounter, job.nHeight, job.block.vtx.size());
+    return true;
+}
+
+std::string CStratumServer::GetJobMessages(CStratumClient& client, bool fClean)
+{
+    if (mapJobs.empty() || !client.fSubscribed || !client.fAuthorized)
+        return "";
+
+    std::string strOut;
+    if (client.dDifficulty != client.dSentDifficulty) {
+        UniValue params(UniValue::VARR);
+        params.push_back(client.dDifficulty);
+        strOut += StratumNotification("mining.set_difficulty", params);
+        client.dSentDifficulty = client.dDifficulty;
+    }
+
+    // Split the coinbase around the extranonce so the miner can splice in its own
+    const CStratumJob& job = mapJobs.rbegin()->second;
+    std::vector<unsigned char> vchExtraNonce(client.vchExtraNonce1);
+    vchExtraNonce.resize(STRATUM_EXTRANONCE1_SIZE + STRATUM_EXTRANONCE2_SIZE);
+    CMutableTransaction txCoinbase = StratumCoinbase(job, client.scriptPayout, vchExtraNonce);
+    CDataStream ssCoinbase(SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS);
+    ssCoinbase << txCoinbase;
+    const CScript& scriptSig = txCoinbase.vin[0].scriptSig;
+    size_t nExtraNonceOffset = 4 + 1 + 36 + GetSizeOfCompactSize(scriptSig.size()) + (CScript() << job.nHeight).size() + 1;
+    assert(ssCoinbase.size() >= nExtraNonceOffset + vchExtraNonce.size());
+
+    UniValue branch(UniValue::VARR);
+    BOOST_FOREACH(const uint256& hash, job.vMerkleBranch)
+        branch.push_back(HexStr(hash.begin(), hash.end()));
+
+    UniValue params(UniValue::VARR);
+    params.push_back(strprintf("%d", mapJobs.rbegin()->first));
+    params.push_back(StratumPrevHash(job.block.hashPrevBlock));
+    params.push_back(HexStr(ssCoinbase.begin(), ssCoinbase.begin() + nExtraNonceOffset));
+    params.push_back(HexStr(ssCoinbase.begin() + nExtraNonceOffset + vchExtraNonce.size(), ssCoinbase.end()));
+    params.push_back(branch);
+    params.push_back(strprintf("%08x", job.block.nVersion));
+    params.push_back(strprintf("%08x", job.block.nBits));
+    params.push_back(strprintf("%08x", job.block.nTime));
+    params.push_back(fClean);
+    strOut += StratumNotification("mining.notify", params);
+    return strOut;
+}
+
+std::string CStratumServer::HandleSubscribe(CStratumClient& client, const UniValue& id)
+{
+    client.fSubscribed = true;
+    std::string strSubscription = HexStr(client.vchExtraNonce1);
+    UniValue subscriptions(UniValue::VARR);
+    UniValue subscription(UniValue::VARR);
+    subscription.push_back("mining.set_difficulty");
+    subscription.push_back(strSubscription);
+    subscriptions.push_back(subscription);
+    subscription = UniValue(UniValue::VARR);
+    subscription.push_back("mining.notify");
+    subscription.push_back(strSubscription);
+    subscriptions.push_back(subscription);
+
+    UniValue result(UniValue::VARR);
+    result.push_back(subscriptions);
+    result.push_back(HexStr(client.vchExtraNonce1));
+    result.push_back(STRATUM_EXTRANONCE2_SIZE);
+    return StratumReply(id, result) + GetJobMessages(client, true);
+}
+
+std::string CStratumServer::HandleAuthorize(CStratumClient& client, const UniValue& params, const UniValue& id)
+{
+    if (params.size() < 1 || !params[0].isStr())
+        return StratumError(id, STRATUM_ERROR_OTHER, "Missing user name");
+    // The user name is the payout address, optionally followed by a worker name
+    const std::string& strUser = params[0].get_str();
+    CBitcoinAddress address(strUser.substr(0, strUser.find('.')));
+    if (!address.IsValid())
+        return StratumError(id, STRATUM_ERROR_UNAUTHORIZED, "User name is not a valid payout address");
+
+    client.fAuthorized = true;
+    client.strWorker = strUser;
+    client.scriptPayout = GetScriptForDestination(address.Get());
+    LogPrint("stratum", "stratum: authorized worker %s\n", strUser);
+    if (mapJobs.empty()) {
+        bool fClean;
+        UpdateJob(fClean);
+    }
+    return StratumReply(id, true) + GetJobMessages(client, true);
+}
+
+std::string CStratumServer::HandleSubmit(CStratumClient& client, const UniValue& params, const UniValue& id)
+{
+    if (!client.fSubscribed)
+        return StratumError(id, STRATUM_ERROR_NOT_SUBSCRIBED, "Not subscribed");
+    if (!client.fAuthorized)
+        return StratumError(id, STRATUM_ERROR_UNAUTHORIZED, "Unauthorized worker");
+
+    std::vector<unsigned char> vchExtraNonce2, vchTime, vchNonce;
+    int64_t nJobId;
+    if (params.size() < 5 || !params[1].isStr() || !ParseInt64(params[1].get_str(), &nJobId) ||
+        !ParseStratumHex(params[2], STRATUM_EXTRANONCE2_SIZE, vchExtraNonce2) ||
+        !ParseStratumHex(params[3], 4, vchTime) || !ParseStratumHex(params[4], 4, vchNonce))
+        return StratumError(id, STRATUM_ERROR_OTHER, "Malformed share");
+
+    std::map<uint64_t, CStratumJob>::iterator it = mapJobs.find(nJobId);
+    if (it == mapJobs.end())
+        return StratumError(id, STRATUM_ERROR_JOB_NOT_FOUND, "Job not found");
+    CStratumJob& job = it->second;
+
+    std::vector<unsigned char> vchExtraNonce(client.vchExtraNonce1);
+    vchExtraNonce.insert(vchExtraNonce.end(), vchExtraNonce2.begin(), vchExtraNonce2.end());
+    CMutableTransaction txCoinbase = StratumCoinbase(job, client.scriptPayout, vchExtraNonce);
+
+    CBlockHeader header = job.block.GetBlockHeader();
+    header.hashMerkleRoot = ComputeMerkleRootFromBranch(txCoinbase.GetHash(), job.vMerkleBranch, 0);
+    header.nTime = ReadBE32(&vchTime[0]);
+    header.nNonce = ReadBE32(&vchNonce[0]);
+    if (header.nTime < job.nMinTime || header.nTime > GetAdjustedTime() + 2 * 60 * 60)
+        return StratumError(id, STRATUM_ERROR_OTHER, "Time out of range");
+    const uint256 hashHeader = header.GetHash();
+    if (job.setSubmitted.count(hashHeader))
+        return StratumError(id, STRATUM_ERROR_DUPLICATE_SHARE, "Duplicate share");
+
+    uint256 hashPoW;
+    scrypt_1024_1_1_256_sp(BEGIN(header.nVersion), BEGIN(hashPoW), &vchScratchpad[0]);
+    arith_uint256 bnBlockTarget;
+    bnBlockTarget.SetCompact(header.nBits);
+    bool fBlock = UintToArith256(hashPoW) <= bnBlockTarget;
+    if (!fBlock && UintToArith256(hashPoW) > StratumDifficultyTarget(client.dDifficulty))
+        return StratumError(id, STRATUM_ERROR_LOW_DIFFICULTY, "Low difficulty share");
+    // Only shares that passed are remembered, and only so many per job; a
+    // miner that fills it has to wait for the next job, unless it found a block
+    if (job.setSubmitted.size() < MAX_STRATUM_JOB_SHARES)
+        job.setSubmitted.insert(hashHeader);
+    else if (!fBlock)
+        return StratumError(id, STRATUM_ERROR_JOB_NOT_FOUND, "Too many shares for job");
+    LogPrint("stratum", "stratum: share from %s for job %d, hash %s\n", client.strWorker, nJobId, hashPoW.ToString());
+
+    if (fBlock) {
+        CBlock block(job.block);
+        block.vtx[0] = txCoinbase;
+        block.hashMerkleRoot = header.hashMerkleRoot;
+        block.nTime = header.nTime;
+        block.nNonce = header.nNonce;
+        CValidationState state;
+        if (ProcessNewBlock(state, chainparams, NULL, &block, true, NULL, false))
+            LogPrintf("stratum: block %s at height %d found by %s\n", block.GetHash().ToString(), job.nHeight, client.strWorker);
+        else
+            LogPrintf("stratum: block %s from %s not accepted: %s\n", block.GetHash().ToString(), client.strWorker, FormatStateMessage(state));
+    }
+    return StratumReply(id, true);
+}
+
+std::string CStratumServer::ProcessLine(CStratumClient& client, const std::string& strLine)
+{
+    UniValue request;
+    if (!request.read(strLine) || !request.isObject())
+        return StratumError(NullUniValue, STRATUM_ERROR_OTHER, "Parse error");
+    const UniValue& id = find_value(request, "id");
+    const UniValue& method = find_value(request, "method");
+    const UniValue& params = find_value(request, "params");
+    if (!method.isStr())
+        return StratumError(id, STRATUM_ERROR_OTHER, "Missing method");
+    if (!params.isArray() && !params.isNull())
+        return StratumError(id, STRATUM_ERROR_OTHER, "Params must be an array");
+    UniValue args = params.isArray() ? params : UniValue(UniValue::VARR);
+
+    const std::string& strMethod = method.get_str();
+    if (strMethod == "mining.subscribe")
+        return HandleSubscribe(client, id);
+    if (strMethod == "mining.authorize")
+        return HandleAuthorize(client, args, id);
+    if (strMethod == "mining.submit")
+        return HandleSubmit(client, args, id);
+    if (strMethod == "mining.extranonce.subscribe")
+        return StratumReply(id, false);
+    return StratumError(id, STRATUM_ERROR_OTHER, "Method not found");
+}
+
+/****** Network transport ********/
+
+static struct event_base* stratumBase = NULL;
+static boost::thread stratumThread;
+static std::vector<struct evconnlistener*> vStratumListeners;
+static struct event* stratumUpdateEvent = NULL;
+static struct event* stratumTimerEvent = NULL;
+static std::unique_ptr<CStratumServer> stratumServer;
+static std::map<struct bufferevent*, CStratumClient> mapStratumClients;
+/** Set by InterruptStratumServer; the event loop breaks as soon as it sees it */
+static std::atomic<bool> fStratumStopping(false);
+
+/** Wakes the stratum thread as soon as the chain tip moves */
+class CStratumNotifier : public CValidationInterface
+{
+protected:
+    void UpdatedBlockTip(const CBlockIndex *pindex)
+    {
+        event_active(stratumUpdateEvent, 0, 0);
+    }
+};
+static std::unique_ptr<CStratumNotifier> stratumNotifier;
+
+static void StratumDisconnect(struct bufferevent* bev)
+{
+    mapStratumClients.erase(bev);
+    bufferevent_free(bev);
+}
+
+static void stratum_update_cb(evutil_socket_t, short, void*)
+{
+    // A loopbreak sent before the loop started is lost, so the loop also
+    // breaks itself from here
+    if (fStratumStopping) {
+        event_base_loopbreak(stratumBase);
+        return;
+    }
+    bool fClean;
+    if (!stratumServer->UpdateJob(fClean))
+        return;
+    for (std::map<struct bufferevent*, CStratumClient>::iterator it = mapStratumClients.begin(); it != mapStratumClients.end(); ++it) {
+        std::string strOut = stratumServer->GetJobMessages(it->second, fClean);
+        bufferevent_write(it->first, strOut.data(), strOut.size());
+    }
+}
+
+static void stratum_read_cb(struct bufferevent* bev, void*)
+{
+    std::map<struct bufferevent*, CStratumClient>::iterator it = mapStratumClients.find(bev);
+    assert(it != mapStratumClients.end());
+    struct evbuffer* input = bufferevent_get_input(bev);
+    size_t n_read_out = 0;
+    char* line;
+    while ((line = evbuffer_readln(input, &n_read_out, EVBUFFER_EOL_CRLF)) != NULL) {
+        std::string strLine(line, n_read_out);
+        free(line);
+        if (strLine.empty())
+            continue;
+        std::string strOut = stratumServer->ProcessLine(it->second, strLine);
+        bufferevent_write(bev, strOut.data(), strOut.size());
+    }
+    // Whatever is left is an incomplete line
+    if (evbuffer_get_length(input) > MAX_STRATUM_LINE_LENGTH) {
+        LogPrint("stratum", "stratum: disconnecting %s, line too long\n", it->second.strWorker);
+        StratumDisconnect(bev);
+    }
+}
+
+static void stratum_event_cb(struct bufferevent* bev, short what, void*)
+{
+    if (what & (BEV_EVENT_EOF | BEV_EVENT_ERROR))
+        StratumDisconnect(bev);
+}
+
+static void stratum_accept_cb(struct evconnlistener*, evutil_socket_t fd, struct sockaddr*, int, void*)
+{
+    struct bufferevent* bev = bufferevent_socket_new(stratumBase, fd, BEV_OPT_CLOSE_ON_FREE);
+    if (!bev) {
+        evutil_closesocket(fd);
+        return;
+    }
+    stratumServer->InitClient(mapStratumClients[bev]);
+    bufferevent_setcb(bev, stratum_read_cb, NULL, stratum_event_cb, NULL);
+    bufferevent_enable(bev, EV_READ | EV_WRITE);
+}
+
+static void StratumThread()
+{
+    event_base_dispatch(stratumBase);
+}
+
+/** Listen on -stratumbind, or on loopback if it is not given */
+static bool StratumBindAddresses(int nPort)
+{
+    std::vector<std::string> vBind;
+    if (mapArgs.count("-stratumbind")) {
+        vBind = mapMultiArgs["-stratumbind"];
+    } else {
+        vBind.push_back("::1");
+        vBind.push_back("127.0.0.1");
+    }
+    BOOST_FOREACH(const std::string& strBind, vBind) {
+        CService addrBind;
+        struct sockaddr_storage sockaddr;
+        socklen_t len = sizeof(sockaddr);
+        if (!Lookup(strBind.c_str(), addrBind, nPort, false) || !addrBind.GetSockAddr((struct sockaddr*)&sockaddr, &len)) {
+            LogPrintf("stratum: invalid bind address %s\n", strBind);
+            continue;
+        }
+        struct evconnlistener* listener = evconnlistener_new_bind(stratumBase, stratum_accept_cb, NULL,
+            LEV_OPT_CLOSE_ON_FREE | LEV_OPT_REUSEABLE, -1, (struct sockaddr*)&sockaddr, len);
+        if (!listener) {
+            LogPrintf("stratum: binding on %s failed\n", addrBind.ToString());
+            continue;
+        }
+        LogPrintf("stratum: listening on %s\n", addrBind.ToString());
+        vStratumListeners.push_back(listener);
+    }
+    return !vStratumListeners.empty();
+}
+
+bool StartStratumServer()
+{
+    if (!mapArgs.count("-stratumport"))
+        return true;
+    double dDifficulty = DEFAULT_STRATUM_DIFFICULTY;
+    if (mapArgs.count("-stratumdifficulty") && (!ParseDouble(mapArgs["-stratumdifficulty"], &dDifficulty) ||
+        !(dDifficulty >= MIN_STRATUM_DIFFICULTY && dDifficulty <= MAX_STRATUM_DIFFICULTY))) {
+        LogPrintf("stratum: invalid -stratumdifficulty '%s', must be between %g and %g\n", mapArgs["-stratumdifficulty"], MIN_STRATUM_DIFFICULTY, MAX_STRATUM_DIFFICULTY);
+        return false;
+    }
+    assert(!stratumBase);
+    fStratumStopping = false;
+#ifdef WIN32
+    evthread_use_windows_threads();
+#else
+    evthread_use_pthreads();
+#endif
+    stratumBase = event_base_new();
+    if (!stratumBase) {
+        LogPrintf("stratum: unable to create event_base\n");
+        return false;
+    }
+    stratumServer.reset(new CStratumServer(Params(), dDifficulty));
+    if (!StratumBindAddresses(GetArg("-stratumport", 0))) {
+        StopStratumServer();
+        return false;
+    }
+
+    stratumUpdateEvent = event_new(stratumBase, -1, 0, stratum_update_cb, NULL);
+    stratumTimerEvent = event_new(stratumBase, -1, EV_PERSIST, stratum_update_cb, NULL);
+    struct timeval tv = {STRATUM_UPDATE_CHECK_INTERVAL, 0};
+    event_add(stratumTimerEvent, &tv);
+    stratumNotifier.reset(new CStratumNotifier());
+    RegisterValidationInterface(stratumNotifier.get());
+
+    stratumThread = boost::thread(boost::bind(&TraceThread<void (*)()>, "stratum", &StratumThread));
+    return true;
+}
+
+void InterruptStratumServer()
+{
+    fStratumStopping = true;
+    if (stratumBase) {
+        // Runs stratum_update_cb as soon as the loop is, or gets, going
+        if (stratumUpdateEvent)
+            event_active(stratumUpdateEvent, 0, 0);
+        event_base_loopbreak(stratumBase);
+    }
+}
+
+void StopStratumServer()
+{
+    if (!stratumBase)
+        return;
+    if (stratumNotifier) {
+        UnregisterValidationInterface(stratumNotifier.get());
+        stratumNotifier.reset();
+    }
+    stratumThread.join();
+    while (!mapStratumClients.empty())
+        StratumDisconnect(mapStratumClients.begin()->first);
+    BOOST_FOREACH(struct evconnlistener* listener, vStratumListeners)
+        evconnlistener_free(listener);
+    vStratumListeners.clear();
+    if (stratumTimerEvent)
+        event_free(stratumTimerEvent);
+    if (stratumUpdateEvent)
+        event_free(stratumUpdateEvent);
+    stratumTimerEvent = stratumUpdateEvent = NULL;
+    stratumServer.reset();
+    event_base_free(stratumBase);
+    stratumBase = NULL;
+}
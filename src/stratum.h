@@ -0,0 +1,130 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+/**
+ * Stratum v1 mining server. Miners connect over TCP, receive block templates
+ * from BlockAssembler as stratum jobs, and submit shares that are checked
+ * here and turned into blocks when they meet the network target.
+ */
+#ifndef BITCOIN_STRATUM_H
+#define BITCOIN_STRATUM_H
+
+#include "arith_uint256.h"
+#include "primitives/block.h"
+#include "script/script.h"
+#include "uint256.h"
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+class CChainParams;
+class UniValue;
+
+/** Default difficulty of the shares asked from miners, in scrypt pool units */
+static const double DEFAULT_STRATUM_DIFFICULTY = 1.0;
+/** Range of share difficulties StratumDifficultyTarget can represent */
+static const double MIN_STRATUM_DIFFICULTY = 1.0 / 1024;
+static const double MAX_STRATUM_DIFFICULTY = 8796093022208.0; // 2^43
+/** Size in bytes of the per-connection extranonce1 and the miner-chosen extranonce2 */
+static const int STRATUM_EXTRANONCE1_SIZE = 4;
+static const int STRATUM_EXTRANONCE2_SIZE = 4;
+/** Seconds after which a job is rebuilt to pick up new mempool transactions */
+static const int64_t STRATUM_JOB_REFRESH_INTERVAL = 30;
+/** Number of jobs on the current tip that shares are still accepted for */
+static const size_t MAX_STRATUM_JOBS = 16;
+/** Number of accepted shares remembered per job to reject duplicates */
+static const size_t MAX_STRATUM_JOB_SHARES = 1 << 16;
+
+/** A block template handed out to miners */
+struct CStratumJob
+{
+    /** Template block; its coinbase is rebuilt for every miner */
+    CBlock block;
+    int nHeight;
+    /** Coinbase output paying the miner */
+    unsigned int nPayoutOutput;
+    /** Earliest timestamp a miner may put in the header */
+    uint32_t nMinTime;
+    /** Merkle branch of the coinbase, the same for every coinbase */
+    std::vector<uint256> vMerkleBranch;
+    /** Headers already submitted for this job */
+    std::set<uint256> setSubmitted;
+};
+
+/** Protocol state of one miner connection */
+struct CStratumClient
+{
+    std::vector<unsigned char> vchExtraNonce1;
+    bool fSubscribed;
+    bool fAuthorized;
+    std::string strWorker;
+    CScript scriptPayout;
+    double dDifficulty;
+    /** Difficulty last sent with mining.set_difficulty */
+    double dSentDifficulty;
+
+    CStratumClient() : fSubscribed(false), fAuthorized(false), dDifficulty(DEFAULT_STRATUM_DIFFICULTY), dSentDifficulty(0) {}
+};
+
+/**
+ * Stratum protocol handling, independent of the network transport. Not
+ * thread safe: the server calls it from its event thread only.
+ */
+class CStratumServer
+{
+private:
+    const CChainParams& chainparams;
+    double dDifficulty;
+    uint32_t nExtraNonce1Counter;
+    /** Jobs on top of the current tip, by job id; the last one is current */
+    std::map<uint64_t, CStratumJob> mapJobs;
+    uint64_t nJobCounter;
+    uint256 hashJobTip;
+    unsigned int nTransactionsUpdatedLast;
+    int64_t nJobTime;
+    std::vector<char> vchScratchpad;
+
+    std::string HandleSubscribe(CStratumClient& client, const UniValue& id);
+    std::string HandleAuthorize(CStratumClient& client, const UniValue& params, const UniValue& id);
+    std::string HandleSubmit(CStratumClient& client, const UniValue& params, const UniValue& id);
+
+public:
+    CStratumServer(const CChainParams& chainparams, double dDifficulty);
+
+    /** Hand a new connection its extranonce1 */
+    void InitClient(CStratumClient& client);
+    /**
+     * Handle one line received from a miner.
+     * @return the newline-terminated messages to send back, possibly none
+     */
+    std::string ProcessLine(CStratumClient& client, const std::string& strLine);
+    /**
+     * Build a new job if the tip changed, or if the mempool changed and the
+     * current job is older than STRATUM_JOB_REFRESH_INTERVAL.
+     * @return true if there is a new job to announce; fClean is set when
+     *         the old jobs are stale and were dropped
+     */
+    bool UpdateJob(bool& fClean);
+    /** mining.set_difficulty, if needed, and mining.notify for the current job */
+    std::string GetJobMessages(CStratumClient& client, bool fClean);
+};
+
+/** Coinbase of a job for the given payout script and extranonce1 || extranonce2 */
+CMutableTransaction StratumCoinbase(const CStratumJob& job, const CScript& scriptPayout, const std::vector<unsigned char>& vchExtraNonce);
+/**
+ * Share target for a stratum difficulty; 1 is 0x0000ffff << 224 as usual for
+ * scrypt. Difficulties outside MIN/MAX_STRATUM_DIFFICULTY are clamped.
+ */
+arith_uint256 StratumDifficultyTarget(double dDifficulty);
+
+/** Start the stratum server if -stratumport is set */
+bool StartStratumServer();
+/** Interrupt the stratum server thread */
+void InterruptStratumServer();
+/** Stop the stratum server */
+void StopStratumServer();
+
+#endif // BITCOIN_STRATUM_H
@@ -0,0 +1,182 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+#define BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+
+#include <assert.h>
+#include <stddef.h>
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+/**
+ * Memory resource for node based containers whose nodes all have about the
+ * same size, like the coins cache.
+ *
+ * Blocks of up to MAX_BLOCK_SIZE bytes are carved out of large chunks, with
+ * no per block bookkeeping. A freed block goes onto a free list for its size
+ * and is handed out again by the next allocation of that size. Chunks are
+ * only given back when the resource is destroyed, which frees all of its
+ * blocks at once. Larger blocks (like the bucket array of a hash table) come
+ * from operator new.
+ *
+ * Not thread safe; a resource belongs to one container.
+ */
+template <size_t MAX_BLOCK_SIZE, size_t ALIGN>
+class PoolResource
+{
+private:
+    //! Free blocks are linked through their first bytes
+    struct ListNode
+    {
+        ListNode* next;
+    };
+
+    //! Granularity of block sizes, also the alignment of every block
+    static const size_t ELEM_ALIGN = ALIGN > alignof(ListNode) ? ALIGN : alignof(ListNode);
+    static_assert((ELEM_ALIGN & (ELEM_ALIGN - 1)) == 0, "ALIGN must be a power of two");
+    static_assert(ELEM_ALIGN <= alignof(std::max_align_t), "chunks from operator new must be aligned enough");
+    static_assert(MAX_BLOCK_SIZE % ELEM_ALIGN == 0, "MAX_BLOCK_SIZE must be a multiple of ALIGN");
+
+    const size_t nChunkSize;
+    std::vector<char*> vChunks;
+    //! Free list heads, indexed by block size in units of ELEM_ALIGN
+    ListNode* vFreeLists[MAX_BLOCK_SIZE / ELEM_ALIGN + 1];
+    //! Unused tail of the newest chunk
+    char* pAvailable;
+    char* pAvailableEnd;
+
+    static size_t NumElems(size_t nBytes)
+    {
+        return (nBytes + ELEM_ALIGN - 1) / ELEM_ALIGN + (nBytes == 0);
+    }
+
+    void PushFree(void* p, size_t nElems)
+    {
+        ListNode* node = new (p) ListNode;
+        node->next = vFreeLists[nElems];
+        vFreeLists[nElems] = node;
+    }
+
+    void AllocateChunk()
+    {
+        // The rest of the current chunk is too small for the request; keep
+        // it on the free list of its size rather than wasting it
+        const size_t nRemaining = pAvailableEnd - pAvailable;
+        if (nRemaining > 0)
+            PushFree(pAvailable, nRemaining / ELEM_ALIGN);
+        pAvailable = static_cast<char*>(::operator new(nChunkSize));
+        pAvailableEnd = pAvailable + nChunkSize;
+        vChunks.push_back(pAvailable);
+    }
+
+    PoolResource(const PoolResource&);
+    PoolResource& operator=(const PoolResource&);
+
+public:
+    //! Chunk size used unless another one is given
+    static const size_t DEFAULT_CHUNK_SIZE = 256 * 1024;
+
+    explicit PoolResource(size_t nChunkSizeIn = DEFAULT_CHUNK_SIZE) : nChunkSize(NumElems(nChunkSizeIn) * ELEM_ALIGN), pAvailable(NULL), pAvailableEnd(NULL)
+    {
+        assert(nChunkSize >= MAX_BLOCK_SIZE);
+        for (size_t i = 0; i <= MAX_BLOCK_SIZE / ELEM_ALIGN; i++)
+            vFreeLists[i] = NULL;
+    }
+
+    ~PoolResource()
+    {
+        for (std::vector<char*>::iterator it = vChunks.begin(); it != vChunks.end(); ++it)
+            ::operator delete(*it);
+    }
+
+    //! Whether blocks of this size and alignment come from the pool
+    static bool IsPooled(size_t nBytes, size_t nAlign)
+    {
+        return nBytes <= MAX_BLOCK_SIZE && nAlign <= ELEM_ALIGN;
+    }
+
+    void* Allocate(size_t nBytes, size_t nAlign)
+    {
+        if (!IsPooled(nBytes, nAlign))
+            return ::operator new(nBytes);
+        const size_t nElems = NumElems(nBytes);
+        if (vFreeLists[nElems] != NULL) {
+            ListNode* node = vFreeLists[nElems];
+            vFreeLists[nElems] = node->next;
+            return node;
+        }
+        const size_t nRound = nElems * ELEM_ALIGN;
+        if (nRound > (size_t)(pAvailableEnd - pAvailable))
+            AllocateChunk();
+        void* p = pAvailable;
+        pAvailable += nRound;
+        return p;
+    }
+
+    void Deallocate(void* p, size_t nBytes, size_t nAlign)
+    {
+        if (!IsPooled(nBytes, nAlign)) {
+            ::operator delete(p);
+            return;
+        }
+        PushFree(p, NumElems(nBytes));
+    }
+
+    size_t NumAllocatedChunks() const { return vChunks.size(); }
+    size_t ChunkSize() const { return nChunkSize; }
+};
+
+/**
+ * Allocator drawing from a PoolResource, for node based containers. Copies and
+ * rebinds share the resource, which must outlive the container.
+ */
+template <class T, size_t MAX_BLOCK_SIZE, size_t ALIGN = alignof(T)>
+class PoolAllocator
+{
+public:
+    typedef T value_type;
+    typedef PoolResource<MAX_BLOCK_SIZE, ALIGN> ResourceType;
+
+    template <class U>
+    struct rebind {
+        typedef PoolAllocator<U, MAX_BLOCK_SIZE, ALIGN> other;
+    };
+
+    PoolAllocator(ResourceType* resourceIn) : resource(resourceIn) {}
+
+    template <class U>
+    PoolAllocator(const PoolAllocator<U, MAX_BLOCK_SIZE, ALIGN>& other) : resource(other.GetResource()) {}
+
+    T* allocate(size_t n)
+    {
+        return static_cast<T*>(resource->Allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* p, size_t n)
+    {
+        resource->Deallocate(p, n * sizeof(T), alignof(T));
+    }
+
+    ResourceType* GetResource() const { return resource; }
+
+private:
+    ResourceType* resource;
+};
+
+template <class T1, class T2, size_t MAX_BLOCK_SIZE, size_t ALIGN>
+bool operator==(const PoolAllocator<T1, MAX_BLOCK_SIZE, ALIGN>& a, const PoolAllocator<T2, MAX_BLOCK_SIZE, ALIGN>& b)
+{
+    return a.GetResource() == b.GetResource();
+}
+
+template <class T1, class T2, size_t MAX_BLOCK_SIZE, size_t ALIGN>
+bool operator!=(const PoolAllocator<T1, MAX_BLOCK_SIZE, ALIGN>& a, const PoolAllocator<T2, MAX_BLOCK_SIZE, ALIGN>& b)
+{
+    return !(a == b);
+}
+
+#endif // BITCOIN_SUPPORT_ALLOCATORS_POOL_H
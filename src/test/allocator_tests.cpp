@@ -4,9 +4,11 @@
 
 #include "util.h"
 
+#include "support/allocators/pool.h"
 #include "support/allocators/secure.h"
 #include "test/test_bitcoin.h"
 
+#include <boost/unordered_map.hpp>
 #include <boost/test/unit_test.hpp>
 
 BOOST_FIXTURE_TEST_SUITE(allocator_tests, BasicTestingSetup)
@@ -117,4 +119,64 @@ BOOST_AUTO_TEST_CASE(test_LockedPageManagerBase)
     BOOST_CHECK((last_unlock_len & (test_page_size-1)) == 0); // always unlock entire pages
 }
 
+BOOST_AUTO_TEST_CASE(pool_resource)
+{
+    PoolResource<64, 8> resource(1024);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 0);
+
+    // Blocks of one size are cut from a chunk next to each other
+    void* a = resource.Allocate(24, 8);
+    void* b = resource.Allocate(24, 8);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 1);
+    BOOST_CHECK_EQUAL((char*)b - (char*)a, 24);
+
+    // A freed block is handed out again for the same rounded size
+    resource.Deallocate(a, 24, 8);
+    BOOST_CHECK(resource.Allocate(32, 8) != a);
+    BOOST_CHECK(resource.Allocate(17, 8) == a);
+
+    // Larger or more aligned blocks bypass the pool
+    BOOST_CHECK(!resource.IsPooled(65, 8));
+    BOOST_CHECK(!resource.IsPooled(8, 16));
+    void* d = resource.Allocate(4096, 8);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 1);
+    resource.Deallocate(d, 4096, 8);
+
+    // The tail of a full chunk is kept for blocks that fit in it
+    std::vector<void*> v;
+    while (resource.NumAllocatedChunks() == 1)
+        v.push_back(resource.Allocate(64, 8));
+    BOOST_CHECK_EQUAL(v.size(), (1024 - 80) / 64 + 1);
+    BOOST_CHECK(resource.Allocate((1024 - 80) % 64, 8) == (char*)a + 80 + 64 * (v.size() - 1));
+    BOOST_CHECK(resource.Allocate(64, 8) == (char*)v.back() + 64);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 2);
+}
+
+BOOST_AUTO_TEST_CASE(pool_allocator_map)
+{
+    typedef PoolAllocator<std::pair<const int, int>, 64> Allocator;
+    typedef boost::unordered_map<int, int, boost::hash<int>, std::equal_to<int>, Allocator> Map;
+    Allocator::ResourceType resource(4096);
+    {
+        Map m(0, boost::hash<int>(), std::equal_to<int>(), &resource);
+        for (int i = 0; i < 1000; i++)
+            m[i] = i;
+        const size_t nChunks = resource.NumAllocatedChunks();
+        BOOST_CHECK(nChunks > 1);
+
+        // Erased nodes are reused, so churn does not grow the pool
+        for (int i = 0; i < 10000; i++) {
+            m.erase(i);
+            m[i + 1000] = i;
+        }
+        BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), nChunks);
+        BOOST_CHECK_EQUAL(m.size(), 1000);
+        BOOST_CHECK_EQUAL(m[10999], 9999);
+
+        Map copy(m);
+        BOOST_CHECK(copy.get_allocator() == m.get_allocator());
+        BOOST_CHECK_EQUAL(copy.size(), 1000);
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
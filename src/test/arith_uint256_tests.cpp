@@ -10,6 +10,7 @@
 #include <cmath>
 #include "uint256.h"
 #include "arith_uint256.h"
+#include "random.h"
 #include <string>
 #include "version.h"
 #include "test/test_bitcoin.h"
@@ -366,6 +367,16 @@ BOOST_AUTO_TEST_CASE( divide )
     BOOST_CHECK(R2L / MaxL == ZeroL);
     BOOST_CHECK(MaxL / R2L == 1);
     BOOST_CHECK_THROW(R2L / ZeroL, uint_error);
+
+    // Divisors that fit in one limb take a shortcut; check it against the remainder identity
+    for (int i = 0; i < 1000; i++) {
+        arith_uint256 num = UintToArith256(GetRandHash()) >> (insecure_rand() % 256);
+        arith_uint256 div = arith_uint256((insecure_rand() >> (insecure_rand() % 32)) | 1);
+        arith_uint256 quot = num / div;
+        arith_uint256 rem = num - quot * div;
+        BOOST_CHECK(quot * div <= num);
+        BOOST_CHECK(rem < div);
+    }
 }
 
 
@@ -0,0 +1,137 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "checkqueue.h"
+#include "random.h"
+
+#include "test/test_bitcoin.h"
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(checkqueue_tests, BasicTestingSetup)
+
+/** A check that counts how often it ran, and holds on to a token until it is freed. */
+struct CountingCheck
+{
+    std::atomic<int>* pcount;
+    bool fOk;
+    std::shared_ptr<int> token;
+
+    CountingCheck() : pcount(NULL), fOk(true) {}
+    CountingCheck(std::atomic<int>* pcountIn, bool fOkIn, const std::shared_ptr<int>& tokenIn) : pcount(pcountIn), fOk(fOkIn), token(tokenIn) {}
+
+    bool operator()()
+    {
+        if (pcount != NULL)
+            ++*pcount;
+        return fOk;
+    }
+
+    void swap(CountingCheck& check)
+    {
+        std::swap(pcount, check.pcount);
+        std::swap(fOk, check.fOk);
+        token.swap(check.token);
+    }
+};
+
+static void StartWorkers(boost::thread_group& threadGroup, CCheckQueue<CountingCheck>& queue, int nThreads)
+{
+    for (int i = 0; i < nThreads; i++)
+        threadGroup.create_thread(boost::bind(&CCheckQueue<CountingCheck>::Thread, boost::ref(queue)));
+}
+
+static void StopWorkers(boost::thread_group& threadGroup)
+{
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+}
+
+/** Add nChecks checks in random batches, and return whether they all passed. */
+static bool RunRound(CCheckQueue<CountingCheck>& queue, std::atomic<int>& count, int nChecks, int nFail, const std::shared_ptr<int>& token)
+{
+    CCheckQueueControl<CountingCheck> control(&queue);
+    int nAdded = 0;
+    while (nAdded < nChecks) {
+        std::vector<CountingCheck> vChecks;
+        int nBatch = std::min(nChecks - nAdded, (int)(insecure_rand() % 300) + 1);
+        for (int i = 0; i < nBatch; i++, nAdded++)
+            vChecks.push_back(CountingCheck(&count, nAdded != nFail, token));
+        control.Add(vChecks);
+    }
+    return control.Wait();
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_all_run_once)
+{
+    CCheckQueue<CountingCheck> queue(4);
+    boost::thread_group threadGroup;
+    StartWorkers(threadGroup, queue, 3);
+
+    std::shared_ptr<int> token(new int(0));
+    for (int nRound = 0; nRound < 50; nRound++) {
+        std::atomic<int> count(0);
+        const int nChecks = insecure_rand() % 3000;
+        BOOST_CHECK(RunRound(queue, count, nChecks, -1, token));
+        BOOST_CHECK_EQUAL(count.load(), nChecks);
+        BOOST_CHECK(queue.IsIdle());
+    }
+    StopWorkers(threadGroup);
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_failure)
+{
+    CCheckQueue<CountingCheck> queue(4);
+    boost::thread_group threadGroup;
+    StartWorkers(threadGroup, queue, 3);
+
+    std::shared_ptr<int> token(new int(0));
+    for (int nRound = 0; nRound < 20; nRound++) {
+        std::atomic<int> count(0);
+        const int nChecks = 1 + insecure_rand() % 2000;
+        BOOST_CHECK(!RunRound(queue, count, nChecks, insecure_rand() % nChecks, token));
+        BOOST_CHECK(count.load() <= nChecks);
+        // A failure does not carry over into the next round
+        std::atomic<int> countNext(0);
+        BOOST_CHECK(RunRound(queue, countNext, 100, -1, token));
+        BOOST_CHECK_EQUAL(countNext.load(), 100);
+    }
+    StopWorkers(threadGroup);
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_no_workers)
+{
+    // Without worker threads, the master runs everything in Wait
+    CCheckQueue<CountingCheck> queue(8);
+    std::shared_ptr<int> token(new int(0));
+    std::atomic<int> count(0);
+    BOOST_CHECK(RunRound(queue, count, 1000, -1, token));
+    BOOST_CHECK_EQUAL(count.load(), 1000);
+    std::atomic<int> countFail(0);
+    BOOST_CHECK(!RunRound(queue, countFail, 1000, 500, token));
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_frees_checks)
+{
+    CCheckQueue<CountingCheck> queue(4);
+    boost::thread_group threadGroup;
+    StartWorkers(threadGroup, queue, 3);
+
+    std::shared_ptr<int> token(new int(0));
+    std::atomic<int> count(0);
+    BOOST_CHECK(RunRound(queue, count, 2000, -1, token));
+    // Every check, run or dropped, has let go of its copy of the token
+    BOOST_CHECK_EQUAL(token.use_count(), 1);
+    BOOST_CHECK(!RunRound(queue, count, 2000, 10, token));
+    BOOST_CHECK_EQUAL(token.use_count(), 1);
+    StopWorkers(threadGroup);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
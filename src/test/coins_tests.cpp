@@ -3,9 +3,14 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "coins.h"
+#include "chainparams.h"
+#include "coinscan.h"
+#include "coinsprefetch.h"
 #include "random.h"
 #include "script/standard.h"
+#include "txdb.h"
 #include "uint256.h"
+#include "undo.h"
 #include "utilstrencodings.h"
 #include "test/test_bitcoin.h"
 #include "main.h"
@@ -14,34 +19,44 @@
 #include <vector>
 #include <map>
 
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
 #include <boost/test/unit_test.hpp>
 
+bool operator==(const Coin &a, const Coin &b) {
+    // Empty Coin objects are always equal.
+    if (a.IsSpent() && b.IsSpent()) return true;
+    return a.fCoinBase == b.fCoinBase &&
+           a.nHeight == b.nHeight &&
+           a.out == b.out;
+}
+
 namespace
 {
 class CCoinsViewTest : public CCoinsView
 {
     uint256 hashBestBlock_;
-    std::map<uint256, CCoins> map_;
+    std::map<COutPoint, Coin> map_;
 
 public:
-    bool GetCoins(const uint256& txid, CCoins& coins) const
+    bool GetCoin(const COutPoint& outpoint, Coin& coin) const
     {
-        std::map<uint256, CCoins>::const_iterator it = map_.find(txid);
+        std::map<COutPoint, Coin>::const_iterator it = map_.find(outpoint);
         if (it == map_.end()) {
             return false;
         }
-        coins = it->second;
-        if (coins.IsPruned() && insecure_rand() % 2 == 0) {
+        coin = it->second;
+        if (coin.IsSpent() && insecure_rand() % 2 == 0) {
             // Randomly return false in case of an empty entry.
             return false;
         }
         return true;
     }
 
-    bool HaveCoins(const uint256& txid) const
+    bool HaveCoin(const COutPoint& outpoint) const
     {
-        CCoins coins;
-        return GetCoins(txid, coins);
+        Coin coin;
+        return GetCoin(outpoint, coin);
     }
 
     uint256 GetBestBlock() const { return hashBestBlock_; }
@@ -51,8 +66,8 @@ public:
         for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); ) {
             if (it->second.flags & CCoinsCacheEntry::DIRTY) {
                 // Same optimization used in CCoinsViewDB is to only write dirty entries.
-                map_[it->first] = it->second.coins;
-                if (it->second.coins.IsPruned() && insecure_rand() % 3 == 0) {
+                map_[it->first] = it->second.coin;
+                if (it->second.coin.IsSpent() && insecure_rand() % 3 == 0) {
                     // Randomly delete empty entries on write.
                     map_.erase(it->first);
                 }
@@ -75,13 +90,60 @@ public:
         // Manually recompute the dynamic usage of the whole data, and compare it.
         size_t ret = memusage::DynamicUsage(cacheCoins);
         for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end(); it++) {
-            ret += it->second.coins.DynamicMemoryUsage();
+            ret += it->second.coin.DynamicMemoryUsage();
         }
         BOOST_CHECK_EQUAL(DynamicMemoryUsage(), ret);
     }
 
 };
 
+//! Writes its bytes as they are, to store records of an older format
+struct CRawRecord
+{
+    std::vector<unsigned char> vch;
+
+    CRawRecord(const std::vector<unsigned char>& vchIn) : vch(vchIn) {}
+    unsigned int GetSerializeSize(int nType, int nVersion) const { return vch.size(); }
+    template<typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const { s.write((const char*)vch.data(), vch.size()); }
+};
+
+class CCoinsViewDBTest : public CCoinsViewDB
+{
+public:
+    CCoinsViewDBTest() : CCoinsViewDB(1 << 20, true) {}
+
+    void WriteLegacy(const uint256& txid, const std::string& strHex)
+    {
+        BOOST_CHECK(db.Write(std::make_pair('c', txid), CRawRecord(ParseHex(strHex))));
+    }
+    bool HaveLegacy(const uint256& txid) { return db.Exists(std::make_pair('c', txid)); }
+
+    //! Leave the database as a write from hashOld to hashNew that was cut short
+    void InterruptWrite(const uint256& hashNew, const uint256& hashOld)
+    {
+        std::vector<uint256> vHeads;
+        vHeads.push_back(hashNew);
+        vHeads.push_back(hashOld);
+        BOOST_CHECK(db.Write('H', vHeads));
+        BOOST_CHECK(db.Erase('B'));
+    }
+};
+
+//! The coins a view's cursor walks
+std::map<COutPoint, Coin> ReadCoins(const CCoinsView& view)
+{
+    std::map<COutPoint, Coin> coins;
+    boost::scoped_ptr<CCoinsViewCursor> pcursor(view.Cursor());
+    for (; pcursor->Valid(); pcursor->Next()) {
+        COutPoint key;
+        Coin coin;
+        BOOST_CHECK(pcursor->GetKey(key) && pcursor->GetValue(coin));
+        coins[key] = coin;
+    }
+    return coins;
+}
+
 }
 
 BOOST_FIXTURE_TEST_SUITE(coins_tests, BasicTestingSetup)
@@ -91,7 +153,7 @@ static const unsigned int NUM_SIMULATION_ITERATIONS = 40000;
 // This is a large randomized insert/remove simulation test on a variable-size
 // stack of caches on top of CCoinsViewTest.
 //
-// It will randomly create/update/delete CCoins entries to a tip of caches, with
+// It will randomly create/update/delete Coin entries to a tip of caches, with
 // txids picked from a limited list of random 256-bit hashes. Occasionally, a
 // new tip is added to the stack of caches, or the tip is flushed and removed.
 //
@@ -103,13 +165,16 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     bool removed_all_caches = false;
     bool reached_4_caches = false;
     bool added_an_entry = false;
+    bool added_an_unspendable_entry = false;
     bool removed_an_entry = false;
     bool updated_an_entry = false;
     bool found_an_entry = false;
     bool missed_an_entry = false;
+    bool uncached_an_entry = false;
+    bool synced_a_cache = false;
 
     // A simple map to track what we expect the cache stack to represent.
-    std::map<uint256, CCoins> result;
+    std::map<COutPoint, Coin> result;
 
     // The cache stack.
     CCoinsViewTest base; // A CCoinsViewTest at the bottom.
@@ -127,36 +192,51 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
         // Do a random modification.
         {
             uint256 txid = txids[insecure_rand() % txids.size()]; // txid we're going to modify in this iteration.
-            CCoins& coins = result[txid];
-            CCoinsModifier entry = stack.back()->ModifyCoins(txid);
-            BOOST_CHECK(coins == *entry);
-            if (insecure_rand() % 5 == 0 || coins.IsPruned()) {
-                if (coins.IsPruned()) {
-                    added_an_entry = true;
+            Coin& coin = result[COutPoint(txid, 0)];
+            const Coin& entry = (insecure_rand() % 500 == 0) ? AccessByTxid(*stack.back(), txid) : stack.back()->AccessCoin(COutPoint(txid, 0));
+            BOOST_CHECK(coin == entry);
+
+            if (insecure_rand() % 5 == 0 || coin.IsSpent()) {
+                Coin newcoin;
+                newcoin.out.nValue = insecure_rand();
+                newcoin.nHeight = 1;
+                if (insecure_rand() % 16 == 0 && coin.IsSpent()) {
+                    newcoin.out.scriptPubKey.assign(1 + (insecure_rand() & 0x3F), OP_RETURN);
+                    BOOST_CHECK(newcoin.out.scriptPubKey.IsUnspendable());
+                    added_an_unspendable_entry = true;
                 } else {
-                    updated_an_entry = true;
+                    newcoin.out.scriptPubKey.assign(insecure_rand() & 0x3F, 0); // Random sizes so we can test memory usage accounting
+                    (coin.IsSpent() ? added_an_entry : updated_an_entry) = true;
+                    coin = newcoin;
                 }
-                coins.nVersion = insecure_rand();
-                coins.vout.resize(1);
-                coins.vout[0].nValue = insecure_rand();
-                *entry = coins;
+                stack.back()->AddCoin(COutPoint(txid, 0), std::move(newcoin), !coin.IsSpent() || insecure_rand() & 1);
             } else {
-                coins.Clear();
-                entry->Clear();
                 removed_an_entry = true;
+                coin.Clear();
+                stack.back()->SpendCoin(COutPoint(txid, 0));
             }
         }
 
+        // One every 10 iterations, remove a random entry from the cache
+        if (insecure_rand() % 10 == 0) {
+            COutPoint out(txids[insecure_rand() % txids.size()], 0);
+            int cacheid = insecure_rand() % stack.size();
+            stack[cacheid]->Uncache(out);
+            uncached_an_entry |= !stack[cacheid]->HaveCoinInCache(out);
+        }
+
         // Once every 1000 iterations and at the end, verify the full cache.
         if (insecure_rand() % 1000 == 1 || i == NUM_SIMULATION_ITERATIONS - 1) {
-            for (std::map<uint256, CCoins>::iterator it = result.begin(); it != result.end(); it++) {
-                const CCoins* coins = stack.back()->AccessCoins(it->first);
-                if (coins) {
-                    BOOST_CHECK(*coins == it->second);
-                    found_an_entry = true;
-                } else {
-                    BOOST_CHECK(it->second.IsPruned());
+            for (std::map<COutPoint, Coin>::iterator it = result.begin(); it != result.end(); it++) {
+                bool have = stack.back()->HaveCoin(it->first);
+                const Coin& coin = stack.back()->AccessCoin(it->first);
+                BOOST_CHECK(have == !coin.IsSpent());
+                BOOST_CHECK(coin == it->second);
+                if (coin.IsSpent()) {
                     missed_an_entry = true;
+                } else {
+                    BOOST_CHECK(stack.back()->HaveCoinInCache(it->first));
+                    found_an_entry = true;
                 }
             }
             BOOST_FOREACH(const CCoinsViewCacheTest *test, stack) {
@@ -168,7 +248,12 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
             // Every 100 iterations, flush an intermediate cache
             if (stack.size() > 1 && insecure_rand() % 2 == 0) {
                 unsigned int flushIndex = insecure_rand() % (stack.size() - 1);
-                stack[flushIndex]->Flush();
+                if (insecure_rand() % 2 == 0) {
+                    stack[flushIndex]->Sync();
+                    synced_a_cache = true;
+                } else {
+                    stack[flushIndex]->Flush();
+                }
             }
         }
         if (insecure_rand() % 100 == 0) {
@@ -205,10 +290,13 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     BOOST_CHECK(removed_all_caches);
     BOOST_CHECK(reached_4_caches);
     BOOST_CHECK(added_an_entry);
+    BOOST_CHECK(added_an_unspendable_entry);
     BOOST_CHECK(removed_an_entry);
     BOOST_CHECK(updated_an_entry);
     BOOST_CHECK(found_an_entry);
     BOOST_CHECK(missed_an_entry);
+    BOOST_CHECK(uncached_an_entry);
+    BOOST_CHECK(synced_a_cache);
 }
 
 // This test is similar to the previous test
@@ -220,7 +308,7 @@ BOOST_AUTO_TEST_CASE(updatecoins_simulation_test)
 {
     bool spent_a_duplicate_coinbase = false;
     // A simple map to track what we expect the cache stack to represent.
-    std::map<uint256, CCoins> result;
+    std::map<COutPoint, Coin> result;
 
     // The cache stack.
     CCoinsViewTest base; // A CCoinsViewTest at the bottom.
@@ -238,7 +326,7 @@ BOOST_AUTO_TEST_CASE(updatecoins_simulation_test)
             tx.vin.resize(1);
             tx.vout.resize(1);
             tx.vout[0].nValue = i; //Keep txs unique unless intended to duplicate
-            unsigned int height = insecure_rand();
+            unsigned int height = insecure_rand() & 0x7FFFFFFF;
 
             // 1/10 times create a coinbase
             if (insecure_rand() % 10 == 0 || coinbaseids.size() < 10) {
@@ -273,8 +361,7 @@ BOOST_AUTO_TEST_CASE(updatecoins_simulation_test)
                 tx.vin[0].prevout.n = 0;
 
                 // Update the expected result of prevouthash to know these coins are spent
-                CCoins& oldcoins = result[prevouthash];
-                oldcoins.Clear();
+                result[tx.vin[0].prevout].Clear();
 
                 // It is of particular importance here that once we spend a coinbase tx hash
                 // it is no longer available to be duplicated (or spent again)
@@ -294,21 +381,18 @@ BOOST_AUTO_TEST_CASE(updatecoins_simulation_test)
             alltxids.insert(tx.GetHash());
 
             // Update the expected result to know about the new output coins
-            CCoins &coins = result[tx.GetHash()];
-            coins.FromTx(tx, height);
+            result[COutPoint(tx.GetHash(), 0)] = Coin(tx.vout[0], height, CTransaction(tx).IsCoinBase());
 
             UpdateCoins(tx, *(stack.back()), height);
         }
 
         // Once every 1000 iterations and at the end, verify the full cache.
         if (insecure_rand() % 1000 == 1 || i == NUM_SIMULATION_ITERATIONS - 1) {
-            for (std::map<uint256, CCoins>::iterator it = result.begin(); it != result.end(); it++) {
-                const CCoins* coins = stack.back()->AccessCoins(it->first);
-                if (coins) {
-                    BOOST_CHECK(*coins == it->second);
-                 } else {
-                    BOOST_CHECK(it->second.IsPruned());
-                 }
+            for (std::map<COutPoint, Coin>::iterator it = result.begin(); it != result.end(); it++) {
+                bool have = stack.back()->HaveCoin(it->first);
+                const Coin& coin = stack.back()->AccessCoin(it->first);
+                BOOST_CHECK(have == !coin.IsSpent());
+                BOOST_CHECK(coin == it->second);
             }
         }
 
@@ -349,53 +433,36 @@ BOOST_AUTO_TEST_CASE(updatecoins_simulation_test)
 BOOST_AUTO_TEST_CASE(ccoins_serialization)
 {
     // Good example
-    CDataStream ss1(ParseHex("0104835800816115944e077fe7c803cfa57f29b36bf87c1d358bb85e"), SER_DISK, CLIENT_VERSION);
-    CCoins cc1;
+    CDataStream ss1(ParseHex("97f23c835800816115944e077fe7c803cfa57f29b36bf87c1d35"), SER_DISK, CLIENT_VERSION);
+    Coin cc1;
     ss1 >> cc1;
-    BOOST_CHECK_EQUAL(cc1.nVersion, 1);
     BOOST_CHECK_EQUAL(cc1.fCoinBase, false);
     BOOST_CHECK_EQUAL(cc1.nHeight, 203998);
-    BOOST_CHECK_EQUAL(cc1.vout.size(), 2);
-    BOOST_CHECK_EQUAL(cc1.IsAvailable(0), false);
-    BOOST_CHECK_EQUAL(cc1.IsAvailable(1), true);
-    BOOST_CHECK_EQUAL(cc1.vout[1].nValue, 60000000000ULL);
-    BOOST_CHECK_EQUAL(HexStr(cc1.vout[1].scriptPubKey), HexStr(GetScriptForDestination(CKeyID(uint160(ParseHex("816115944e077fe7c803cfa57f29b36bf87c1d35"))))));
+    BOOST_CHECK_EQUAL(cc1.out.nValue, 60000000000ULL);
+    BOOST_CHECK_EQUAL(HexStr(cc1.out.scriptPubKey), HexStr(GetScriptForDestination(CKeyID(uint160(ParseHex("816115944e077fe7c803cfa57f29b36bf87c1d35"))))));
 
     // Good example
-    CDataStream ss2(ParseHex("0109044086ef97d5790061b01caab50f1b8e9c50a5057eb43c2d9563a4eebbd123008c988f1a4a4de2161e0f50aac7f17e7f9555caa486af3b"), SER_DISK, CLIENT_VERSION);
-    CCoins cc2;
+    CDataStream ss2(ParseHex("8ddf77bbd123008c988f1a4a4de2161e0f50aac7f17e7f9555caa4"), SER_DISK, CLIENT_VERSION);
+    Coin cc2;
     ss2 >> cc2;
-    BOOST_CHECK_EQUAL(cc2.nVersion, 1);
     BOOST_CHECK_EQUAL(cc2.fCoinBase, true);
     BOOST_CHECK_EQUAL(cc2.nHeight, 120891);
-    BOOST_CHECK_EQUAL(cc2.vout.size(), 17);
-    for (int i = 0; i < 17; i++) {
-        BOOST_CHECK_EQUAL(cc2.IsAvailable(i), i == 4 || i == 16);
-    }
-    BOOST_CHECK_EQUAL(cc2.vout[4].nValue, 234925952);
-    BOOST_CHECK_EQUAL(HexStr(cc2.vout[4].scriptPubKey), HexStr(GetScriptForDestination(CKeyID(uint160(ParseHex("61b01caab50f1b8e9c50a5057eb43c2d9563a4ee"))))));
-    BOOST_CHECK_EQUAL(cc2.vout[16].nValue, 110397);
-    BOOST_CHECK_EQUAL(HexStr(cc2.vout[16].scriptPubKey), HexStr(GetScriptForDestination(CKeyID(uint160(ParseHex("8c988f1a4a4de2161e0f50aac7f17e7f9555caa4"))))));
+    BOOST_CHECK_EQUAL(cc2.out.nValue, 110397);
+    BOOST_CHECK_EQUAL(HexStr(cc2.out.scriptPubKey), HexStr(GetScriptForDestination(CKeyID(uint160(ParseHex("8c988f1a4a4de2161e0f50aac7f17e7f9555caa4"))))));
 
     // Smallest possible example
-    CDataStream ssx(SER_DISK, CLIENT_VERSION);
-    BOOST_CHECK_EQUAL(HexStr(ssx.begin(), ssx.end()), "");
-
-    CDataStream ss3(ParseHex("0002000600"), SER_DISK, CLIENT_VERSION);
-    CCoins cc3;
+    CDataStream ss3(ParseHex("000006"), SER_DISK, CLIENT_VERSION);
+    Coin cc3;
     ss3 >> cc3;
-    BOOST_CHECK_EQUAL(cc3.nVersion, 0);
     BOOST_CHECK_EQUAL(cc3.fCoinBase, false);
     BOOST_CHECK_EQUAL(cc3.nHeight, 0);
-    BOOST_CHECK_EQUAL(cc3.vout.size(), 1);
-    BOOST_CHECK_EQUAL(cc3.IsAvailable(0), true);
-    BOOST_CHECK_EQUAL(cc3.vout[0].nValue, 0);
-    BOOST_CHECK_EQUAL(cc3.vout[0].scriptPubKey.size(), 0);
+    BOOST_CHECK_EQUAL(cc3.out.nValue, 0);
+    BOOST_CHECK_EQUAL(cc3.out.scriptPubKey.size(), 0);
 
     // scriptPubKey that ends beyond the end of the stream
-    CDataStream ss4(ParseHex("0002000800"), SER_DISK, CLIENT_VERSION);
+    CDataStream ss4(ParseHex("000007"), SER_DISK, CLIENT_VERSION);
     try {
-        CCoins cc4;
+        Coin cc4;
         ss4 >> cc4;
         BOOST_CHECK_MESSAGE(false, "We should have thrown");
     } catch (const std::ios_base::failure& e) {
@@ -406,13 +473,362 @@ BOOST_AUTO_TEST_CASE(ccoins_serialization)
     uint64_t x = 3000000000ULL;
     tmp << VARINT(x);
     BOOST_CHECK_EQUAL(HexStr(tmp.begin(), tmp.end()), "8a95c0bb00");
-    CDataStream ss5(ParseHex("0002008a95c0bb0000"), SER_DISK, CLIENT_VERSION);
+    CDataStream ss5(ParseHex("00008a95c0bb00"), SER_DISK, CLIENT_VERSION);
     try {
-        CCoins cc5;
+        Coin cc5;
         ss5 >> cc5;
         BOOST_CHECK_MESSAGE(false, "We should have thrown");
     } catch (const std::ios_base::failure& e) {
     }
+
+    // Undo records keep the old layout, whose version field is now ignored
+    CDataStream ss6(SER_DISK, CLIENT_VERSION);
+    ss6 << VARINT(1) << VARINT(203998 * 2) << VARINT(1) << CTxOutCompressor(cc1.out);
+    CTxUndo undo;
+    ss6 >> undo;
+    BOOST_CHECK_EQUAL(undo.vprevout.size(), 1);
+    BOOST_CHECK(undo.vprevout[0] == cc1);
+    CDataStream ss7(SER_DISK, CLIENT_VERSION);
+    ss7 << undo;
+    CTxUndo undo2;
+    ss7 >> undo2;
+    BOOST_CHECK(undo2.vprevout[0] == cc1);
+}
+
+BOOST_AUTO_TEST_CASE(coins_prefetch)
+{
+    CCoinsViewDBTest db;
+    std::vector<COutPoint> outpoints;
+    {
+        CCoinsViewCache cache(&db);
+        for (int i = 0; i < 100; i++) {
+            outpoints.push_back(COutPoint(GetRandHash(), i));
+            cache.AddCoin(outpoints.back(), Coin(CTxOut(i + 1, CScript() << OP_TRUE), 1, false), false);
+        }
+        BOOST_CHECK(cache.Flush());
+    }
+
+    // A block spending them all, and an output of its own
+    CBlock block;
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vout.push_back(CTxOut(50, CScript() << OP_TRUE));
+    block.vtx.push_back(coinbase);
+    CMutableTransaction spend;
+    for (int i = 0; i < 100; i++)
+        spend.vin.push_back(CTxIn(outpoints[i]));
+    spend.vout.push_back(CTxOut(1, CScript() << OP_TRUE));
+    block.vtx.push_back(spend);
+    CMutableTransaction child;
+    child.vin.push_back(CTxIn(COutPoint(block.vtx[1].GetHash(), 0)));
+    block.vtx.push_back(child);
+
+    // Without workers nothing is queued
+    CCoinsViewPrefetch prefetch(&db);
+    CCoinsViewCache cache(&prefetch);
+    prefetch.Prefetch(block, cache);
+    BOOST_CHECK_EQUAL(prefetch.GetStagedCount(), 0);
+
+    boost::thread_group workers;
+    for (int i = 0; i < 3; i++)
+        workers.create_thread(boost::bind(&CCoinsViewPrefetch::WorkerThread, &prefetch));
+    // Every input except those already cached or created in the block
+    cache.AccessCoin(outpoints[0]);
+    prefetch.Prefetch(block, cache);
+    prefetch.WaitForPrefetch();
+    BOOST_CHECK_EQUAL(prefetch.GetStagedCount(), 99);
+
+    // Staged coins are what the cache gets, even once the database moved
+    // on behind the prefetcher's back
+    {
+        CCoinsViewCache direct(&db);
+        for (int i = 1; i < 100; i++)
+            direct.SpendCoin(outpoints[i]);
+        BOOST_CHECK(direct.Flush());
+    }
+    BOOST_CHECK(!cache.AccessCoin(outpoints[1]).IsSpent());
+    BOOST_CHECK_EQUAL(cache.AccessCoin(outpoints[1]).out.nValue, 2);
+    BOOST_CHECK_EQUAL(prefetch.GetStagedCount(), 98);
+
+    // Coins written through the prefetcher are no longer staged
+    {
+        CCoinsMapMemoryResource resource;
+        CCoinsMap mapCoins(0, SaltedOutpointHasher(), std::equal_to<COutPoint>(), &resource);
+        mapCoins[outpoints[2]].flags = CCoinsCacheEntry::DIRTY;
+        BOOST_CHECK(prefetch.BatchWrite(mapCoins, uint256()));
+    }
+    BOOST_CHECK_EQUAL(prefetch.GetStagedCount(), 97);
+    Coin coin;
+    BOOST_CHECK(!prefetch.GetCoin(outpoints[2], coin));
+    BOOST_CHECK(prefetch.GetCoin(outpoints[3], coin));
+    BOOST_CHECK_EQUAL(prefetch.GetStagedCount(), 96);
+
+    workers.interrupt_all();
+    workers.join_all();
+}
+
+BOOST_AUTO_TEST_CASE(chainstate_upgrade)
+{
+    // The two per-transaction records the old format documented: vout[1] of
+    // a transaction at height 203998, and vout[4] and vout[16] of a coinbase
+    // at height 120891
+    uint256 txid1 = GetRandHash(), txid2 = GetRandHash(), hashBlock = GetRandHash();
+    CCoinsViewDBTest db;
+    db.WriteLegacy(txid1, "0104835800816115944e077fe7c803cfa57f29b36bf87c1d358bb85e");
+    db.WriteLegacy(txid2, "0109044086ef97d5790061b01caab50f1b8e9c50a5057eb43c2d9563a4eebbd123008c988f1a4a4de2161e0f50aac7f17e7f9555caa486af3b");
+    CCoinsMapMemoryResource resource;
+    CCoinsMap mapCoins(0, SaltedOutpointHasher(), std::equal_to<COutPoint>(), &resource);
+    BOOST_CHECK(db.BatchWrite(mapCoins, hashBlock));
+
+    BOOST_CHECK(db.Upgrade());
+    BOOST_CHECK(!db.HaveLegacy(txid1));
+    BOOST_CHECK(!db.HaveLegacy(txid2));
+    BOOST_CHECK(db.GetBestBlock() == hashBlock);
+
+    Coin coin;
+    BOOST_CHECK(!db.HaveCoin(COutPoint(txid1, 0)));
+    BOOST_CHECK(db.GetCoin(COutPoint(txid1, 1), coin));
+    BOOST_CHECK_EQUAL(coin.fCoinBase, false);
+    BOOST_CHECK_EQUAL(coin.nHeight, 203998);
+    BOOST_CHECK_EQUAL(coin.out.nValue, 60000000000ULL);
+    for (int i = 0; i < 17; i++)
+        BOOST_CHECK_EQUAL(db.HaveCoin(COutPoint(txid2, i)), i == 4 || i == 16);
+    BOOST_CHECK(db.GetCoin(COutPoint(txid2, 16), coin));
+    BOOST_CHECK_EQUAL(coin.fCoinBase, true);
+    BOOST_CHECK_EQUAL(coin.nHeight, 120891);
+    BOOST_CHECK_EQUAL(coin.out.nValue, 110397);
+
+    // The cursor walks the converted outputs
+    boost::scoped_ptr<CCoinsViewCursor> pcursor(db.Cursor());
+    int nCoins = 0;
+    for (; pcursor->Valid(); pcursor->Next()) {
+        COutPoint key;
+        BOOST_CHECK(pcursor->GetKey(key) && pcursor->GetValue(coin));
+        nCoins++;
+    }
+    BOOST_CHECK_EQUAL(nCoins, 3);
+
+    // Nothing is left to convert
+    BOOST_CHECK(db.Upgrade());
+}
+
+BOOST_AUTO_TEST_CASE(chainstate_write_batches)
+{
+    // Small batches, written by the writer thread while coins are looked up
+    mapArgs["-dbbatchsize"] = "1000";
+    CCoinsViewDBTest db;
+    mapArgs.erase("-dbbatchsize");
+    boost::thread writer(boost::bind(&CCoinsViewDB::WriterThread, &db));
+
+    std::map<COutPoint, Coin> result;
+    std::vector<COutPoint> outpoints;
+    CCoinsViewCache cache(&db);
+    for (int i = 0; i < 20; i++) {
+        for (int j = 0; j < 100; j++) {
+            COutPoint outpoint(GetRandHash(), j);
+            Coin coin(CTxOut(insecure_rand(), CScript() << OP_TRUE), i + 1, false);
+            result[outpoint] = coin;
+            cache.AddCoin(outpoint, std::move(coin), false);
+            outpoints.push_back(outpoint);
+        }
+        for (int j = 0; j < 30; j++) {
+            COutPoint outpoint = outpoints[insecure_rand() % outpoints.size()];
+            cache.SpendCoin(outpoint);
+            result[outpoint].Clear();
+        }
+        uint256 hashBlock = GetRandHash();
+        cache.SetBestBlock(hashBlock);
+        BOOST_CHECK(i % 2 ? cache.Flush() : cache.Sync());
+
+        // Written or not, the database answers with the new state
+        BOOST_CHECK(db.GetBestBlock() == hashBlock);
+        for (int j = 0; j < 50; j++) {
+            const COutPoint& outpoint = outpoints[insecure_rand() % outpoints.size()];
+            Coin coin;
+            bool fHave = db.GetCoin(outpoint, coin);
+            BOOST_CHECK_EQUAL(fHave, !result[outpoint].IsSpent());
+            BOOST_CHECK_EQUAL(db.HaveCoin(outpoint), fHave);
+            BOOST_CHECK(!fHave || coin == result[outpoint]);
+        }
+    }
+
+    BOOST_CHECK(db.WaitForWrites());
+    BOOST_CHECK(db.GetHeadBlocks().empty());
+    std::map<COutPoint, Coin> written = ReadCoins(db);
+    size_t nUnspent = 0;
+    for (std::map<COutPoint, Coin>::iterator it = result.begin(); it != result.end(); ++it) {
+        if (it->second.IsSpent())
+            continue;
+        nUnspent++;
+        BOOST_CHECK(written.count(it->first) && written[it->first] == it->second);
+    }
+    BOOST_CHECK_EQUAL(written.size(), nUnspent);
+
+    writer.interrupt();
+    writer.join();
+}
+
+BOOST_AUTO_TEST_CASE(chainstate_abort_load)
+{
+    SelectParams(CBaseChainParams::REGTEST);
+    const CChainParams& params = Params();
+    const uint256 hashGenesis = params.GetConsensus().hashGenesisBlock;
+    const uint256 hashSnapshot = GetRandHash();
+    const MapSnapshots mapSnapshotsOld = params.Snapshots();
+    UpdateRegtestSnapshot(1000, hashSnapshot, GetRandHash());
+
+    CCoinsViewDBTest db;
+    {
+        CCoinsViewCache cache(&db);
+        cache.SetBestBlock(hashGenesis);
+        BOOST_CHECK(cache.Flush());
+    }
+    std::vector<std::pair<COutPoint, Coin> > vCoins;
+    for (int i = 0; i < 100; i++)
+        vCoins.push_back(std::make_pair(COutPoint(GetRandHash(), i), Coin(CTxOut(i + 1, CScript() << OP_TRUE), 1, false)));
+
+    // A load interrupted after its first batch is rolled back, after which
+    // the flush at shutdown writes at the genesis block as before
+    BOOST_CHECK(db.LoadCoins(vCoins, hashSnapshot, false));
+    BOOST_CHECK(db.GetBestBlock().IsNull());
+    BOOST_CHECK(db.AbortLoadCoins(hashSnapshot));
+    BOOST_CHECK(db.GetHeadBlocks().empty());
+    BOOST_CHECK(db.GetBestBlock() == hashGenesis);
+    BOOST_CHECK(ReadCoins(db).empty());
+    {
+        CCoinsViewCache cache(&db);
+        BOOST_CHECK(cache.GetBestBlock() == hashGenesis);
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK(db.AbortLoadCoins(hashSnapshot));
+
+    // A load the node went down in the middle of is dropped by the next start
+    BOOST_CHECK(db.LoadCoins(vCoins, hashSnapshot, false));
+    BOOST_CHECK(ReplayBlocks(params, &db));
+    BOOST_CHECK(db.GetHeadBlocks().empty());
+    BOOST_CHECK(db.GetBestBlock() == hashGenesis);
+    BOOST_CHECK(ReadCoins(db).empty());
+
+    // After which the snapshot can be loaded again
+    BOOST_CHECK(db.LoadCoins(vCoins, hashSnapshot, false));
+    BOOST_CHECK(db.LoadCoins(std::vector<std::pair<COutPoint, Coin> >(), hashSnapshot, true));
+    BOOST_CHECK(db.GetBestBlock() == hashSnapshot);
+    BOOST_CHECK_EQUAL(ReadCoins(db).size(), vCoins.size());
+
+    // Leave the regtest params as they were for the tests that follow
+    MapSnapshots::const_iterator it = mapSnapshotsOld.find(1000);
+    if (it != mapSnapshotsOld.end())
+        UpdateRegtestSnapshot(1000, it->second.hashBlock, it->second.hashSerialized);
+    else
+        UpdateRegtestSnapshot(1000, uint256(), uint256());
+    BOOST_CHECK_EQUAL(params.Snapshots().count(1000), mapSnapshotsOld.count(1000));
+    SelectParams(CBaseChainParams::MAIN);
+}
+
+namespace {
+
+//! Records the coins a scan hands it, in order
+class CCoinsScanRecorder : public CCoinsScanReducer
+{
+public:
+    std::vector<std::pair<COutPoint, Coin> > vCoins;
+
+    CCoinsScanReducer* Fork() const { return new CCoinsScanRecorder(); }
+
+    bool Apply(const COutPoint& outpoint, const Coin& coin, unsigned int nValueSize)
+    {
+        vCoins.push_back(std::make_pair(outpoint, coin));
+        return true;
+    }
+
+    void Merge(const CCoinsScanReducer& shard)
+    {
+        const CCoinsScanRecorder& other = static_cast<const CCoinsScanRecorder&>(shard);
+        vCoins.insert(vCoins.end(), other.vCoins.begin(), other.vCoins.end());
+    }
+};
+
+}
+
+BOOST_AUTO_TEST_CASE(chainstate_scan)
+{
+    CCoinsViewDBTest db;
+    std::map<COutPoint, Coin> result;
+    {
+        CCoinsViewCache cache(&db);
+        for (int i = 0; i < 1000; i++) {
+            COutPoint outpoint(GetRandHash(), insecure_rand() % 4);
+            Coin coin(CTxOut(insecure_rand(), CScript() << OP_TRUE), i + 1, i % 7 == 0);
+            result[outpoint] = coin;
+            cache.AddCoin(outpoint, std::move(coin), true);
+        }
+        cache.SetBestBlock(GetRandHash());
+        BOOST_CHECK(cache.Flush());
+    }
+
+    // However many shards it is split into, the scan sees every coin once, in key order
+    const int nThreads[] = {1, 2, 3, 16};
+    for (unsigned int i = 0; i < sizeof(nThreads) / sizeof(nThreads[0]); i++) {
+        CCoinsScanRecorder recorder;
+        uint256 hashBlock;
+        BOOST_CHECK(ScanCoins(db, recorder, nThreads[i], hashBlock));
+        BOOST_CHECK(hashBlock == db.GetBestBlock());
+        BOOST_CHECK_EQUAL(recorder.vCoins.size(), result.size());
+        std::map<COutPoint, Coin>::const_iterator it = result.begin();
+        for (size_t j = 0; j < recorder.vCoins.size() && it != result.end(); j++, ++it) {
+            BOOST_CHECK(recorder.vCoins[j].first == it->first);
+            BOOST_CHECK(recorder.vCoins[j].second == it->second);
+        }
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE(chainstate_replay, TestChain100Setup)
+{
+    // A copy of the coins database as of the tip, which becomes the old tip
+    // of a write that gets cut short
+    FlushStateToDisk();
+    CCoinsViewDBTest db;
+    {
+        CCoinsViewCache cache(&db);
+        std::map<COutPoint, Coin> coins = ReadCoins(*pcoinsdbview);
+        for (std::map<COutPoint, Coin>::iterator it = coins.begin(); it != coins.end(); ++it)
+            cache.AddCoin(it->first, std::move(it->second), false);
+        cache.SetBestBlock(chainActive.Tip()->GetBlockHash());
+        BOOST_CHECK(cache.Flush());
+    }
+    const uint256 hashOld = chainActive.Tip()->GetBlockHash();
+
+    // Reorganize onto a longer branch forking 3 blocks down
+    {
+        CValidationState state;
+        LOCK(cs_main);
+        BOOST_CHECK(InvalidateBlock(state, Params(), chainActive[chainActive.Height() - 2]));
+    }
+    for (int i = 0; i < 4; i++)
+        CreateAndProcessBlock(std::vector<CMutableTransaction>(), CScript() << OP_TRUE);
+    BOOST_CHECK_EQUAL(chainActive.Height(), 101);
+    FlushStateToDisk();
+
+    // The write to the new tip only got as far as the coinbase of its last block
+    db.InterruptWrite(chainActive.Tip()->GetBlockHash(), hashOld);
+    {
+        CBlock block;
+        BOOST_CHECK(ReadBlockFromDisk(block, chainActive.Tip(), Params().GetConsensus()));
+        CCoinsMapMemoryResource resource;
+        CCoinsMap mapCoins(0, SaltedOutpointHasher(), std::equal_to<COutPoint>(), &resource);
+        CCoinsCacheEntry& entry = mapCoins[COutPoint(block.vtx[0].GetHash(), 0)];
+        entry.coin = Coin(block.vtx[0].vout[0], chainActive.Height(), true);
+        entry.flags = CCoinsCacheEntry::DIRTY;
+        BOOST_CHECK(db.BatchWrite(mapCoins, uint256()));
+    }
+    BOOST_CHECK(db.GetBestBlock().IsNull());
+    BOOST_CHECK_EQUAL(db.GetHeadBlocks().size(), 2);
+
+    // Replaying rolls the old branch back and the new one forward
+    BOOST_CHECK(ReplayBlocks(Params(), &db));
+    BOOST_CHECK(db.GetHeadBlocks().empty());
+    BOOST_CHECK(db.GetBestBlock() == chainActive.Tip()->GetBlockHash());
+    BOOST_CHECK(ReadCoins(db) == ReadCoins(*pcoinsdbview));
 }
 
 BOOST_AUTO_TEST_SUITE_END()
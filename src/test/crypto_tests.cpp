@@ -3,6 +3,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "crypto/aes.h"
+#include "crypto/muhash.h"
 #include "crypto/ripemd160.h"
 #include "crypto/sha1.h"
 #include "crypto/sha256.h"
@@ -439,4 +440,51 @@ BOOST_AUTO_TEST_CASE(aes_cbc_testvectors) {
                   "b2eb05e2c39be9fcda6c19078c6a9d1b3f461796d6b0d6b2e0c2a72b4d80e644");
 }
 
+static std::string MuHashHex(MuHash3072 muhash)
+{
+    unsigned char out[32];
+    muhash.Finalize(out);
+    return HexStr(out, out + sizeof(out));
+}
+
+BOOST_AUTO_TEST_CASE(muhash_tests)
+{
+    const unsigned char abc[3] = {'a', 'b', 'c'};
+    const unsigned char one[1] = {1}, two[1] = {2}, three[1] = {3};
+
+    // SHA256 of the little-endian 1
+    BOOST_CHECK_EQUAL(MuHashHex(MuHash3072()), "c85525462fdcf30a2c18d6f4b92923000974355c2477f59594d2c205a1d25add");
+    MuHash3072 set;
+    set.Insert(abc, 0).Insert(abc, sizeof(abc));
+    BOOST_CHECK_EQUAL(MuHashHex(set), "f20da9a7f33293d8a539bd0c26fecd85affff0874b0c6bb12d76b20c9fe6caa2");
+
+    // Order does not matter, and removes cancel adds
+    MuHash3072 a, b;
+    a.Insert(one, 1).Insert(two, 1).Insert(three, 1).Remove(two, 1);
+    b.Remove(two, 1).Insert(three, 1).Insert(two, 1).Insert(one, 1);
+    BOOST_CHECK_EQUAL(MuHashHex(a), "ecf01ab81c64e90b56aa2cffc74e9be4d71aeaa16a45a476ec11e25111edfac2");
+    BOOST_CHECK_EQUAL(MuHashHex(b), MuHashHex(a));
+
+    // Combining sets, and a round trip through bytes
+    for (int i = 0; i < 8; i++) {
+        uint32_t r = insecure_rand();
+        const unsigned char data[4] = {(unsigned char)r, (unsigned char)(r >> 8), (unsigned char)(r >> 16), (unsigned char)(r >> 24)};
+        MuHash3072 delta;
+        if (i % 3 == 0) {
+            a.Remove(data, sizeof(data));
+            delta.Remove(data, sizeof(data));
+        } else {
+            a.Insert(data, sizeof(data));
+            delta.Insert(data, sizeof(data));
+        }
+        b *= delta;
+    }
+    unsigned char bytes[MuHash3072::SERIALIZED_SIZE];
+    b.ToBytes(bytes);
+    MuHash3072 c;
+    c.FromBytes(bytes);
+    BOOST_CHECK_EQUAL(MuHashHex(c), MuHashHex(a));
+    BOOST_CHECK(MuHashHex(c) != MuHashHex(MuHash3072()));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
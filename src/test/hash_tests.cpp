@@ -2,7 +2,9 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "crypto/common.h"
 #include "hash.h"
+#include "random.h"
 #include "utilstrencodings.h"
 #include "test/test_bitcoin.h"
 
@@ -126,6 +128,18 @@ BOOST_AUTO_TEST_CASE(siphash)
     CHashWriter ss(SER_DISK, CLIENT_VERSION);
     ss << CTransaction();
     BOOST_CHECK_EQUAL(SipHashUint256(1, 2, ss.GetHash()), 0x79751e980c2a0a35ULL);
+
+    // Check SipHashUint256Extra against the generic hasher over hash || LE32(n)
+    for (int i = 0; i < 16; ++i) {
+        uint256 x = GetRandHash();
+        uint32_t n = insecure_rand();
+        unsigned char nb[4];
+        WriteLE32(nb, n);
+        CSipHasher sip(1, 2);
+        sip.Write(x.begin(), 32);
+        sip.Write(nb, 4);
+        BOOST_CHECK_EQUAL(SipHashUint256Extra(1, 2, x, n), sip.Finalize());
+    }
 }
 
 BOOST_AUTO_TEST_SUITE_END()
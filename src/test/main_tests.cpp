@@ -7,6 +7,10 @@
 
 #include "test/test_bitcoin.h"
 
+#include <limits>
+
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_int.hpp>
 #include <boost/signals2/signal.hpp>
 #include <boost/test/unit_test.hpp>
 
@@ -57,8 +61,48 @@ BOOST_AUTO_TEST_CASE(subsidy_limit_test)
         }
         nSum += nSubsidy;
         BOOST_CHECK(MoneyRange(nSum));
+        if (nHeight % 36000 == 0 || nHeight % 36000 == 17910)
+            BOOST_CHECK_EQUAL(GetTotalSupply(nHeight, consensusParams) + GetBlockSubsidy(0, consensusParams), nSum);
     }
     BOOST_CHECK_EQUAL(nSum, 29893739300000000ULL);
+    BOOST_CHECK_EQUAL(GetTotalSupply(26500000, consensusParams) + GetBlockSubsidy(0, consensusParams), nSum);
+    BOOST_CHECK_EQUAL(GetTotalSupply(std::numeric_limits<int>::max(), consensusParams), GetTotalSupply(26280000, consensusParams));
+}
+
+BOOST_AUTO_TEST_CASE(subsidy_wormhole_test)
+{
+    const Consensus::Params& consensusParams = Params(CBaseChainParams::MAIN).GetConsensus();
+    BOOST_CHECK_EQUAL(GetBlockSubsidy(-1, consensusParams), 1024 * COIN);
+    BOOST_CHECK_EQUAL(GetBlockSubsidy(1, consensusParams), 10747 * COIN);
+    BOOST_CHECK_EQUAL(GetTotalSupply(0, consensusParams), 0);
+    BOOST_CHECK_EQUAL(GetTotalSupply(2, consensusParams), (10747 + 1024) * COIN);
+
+    for (int epoch = 1; epoch <= 48; epoch++) {
+        boost::mt19937 gen(5299860 * epoch);
+        boost::uniform_int<> dist(1, 35820);
+        int nStart = dist(gen) + (epoch - 1) * 36000;
+        bool fWormhole = epoch > 1 && epoch < 48;
+        CAmount nBefore = GetBlockSubsidy(nStart - 1, consensusParams);
+        BOOST_CHECK(nBefore != 2973 * COIN);
+        BOOST_CHECK_EQUAL(GetBlockSubsidy(nStart, consensusParams) == 2973 * COIN, fWormhole);
+        BOOST_CHECK_EQUAL(GetBlockSubsidy(nStart + 179, consensusParams) == 2973 * COIN, fWormhole);
+        BOOST_CHECK(GetBlockSubsidy(nStart + 180, consensusParams) != 2973 * COIN);
+        if (fWormhole) {
+            BOOST_CHECK_EQUAL(GetTotalSupply(nStart + 179, consensusParams) - GetTotalSupply(nStart - 1, consensusParams), 180 * 2973 * COIN);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(subsidy_supply_halvings_test)
+{
+    const Consensus::Params& consensusParams = Params(CBaseChainParams::REGTEST).GetConsensus();
+    const int nInterval = consensusParams.nSubsidyHalvingInterval;
+    CAmount nSum = 0;
+    for (int nHeight = 1; nHeight <= 66 * nInterval; nHeight++) {
+        nSum += GetBlockSubsidy(nHeight, consensusParams);
+        if (nHeight % nInterval <= 1 || nHeight % nInterval == nInterval - 1)
+            BOOST_CHECK_EQUAL(GetTotalSupply(nHeight, consensusParams), nSum);
+    }
 }
 
 bool ReturnFalse() { return false; }
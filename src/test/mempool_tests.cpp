@@ -89,17 +89,21 @@ BOOST_AUTO_TEST_CASE(MempoolRemoveTest)
     BOOST_CHECK_EQUAL(testPool.size(), 0);
     removed.clear();
 
+    BOOST_CHECK_EQUAL(testPool.GetTotalFee(), 0);
+
     // Add children and grandchildren, but NOT the parent (simulate the parent being in a block)
     for (int i = 0; i < 3; i++)
     {
-        testPool.addUnchecked(txChild[i].GetHash(), entry.FromTx(txChild[i]));
-        testPool.addUnchecked(txGrandChild[i].GetHash(), entry.FromTx(txGrandChild[i]));
+        testPool.addUnchecked(txChild[i].GetHash(), entry.Fee(1000 + i).FromTx(txChild[i]));
+        testPool.addUnchecked(txGrandChild[i].GetHash(), entry.Fee(2000 + i).FromTx(txGrandChild[i]));
     }
+    BOOST_CHECK_EQUAL(testPool.GetTotalFee(), 9006);
     // Now remove the parent, as might happen if a block-re-org occurs but the parent cannot be
     // put into the mempool (maybe because it is non-standard):
     testPool.removeRecursive(txParent, removed);
     BOOST_CHECK_EQUAL(removed.size(), 6);
     BOOST_CHECK_EQUAL(testPool.size(), 0);
+    BOOST_CHECK_EQUAL(testPool.GetTotalFee(), 0);
     removed.clear();
 }
 
@@ -2,7 +2,9 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "chain.h"
 #include "consensus/merkle.h"
+#include "miner.h"
 #include "test/test_bitcoin.h"
 #include "random.h"
 
@@ -133,4 +135,33 @@ BOOST_AUTO_TEST_CASE(merkle_test)
     }
 }
 
+BOOST_AUTO_TEST_CASE(merkle_extranonce_test)
+{
+    CBlockIndex indexPrev;
+    indexPrev.nHeight = 1000;
+    for (int ntx = 1; ntx <= 33; ntx++) {
+        CBlock block;
+        block.vtx.resize(ntx);
+        for (int j = 0; j < ntx; j++) {
+            CMutableTransaction mtx;
+            mtx.vin.resize(1);
+            mtx.nLockTime = j;
+            block.vtx[j] = mtx;
+        }
+        std::vector<uint256> branch = BlockMerkleBranch(block, 0);
+        unsigned int nExtraNonce = 0;
+        for (int i = 0; i < 3; i++) {
+            // Rolling the extranonce with the cached branch gives the full recomputation
+            CBlock blockBranch = block;
+            unsigned int nExtraNonceBranch = nExtraNonce;
+            IncrementExtraNonce(&blockBranch, &indexPrev, nExtraNonceBranch, &branch);
+            IncrementExtraNonce(&block, &indexPrev, nExtraNonce);
+            BOOST_CHECK_EQUAL(nExtraNonceBranch, nExtraNonce);
+            BOOST_CHECK(blockBranch.vtx[0].GetHash() == block.vtx[0].GetHash());
+            BOOST_CHECK(blockBranch.hashMerkleRoot == BlockMerkleRoot(block));
+            BOOST_CHECK(block.hashMerkleRoot == BlockMerkleRoot(block));
+        }
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -7,6 +7,7 @@
 #include "consensus/consensus.h"
 #include "consensus/merkle.h"
 #include "consensus/validation.h"
+#include "key.h"
 #include "main.h"
 #include "miner.h"
 #include "pubkey.h"
@@ -15,9 +16,12 @@
 #include "uint256.h"
 #include "util.h"
 #include "utilstrencodings.h"
+#include "utiltime.h"
 
 #include "test/test_bitcoin.h"
 
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
 #include <boost/test/unit_test.hpp>
 
 BOOST_FIXTURE_TEST_SUITE(miner_tests, TestingSetup)
@@ -502,4 +506,88 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     fCheckpointsEnabled = true;
 }
 
+/** The background template on pindexPrev for the current mempool, once the builder has it */
+static std::shared_ptr<const CBlockTemplate> WaitForPrebuiltTemplate(const CBlockIndex* pindexPrev)
+{
+    // Until the builder thread is up, asking returns at once
+    std::shared_ptr<const CBlockTemplate> ptemplate;
+    for (int i = 0; i < 100 && !ptemplate; i++) {
+        ptemplate = GetPrebuiltBlockTemplate(pindexPrev, mempool.GetTransactionsUpdated(), 100);
+        if (!ptemplate)
+            MilliSleep(100);
+    }
+    return ptemplate;
+}
+
+/** Spend the output of coinbase to scriptPubKey, leaving nFee, and add it to the mempool */
+static CMutableTransaction SpendToMemPool(const CTransaction& coinbase, const CKey& key, const CScript& scriptPubKey, CAmount nFee)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(coinbase.GetHash(), 0);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = coinbase.vout[0].nValue - nFee;
+    tx.vout[0].scriptPubKey = scriptPubKey;
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(coinbase.vout[0].scriptPubKey, tx, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+    BOOST_CHECK(key.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    tx.vin[0].scriptSig << vchSig;
+
+    LOCK(cs_main);
+    CValidationState state;
+    BOOST_CHECK(AcceptToMemoryPool(mempool, state, tx, false, NULL, true, 0));
+    return tx;
+}
+
+BOOST_FIXTURE_TEST_CASE(prebuilt_block_template, TestChain100Setup)
+{
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    // Time stands still unless moved on below, so only the fee delta and
+    // new tips make the builder rebuild at first
+    SetMockTime(GetTime());
+    const CBlockIndex* pindexOld = chainActive.Tip();
+
+    // There is no template before the builder runs; getblocktemplate and
+    // stratum then build their own
+    BOOST_CHECK(!GetPrebuiltBlockTemplate(pindexOld, mempool.GetTransactionsUpdated()));
+
+    boost::thread builder(boost::bind(&ThreadBlockTemplateBuilder, COIN));
+    std::shared_ptr<const CBlockTemplate> ptemplate = WaitForPrebuiltTemplate(pindexOld);
+    BOOST_REQUIRE(ptemplate);
+    BOOST_CHECK(ptemplate->block.hashPrevBlock == pindexOld->GetBlockHash());
+
+    // A new tip gets a template of its own, and the one on the old tip is refused
+    CreateAndProcessBlock(std::vector<CMutableTransaction>(), scriptPubKey);
+    const CBlockIndex* pindexNew = chainActive.Tip();
+    BOOST_CHECK(pindexNew != pindexOld);
+    ptemplate = WaitForPrebuiltTemplate(pindexNew);
+    BOOST_REQUIRE(ptemplate);
+    BOOST_CHECK(ptemplate->block.hashPrevBlock == pindexNew->GetBlockHash());
+    BOOST_CHECK(!GetPrebuiltBlockTemplate(pindexOld, mempool.GetTransactionsUpdated()));
+
+    // Fees growing by the fee delta get a new template right away, and the
+    // template from before is refused
+    const unsigned int nTransactionsUpdatedOld = mempool.GetTransactionsUpdated();
+    CMutableTransaction txHighFee = SpendToMemPool(coinbaseTxns[0], coinbaseKey, scriptPubKey, 2 * COIN);
+    ptemplate = WaitForPrebuiltTemplate(pindexNew);
+    BOOST_REQUIRE(ptemplate);
+    BOOST_REQUIRE_EQUAL(ptemplate->block.vtx.size(), 2U);
+    BOOST_CHECK(ptemplate->block.vtx[1].GetHash() == txHighFee.GetHash());
+    BOOST_CHECK(!GetPrebuiltBlockTemplate(pindexNew, nTransactionsUpdatedOld));
+
+    // Smaller fees only get one once the template is BLOCK_TEMPLATE_MIN_AGE old
+    CMutableTransaction txLowFee = SpendToMemPool(coinbaseTxns[1], coinbaseKey, scriptPubKey, CENT);
+    BOOST_CHECK(!GetPrebuiltBlockTemplate(pindexNew, mempool.GetTransactionsUpdated(), 1500));
+    SetMockTime(GetTime() + BLOCK_TEMPLATE_MIN_AGE);
+    ptemplate = WaitForPrebuiltTemplate(pindexNew);
+    BOOST_REQUIRE(ptemplate);
+    BOOST_CHECK_EQUAL(ptemplate->block.vtx.size(), 3U);
+
+    builder.interrupt();
+    builder.join();
+    mempool.clear();
+    SetMockTime(0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,93 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "momcache.h"
+
+#include "chainparams.h"
+#include "consensus/validation.h"
+#include "main.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+uint256 komodo_calcMoM(int32_t height, int32_t MoMdepth);
+
+BOOST_FIXTURE_TEST_SUITE(momcache_tests, TestChain100Setup)
+
+static std::vector<uint256> Leaves(int nHeight, int nDepth)
+{
+    std::vector<uint256> vLeaves;
+    for (int i = 0; i < nDepth; i++)
+        vLeaves.push_back(chainActive[nHeight - i]->hashMerkleRoot);
+    return vLeaves;
+}
+
+// The global cache is not fed in tests, so komodo_calcMoM builds the whole
+// iguana_merkle tree and is the reference for every MoM the cache answers
+static int CheckCache(const CMoMCache& cache)
+{
+    int nAnswered = 0;
+    for (int nHeight = 2; nHeight <= chainActive.Height(); nHeight++) {
+        for (int nDepth = 1; nDepth < nHeight; nDepth++) {
+            uint256 MoM;
+            if (!cache.GetMoM(chainActive[nHeight], nDepth, MoM))
+                continue;
+            nAnswered++;
+            BOOST_CHECK(MoM == komodo_calcMoM(nHeight, nDepth));
+            std::vector<uint256> vLeaves = Leaves(nHeight, nDepth);
+            for (int nPos = 0; nPos < nDepth; nPos++) {
+                std::vector<uint256> vBranch;
+                BOOST_CHECK(cache.GetMoMBranch(chainActive[nHeight], nDepth, nHeight - nPos, vBranch));
+                BOOST_CHECK(vBranch == ComputeMoMBranch(vLeaves, nPos));
+                BOOST_CHECK(ComputeMoMFromBranch(vLeaves[nPos], vBranch, nPos) == MoM);
+            }
+        }
+    }
+    return nAnswered;
+}
+
+BOOST_AUTO_TEST_CASE(momcache_matches_iguana_merkle)
+{
+    for (int nDepth = 1; nDepth < 100; nDepth++)
+        BOOST_CHECK(ComputeMoM(Leaves(100, nDepth)) == komodo_calcMoM(100, nDepth));
+
+    CMoMCache cache(7);
+    cache.SetTip(chainActive.Tip());
+    // Every MoM of the 100 block chain fits in 128 cached heights
+    BOOST_CHECK_EQUAL(CheckCache(cache), 99 * 100 / 2);
+
+    std::vector<uint256> vBranch;
+    BOOST_CHECK(!cache.GetMoMBranch(chainActive[50], 10, 40, vBranch));
+    BOOST_CHECK(!cache.GetMoMBranch(chainActive[50], 10, 51, vBranch));
+}
+
+BOOST_AUTO_TEST_CASE(momcache_follows_tip)
+{
+    // A block at a time, as UpdatedBlockTip delivers them, and only the last
+    // 16 heights are kept
+    CMoMCache cache(4);
+    for (int nHeight = 0; nHeight <= chainActive.Height(); nHeight++)
+        cache.SetTip(chainActive[nHeight]);
+    uint256 MoM;
+    BOOST_CHECK(cache.GetMoM(chainActive[100], 16, MoM));
+    BOOST_CHECK(!cache.GetMoM(chainActive[100], 17, MoM));
+    BOOST_CHECK(!cache.GetMoM(chainActive[84], 1, MoM));
+    BOOST_CHECK_EQUAL(CheckCache(cache), 16 * 17 / 2);
+
+    // Reorganize onto a branch with other merkle roots from height 95
+    const CBlockIndex* pindexStale = chainActive[96];
+    CValidationState state;
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(InvalidateBlock(state, Params(), chainActive[95]));
+    }
+    for (int i = 0; i < 8; i++)
+        CreateAndProcessBlock(std::vector<CMutableTransaction>(), CScript() << OP_TRUE);
+    BOOST_CHECK_EQUAL(chainActive.Height(), 102);
+    cache.SetTip(chainActive.Tip());
+    BOOST_CHECK_EQUAL(CheckCache(cache), 16 * 17 / 2);
+    BOOST_CHECK(!cache.GetMoM(pindexStale, 1, MoM));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
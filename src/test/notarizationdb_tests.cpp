@@ -0,0 +1,254 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "notarizationdb.h"
+
+#include "chainparams.h"
+#include "consensus/validation.h"
+#include "komodo_notaries.h"
+#include "main.h"
+#include "random.h"
+#include "undo.h"
+#include "utilstrencodings.h"
+#include "validationinterface.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/filesystem/operations.hpp>
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+extern char ASSETCHAINS_SYMBOL[65];
+extern int32_t NOTARIZED_HEIGHT;
+extern uint256 NOTARIZED_HASH;
+void komodo_setstate();
+int32_t komodo_checkpoint(int32_t *notarized_heightp, int32_t nHeight, uint256 hash);
+
+BOOST_FIXTURE_TEST_SUITE(notarizationdb_tests, BasicTestingSetup)
+
+static CNotarizedCheckpoint Checkpoint(int nHeight, int nNotarizedHeight, int nMoMDepth)
+{
+    CNotarizedCheckpoint checkpoint;
+    checkpoint.nHeight = nHeight;
+    checkpoint.nNotarizedHeight = nNotarizedHeight;
+    checkpoint.hashNotarized = GetRandHash();
+    checkpoint.hashDestTx = GetRandHash();
+    if (nMoMDepth > 0) {
+        checkpoint.MoM = GetRandHash();
+        checkpoint.nMoMDepth = nMoMDepth;
+    }
+    return checkpoint;
+}
+
+// The linear scans the index replaces
+static const CNotarizedCheckpoint* ScanBefore(const std::vector<CNotarizedCheckpoint>& v, int nHeight)
+{
+    const CNotarizedCheckpoint* p = NULL;
+    for (size_t i = 0; i < v.size() && v[i].nHeight < nHeight; i++)
+        p = &v[i];
+    return p;
+}
+
+static const CNotarizedCheckpoint* ScanMoM(const std::vector<CNotarizedCheckpoint>& v, int nHeight)
+{
+    for (size_t i = v.size(); i-- > 0; )
+        if (v[i].nMoMDepth > 0 && nHeight > v[i].nNotarizedHeight - v[i].nMoMDepth && nHeight <= v[i].nNotarizedHeight)
+            return &v[i];
+    return NULL;
+}
+
+static int ScanPrevMoMHeight(const std::vector<CNotarizedCheckpoint>& v)
+{
+    for (size_t i = v.size(); i-- > 0; )
+        if (!v[i].MoM.IsNull())
+            return v[i].nNotarizedHeight;
+    return 0;
+}
+
+static void CheckIndex(const CNotarizationIndex& index, const std::vector<CNotarizedCheckpoint>& v, int nMaxHeight)
+{
+    BOOST_CHECK_EQUAL(index.Size(), v.size());
+    BOOST_CHECK_EQUAL(index.PrevMoMHeight(), ScanPrevMoMHeight(v));
+    for (int nHeight = 0; nHeight <= nMaxHeight; nHeight++) {
+        CNotarizedCheckpoint checkpoint;
+        const CNotarizedCheckpoint* p = ScanBefore(v, nHeight);
+        BOOST_CHECK_EQUAL(index.FindBefore(nHeight, checkpoint), p != NULL);
+        if (p)
+            BOOST_CHECK(checkpoint.hashNotarized == p->hashNotarized);
+        p = ScanMoM(v, nHeight);
+        BOOST_CHECK_EQUAL(index.FindMoM(nHeight, checkpoint), p != NULL);
+        if (p)
+            BOOST_CHECK(checkpoint.MoM == p->MoM);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(notarizationindex_lookups)
+{
+    CNotarizationIndex index;
+    std::vector<CNotarizedCheckpoint> v;
+    int nHeight = 0, nNotarizedHeight = 0;
+    for (int i = 0; i < 200; i++) {
+        nHeight += 1 + insecure_rand() % 20;
+        nNotarizedHeight = std::max(nNotarizedHeight + 1, nHeight - 1 - (int)(insecure_rand() % 30));
+        if (nNotarizedHeight >= nHeight)
+            nHeight = nNotarizedHeight + 1;
+        // Overlapping, nested and missing MoM windows
+        int nMoMDepth = insecure_rand() % 4 == 0 ? 0 : 1 + insecure_rand() % std::min(nNotarizedHeight, 60);
+        v.push_back(Checkpoint(nHeight, nNotarizedHeight, nMoMDepth));
+        BOOST_CHECK(index.Add(v.back()));
+    }
+    CheckIndex(index, v, nHeight + 1);
+
+    // Removing the tail restores the lookups of the shorter chain
+    int nReorgHeight = v[150].nHeight;
+    BOOST_CHECK(index.EraseFrom(nReorgHeight));
+    v.resize(150);
+    CheckIndex(index, v, nHeight + 1);
+
+    // A notarization from another branch replaces the ones it conflicts with
+    CNotarizedCheckpoint checkpoint = Checkpoint(v[140].nHeight + 1, v[130].nNotarizedHeight + 1, 0);
+    BOOST_CHECK(index.Add(checkpoint));
+    v.resize(131);
+    v.push_back(checkpoint);
+    CheckIndex(index, v, nHeight + 1);
+}
+
+BOOST_AUTO_TEST_CASE(notarizationindex_persistence)
+{
+    boost::filesystem::path ph = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    std::vector<CNotarizedCheckpoint> v;
+    {
+        CNotarizationIndex index;
+        BOOST_CHECK(index.Open(ph, 1 << 20));
+        BOOST_CHECK(!index.ReadFlag("flag"));
+        BOOST_CHECK(index.WriteFlag("flag"));
+        for (int i = 1; i <= 300; i++) {
+            v.push_back(Checkpoint(i * 10, i * 10 - 5, i % 3 ? 7 : 0));
+            BOOST_CHECK(index.Add(v.back()));
+        }
+        // Both ways of dropping checkpoints reach the database
+        BOOST_CHECK(index.EraseFrom(2500));
+        v.resize(249);
+        CNotarizedCheckpoint checkpoint = Checkpoint(2480, 2470, 7);
+        BOOST_CHECK(index.Add(checkpoint));
+        v.resize(247);
+        v.push_back(checkpoint);
+        index.Close();
+        BOOST_CHECK_EQUAL(index.Size(), 0);
+    }
+    CNotarizationIndex index;
+    BOOST_CHECK(index.Open(ph, 1 << 20));
+    BOOST_CHECK(index.ReadFlag("flag"));
+    CheckIndex(index, v, 3100);
+    index.Close();
+    BOOST_CHECK(index.Open(ph, 1 << 20, true));
+    BOOST_CHECK_EQUAL(index.Size(), 0);
+    BOOST_CHECK(!index.ReadFlag("flag"));
+    index.Close();
+    boost::filesystem::remove_all(ph);
+}
+
+BOOST_FIXTURE_TEST_CASE(notarization_disconnect, TestChain100Setup)
+{
+    // Without its thread the processor handles blocks as they disconnect
+    RegisterValidationInterface(&notarizationprocessor);
+    CNotarizedCheckpoint first = Checkpoint(95, 80, 10);
+    first.hashNotarized = chainActive[80]->GetBlockHash();
+    CNotarizedCheckpoint second = Checkpoint(100, 90, 0);
+    second.hashNotarized = chainActive[90]->GetBlockHash();
+    BOOST_CHECK(notarizationindex.Add(first));
+    BOOST_CHECK(notarizationindex.Add(second));
+    komodo_setstate();
+    BOOST_CHECK_EQUAL(NOTARIZED_HEIGHT, 90);
+
+    // Disconnecting the tip only undoes the notarization it carried
+    CValidationState state;
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(InvalidateBlock(state, Params(), chainActive.Tip()));
+    }
+    BOOST_CHECK_EQUAL(chainActive.Height(), 99);
+    BOOST_CHECK_EQUAL(notarizationindex.Size(), 1);
+    BOOST_CHECK_EQUAL(NOTARIZED_HEIGHT, 80);
+    BOOST_CHECK(NOTARIZED_HASH == first.hashNotarized);
+    BOOST_CHECK_EQUAL(notarizationindex.PrevMoMHeight(), 80);
+
+    BOOST_CHECK(notarizationindex.EraseFrom(0));
+    komodo_setstate();
+    BOOST_CHECK_EQUAL(NOTARIZED_HEIGHT, 0);
+    UnregisterValidationInterface(&notarizationprocessor);
+    // The snapshot must not outlive the block index of this test
+    notarizationprocessor.Publish(NULL);
+}
+
+/** A block whose second transaction spends coins of nSigners season 2 notaries and notarizes pindexNotarized */
+static void NotarizationBlock(const CBlockIndex* pindexNotarized, int nSigners, CBlock& block, CBlockUndo& blockundo)
+{
+    uint256 hashNotarized = pindexNotarized->GetBlockHash();
+    std::vector<unsigned char> vchData(hashNotarized.begin(), hashNotarized.end());
+    for (int i = 0; i < 4; i++)
+        vchData.push_back((pindexNotarized->nHeight >> (8 * i)) & 0xff);
+    uint256 hashDestTx = GetRandHash();
+    vchData.insert(vchData.end(), hashDestTx.begin(), hashDestTx.end());
+    vchData.insert(vchData.end(), ASSETCHAINS_SYMBOL, ASSETCHAINS_SYMBOL + strlen(ASSETCHAINS_SYMBOL) + 1);
+
+    CMutableTransaction tx;
+    tx.vout.resize(2);
+    tx.vout[1].scriptPubKey = CScript() << OP_RETURN << vchData;
+    block.vtx.resize(2);
+    block.vtx[1] = tx;
+    blockundo.vtxundo.resize(1);
+    for (int i = 0; i < nSigners; i++)
+        blockundo.vtxundo[0].vprevout.push_back(Coin(CTxOut(10000, CScript() << ParseHex(notaries_elected[1][i][1]) << OP_CHECKSIG), 1, false));
+}
+
+BOOST_FIXTURE_TEST_CASE(notarization_processor, TestChain100Setup)
+{
+    notarizationindex.EraseFrom(0);
+    komodo_setstate();
+    RegisterValidationInterface(&notarizationprocessor);
+    boost::thread thread(boost::bind(&CNotarizationProcessor::Thread, &notarizationprocessor));
+
+    CBlock block;
+    CBlockUndo blockundo;
+    NotarizationBlock(chainActive[90], 10, block, blockundo);
+    GetMainSignals().BlockConnected(block, chainActive[98], blockundo);
+    NotarizationBlock(chainActive[90], 13, block, blockundo);
+    GetMainSignals().BlockConnected(block, chainActive[99], blockundo);
+    notarizationprocessor.Sync();
+
+    // Only the transaction enough notaries signed counts
+    BOOST_CHECK_EQUAL(notarizationindex.Size(), 1);
+    BOOST_CHECK_EQUAL(NOTARIZED_HEIGHT, 90);
+    std::shared_ptr<const CNotarizationSnapshot> snapshot = notarizationprocessor.GetSnapshot();
+    BOOST_CHECK(snapshot->pindex == chainActive[99]);
+    BOOST_CHECK_EQUAL(snapshot->vCheckpoints.size(), 1);
+    BOOST_CHECK_EQUAL(snapshot->vCheckpoints.back().nNotarizedHeight, 90);
+
+    // The checkpoint check only sees the snapshot
+    int32_t nNotarizedHeight;
+    {
+        LOCK(cs_main);
+        BOOST_CHECK_EQUAL(komodo_checkpoint(&nNotarizedHeight, 85, GetRandHash()), -1);
+        BOOST_CHECK_EQUAL(nNotarizedHeight, 90);
+        BOOST_CHECK_EQUAL(komodo_checkpoint(&nNotarizedHeight, 90, GetRandHash()), -1);
+        BOOST_CHECK_EQUAL(komodo_checkpoint(&nNotarizedHeight, 90, chainActive[90]->GetBlockHash()), 0);
+        BOOST_CHECK_EQUAL(komodo_checkpoint(&nNotarizedHeight, 95, GetRandHash()), 0);
+    }
+
+    GetMainSignals().BlockDisconnected(block, chainActive[99]);
+    notarizationprocessor.Sync();
+    BOOST_CHECK_EQUAL(notarizationindex.Size(), 0);
+    BOOST_CHECK_EQUAL(NOTARIZED_HEIGHT, 0);
+    snapshot = notarizationprocessor.GetSnapshot();
+    BOOST_CHECK(snapshot->pindex == chainActive[98]);
+    BOOST_CHECK(snapshot->vCheckpoints.empty());
+
+    thread.interrupt();
+    thread.join();
+    UnregisterValidationInterface(&notarizationprocessor);
+    // The snapshot must not outlive the block index of this test
+    notarizationprocessor.Publish(NULL);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -4,11 +4,16 @@
 
 #include "chain.h"
 #include "chainparams.h"
+#include "crypto/scrypt.h"
+#include "main.h"
+#include "miner.h"
 #include "pow.h"
 #include "random.h"
 #include "util.h"
 #include "test/test_bitcoin.h"
 
+#include <cmath>
+
 #include <boost/test/unit_test.hpp>
 
 using namespace std;
@@ -95,4 +100,192 @@ BOOST_AUTO_TEST_CASE(GetBlockProofEquivalentTime_test)
     }
 }
 
+/* Straightforward Kimoto Gravity Well, kept as the consensus reference for the optimized engine */
+static unsigned int ReferenceKimotoGravityWell(const CBlockIndex* pindexLast, uint64_t TargetBlocksSpacingSeconds, uint64_t PastBlocksMin, uint64_t PastBlocksMax, const Consensus::Params& params)
+{
+    const arith_uint256 bnPowLimit = UintToArith256(params.powLimit);
+    if (pindexLast == NULL || pindexLast->nHeight == 0 || (uint64_t)pindexLast->nHeight < PastBlocksMin)
+        return bnPowLimit.GetCompact();
+
+    uint64_t PastBlocksMass = 0;
+    int64_t PastRateActualSeconds = 0;
+    int64_t PastRateTargetSeconds = 0;
+    arith_uint256 PastDifficultyAverage;
+    arith_uint256 PastDifficultyAveragePrev;
+    const CBlockIndex* BlockReading = pindexLast;
+    for (unsigned int i = 1; BlockReading && BlockReading->nHeight > 0; i++) {
+        if (PastBlocksMax > 0 && i > PastBlocksMax)
+            break;
+        PastBlocksMass++;
+
+        if (i == 1)
+            PastDifficultyAverage.SetCompact(BlockReading->nBits);
+        else if (arith_uint256().SetCompact(BlockReading->nBits) >= PastDifficultyAveragePrev)
+            PastDifficultyAverage = ((arith_uint256().SetCompact(BlockReading->nBits) - PastDifficultyAveragePrev) / i) + PastDifficultyAveragePrev;
+        else
+            PastDifficultyAverage = PastDifficultyAveragePrev - ((PastDifficultyAveragePrev - arith_uint256().SetCompact(BlockReading->nBits)) / i);
+        PastDifficultyAveragePrev = PastDifficultyAverage;
+
+        PastRateActualSeconds = pindexLast->GetBlockTime() - BlockReading->GetBlockTime();
+        PastRateTargetSeconds = TargetBlocksSpacingSeconds * PastBlocksMass;
+        double PastRateAdjustmentRatio = double(1);
+        if (PastRateActualSeconds < 0)
+            PastRateActualSeconds = 0;
+        if (PastRateActualSeconds != 0 && PastRateTargetSeconds != 0)
+            PastRateAdjustmentRatio = double(PastRateTargetSeconds) / double(PastRateActualSeconds);
+        double EventHorizonDeviation = 1 + (0.7084 * pow((double(PastBlocksMass)/double(144)), -1.228));
+        if (PastBlocksMass >= PastBlocksMin && (PastRateAdjustmentRatio <= 1 / EventHorizonDeviation || PastRateAdjustmentRatio >= EventHorizonDeviation))
+            break;
+        if (BlockReading->pprev == NULL)
+            break;
+        BlockReading = BlockReading->pprev;
+    }
+
+    arith_uint256 bnNew(PastDifficultyAverage);
+    if (PastRateActualSeconds != 0 && PastRateTargetSeconds != 0) {
+        bnNew *= PastRateActualSeconds;
+        bnNew /= PastRateTargetSeconds;
+    }
+    if (bnNew > bnPowLimit)
+        bnNew = bnPowLimit;
+    return bnNew.GetCompact();
+}
+
+static unsigned int ReferenceNextWorkRequired(const CBlockIndex* pindexLast, const Consensus::Params& params)
+{
+    if (pindexLast->nHeight + 1 >= 56000)
+        return CalculateNextWorkRequired(pindexLast, pindexLast->pprev->GetBlockTime(), params);
+    return ReferenceKimotoGravityWell(pindexLast, 60, 60 * 60 * 24 / 4 / 60, 60 * 60 * 24 * 7 / 60, params);
+}
+
+/* Build a chain whose every target comes from the engine and check each one against the reference */
+static void CheckNextWorkOverChain(int nStartHeight, int nBlocks, const Consensus::Params& params)
+{
+    std::vector<CBlockIndex> blocks(nBlocks);
+    CBlockHeader header;
+    int64_t nSpacing = params.nPowTargetSpacing;
+    for (int i = 0; i < nBlocks; i++) {
+        // Alternate runs of fast and slow blocks so the gravity well both widens and cuts off early
+        if (i % 500 == 0)
+            nSpacing = 5 + insecure_rand() % (4 * params.nPowTargetSpacing);
+        blocks[i].pprev = i ? &blocks[i - 1] : NULL;
+        blocks[i].nHeight = nStartHeight + i;
+        blocks[i].nTime = 1400000000 + i * nSpacing + insecure_rand() % 30;
+        if (i == 0) {
+            blocks[i].nBits = UintToArith256(params.powLimit).GetCompact();
+            continue;
+        }
+        // Skip pointers need the chain to reach back to genesis
+        if (nStartHeight == 0)
+            blocks[i].BuildSkip();
+        header.nTime = blocks[i].nTime;
+        unsigned int nBits = GetNextWorkRequired(&blocks[i - 1], &header, params);
+        BOOST_REQUIRE_EQUAL(nBits, ReferenceNextWorkRequired(&blocks[i - 1], params));
+        // A second query is answered from the per-index cache
+        BOOST_REQUIRE_EQUAL(GetNextWorkRequired(&blocks[i - 1], &header, params), nBits);
+        blocks[i].nBits = nBits;
+    }
+}
+
+BOOST_AUTO_TEST_CASE(next_work_matches_reference)
+{
+    SelectParams(CBaseChainParams::MAIN);
+    const Consensus::Params& params = Params().GetConsensus();
+    seed_insecure_rand(true);
+
+    // From genesis through the end of the minimum gravity well window
+    CheckNextWorkOverChain(0, 2000, params);
+    // Across the switch from Kimoto Gravity Well to DigiShield at height 56000
+    CheckNextWorkOverChain(53500, 3500, params);
+}
+
+/* The batched check must agree header by header with CheckProofOfWork */
+BOOST_AUTO_TEST_CASE(check_proof_of_work_batch)
+{
+    SelectParams(CBaseChainParams::REGTEST);
+    const Consensus::Params& params = Params().GetConsensus();
+
+    std::vector<CBlockHeader> headers(37);
+    for (size_t i = 0; i < headers.size(); i++) {
+        headers[i].nVersion = 4;
+        headers[i].hashPrevBlock = GetRandHash();
+        headers[i].nTime = 1500000000 + i;
+        headers[i].nBits = UintToArith256(params.powLimit).GetCompact();
+        headers[i].nNonce = i;
+    }
+    // An impossible target must never pass
+    headers[5].nBits = 0;
+
+    std::vector<const CBlockHeader*> vpHeaders;
+    BOOST_FOREACH(const CBlockHeader& header, headers)
+        vpHeaders.push_back(&header);
+
+    std::vector<char> vValid;
+    std::vector<uint256> vHashPoW;
+    CheckProofOfWorkBatch(vpHeaders, vValid, vHashPoW, params);
+    BOOST_CHECK_EQUAL(vValid.size(), headers.size());
+    bool fAllValid = true;
+    for (size_t i = 0; i < headers.size(); i++) {
+        bool fValid = CheckProofOfWork(headers[i].GetPoWHash(), headers[i].nBits, params);
+        fAllValid &= fValid;
+        // Entries may be left unset after a failure, but never set for an invalid header
+        BOOST_CHECK(fValid || !vValid[i]);
+    }
+    BOOST_CHECK(!fAllValid);
+    BOOST_CHECK(!vValid[5]);
+
+    // Without failures every header is confirmed
+    vpHeaders.erase(vpHeaders.begin() + 5);
+    std::vector<const CBlockHeader*> vpPassing;
+    BOOST_FOREACH(const CBlockHeader* pheader, vpHeaders) {
+        if (CheckProofOfWork(pheader->GetPoWHash(), pheader->nBits, params))
+            vpPassing.push_back(pheader);
+    }
+    CheckProofOfWorkBatch(vpPassing, vValid, vHashPoW, params);
+    BOOST_CHECK(std::count(vValid.begin(), vValid.end(), 1) == (long)vpPassing.size());
+    // Confirmed headers come back with their proof-of-work hash
+    for (size_t i = 0; i < vpPassing.size(); i++)
+        BOOST_CHECK(vHashPoW[i] == vpPassing[i]->GetPoWHash());
+}
+
+/* The parallel nonce search used by generate */
+BOOST_AUTO_TEST_CASE(scan_nonces)
+{
+    const Consensus::Params& params = Params(CBaseChainParams::REGTEST).GetConsensus();
+    std::vector<std::vector<char> > vScratchpad(3, std::vector<char>(SCRYPT_MULTI_SCRATCHPAD_SIZE));
+
+    std::vector<CBlock> vBlocks(3);
+    BOOST_FOREACH(CBlock& block, vBlocks) {
+        block.nVersion = 4;
+        block.hashMerkleRoot = GetRandHash();
+        block.nTime = 1500000000;
+        block.nBits = UintToArith256(params.powLimit).GetCompact();
+    }
+
+    // An easy target is met within the first kernel pass of some thread
+    uint64_t nMaxTries = 1000;
+    int nSolved = ScanNonces(vBlocks, 0x10000, nMaxTries, vScratchpad, params);
+    BOOST_REQUIRE(nSolved >= 0 && nSolved < 3);
+    BOOST_CHECK(CheckProofOfWork(vBlocks[nSolved].GetPoWHash(), vBlocks[nSolved].nBits, params));
+    BOOST_CHECK(nMaxTries <= 1000 && nMaxTries + 3 * SCRYPT_MAX_LANES >= 1000);
+
+    // An impossible target exhausts the nonce range of every block
+    BOOST_FOREACH(CBlock& block, vBlocks) {
+        block.nNonce = 0;
+        block.nBits = 0x1d00ffff;
+    }
+    nMaxTries = 1000;
+    BOOST_CHECK_EQUAL(ScanNonces(vBlocks, 40, nMaxTries, vScratchpad, params), -1);
+    BOOST_CHECK_EQUAL(nMaxTries, 1000U - 3 * 40);
+    BOOST_FOREACH(const CBlock& block, vBlocks)
+        BOOST_CHECK_EQUAL(block.nNonce, 40U);
+
+    // ... or runs out of tries first
+    BOOST_FOREACH(CBlock& block, vBlocks)
+        block.nNonce = 0;
+    nMaxTries = 10;
+    BOOST_CHECK_EQUAL(ScanNonces(vBlocks, 40, nMaxTries, vScratchpad, params), -1);
+    BOOST_CHECK_EQUAL(nMaxTries, 0U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
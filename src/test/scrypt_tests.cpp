@@ -32,4 +32,63 @@ BOOST_AUTO_TEST_CASE(scrypt_hashtest)
     }
 }
 
+BOOST_AUTO_TEST_CASE(scrypt_multi)
+{
+    // The multi-hash API must agree with the single-hash one for full batches and short tails
+    const char* inputhex[3] = { "020000004c1271c211717198227392b029a64a7971931d351b387bb80db027f270411e398a07046f7d4a08dd815412a8712f874a7ebf0507e3878bd24e20a3b73fd750a667d2f451eac7471b00de6659", "0200000011503ee6a855e900c00cfdd98f5f55fffeaee9b6bf55bea9b852d9de2ce35828e204eef76acfd36949ae56d1fbe81c1ac9c0209e6331ad56414f9072506a77f8c6faf551eac7471b00389d01", "010000007824bc3a8a1b4628485eee3024abd8626721f7f870f8ad4d2f33a27155167f6a4009d1285049603888fe85a84b6c803a53305a8d497965a5e896e1a00568359589faf551eac7471b0065434e" };
+    scrypt_detect_multi();
+    const size_t count = 2 * SCRYPT_MAX_LANES + 5;
+    std::vector<std::vector<unsigned char> > inputbytes(count);
+    std::vector<uint256> hashes(count), expected(count);
+    std::vector<const char*> inputs(count);
+    std::vector<char*> outputs(count);
+    for (size_t i = 0; i < count; i++) {
+        inputbytes[i] = ParseHex(inputhex[i % 3]);
+        // Vary the nonce so every lane carries a distinct hash
+        inputbytes[i][76] ^= (unsigned char)i;
+        scrypt_1024_1_1_256((const char*)&inputbytes[i][0], BEGIN(expected[i]));
+        inputs[i] = (const char*)&inputbytes[i][0];
+        outputs[i] = BEGIN(hashes[i]);
+    }
+    for (size_t n = 0; n <= count; n += 3) {
+        std::fill(hashes.begin(), hashes.end(), uint256());
+        scrypt_1024_1_1_256_multi(&inputs[0], &outputs[0], n);
+        for (size_t i = 0; i < n; i++)
+            BOOST_CHECK_EQUAL(hashes[i].ToString(), expected[i].ToString());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(scrypt_nonces)
+{
+    // Hashing consecutive nonces from a midstate must match hashing each full header
+    std::vector<unsigned char> header = ParseHex("020000004c1271c211717198227392b029a64a7971931d351b387bb80db027f270411e398a07046f7d4a08dd815412a8712f874a7ebf0507e3878bd24e20a3b73fd750a667d2f451eac7471b00de6659");
+    uint256 known;
+    scrypt_1024_1_1_256((const char*)&header[0], BEGIN(known));
+    BOOST_CHECK_EQUAL(known.ToString(), "00000000002bef4107f882f6115e0b01f348d21195dacd3582aa2dabd7985806");
+    const uint32_t nKnownNonce = le32dec(&header[76]);
+
+    scrypt_detect_multi();
+    scrypt_header_midstate midstate;
+    scrypt_header_midstate_init(&midstate, (const char*)&header[0]);
+    std::vector<char> scratchpad(SCRYPT_MULTI_SCRATCHPAD_SIZE);
+
+    const size_t count = 2 * SCRYPT_MAX_LANES + 3;
+    const uint32_t nFirst = nKnownNonce - 5;
+    std::vector<uint256> hashes(count);
+    std::vector<char*> outputs(count);
+    for (size_t i = 0; i < count; i++)
+        outputs[i] = BEGIN(hashes[i]);
+    for (size_t n = 1; n <= count; n += count / 3) {
+        std::fill(hashes.begin(), hashes.end(), uint256());
+        scrypt_1024_1_1_256_nonces_sp(&midstate, nFirst, &outputs[0], n, &scratchpad[0]);
+        for (size_t i = 0; i < n; i++) {
+            uint256 expected;
+            le32enc(&header[76], nFirst + i);
+            scrypt_1024_1_1_256((const char*)&header[0], BEGIN(expected));
+            BOOST_CHECK_EQUAL(hashes[i].ToString(), expected.ToString());
+        }
+    }
+    BOOST_CHECK_EQUAL(hashes[5].ToString(), known.ToString());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
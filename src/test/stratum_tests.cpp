@@ -0,0 +1,208 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "stratum.h"
+
+#include "base58.h"
+#include "chainparams.h"
+#include "crypto/common.h"
+#include "crypto/scrypt.h"
+#include "hash.h"
+#include "main.h"
+#include "utilstrencodings.h"
+
+#include "test/test_bitcoin.h"
+
+#include <univalue.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(stratum_tests, TestChain100Setup)
+
+/** Stand-in for a stratum miner that builds headers from jobs the way cpuminer does */
+struct StratumMinerStub
+{
+    CStratumServer& server;
+    CStratumClient client;
+    std::string strExtraNonce1;
+    UniValue job;
+    int nRequests;
+
+    StratumMinerStub(CStratumServer& serverIn) : server(serverIn), nRequests(0)
+    {
+        server.InitClient(client);
+    }
+
+    /** Send a request and return the reply to it, applying any notifications that came along */
+    UniValue Request(const std::string& strMethod, const UniValue& params)
+    {
+        UniValue request(UniValue::VOBJ);
+        request.push_back(Pair("id", ++nRequests));
+        request.push_back(Pair("method", strMethod));
+        request.push_back(Pair("params", params));
+        return Receive(server.ProcessLine(client, request.write()));
+    }
+
+    UniValue Receive(const std::string& strMessages)
+    {
+        UniValue reply;
+        size_t nStart = 0, nEnd;
+        while ((nEnd = strMessages.find('\n', nStart)) != std::string::npos) {
+            UniValue message;
+            BOOST_REQUIRE(message.read(strMessages.substr(nStart, nEnd - nStart)));
+            nStart = nEnd + 1;
+            if (find_value(message, "method").isNull())
+                reply = message;
+            else if (find_value(message, "method").get_str() == "mining.notify")
+                job = find_value(message, "params");
+        }
+        BOOST_CHECK_EQUAL(nStart, strMessages.size());
+        return reply;
+    }
+
+    void Subscribe(const std::string& strAddress)
+    {
+        UniValue reply = Request("mining.subscribe", UniValue(UniValue::VARR));
+        const UniValue& result = find_value(reply, "result");
+        strExtraNonce1 = result[1].get_str();
+        BOOST_CHECK_EQUAL(strExtraNonce1.size(), 2 * STRATUM_EXTRANONCE1_SIZE);
+        BOOST_CHECK_EQUAL(result[2].get_int(), STRATUM_EXTRANONCE2_SIZE);
+        UniValue params(UniValue::VARR);
+        params.push_back(strAddress + ".stub");
+        params.push_back("x");
+        BOOST_CHECK(find_value(Request("mining.authorize", params), "result").get_bool());
+        BOOST_CHECK(job.isArray());
+    }
+
+    /** Header for the current job, extranonce2 and nonce */
+    CBlockHeader Header(const std::string& strExtraNonce2, uint32_t nNonce)
+    {
+        std::vector<unsigned char> vchCoinbase = ParseHex(job[2].get_str() + strExtraNonce1 + strExtraNonce2 + job[3].get_str());
+        uint256 hashMerkleRoot = Hash(vchCoinbase.begin(), vchCoinbase.end());
+        for (size_t i = 0; i < job[4].size(); i++) {
+            std::vector<unsigned char> vchBranch = ParseHex(job[4][i].get_str());
+            hashMerkleRoot = Hash(hashMerkleRoot.begin(), hashMerkleRoot.end(), vchBranch.begin(), vchBranch.end());
+        }
+        std::vector<unsigned char> vchPrevHash = ParseHex(job[1].get_str());
+        for (size_t i = 0; i < vchPrevHash.size(); i += 4)
+            std::reverse(vchPrevHash.begin() + i, vchPrevHash.begin() + i + 4);
+
+        CBlockHeader header;
+        header.nVersion = ReadBE32(&ParseHex(job[5].get_str())[0]);
+        header.hashPrevBlock = uint256(vchPrevHash);
+        header.hashMerkleRoot = hashMerkleRoot;
+        header.nBits = ReadBE32(&ParseHex(job[6].get_str())[0]);
+        header.nTime = ReadBE32(&ParseHex(job[7].get_str())[0]);
+        header.nNonce = nNonce;
+        return header;
+    }
+
+    /** Search nonces from nNonce on for one whose header does or does not meet the block target */
+    uint32_t Mine(const std::string& strExtraNonce2, uint32_t nNonce, bool fBlock)
+    {
+        while (true) {
+            CBlockHeader header = Header(strExtraNonce2, nNonce);
+            arith_uint256 bnTarget;
+            bnTarget.SetCompact(header.nBits);
+            if ((UintToArith256(header.GetPoWHash()) <= bnTarget) == fBlock)
+                return nNonce;
+            nNonce++;
+        }
+    }
+
+    UniValue Submit(const std::string& strJob, const std::string& strExtraNonce2, uint32_t nNonce)
+    {
+        UniValue params(UniValue::VARR);
+        params.push_back("stub");
+        params.push_back(strJob);
+        params.push_back(strExtraNonce2);
+        params.push_back(job[7].get_str());
+        params.push_back(strprintf("%08x", nNonce));
+        return Request("mining.submit", params);
+    }
+};
+
+static int ErrorCode(const UniValue& reply)
+{
+    const UniValue& error = find_value(reply, "error");
+    return error.isNull() ? 0 : error[0].get_int();
+}
+
+BOOST_AUTO_TEST_CASE(stratum_mine_block)
+{
+    CStratumServer server(Params(), 1.0);
+    StratumMinerStub miner(server);
+    CBitcoinAddress address(coinbaseKey.GetPubKey().GetID());
+    miner.Subscribe(address.ToString());
+    BOOST_CHECK(miner.job[8].get_bool());
+
+    // Every share of a second miner uses a different coinbase
+    StratumMinerStub other(server);
+    other.Subscribe(address.ToString());
+    BOOST_CHECK(miner.strExtraNonce1 != other.strExtraNonce1);
+    BOOST_CHECK(miner.Header("00000000", 0).hashMerkleRoot != other.Header("00000000", 0).hashMerkleRoot);
+
+    std::string strJob = miner.job[0].get_str();
+    uint32_t nNonce = miner.Mine("0000002a", 0, true);
+    CBlockHeader header = miner.Header("0000002a", nNonce);
+    BOOST_CHECK_EQUAL(ErrorCode(miner.Submit(strJob, "0000002a", nNonce)), 0);
+    BOOST_CHECK_EQUAL(ErrorCode(miner.Submit(strJob, "0000002a", nNonce)), 22);
+
+    // The block made it to the tip and pays the miner's address
+    BOOST_CHECK_EQUAL(chainActive.Height(), 101);
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == header.GetHash());
+    CBlock block;
+    BOOST_CHECK(ReadBlockFromDisk(block, chainActive.Tip(), Params().GetConsensus()));
+    BOOST_CHECK(block.vtx[0].vout[1].scriptPubKey == GetScriptForDestination(address.Get()));
+
+    // The next job builds on it and the old one is gone
+    bool fClean = false;
+    BOOST_CHECK(server.UpdateJob(fClean));
+    BOOST_CHECK(fClean);
+    BOOST_CHECK(!server.UpdateJob(fClean));
+    miner.Receive(server.GetJobMessages(miner.client, fClean));
+    BOOST_CHECK(miner.job[0].get_str() != strJob);
+    BOOST_CHECK(miner.Header("00000000", 0).hashPrevBlock == header.GetHash());
+    BOOST_CHECK_EQUAL(ErrorCode(miner.Submit(strJob, "00000001", nNonce)), 21);
+}
+
+BOOST_AUTO_TEST_CASE(stratum_reject_shares)
+{
+    CStratumServer server(Params(), 1000000.0);
+    StratumMinerStub miner(server);
+    UniValue params(UniValue::VARR);
+    params.push_back("0");
+    params.push_back("00000000");
+    BOOST_CHECK_EQUAL(ErrorCode(miner.Request("mining.submit", params)), 25);
+    BOOST_CHECK_EQUAL(ErrorCode(miner.Request("mining.unknown", params)), 20);
+    BOOST_CHECK_EQUAL(ErrorCode(miner.Receive(server.ProcessLine(miner.client, "{\"id\": 1, \"method\""))), 20);
+
+    UniValue auth(UniValue::VARR);
+    auth.push_back("notanaddress");
+    BOOST_CHECK_EQUAL(ErrorCode(miner.Request("mining.authorize", auth)), 24);
+    miner.Subscribe(CBitcoinAddress(coinbaseKey.GetPubKey().GetID()).ToString());
+
+    std::string strJob = miner.job[0].get_str();
+    uint32_t nNonce = miner.Mine("00000000", 0, false);
+    BOOST_CHECK_EQUAL(ErrorCode(miner.Submit(strJob, "00000000", nNonce)), 23);
+    // Rejected shares are not remembered as submitted
+    BOOST_CHECK_EQUAL(ErrorCode(miner.Submit(strJob, "00000000", nNonce)), 23);
+    BOOST_CHECK_EQUAL(ErrorCode(miner.Submit(strJob, "000000", nNonce)), 20);
+    BOOST_CHECK_EQUAL(ErrorCode(miner.Submit("12345", "00000000", nNonce)), 21);
+    BOOST_CHECK_EQUAL(chainActive.Height(), 100);
+}
+
+BOOST_AUTO_TEST_CASE(stratum_difficulty_target)
+{
+    arith_uint256 bnDiff1;
+    bnDiff1.SetCompact(0x1f00ffff);
+    BOOST_CHECK(StratumDifficultyTarget(1) == bnDiff1);
+    BOOST_CHECK(StratumDifficultyTarget(16) == bnDiff1 / 16);
+    BOOST_CHECK(StratumDifficultyTarget(0.5) == bnDiff1 * 2);
+    BOOST_CHECK(StratumDifficultyTarget(0) == StratumDifficultyTarget(MIN_STRATUM_DIFFICULTY));
+    BOOST_CHECK(StratumDifficultyTarget(1e30) == StratumDifficultyTarget(MAX_STRATUM_DIFFICULTY));
+    BOOST_CHECK(StratumDifficultyTarget(MAX_STRATUM_DIFFICULTY) > 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -7,6 +7,7 @@
 #include "test_bitcoin.h"
 
 #include "chainparams.h"
+#include "coinsprefetch.h"
 #include "consensus/consensus.h"
 #include "consensus/validation.h"
 #include "key.h"
@@ -58,7 +59,11 @@ TestingSetup::TestingSetup(const std::string& chainName) : BasicTestingSetup(cha
         mempool.setSanityCheck(1.0);
         pblocktree = new CBlockTreeDB(1 << 20, true);
         pcoinsdbview = new CCoinsViewDB(1 << 23, true);
-        pcoinsTip = new CCoinsViewCache(pcoinsdbview);
+        pcoinsprefetch = new CCoinsViewPrefetch(pcoinsdbview);
+        pcoinsTip = new CCoinsViewCache(pcoinsprefetch);
+        threadGroup.create_thread(boost::bind(&CCoinsViewDB::WriterThread, pcoinsdbview));
+        for (int i = 0; i < 2; i++)
+            threadGroup.create_thread(boost::bind(&CCoinsViewPrefetch::WorkerThread, pcoinsprefetch));
         InitBlockIndex(chainparams);
         {
             CValidationState state;
@@ -66,8 +71,11 @@ TestingSetup::TestingSetup(const std::string& chainName) : BasicTestingSetup(cha
             BOOST_CHECK(ok);
         }
         nScriptCheckThreads = 3;
-        for (int i=0; i < nScriptCheckThreads-1; i++)
+        for (int i=0; i < nScriptCheckThreads-1; i++) {
             threadGroup.create_thread(&ThreadScriptCheck);
+            threadGroup.create_thread(&ThreadPowCheck);
+            threadGroup.create_thread(&ThreadTxDataPrecompute);
+        }
         RegisterNodeSignals(GetNodeSignals());
 }
 
@@ -78,6 +86,7 @@ TestingSetup::~TestingSetup()
         threadGroup.join_all();
         UnloadBlockIndex();
         delete pcoinsTip;
+        delete pcoinsprefetch;
         delete pcoinsdbview;
         delete pblocktree;
         boost::filesystem::remove_all(pathTemp);
@@ -7,68 +7,317 @@
 
 #include "chainparams.h"
 #include "hash.h"
+#include "init.h"
 #include "pow.h"
+#include "ui_interface.h"
 #include "uint256.h"
+#include "util.h"
 
 #include <stdint.h>
+#include <stdexcept>
 
 #include <boost/thread.hpp>
 
 using namespace std;
 
+static const char DB_COIN = 'C';
 static const char DB_COINS = 'c';
 static const char DB_BLOCK_FILES = 'f';
 static const char DB_TXINDEX = 't';
 static const char DB_BLOCK_INDEX = 'b';
 
 static const char DB_BEST_BLOCK = 'B';
+static const char DB_HEAD_BLOCKS = 'H';
+static const char DB_COINS_STATS = 's';
 static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
 
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true) 
+namespace {
+
+struct CoinEntry {
+    COutPoint* outpoint;
+    char key;
+    CoinEntry(const COutPoint* ptr) : outpoint(const_cast<COutPoint*>(ptr)), key(DB_COIN) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(key);
+        READWRITE(outpoint->hash);
+        READWRITE(VARINT(outpoint->n));
+    }
+};
+
+}
+
+CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true), nBatchSize(GetArg("-dbbatchsize", nDefaultDbBatchSize)), fPending(false), fWriterRunning(false)
 {
 }
 
-bool CCoinsViewDB::GetCoins(const uint256 &txid, CCoins &coins) const {
-    return db.Read(make_pair(DB_COINS, txid), coins);
+CCoinsViewDB::~CCoinsViewDB()
+{
+    // An interrupted writer thread may still be finishing its last write
+    boost::unique_lock<boost::mutex> lock(csPending);
+    while (fWriterRunning)
+        cvWritten.wait(lock);
 }
 
-bool CCoinsViewDB::HaveCoins(const uint256 &txid) const {
-    return db.Exists(make_pair(DB_COINS, txid));
+bool CCoinsViewDB::GetCoin(const COutPoint &outpoint, Coin &coin) const {
+    {
+        boost::lock_guard<boost::mutex> lock(csPending);
+        CPendingCoins::const_iterator it = mapPending.find(outpoint);
+        if (it != mapPending.end()) {
+            coin = it->second;
+            return !coin.IsSpent();
+        }
+    }
+    return db.Read(CoinEntry(&outpoint), coin);
 }
 
-uint256 CCoinsViewDB::GetBestBlock() const {
+bool CCoinsViewDB::HaveCoin(const COutPoint &outpoint) const {
+    {
+        boost::lock_guard<boost::mutex> lock(csPending);
+        CPendingCoins::const_iterator it = mapPending.find(outpoint);
+        if (it != mapPending.end())
+            return !it->second.IsSpent();
+    }
+    return db.Exists(CoinEntry(&outpoint));
+}
+
+uint256 CCoinsViewDB::ReadBestBlock() const {
     uint256 hashBestChain;
     if (!db.Read(DB_BEST_BLOCK, hashBestChain))
         return uint256();
     return hashBestChain;
 }
 
+uint256 CCoinsViewDB::GetBestBlock() const {
+    {
+        boost::lock_guard<boost::mutex> lock(csPending);
+        if (fPending && !hashPending.IsNull())
+            return hashPending;
+    }
+    return ReadBestBlock();
+}
+
+std::vector<uint256> CCoinsViewDB::GetHeadBlocks() const {
+    std::vector<uint256> vhashHeadBlocks;
+    if (!db.Read(DB_HEAD_BLOCKS, vhashHeadBlocks))
+        return std::vector<uint256>();
+    return vhashHeadBlocks;
+}
+
 bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
-    CDBBatch batch(db);
+    boost::unique_lock<boost::mutex> lock(csPending);
+    // One write at a time: the previous one has to be on disk first
+    while (fPending && strWriteError.empty())
+        cvWritten.wait(lock);
+    if (!strWriteError.empty())
+        throw std::runtime_error(strWriteError);
+
     size_t count = 0;
     size_t changed = 0;
     for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
-            if (it->second.coins.IsPruned())
-                batch.Erase(make_pair(DB_COINS, it->first));
-            else
-                batch.Write(make_pair(DB_COINS, it->first), it->second.coins);
+            mapPending[it->first] = std::move(it->second.coin);
             changed++;
         }
         count++;
         CCoinsMap::iterator itOld = it++;
         mapCoins.erase(itOld);
     }
-    if (!hashBlock.IsNull())
+    LogPrint("coindb", "Committing %u changed transaction outputs (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
+
+    statsPending = statsNext.hashBlock == hashBlock ? statsNext : CRollingCoinsStats();
+
+    if (!fWriterRunning) {
+        bool fOk = WriteCoins(mapPending, hashBlock, statsPending);
+        mapPending.clear();
+        return fOk;
+    }
+    hashPending = hashBlock;
+    fPending = true;
+    cvPending.notify_one();
+    return true;
+}
+
+bool CCoinsViewDB::WriteCoins(const CPendingCoins& coins, const uint256& hashBlock, const CRollingCoinsStats& stats) {
+    CDBBatch batch(db);
+    if (!hashBlock.IsNull()) {
+        uint256 hashOld = ReadBestBlock();
+        if (hashOld.IsNull()) {
+            // We may be finishing an interrupted write from ReplayBlocks
+            std::vector<uint256> vhashOldHeads = GetHeadBlocks();
+            if (vhashOldHeads.size() == 2) {
+                assert(vhashOldHeads[0] == hashBlock);
+                hashOld = vhashOldHeads[1];
+            }
+        }
+        // In the first batch, mark the database as being in the middle of a
+        // transition from hashOld to hashBlock
+        std::vector<uint256> vhashHeads;
+        vhashHeads.push_back(hashBlock);
+        vhashHeads.push_back(hashOld);
+        batch.Erase(DB_BEST_BLOCK);
+        batch.Write(DB_HEAD_BLOCKS, vhashHeads);
+    }
+
+    for (CPendingCoins::const_iterator it = coins.begin(); it != coins.end(); ++it) {
+        CoinEntry entry(&it->first);
+        if (it->second.IsSpent())
+            batch.Erase(entry);
+        else
+            batch.Write(entry, it->second);
+        if (batch.SizeEstimate() > nBatchSize) {
+            LogPrint("coindb", "Writing partial batch of %.2f MiB\n", batch.SizeEstimate() * (1.0 / 1048576.0));
+            if (!db.WriteBatch(batch))
+                return false;
+            batch.Clear();
+        }
+    }
+
+    // In the last batch, mark the database as consistent with hashBlock again
+    if (!hashBlock.IsNull()) {
+        batch.Erase(DB_HEAD_BLOCKS);
         batch.Write(DB_BEST_BLOCK, hashBlock);
+        if (stats.hashBlock == hashBlock)
+            batch.Write(DB_COINS_STATS, stats);
+    }
+    LogPrint("coindb", "Writing final batch of %.2f MiB\n", batch.SizeEstimate() * (1.0 / 1048576.0));
+    return db.WriteBatch(batch);
+}
 
-    LogPrint("coindb", "Committing %u changed transactions (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
+bool CCoinsViewDB::LoadCoins(const std::vector<std::pair<COutPoint, Coin> >& vCoins, const uint256& hashBlock, bool fLast) {
+    boost::lock_guard<boost::mutex> lock(csPending);
+    assert(!fWriterRunning);
+    CDBBatch batch(db);
+    std::vector<uint256> vhashHeads = GetHeadBlocks();
+    if (vhashHeads.empty()) {
+        vhashHeads.push_back(hashBlock);
+        vhashHeads.push_back(ReadBestBlock());
+        batch.Erase(DB_BEST_BLOCK);
+        batch.Write(DB_HEAD_BLOCKS, vhashHeads);
+    } else if (vhashHeads[0] != hashBlock) {
+        return error("%s: the database is in the middle of a write to %s", __func__, vhashHeads[0].ToString());
+    }
+    for (std::vector<std::pair<COutPoint, Coin> >::const_iterator it = vCoins.begin(); it != vCoins.end(); ++it)
+        batch.Write(CoinEntry(&it->first), it->second);
+    if (fLast) {
+        batch.Erase(DB_HEAD_BLOCKS);
+        batch.Write(DB_BEST_BLOCK, hashBlock);
+    }
+    LogPrint("coindb", "Loading batch of %u coins, %.2f MiB\n", (unsigned int)vCoins.size(), batch.SizeEstimate() * (1.0 / 1048576.0));
     return db.WriteBatch(batch);
 }
 
+bool CCoinsViewDB::AbortLoadCoins(const uint256& hashBlock) {
+    boost::lock_guard<boost::mutex> lock(csPending);
+    assert(!fWriterRunning);
+    std::vector<uint256> vhashHeads = GetHeadBlocks();
+    if (vhashHeads.empty())
+        return true;
+    if (vhashHeads.size() != 2 || vhashHeads[0] != hashBlock)
+        return error("%s: the database is not in the middle of loading %s", __func__, hashBlock.ToString());
+
+    // Snapshots are only loaded into an empty UTXO set, so every coin came
+    // from the load. The last batch marks the database consistent again, so
+    // an abort that is cut short is simply done over.
+    boost::scoped_ptr<CDBIterator> pcursor(db.NewIterator());
+    CDBBatch batch(db);
+    COutPoint outpoint;
+    CoinEntry entry(&outpoint);
+    for (pcursor->Seek(DB_COIN); pcursor->Valid() && pcursor->GetKey(entry) && entry.key == DB_COIN; pcursor->Next()) {
+        batch.Erase(entry);
+        if (batch.SizeEstimate() > nBatchSize) {
+            if (!db.WriteBatch(batch))
+                return error("%s: failed to erase loaded coins", __func__);
+            batch.Clear();
+        }
+    }
+    batch.Erase(DB_HEAD_BLOCKS);
+    if (!vhashHeads[1].IsNull())
+        batch.Write(DB_BEST_BLOCK, vhashHeads[1]);
+    LogPrintf("Rolled back the partial load of the UTXO set snapshot of block %s\n", hashBlock.ToString());
+    return db.WriteBatch(batch);
+}
+
+void CCoinsViewDB::SetStats(const CRollingCoinsStats& stats)
+{
+    boost::lock_guard<boost::mutex> lock(csPending);
+    statsNext = stats;
+}
+
+bool CCoinsViewDB::ReadStats(CRollingCoinsStats& stats) const
+{
+    return db.Read(DB_COINS_STATS, stats);
+}
+
+void CCoinsViewDB::WritePending()
+{
+    {
+        boost::lock_guard<boost::mutex> lock(csPending);
+        if (!fPending || !strWriteError.empty())
+            return;
+    }
+    // mapPending stays as it is until fPending is cleared, so it is read
+    // here without the lock
+    std::string strError;
+    try {
+        if (!WriteCoins(mapPending, hashPending, statsPending))
+            strError = "Failed to write to coin database";
+    } catch (const std::exception& e) {
+        strError = e.what();
+    }
+
+    boost::lock_guard<boost::mutex> lock(csPending);
+    if (strError.empty()) {
+        mapPending.clear();
+        fPending = false;
+    } else {
+        // Keep serving the pending coins; the next BatchWrite reports it
+        LogPrintf("%s: %s\n", __func__, strError);
+        strWriteError = strError;
+    }
+    cvWritten.notify_all();
+}
+
+void CCoinsViewDB::WriterThread()
+{
+    {
+        boost::lock_guard<boost::mutex> lock(csPending);
+        fWriterRunning = true;
+    }
+    try {
+        while (true) {
+            {
+                boost::unique_lock<boost::mutex> lock(csPending);
+                while (!fPending || !strWriteError.empty())
+                    cvPending.wait(lock);
+            }
+            WritePending();
+        }
+    } catch (const boost::thread_interrupted&) {
+        // What was handed over still goes to disk; later flushes are
+        // written by BatchWrite itself
+        WritePending();
+        boost::lock_guard<boost::mutex> lock(csPending);
+        fWriterRunning = false;
+        cvWritten.notify_all();
+        throw;
+    }
+}
+
+bool CCoinsViewDB::WaitForWrites() const
+{
+    boost::unique_lock<boost::mutex> lock(csPending);
+    while (fPending && strWriteError.empty())
+        cvWritten.wait(lock);
+    return strWriteError.empty();
+}
+
 CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe) {
 }
 
@@ -94,29 +343,58 @@ bool CBlockTreeDB::ReadLastBlockFile(int &nFile) {
 
 CCoinsViewCursor *CCoinsViewDB::Cursor() const
 {
-    CCoinsViewDBCursor *i = new CCoinsViewDBCursor(const_cast<CDBWrapper*>(&db)->NewIterator(), GetBestBlock());
+    // The iterator sees the database as it is when created, which must not
+    // be halfway through a write
+    boost::unique_lock<boost::mutex> lock(csPending);
+    while (fPending && strWriteError.empty())
+        cvWritten.wait(lock);
+    CCoinsViewDBCursor *i = new CCoinsViewDBCursor(const_cast<CDBWrapper*>(&db)->NewIterator(), ReadBestBlock());
     /* It seems that there are no "const iterators" for LevelDB.  Since we
        only need read operations on it, use a const-cast to get around
        that restriction.  */
-    i->pcursor->Seek(DB_COINS);
+    i->pcursor->Seek(DB_COIN);
     // Cache key of first record
-    i->pcursor->GetKey(i->keyTmp);
+    i->ReadKey();
     return i;
 }
 
-bool CCoinsViewDBCursor::GetKey(uint256 &key) const
+std::vector<CCoinsViewCursor*> CCoinsViewDB::ShardedCursors(unsigned int nShards) const
+{
+    assert(nShards > 0 && nShards <= 0x10000);
+    // As in Cursor, and no write may start until the snapshot is taken
+    boost::unique_lock<boost::mutex> lock(csPending);
+    while (fPending && strWriteError.empty())
+        cvWritten.wait(lock);
+    boost::shared_ptr<CDBSnapshot> psnapshot(new CDBSnapshot(db));
+    const uint256 hashBestBlock = ReadBestBlock();
+
+    std::vector<CCoinsViewCursor*> vCursors;
+    for (unsigned int i = 0; i < nShards; i++) {
+        const unsigned int nPrefixBegin = i * 0x10000 / nShards;
+        CCoinsViewDBCursor *c = new CCoinsViewDBCursor(psnapshot->NewIterator(), hashBestBlock, psnapshot, (i + 1) * 0x10000 / nShards);
+        uint256 hashBegin;
+        *hashBegin.begin() = nPrefixBegin >> 8;
+        *(hashBegin.begin() + 1) = nPrefixBegin & 0xff;
+        c->pcursor->Seek(std::make_pair(DB_COIN, hashBegin));
+        c->ReadKey();
+        vCursors.push_back(c);
+    }
+    return vCursors;
+}
+
+bool CCoinsViewDBCursor::GetKey(COutPoint &key) const
 {
     // Return cached key
-    if (keyTmp.first == DB_COINS) {
+    if (keyTmp.first == DB_COIN) {
         key = keyTmp.second;
         return true;
     }
     return false;
 }
 
-bool CCoinsViewDBCursor::GetValue(CCoins &coins) const
+bool CCoinsViewDBCursor::GetValue(Coin &coin) const
 {
-    return pcursor->GetValue(coins);
+    return pcursor->GetValue(coin);
 }
 
 unsigned int CCoinsViewDBCursor::GetValueSize() const
@@ -126,14 +404,25 @@ unsigned int CCoinsViewDBCursor::GetValueSize() const
 
 bool CCoinsViewDBCursor::Valid() const
 {
-    return keyTmp.first == DB_COINS;
+    return keyTmp.first == DB_COIN;
 }
 
 void CCoinsViewDBCursor::Next()
 {
     pcursor->Next();
-    if (!pcursor->Valid() || !pcursor->GetKey(keyTmp))
+    ReadKey();
+}
+
+void CCoinsViewDBCursor::ReadKey()
+{
+    CoinEntry entry(&keyTmp.second);
+    if (!pcursor->Valid() || !pcursor->GetKey(entry)) {
         keyTmp.first = 0; // Invalidate cached key after last record so that Valid() and GetKey() return false
+    } else if (entry.key == DB_COIN && (unsigned int)(*keyTmp.second.hash.begin() << 8 | *(keyTmp.second.hash.begin() + 1)) >= nPrefixEnd) {
+        keyTmp.first = 0; // Or past the range of the cursor
+    } else {
+        keyTmp.first = entry.key;
+    }
 }
 
 bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo) {
@@ -198,15 +487,15 @@ bool CBlockTreeDB::LoadBlockIndexGuts(boost::function<CBlockIndex*(const uint256
                 pindexNew->nNonce         = diskindex.nNonce;
                 pindexNew->nStatus        = diskindex.nStatus;
                 pindexNew->nTx            = diskindex.nTx;
+                pindexNew->hashPoW        = diskindex.hashPoW;
 
-                // Litecoin: Disable PoW Sanity check while loading block index from disk.
-                // We use the sha256 hash for the block index for performance reasons, which is recorded for later use.
-                // CheckProofOfWork() uses the scrypt hash which is discarded after a block is accepted.
-                // While it is technically feasible to verify the PoW, doing so takes several minutes as it
-                // requires recomputing every PoW hash during every Testcoin startup.
-                // We opt instead to simply trust the data that is on your local disk.
-                //if (!CheckProofOfWork(pindexNew->GetBlockHash(), pindexNew->nBits, Params().GetConsensus()))
-                //    return error("LoadBlockIndex(): CheckProofOfWork failed: %s", pindexNew->ToString());
+                // Litecoin: We use the sha256 hash for the block index for performance reasons.
+                // Recomputing every scrypt hash here would take several minutes on every startup,
+                // so only the stored scrypt hash is checked against nBits. Entries written before
+                // it was stored are skipped; -checkblockindexpow recomputes and fills them in
+                // the background once the node is up.
+                if ((pindexNew->nStatus & BLOCK_HAVE_POWHASH) && !CheckProofOfWork(pindexNew->hashPoW, pindexNew->nBits, Params().GetConsensus()))
+                    return error("LoadBlockIndex(): CheckProofOfWork failed: %s", pindexNew->ToString());
 
                 pcursor->Next();
             } else {
@@ -219,3 +508,128 @@ bool CBlockTreeDB::LoadBlockIndexGuts(boost::function<CBlockIndex*(const uint256
 
     return true;
 }
+
+namespace {
+
+//! Legacy class to deserialize pre-pertxout database entries without reindex.
+class CCoins
+{
+public:
+    //! whether transaction is a coinbase
+    bool fCoinBase;
+
+    //! unspent transaction outputs; spent outputs are .IsNull(); spent outputs at the end of the array are dropped
+    std::vector<CTxOut> vout;
+
+    //! at which height this transaction was included in the active block chain
+    int nHeight;
+
+    //! empty constructor
+    CCoins() : fCoinBase(false), vout(0), nHeight(0) { }
+
+    template<typename Stream>
+    void Unserialize(Stream &s, int nType, int nVersion) {
+        unsigned int nCode = 0;
+        // version
+        int nVersionDummy;
+        ::Unserialize(s, VARINT(nVersionDummy), nType, nVersion);
+        // header code
+        ::Unserialize(s, VARINT(nCode), nType, nVersion);
+        fCoinBase = nCode & 1;
+        std::vector<bool> vAvail(2, false);
+        vAvail[0] = (nCode & 2) != 0;
+        vAvail[1] = (nCode & 4) != 0;
+        unsigned int nMaskCode = (nCode / 8) + ((nCode & 6) != 0 ? 0 : 1);
+        // spentness bitmask
+        while (nMaskCode > 0) {
+            unsigned char chAvail = 0;
+            ::Unserialize(s, chAvail, nType, nVersion);
+            for (unsigned int p = 0; p < 8; p++) {
+                bool f = (chAvail & (1 << p)) != 0;
+                vAvail.push_back(f);
+            }
+            if (chAvail != 0)
+                nMaskCode--;
+        }
+        // txouts themself
+        vout.assign(vAvail.size(), CTxOut());
+        for (unsigned int i = 0; i < vAvail.size(); i++) {
+            if (vAvail[i])
+                ::Unserialize(s, REF(CTxOutCompressor(vout[i])), nType, nVersion);
+        }
+        // coinbase height
+        ::Unserialize(s, VARINT(nHeight), nType, nVersion);
+    }
+};
+
+}
+
+/** Upgrade the database from older formats.
+ *
+ * Currently implemented: from the per-tx utxo model to per-txout.
+ */
+bool CCoinsViewDB::Upgrade() {
+    boost::scoped_ptr<CDBIterator> pcursor(db.NewIterator());
+    pcursor->Seek(std::make_pair(DB_COINS, uint256()));
+    if (!pcursor->Valid()) {
+        return true;
+    }
+
+    int64_t count = 0;
+    LogPrintf("Upgrading utxo-set database...\n");
+    LogPrintf("[0%%]...");
+    uiInterface.ShowProgress(_("Upgrading UTXO database"), 0);
+    // Each converted transaction is committed together with the erasure of
+    // its old record, so an interrupted upgrade resumes where it stopped
+    size_t nBatchSize = 0;
+    CDBBatch batch(db);
+    int reportDone = 0;
+    std::pair<unsigned char, uint256> key;
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        if (ShutdownRequested()) {
+            break;
+        }
+        if (pcursor->GetKey(key) && key.first == DB_COINS) {
+            if (count++ % 256 == 0) {
+                uint32_t high = 0x100 * *key.second.begin() + *(key.second.begin() + 1);
+                int percentageDone = (int)(high * 100.0 / 65536.0 + 0.5);
+                uiInterface.ShowProgress(_("Upgrading UTXO database"), percentageDone);
+                if (reportDone < percentageDone/10) {
+                    // report max. every 10% step
+                    LogPrintf("[%d%%]...", percentageDone);
+                    reportDone = percentageDone/10;
+                }
+            }
+            CCoins old_coins;
+            if (!pcursor->GetValue(old_coins)) {
+                return error("%s: cannot parse CCoins record", __func__);
+            }
+            COutPoint outpoint(key.second, 0);
+            for (size_t i = 0; i < old_coins.vout.size(); ++i) {
+                if (!old_coins.vout[i].IsNull() && !old_coins.vout[i].scriptPubKey.IsUnspendable()) {
+                    Coin newcoin(std::move(old_coins.vout[i]), old_coins.nHeight, old_coins.fCoinBase);
+                    outpoint.n = i;
+                    CoinEntry entry(&outpoint);
+                    batch.Write(entry, newcoin);
+                    nBatchSize++;
+                }
+            }
+            batch.Erase(key);
+            if (++nBatchSize > 65536) {
+                if (!db.WriteBatch(batch))
+                    return error("%s: cannot write upgraded coins", __func__);
+                batch.Clear();
+                nBatchSize = 0;
+            }
+            pcursor->Next();
+        } else {
+            break;
+        }
+    }
+    if (!db.WriteBatch(batch))
+        return error("%s: cannot write upgraded coins", __func__);
+    uiInterface.ShowProgress("", 100);
+    LogPrintf("[%s].\n", ShutdownRequested() ? "CANCELLED" : "DONE");
+    return !ShutdownRequested();
+}
@@ -7,6 +7,7 @@
 #define BITCOIN_TXDB_H
 
 #include "coins.h"
+#include "coinstats.h"
 #include "dbwrapper.h"
 #include "chain.h"
 
@@ -16,6 +17,10 @@
 #include <vector>
 
 #include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/unordered_map.hpp>
 
 class CBlockIndex;
 class CCoinsViewDBCursor;
@@ -35,6 +40,8 @@ static const int64_t nMaxBlockDBCache = 2;
 static const int64_t nMaxBlockDBAndTxIndexCache = 1024;
 //! Max memory allocated to coin DB specific cache (MiB)
 static const int64_t nMaxCoinsDBCache = 8;
+//! -dbbatchsize default (bytes)
+static const int64_t nDefaultDbBatchSize = 16 << 20;
 
 struct CDiskTxPos : public CDiskBlockPos
 {
@@ -61,19 +68,95 @@ struct CDiskTxPos : public CDiskBlockPos
     }
 };
 
-/** CCoinsView backed by the coin database (chainstate/) */
+/**
+ * CCoinsView backed by the coin database (chainstate/)
+ *
+ * Changes are written in batches of at most -dbbatchsize bytes. Until the
+ * last one is in, the database records the blocks it is between instead of
+ * a best block, for ReplayBlocks to finish the job after a crash.
+ *
+ * While WriterThread runs, BatchWrite only sets the changed coins aside and
+ * returns; lookups find them there until the thread has written them.
+ *
+ * The rolling statistics of the UTXO set go in with the last batch of the
+ * best block they are as of.
+ */
 class CCoinsViewDB : public CCoinsView
 {
 protected:
     CDBWrapper db;
+
+private:
+    typedef boost::unordered_map<COutPoint, Coin, SaltedOutpointHasher> CPendingCoins;
+
+    const size_t nBatchSize;
+
+    mutable boost::mutex csPending;
+    //! Wakes the writer thread
+    boost::condition_variable cvPending;
+    //! Wakes threads waiting for pending coins to be written
+    mutable boost::condition_variable cvWritten;
+    //! Changed coins not written yet, spent ones included, and the block
+    //! they are as of. Only BatchWrite changes them, and only while
+    //! fPending is false.
+    CPendingCoins mapPending;
+    uint256 hashPending;
+    //! Statistics for the next BatchWrite, and the ones to write with mapPending
+    CRollingCoinsStats statsNext;
+    CRollingCoinsStats statsPending;
+    bool fPending;
+    bool fWriterRunning;
+    //! Why the writer thread failed, empty as long as it did not
+    std::string strWriteError;
+
+    uint256 ReadBestBlock() const;
+    bool WriteCoins(const CPendingCoins& coins, const uint256& hashBlock, const CRollingCoinsStats& stats);
+    void WritePending();
+
 public:
     CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    ~CCoinsViewDB();
 
-    bool GetCoins(const uint256 &txid, CCoins &coins) const;
-    bool HaveCoins(const uint256 &txid) const;
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const;
+    bool HaveCoin(const COutPoint &outpoint) const;
     uint256 GetBestBlock() const;
+    std::vector<uint256> GetHeadBlocks() const;
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
     CCoinsViewCursor *Cursor() const;
+
+    /**
+     * Cursors over nShards consecutive ranges of txids that together cover
+     * the whole set. They all see it as of the same best block, so they can
+     * be walked on different threads while the database is written to.
+     */
+    std::vector<CCoinsViewCursor*> ShardedCursors(unsigned int nShards) const;
+
+    //! Hand over the statistics to write with the next BatchWrite to stats.hashBlock
+    void SetStats(const CRollingCoinsStats& stats);
+    //! The statistics last written; their hashBlock may lag the best block
+    bool ReadStats(CRollingCoinsStats& stats) const;
+
+    //! Convert per-transaction records of an older database in place; false on error or shutdown
+    bool Upgrade();
+
+    /**
+     * Bulk load coins as of hashBlock, in key order, for a UTXO set snapshot.
+     * Until the call with fLast the database is between its old best block
+     * and hashBlock, as during any other write. Not for use with a writer
+     * thread running.
+     */
+    bool LoadCoins(const std::vector<std::pair<COutPoint, Coin> >& vCoins, const uint256& hashBlock, bool fLast);
+    /**
+     * Undo a LoadCoins of hashBlock that never got to fLast: erase the
+     * loaded coins and go back to the old best block. True as well if no
+     * load is in progress.
+     */
+    bool AbortLoadCoins(const uint256& hashBlock);
+
+    /** Write what BatchWrite hands over until interrupted */
+    void WriterThread();
+    /** Wait until everything handed over so far is on disk; false if writing it failed */
+    bool WaitForWrites() const;
 };
 
 /** Specialization of CCoinsViewCursor to iterate over a CCoinsViewDB */
@@ -82,18 +165,25 @@ class CCoinsViewDBCursor: public CCoinsViewCursor
 public:
     ~CCoinsViewDBCursor() {}
 
-    bool GetKey(uint256 &key) const;
-    bool GetValue(CCoins &coins) const;
+    bool GetKey(COutPoint &key) const;
+    bool GetValue(Coin &coin) const;
     unsigned int GetValueSize() const;
 
     bool Valid() const;
     void Next();
 
 private:
-    CCoinsViewDBCursor(CDBIterator* pcursorIn, const uint256 &hashBlockIn):
-        CCoinsViewCursor(hashBlockIn), pcursor(pcursorIn) {}
+    CCoinsViewDBCursor(CDBIterator* pcursorIn, const uint256 &hashBlockIn, const boost::shared_ptr<CDBSnapshot>& psnapshotIn = boost::shared_ptr<CDBSnapshot>(), unsigned int nPrefixEndIn = 0x10000):
+        CCoinsViewCursor(hashBlockIn), psnapshot(psnapshotIn), pcursor(pcursorIn), nPrefixEnd(nPrefixEndIn) {}
+    //! The snapshot pcursor iterates over, if any; it has to outlive pcursor
+    boost::shared_ptr<CDBSnapshot> psnapshot;
     boost::scoped_ptr<CDBIterator> pcursor;
-    std::pair<char, uint256> keyTmp;
+    //! The cursor ends before txids whose first two bytes are this or more
+    unsigned int nPrefixEnd;
+    std::pair<char, COutPoint> keyTmp;
+
+    //! Cache the key pcursor is at, or invalidate it past the end
+    void ReadKey();
 
     friend class CCoinsViewDB;
 };
@@ -11,6 +11,7 @@
 
 class CBlock;
 class CBlockIndex;
+class CBlockUndo;
 struct CBlockLocator;
 class CBlockIndex;
 class CReserveScript;
@@ -33,6 +34,8 @@ void SyncWithWallets(const CTransaction& tx, const CBlockIndex *pindex, const CB
 class CValidationInterface {
 protected:
     virtual void UpdatedBlockTip(const CBlockIndex *pindex) {}
+    virtual void BlockConnected(const CBlock &block, const CBlockIndex *pindex, const CBlockUndo &blockundo) {}
+    virtual void BlockDisconnected(const CBlock &block, const CBlockIndex *pindex) {}
     virtual void SyncTransaction(const CTransaction &tx, const CBlockIndex *pindex, const CBlock *pblock) {}
     virtual void SetBestChain(const CBlockLocator &locator) {}
     virtual void UpdatedTransaction(const uint256 &hash) {}
@@ -49,6 +52,10 @@ protected:
 struct CMainSignals {
     /** Notifies listeners of updated block chain tip */
     boost::signals2::signal<void (const CBlockIndex *)> UpdatedBlockTip;
+    /** Notifies listeners of a block connected to the active chain, with the outputs it spent, while cs_main is held */
+    boost::signals2::signal<void (const CBlock &, const CBlockIndex *, const CBlockUndo &)> BlockConnected;
+    /** Notifies listeners of a block disconnected from the active chain, while cs_main is held */
+    boost::signals2::signal<void (const CBlock &, const CBlockIndex *)> BlockDisconnected;
     /** Notifies listeners of updated transaction data (transaction, and optionally the block it is found in. */
     boost::signals2::signal<void (const CTransaction &, const CBlockIndex *pindex, const CBlock *)> SyncTransaction;
     /** Notifies listeners of an updated transaction without new data (for now: a coinbase potentially becoming visible). */